@@ -0,0 +1,37 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+
+#include "octree.glsl"
+#include "octree-tracer.glsl"
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(binding = 2, set = 0) writeonly buffer BeamBuffer {
+    float uBeamDistance[];
+};
+
+// Traces a cone from every tile corner and stops at the first node that is
+// no smaller than the footprint of the four tiles around the corner, so
+// every pixel ray of those tiles passes through it too. The distance at
+// which it was entered is a conservative starting point for those pixels.
+// A corner that misses says nothing about the pixels between the corners,
+// they trace from the camera
+void main() {
+    uvec2 beamCount = (uImageSize + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE + 1;
+    uvec2 beam = gl_GlobalInvocationID.xy;
+    if (any(greaterThanEqual(beam, beamCount)))
+        return;
+
+    vec3 r0, rd;
+    GenerateOctreeRay(vec2(beam) * float(TRACE_TILE_SIZE), r0, rd);
+
+    vec3 outPos, outColor, outNormal;
+    float outT;
+    uint outIter;
+    float t = BEAM_MISS;
+    if (Octree_RayMarch(r0, rd, 0.0f, uBeamScale, outPos, outColor, outNormal, outT, outIter))
+        t = outT;
+
+    uBeamDistance[beam.y * beamCount.x + beam.x] = t;
+}
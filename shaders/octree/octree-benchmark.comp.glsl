@@ -0,0 +1,39 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+
+#define OCTREE_TRAVERSAL_STATS
+#include "octree.glsl"
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// Origin and direction of every ray in octree space
+layout(binding = 2, set = 0) readonly buffer RayBuffer {
+    vec4 uRays[];
+};
+
+// x: hit distance, negative on a miss
+// y: iterations
+// z: stack depth
+// w: leaf color
+layout(binding = 3, set = 0) writeonly buffer ResultBuffer {
+    uvec4 uResults[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uRayCount;
+};
+
+// Traces a list of rays with Octree_RayMarchLeaf for OctreeBenchmark
+void main() {
+    uint ray = gl_GlobalInvocationID.x;
+    if (ray >= uRayCount)
+        return;
+
+    vec3 outPos, outColor, outNormal;
+    float outT;
+    uint outIter;
+    bool hit = Octree_RayMarch(uRays[ray * 2].xyz, uRays[ray * 2 + 1].xyz, 0.0f, 0.0f, outPos, outColor, outNormal, outT, outIter);
+
+    uResults[ray] = uvec4(floatBitsToUint(hit ? outT : -1.0f), outIter, octreeStackDepth, packUnorm4x8(vec4(outColor, 0.0f)));
+}
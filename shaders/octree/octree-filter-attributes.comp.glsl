@@ -0,0 +1,68 @@
+#version 460
+
+layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) readonly buffer SparseOctreeBuffer {
+    uint octree[];
+};
+
+// Attributes of the node in the same slot of the octree
+//   x: rgb color, coverage in the highest 8 bits
+//   y: snorm normal
+layout(binding = 1, set = 0) buffer OctreeAttributeBuffer {
+    uvec2 octreeAttributes[];
+};
+
+// Slots filtered by this dispatch, a single level when the build orders the
+// slots by level and every node otherwise
+layout(push_constant) uniform PushConstants {
+    uint nodeBegin;
+    uint nodeEnd;
+};
+
+// A node is final once all of its children were final in a previous
+// dispatch, so the root is final once every level was filtered bottom up
+void main() {
+    uint id = nodeBegin + gl_GlobalInvocationID.x;
+    if (id >= nodeEnd)
+        return;
+
+    uint node = octree[id];
+    if ((node & 0x80000000u) == 0u)
+        return;
+
+    // Leaves are solid and their normal is only known from their neighbours
+    if ((node & 0x40000000u) != 0u) {
+        octreeAttributes[id] = uvec2((node & 0xffffffu) | 0xff000000u, 0u);
+        return;
+    }
+
+    uint first = id + (node & 0x3fffffffu);
+    vec3 color = vec3(0.0f);
+    vec3 normal = vec3(0.0f);
+    float coverage = 0.0f;
+    float weightSum = 0.0f;
+    for (uint i = 0; i < 8; ++i) {
+        vec3 offset = vec3(uvec3(i, i >> 1, i >> 2) & 1u) * 2.0f - 1.0f;
+        uint child = octree[first + i];
+        if ((child & 0x80000000u) == 0u) {
+            // Empty children pull the normal towards the open side
+            normal += offset;
+            continue;
+        }
+
+        uvec2 attributes = (child & 0x40000000u) != 0u ? uvec2(child | 0xff000000u, 0u) : octreeAttributes[first + i];
+        vec4 childColor = unpackUnorm4x8(attributes.x);
+        // Sparse subtrees round to zero coverage but still have a color
+        float weight = max(childColor.a, 1.0f / 255.0f);
+        color += childColor.rgb * weight;
+        normal += unpackSnorm4x8(attributes.y).xyz * weight;
+        coverage += childColor.a;
+        weightSum += weight;
+    }
+
+    color /= weightSum;
+    float normalLength = length(normal);
+    normal = normalLength > 1e-4f ? normal / normalLength : vec3(0.0f);
+    octreeAttributes[id] = uvec2(packUnorm4x8(vec4(color, coverage / 8.0f)), packSnorm4x8(vec4(normal, 0.0f)));
+}
@@ -0,0 +1,65 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "octree-morton.glsl"
+
+// Counts the nodes that start inside each tile for every level, a fragment
+// starts a node on every level at or below the one it splits from the
+// previous fragment
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) readonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(binding = 1, set = 0) writeonly buffer NodeCountBuffer {
+    uint nodeCounts[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uVoxelCount;
+    uint uTileCount;
+    uint uMaxLevel;
+};
+
+shared uint sNodeCounts[MAX_OCTREE_LEVELS];
+
+uint GetNodeLevel(uint index) {
+    if (index == 0)
+        return 0;
+    return GetSplitLevel(voxelKeys[index - 1], voxelKeys[index], uMaxLevel);
+}
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint tile = gl_WorkGroupID.x;
+
+    if (lid < MAX_OCTREE_LEVELS)
+        sNodeCounts[lid] = 0;
+    barrier();
+
+    uint counts[MAX_OCTREE_LEVELS];
+    for (uint level = 0; level < MAX_OCTREE_LEVELS; ++level)
+        counts[level] = 0;
+
+    uint begin = tile * TILE_SIZE + lid * ITEMS_PER_THREAD;
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        if (index >= uVoxelCount)
+            break;
+
+        for (uint level = GetNodeLevel(index); level <= uMaxLevel; ++level)
+            counts[level]++;
+    }
+
+    for (uint level = 0; level <= uMaxLevel; ++level) {
+        if (counts[level] > 0)
+            atomicAdd(sNodeCounts[level], counts[level]);
+    }
+    barrier();
+
+    if (lid <= uMaxLevel)
+        nodeCounts[lid * uTileCount + tile] = sNodeCounts[lid];
+}
@@ -0,0 +1,117 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "octree-morton.glsl"
+
+// Writes every node straight to its final slot. Nodes of a level are laid
+// out in morton order and each internal node of the previous level owns
+// eight consecutive slots, so the slot only depends on the rank of the
+// parent. The buffer is expected to be cleared beforehand.
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) writeonly buffer SparseOctreeBuffer {
+    uint octree[];
+};
+
+layout(binding = 1, set = 0) readonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+// Exclusive scan of the counts written by octree-morton-count, level major
+layout(binding = 2, set = 0) readonly buffer NodeCountBuffer {
+    uint nodeOffsets[];
+};
+
+layout(binding = 3, set = 0) readonly buffer VoxelColorBuffer {
+    uint voxelColors[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uVoxelCount;
+    uint uTileCount;
+    uint uMaxLevel;
+};
+
+shared uint sScan[WORKGROUP_SIZE];
+
+uint GetNodeLevel(uint index) {
+    if (index == 0)
+        return 0;
+    return GetSplitLevel(voxelKeys[index - 1], voxelKeys[index], uMaxLevel);
+}
+
+// Number of nodes in all the levels above
+uint GetLevelStart(uint level) {
+    return nodeOffsets[level * uTileCount];
+}
+
+// Index of the first slot of the level
+uint GetLevelBase(uint level) {
+    return level == 0 ? 0 : 1 + 8 * GetLevelStart(level - 1);
+}
+
+uint ExclusiveScan(uint value) {
+    uint lid = gl_LocalInvocationID.x;
+    sScan[lid] = value;
+    barrier();
+
+    for (uint offset = 1; offset < WORKGROUP_SIZE; offset <<= 1) {
+        uint sum = lid >= offset ? sScan[lid - offset] : 0;
+        barrier();
+        sScan[lid] += sum;
+        barrier();
+    }
+
+    uint result = sScan[lid] - value;
+    barrier();
+    return result;
+}
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint tile = gl_WorkGroupID.x;
+    uint begin = tile * TILE_SIZE + lid * ITEMS_PER_THREAD;
+
+    uint nodeLevels[ITEMS_PER_THREAD];
+    uint parentRanks[ITEMS_PER_THREAD];
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        nodeLevels[i] = index < uVoxelCount ? GetNodeLevel(index) : uMaxLevel + 1;
+        parentRanks[i] = 0;
+    }
+
+    for (uint level = 0; level <= uMaxLevel; ++level) {
+        uint headCount = 0;
+        for (uint i = 0; i < ITEMS_PER_THREAD; ++i)
+            headCount += nodeLevels[i] <= level ? 1 : 0;
+
+        // Rank of the node owning the item before this thread's range, it
+        // wraps around for the very first fragment and is incremented
+        // before use
+        uint rank = nodeOffsets[level * uTileCount + tile] - GetLevelStart(level) + ExclusiveScan(headCount) - 1;
+        uint levelBase = GetLevelBase(level);
+        uint childBase = GetLevelBase(level + 1);
+
+        for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+            uint index = begin + i;
+            if (index >= uVoxelCount)
+                break;
+
+            if (nodeLevels[i] <= level) {
+                rank++;
+
+                uint slot = 0;
+                if (level > 0)
+                    slot = levelBase + parentRanks[i] * 8 + GetChildIndex(voxelKeys[index], level, uMaxLevel);
+
+                if (level == uMaxLevel)
+                    octree[slot] = (voxelColors[index] & VOXEL_COLOR_MASK) | 0x40000000 | 0x80000000;
+                else
+                    octree[slot] = (childBase + rank * 8 - slot) | 0x80000000;
+            }
+            parentRanks[i] = rank;
+        }
+    }
+}
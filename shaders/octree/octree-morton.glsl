@@ -0,0 +1,27 @@
+#ifndef OCTREE_MORTON_GLSL
+#define OCTREE_MORTON_GLSL
+
+#include "../voxelizer/voxel-fragment.glsl"
+
+// Shared by the bottom-up build, fragments have to be unique and sorted
+// in morton order so that every node covers a contiguous range of them.
+// Levels are three key bits each and the root owns the highest ones.
+
+// Shallowest level at which the two keys fall in different nodes, keys
+// that are equal never split so maxLevel + 1 is returned
+uint GetSplitLevel(uint64_t keyA, uint64_t keyB, uint maxLevel) {
+    uint64_t diff = keyA ^ keyB;
+    if (diff == 0)
+        return maxLevel + 1;
+
+    uint high = uint(diff >> 32);
+    uint msb = high != 0 ? 32 + uint(findMSB(high)) : uint(findMSB(uint(diff)));
+    return maxLevel - msb / 3;
+}
+
+// Child index of the node at level inside its parent, x + 2y + 4z
+uint GetChildIndex(uint64_t key, uint level, uint maxLevel) {
+    return uint(key >> (3 * (maxLevel - level))) & 7u;
+}
+
+#endif
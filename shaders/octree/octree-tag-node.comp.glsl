@@ -1,15 +1,22 @@
 #version 460
 
+#extension GL_GOOGLE_include_directive : enable
 #extension GL_ARB_gpu_shader_int64 : enable
 
+#include "../voxelizer/voxel-fragment.glsl"
+
 layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
 
 layout(binding = 0, set = 0) buffer SparseOctreeBuffer {
     uint octree[];
 };
 
-layout(binding = 1, set = 0) readonly buffer VoxelFragmentBuffer {
-    uint64_t voxelFragments[];
+layout(binding = 1, set = 0) readonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(binding = 2, set = 0) readonly buffer VoxelColorBuffer {
+    uint voxelColors[];
 };
 
 layout(push_constant) uniform PushConstants {
@@ -18,22 +25,8 @@ layout(push_constant) uniform PushConstants {
     uint uVoxelDims;
 };
 
-vec3 getPositionFromUint(uint64_t voxel) {
-    vec3 position;
-    /*
-    position.x = float((p >> 20) & 0x3ff);
-    position.y = float((p >> 10) & 0x3ff);
-    position.z = float(p & 0x3ff);
-    */
-
-    position.x = float(voxel & 0xfff);
-    position.y = float((voxel >> 12) & 0xfff);
-    position.z = float((voxel >> 24) & 0xfff);
-    return position - uVoxelDims * 0.5f;
-}
-
-uint getColorFromUint(uint64_t voxel) {
-    return uint((voxel >> 40) & 0xffffff);
+vec3 getPositionFromKey(uint64_t key) {
+    return vec3(DecodeMorton(key)) - uVoxelDims * 0.5f;
 }
 
 void main() {
@@ -41,7 +34,7 @@ void main() {
     if (threadId >= uVoxelCount)
         return;
 
-    vec3 position = getPositionFromUint(voxelFragments[threadId]);
+    vec3 position = getPositionFromKey(voxelKeys[threadId]);
 
     uint childIndex = 0;
     uint node = octree[0];
@@ -68,7 +61,7 @@ void main() {
     if (bFlag) {
         const float leafNodeLevel = log2(uVoxelDims);
         if (uLevel == uint(leafNodeLevel)) {
-            uint col = getColorFromUint(voxelFragments[threadId]);
+            uint col = voxelColors[threadId] & VOXEL_COLOR_MASK;
             col |= 0x40000000;
             atomicExchange(octree[childIndex], col);
         }
@@ -0,0 +1,223 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+
+#include "octree.glsl"
+#include "octree-tracer.glsl"
+
+layout(local_size_x = TRACE_TILE_SIZE, local_size_y = TRACE_TILE_SIZE, local_size_z = 1) in;
+
+layout(binding = 2, set = 0) readonly buffer BeamBuffer {
+    float uBeamDistance[];
+};
+
+layout(rgba8, binding = 3, set = 0) uniform writeonly image2D uOutput;
+
+// Shaded color of every pixel with the number of frames it was reused for
+// in the alpha, and the distance of the hit from the camera
+layout(binding = 4, set = 0) readonly buffer PrevHistoryBuffer {
+    uvec2 uPrevHistory[];
+};
+
+layout(binding = 5, set = 0) writeonly buffer HistoryBuffer {
+    uvec2 uHistory[];
+};
+
+#define SHADOW_TILE_SIZE (TRACE_TILE_SIZE / 2)
+#define NO_HIT -1.0f
+#define NOT_TRACED -2.0f
+// A pixel reused for this many frames in a row is traced again
+#define MAX_HISTORY_AGE 2u
+#define HISTORY_DEPTH_TOLERANCE 0.02f
+
+// Primary hits of the tile, shadows of one pixel of every 2x2 block are
+// traced by the first threads of the group
+shared vec3 sHitPosition[TRACE_TILE_SIZE * TRACE_TILE_SIZE];
+shared float sHitDistance[TRACE_TILE_SIZE * TRACE_TILE_SIZE];
+shared bool sShadow[SHADOW_TILE_SIZE * SHADOW_TILE_SIZE];
+
+const vec3 ld = normalize(vec3(0.01f, 0.8f, 0.1f));
+
+float GetStartDistance(uvec2 tile) {
+    uint beamCountX = (uImageSize.x + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE + 1;
+    uint index = tile.y * beamCountX + tile.x;
+    vec4 corners = vec4(uBeamDistance[index], uBeamDistance[index + 1],
+                        uBeamDistance[index + beamCountX], uBeamDistance[index + beamCountX + 1]);
+    // A pixel ray can hit something a corner ray passed by, the tile is
+    // traced from the camera as soon as one of its corners missed
+    if (any(equal(corners, vec4(BEAM_MISS))))
+        return 0.0f;
+    float t = min(min(corners.x, corners.y), min(corners.z, corners.w));
+    // Back off by the size of the node the beam stopped at so that the
+    // pixel ray enters it instead of starting inside it
+    return max(t - t * uBeamScale, 0.0f);
+}
+
+bool TraceShadow(vec3 position, float t) {
+    return Octree_Occluded(position, ld, 0.0f, BEAM_MISS, uShadowLodScale * t);
+}
+
+uint GetLocalIndex(ivec2 local) {
+    return uint(local.y * TRACE_TILE_SIZE + local.x);
+}
+
+// Picks the block closest in depth among the four around the pixel, falls
+// back to tracing when none of them hit anything near
+bool UpsampleShadow(uvec2 local, uint leaderOffset, vec3 position, float t) {
+    ivec2 block = ivec2(local / 2);
+    ivec2 neighbour = ivec2((local & 1u) * 2u) - 1;
+
+    float bestDifference = t * 0.05f;
+    int bestBlock = -1;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 candidate = block + ivec2(i & 1, i >> 1) * neighbour;
+        if (any(lessThan(candidate, ivec2(0))) || any(greaterThanEqual(candidate, ivec2(SHADOW_TILE_SIZE))))
+            continue;
+
+        float candidateT = sHitDistance[GetLocalIndex(candidate * 2 + ivec2(leaderOffset, 0))];
+        float difference = abs(candidateT - t);
+        if (candidateT >= 0.0f && difference <= bestDifference) {
+            bestDifference = difference;
+            bestBlock = candidate.y * SHADOW_TILE_SIZE + candidate.x;
+        }
+    }
+    return bestBlock >= 0 ? sShadow[bestBlock] : TraceShadow(position, t);
+}
+
+// Estimates the depth of an untraced pixel from its traced neighbours and
+// looks it up in the previous frame. Fails near edges, misses and wherever
+// the previous frame saw a different surface
+bool Reproject(uvec2 local, vec3 r0, vec3 rd, out vec3 color, out uint age, out float t) {
+    const ivec2 offsets[4] = ivec2[](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+
+    float tMin = BEAM_MISS, tMax = 0.0f, tSum = 0.0f;
+    uint count = 0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 neighbour = ivec2(local) + offsets[i];
+        if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, ivec2(TRACE_TILE_SIZE))))
+            continue;
+
+        float neighbourT = sHitDistance[GetLocalIndex(neighbour)];
+        if (neighbourT == NOT_TRACED)
+            continue;
+        if (neighbourT == NO_HIT)
+            return false;
+        tMin = min(tMin, neighbourT);
+        tMax = max(tMax, neighbourT);
+        tSum += neighbourT;
+        count++;
+    }
+    if (count == 0 || tMax - tMin > tMin * HISTORY_DEPTH_TOLERANCE)
+        return false;
+
+    t = tSum / float(count);
+    vec3 position = r0 + rd * t;
+    vec4 prevClip = uPrevViewProj * vec4(position, 1.0f);
+    if (prevClip.w <= 0.0f)
+        return false;
+
+    vec2 prevPixel = (prevClip.xy / prevClip.w * 0.5f + 0.5f) * vec2(uImageSize);
+    if (any(lessThan(prevPixel, vec2(0.0f))) || any(greaterThanEqual(prevPixel, vec2(uImageSize))))
+        return false;
+
+    uvec2 history = uPrevHistory[uint(prevPixel.y) * uImageSize.x + uint(prevPixel.x)];
+    vec4 historyColor = unpackUnorm4x8(history.x);
+    float historyT = uintBitsToFloat(history.y);
+    age = (history.x >> 24u) + 1u;
+    color = historyColor.rgb;
+
+    float prevT = length(position - uPrevRayOrigin.xyz);
+    return age <= MAX_HISTORY_AGE && historyT >= 0.0f && abs(prevT - historyT) <= historyT * HISTORY_DEPTH_TOLERANCE;
+}
+
+void main() {
+    uvec2 pixel = gl_GlobalInvocationID.xy;
+    uvec2 local = gl_LocalInvocationID.xy;
+    bool valid = all(lessThan(pixel, uImageSize));
+    bool halfResShadows = (uFlags & TRACE_FLAG_HALF_RES_SHADOWS) != 0;
+    bool temporal = (uFlags & TRACE_FLAG_TEMPORAL) != 0;
+    bool reproject = temporal && (uFlags & TRACE_FLAG_HISTORY_VALID) != 0;
+
+    vec3 r0, rd;
+    GenerateOctreeRay(vec2(pixel) + 0.5f, r0, rd);
+    float tStart = GetStartDistance(gl_WorkGroupID.xy);
+
+    // Checkerboard that flips every frame
+    bool traced = !reproject || ((pixel.x + pixel.y + uFrame) & 1u) == 0u;
+
+    vec3 outPos = vec3(0.0f), outColor, outNormal;
+    float outT = NO_HIT;
+    uint outIter;
+    if (valid && traced) {
+        if (!Octree_RayMarch(r0, rd, tStart, uLodScale, outPos, outColor, outNormal, outT, outIter))
+            outT = NO_HIT;
+    }
+
+    vec3 historyColor = vec3(0.0f);
+    uint age = 0u;
+    bool reused = false;
+    if (reproject) {
+        sHitDistance[gl_LocalInvocationIndex] = traced ? outT : NOT_TRACED;
+        barrier();
+
+        if (valid && !traced) {
+            reused = Reproject(local, r0, rd, historyColor, age, outT);
+            if (!reused) {
+                traced = true;
+                age = 0u;
+                outT = NO_HIT;
+                if (!Octree_RayMarch(r0, rd, tStart, uLodScale, outPos, outColor, outNormal, outT, outIter))
+                    outT = NO_HIT;
+            }
+        }
+        barrier();
+    }
+
+    // Reused pixels already have their shadow in the history color
+    bool hit = traced && outT != NO_HIT;
+    bool shadow = false;
+    if (halfResShadows) {
+        // The leader of every block has to be on the traced checkerboard
+        uint leaderOffset = reproject ? (uFrame & 1u) : 0u;
+        sHitPosition[gl_LocalInvocationIndex] = outPos;
+        sHitDistance[gl_LocalInvocationIndex] = hit ? outT : NO_HIT;
+        barrier();
+
+        // Compacted so that the shadow rays run on as few warps as possible
+        if (gl_LocalInvocationIndex < SHADOW_TILE_SIZE * SHADOW_TILE_SIZE) {
+            ivec2 block = ivec2(gl_LocalInvocationIndex % SHADOW_TILE_SIZE, gl_LocalInvocationIndex / SHADOW_TILE_SIZE);
+            uint source = GetLocalIndex(block * 2 + ivec2(leaderOffset, 0));
+            float t = sHitDistance[source];
+            sShadow[gl_LocalInvocationIndex] = t >= 0.0f && TraceShadow(sHitPosition[source], t);
+        }
+        barrier();
+
+        if (hit)
+            shadow = UpsampleShadow(local, leaderOffset, outPos, outT);
+    } else if (hit)
+        shadow = TraceShadow(outPos, outT);
+
+    if (!valid)
+        return;
+
+    vec3 col = historyColor;
+    if (!reused) {
+        col = vec3(0.0f);
+        if (hit) {
+            col = max(dot(outNormal, ld), 0.1f) * vec3(1.0f, 1.01f, 1.01f) * 5.;
+            if (shadow) {
+                col *= 0.01f;
+            }
+            col *= outColor;
+        }
+
+        col /= (1.0f + col);
+        col = pow(col, vec3(0.4545));
+    }
+    imageStore(uOutput, ivec2(pixel), vec4(col, 1.0f));
+
+    if (temporal) {
+        uint packedColor = (packUnorm4x8(vec4(col, 0.0f)) & 0xffffffu) | (age << 24u);
+        uHistory[pixel.y * uImageSize.x + pixel.x] = uvec2(packedColor, floatBitsToUint(outT));
+    }
+}
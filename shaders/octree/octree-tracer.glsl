@@ -0,0 +1,47 @@
+#ifndef OCTREE_TRACER_GLSL
+#define OCTREE_TRACER_GLSL
+
+// Beam rays are traced at the corners of TRACE_TILE_SIZE^2 pixel tiles
+#define TRACE_TILE_SIZE 8
+#define BEAM_MISS 1e30f
+
+// Shadows are traced for one pixel out of every 2x2 block and upsampled
+#define TRACE_FLAG_HALF_RES_SHADOWS 1
+// Only half of the pixels are traced in a checkerboard, the rest are
+// reprojected from the previous frame when it can be validated
+#define TRACE_FLAG_TEMPORAL 2
+// Set when the history was written by the previous frame
+#define TRACE_FLAG_HISTORY_VALID 4
+
+// Everything is in the octree space, where the octree spans [1, 2]. Written
+// to the transient buffer every frame, too large for push constants
+layout(binding = 6, set = 0) uniform TraceConstants {
+    // Direction of the ray through uv is mat3(uRayMatrix) * vec3(uv, 1)
+    mat4 uRayMatrix;
+    vec4 uRayOrigin;
+    // Previous frame view projection and camera position
+    mat4 uPrevViewProj;
+    vec4 uPrevRayOrigin;
+    uvec2 uImageSize;
+    // Footprint of a beam per unit distance
+    float uBeamScale;
+    // Footprint of a pixel ray per unit distance, nodes smaller than it are
+    // not descended into
+    float uLodScale;
+    uint uFlags;
+    // Shadow rays stop at nodes smaller than the pixel footprint at the hit
+    // scaled by this, zero traces them to the leaves
+    float uShadowLodScale;
+    uint uFrame;
+    uint uPadding;
+};
+
+// Ray through the given pixel coordinate, the image is flipped vertically
+// when it is copied to the swapchain
+void GenerateOctreeRay(vec2 pixel, out vec3 r0, out vec3 rd) {
+    vec2 uv = pixel / vec2(uImageSize) * 2.0f - 1.0f;
+    r0 = uRayOrigin.xyz;
+    rd = normalize(mat3(uRayMatrix) * vec3(uv, 1.0f));
+}
+
+#endif
@@ -36,11 +36,85 @@ struct StackItem {
     float t_max;
 } stack[STACK_SIZE + 1];
 
+// Set by the pipeline, the short stack replaces the full stack with a ring
+// of OCTREE_SHORT_STACK_SIZE entries (a power of two). Entries remember the
+// scale they were pushed at, popping to a scale that has been overwritten
+// restarts the traversal from the root instead.
+layout(constant_id = 0) const bool OCTREE_SHORT_STACK = false;
+layout(constant_id = 1) const uint OCTREE_SHORT_STACK_SIZE = 4u;
+
+struct ShortStackItem {
+    uint node;
+    float t_max;
+    uint scale;
+} shortStack[OCTREE_SHORT_STACK_SIZE];
+
+#ifdef OCTREE_TRAVERSAL_STATS
+// Deepest stack entry written by the last traversal, see cpu-octree-tracer.h
+uint octreeStackDepth = 0u;
+#endif
+
+void Octree_StackPush(uint scale, uint node, float t_max) {
+#ifdef OCTREE_TRAVERSAL_STATS
+    octreeStackDepth = max(octreeStackDepth, STACK_SIZE - scale);
+#endif
+    if (!OCTREE_SHORT_STACK) {
+        stack[scale].node = node;
+        stack[scale].t_max = t_max;
+    } else {
+        uint slot = scale & (OCTREE_SHORT_STACK_SIZE - 1u);
+        shortStack[slot].node = node;
+        shortStack[slot].t_max = t_max;
+        shortStack[slot].scale = scale;
+    }
+}
+
+// Returns false when the entry is gone and the ray has to restart
+bool Octree_StackPop(uint scale, out uint node, out float t_max) {
+    if (!OCTREE_SHORT_STACK) {
+        node = stack[scale].node;
+        t_max = stack[scale].t_max;
+        return true;
+    }
+    uint slot = scale & (OCTREE_SHORT_STACK_SIZE - 1u);
+    node = shortStack[slot].node;
+    t_max = shortStack[slot].t_max;
+    return shortStack[slot].scale == scale;
+}
+
+void Octree_StackClear() {
+#ifdef OCTREE_TRAVERSAL_STATS
+    octreeStackDepth = 0u;
+#endif
+    if (OCTREE_SHORT_STACK)
+        for (uint i = 0u; i < OCTREE_SHORT_STACK_SIZE; ++i)
+            shortStack[i].scale = 0xffffffffu;
+}
+
 layout(set = 0, binding = 0) readonly buffer OctreeBuffer {
     uint uOctree[];
 };
 
-bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out vec3 o_normal, out uint o_iter) {
+// Filtered attributes of every node, written by octree-filter-attributes
+//   x: rgb color, coverage in the highest 8 bits
+//   y: snorm normal, zero for leaves and closed nodes
+layout(set = 0, binding = 1) readonly buffer OctreeAttributeBuffer {
+    uvec2 uOctreeAttributes[];
+};
+
+vec4 Octree_GetColor(uint node) {
+    return unpackUnorm4x8(uOctreeAttributes[node].x);
+}
+
+vec3 Octree_GetNormal(uint node) {
+    return unpackSnorm4x8(uOctreeAttributes[node].y).xyz;
+}
+
+// t_start skips everything in front of it along the ray, ray_scale is the
+// footprint of the ray per unit distance. Traversal stops at the first node
+// smaller than the footprint, zero disables it. o_t is the distance at which
+// the returned node was entered.
+bool Octree_RayMarch(vec3 o, vec3 d, float t_start, float ray_scale, out vec3 o_pos, out vec3 o_color, out vec3 o_normal, out float o_t, out uint o_iter) {
     uint iter = 0;
 
     d.x = abs(d.x) > EPS ? d.x : (d.x >= 0 ? EPS : -EPS);
@@ -63,8 +137,10 @@ bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out v
     // Initialize the active span of t-values.
     float t_min = max(max(2.0f * t_coef.x - t_bias.x, 2.0f * t_coef.y - t_bias.y), 2.0f * t_coef.z - t_bias.z);
     float t_max = min(min(t_coef.x - t_bias.x, t_coef.y - t_bias.y), t_coef.z - t_bias.z);
-    t_min = max(t_min, 0.0f);
+    t_min = max(t_min, max(t_start, 0.0f));
+    float t_root_max = t_max;
     float h = t_max;
+    Octree_StackClear();
 
     uint parent = 1u;
     uint cur = 0u;
@@ -80,7 +156,6 @@ bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out v
     uint scale = STACK_SIZE - 1;
     float scale_exp2 = 0.5f; // exp2( scale - STACK_SIZE )
 
-    float ray_scale = 0.0f; // 0.0025f;
     while (scale < STACK_SIZE) {
         ++iter;
         uint child_index = idx ^ oct_mask;
@@ -93,8 +168,8 @@ bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out v
         float tc_max = min(min(t_corner.x, t_corner.y), t_corner.z);
 
         if ((cur & 0x80000000u) != 0 && t_min <= t_max) {
-            // if (tc_max * ray_scale >= scale_exp2)
-            //     break; //
+            if (tc_max * ray_scale >= scale_exp2)
+                break;
 
             // INTERSECT
             float tv_max = min(t_max, tc_max);
@@ -106,10 +181,8 @@ bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out v
                     break;
 
                 // PUSH
-                if (tc_max < h) {
-                    stack[scale].node = parent;
-                    stack[scale].t_max = t_max;
-                }
+                if (tc_max < h)
+                    Octree_StackPush(scale, parent, t_max);
                 h = tc_max;
 
                 parent += (cur & 0x3fffffffu) + child_index;
@@ -156,11 +229,31 @@ bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out v
             if ((step_mask & 4u) != 0)
                 differing_bits |= floatBitsToUint(pos.z) ^ floatBitsToUint(pos.z + scale_exp2);
             scale = findMSB(differing_bits);
+            if (scale >= STACK_SIZE)
+                break;
             scale_exp2 = uintBitsToFloat((scale - STACK_SIZE + 127u) << 23u); // exp2f(scale - s_max)
 
             // Restore parent voxel from the stack.
-            parent = stack[scale].node;
-            t_max = stack[scale].t_max;
+            if (!Octree_StackPop(scale, parent, t_max)) {
+                // RESTART
+                // Walk down from the root again, t_min already skips
+                // everything the ray has left behind
+                parent = 1u;
+                cur = 0u;
+                pos = vec3(1.0f);
+                idx = 0u;
+                if (1.5f * t_coef.x - t_bias.x > t_min)
+                    idx ^= 1u, pos.x = 1.5f;
+                if (1.5f * t_coef.y - t_bias.y > t_min)
+                    idx ^= 2u, pos.y = 1.5f;
+                if (1.5f * t_coef.z - t_bias.z > t_min)
+                    idx ^= 4u, pos.z = 1.5f;
+                scale = STACK_SIZE - 1;
+                scale_exp2 = 0.5f;
+                t_max = t_root_max;
+                h = t_max;
+                continue;
+            }
 
             // Round cube position and extract child slot index.
             uint shx = floatBitsToUint(pos.x) >> scale;
@@ -206,11 +299,176 @@ bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out v
         o_pos.y = norm.y > 0 ? pos.y + scale_exp2 + EPS * 2 : pos.y - EPS;
     if (norm.z != 0)
         o_pos.z = norm.z > 0 ? pos.z + scale_exp2 + EPS * 2 : pos.z - EPS;
+    bool hit = scale < STACK_SIZE && t_min <= t_max;
     o_normal = norm;
-    o_color = unpackUnorm4x8(cur).xyz;
+    o_color = vec3(0.0f);
+    if (hit) {
+        uint node = parent + (idx ^ oct_mask);
+        o_color = Octree_GetColor(node).rgb;
+        // Nodes cut off by the level of detail are shaded with the filtered
+        // normal of their subtree rather than the face of the cube
+        vec3 filteredNormal = Octree_GetNormal(node);
+        if ((cur & 0x40000000u) == 0u && dot(filteredNormal, filteredNormal) > 0.0f)
+            o_normal = normalize(filteredNormal);
+    }
+    o_t = t_min;
     o_iter = iter;
 
-    return scale < STACK_SIZE && t_min <= t_max;
+    return hit;
+}
+
+bool Octree_RayMarchLeaf(vec3 o, vec3 d, out vec3 o_pos, out vec3 o_color, out vec3 o_normal, out uint o_iter) {
+    float t;
+    return Octree_RayMarch(o, d, 0.0f, 0.0f, o_pos, o_color, o_normal, t, o_iter);
+}
+
+// Only the top OCCLUSION_STACK_LEVELS levels are pushed by Octree_Occluded,
+// popping to a deeper level restarts from the root instead
+#ifndef OCCLUSION_STACK_LEVELS
+#define OCCLUSION_STACK_LEVELS 8
+#endif
+#define OCCLUSION_MIN_STACK_SCALE (STACK_SIZE - OCCLUSION_STACK_LEVELS)
+
+// Occlusion only traversal for shadow rays, returns on the first leaf in
+// [t_start, t_end] without computing the hit. Nodes smaller than ray_size
+// are not descended into, they occlude when at least half of their volume
+// is covered. A ray_size of zero always descends to the leaves.
+bool Octree_Occluded(vec3 o, vec3 d, float t_start, float t_end, float ray_size) {
+    d.x = abs(d.x) > EPS ? d.x : (d.x >= 0 ? EPS : -EPS);
+    d.y = abs(d.y) > EPS ? d.y : (d.y >= 0 ? EPS : -EPS);
+    d.z = abs(d.z) > EPS ? d.z : (d.z >= 0 ? EPS : -EPS);
+
+    vec3 t_coef = 1.0f / -abs(d);
+    vec3 t_bias = t_coef * o;
+
+    uint oct_mask = 0u;
+    if (d.x > 0.0f)
+        oct_mask ^= 1u, t_bias.x = 3.0f * t_coef.x - t_bias.x;
+    if (d.y > 0.0f)
+        oct_mask ^= 2u, t_bias.y = 3.0f * t_coef.y - t_bias.y;
+    if (d.z > 0.0f)
+        oct_mask ^= 4u, t_bias.z = 3.0f * t_coef.z - t_bias.z;
+
+    float t_min = max(max(2.0f * t_coef.x - t_bias.x, 2.0f * t_coef.y - t_bias.y), 2.0f * t_coef.z - t_bias.z);
+    float t_root_max = min(min(t_coef.x - t_bias.x, t_coef.y - t_bias.y), t_coef.z - t_bias.z);
+    t_root_max = min(t_root_max, t_end);
+    t_min = max(t_min, max(t_start, 0.0f));
+    Octree_StackClear();
+
+    uint parent, cur, idx, scale;
+    vec3 pos;
+    float scale_exp2, t_max, h;
+    bool restart = true;
+    while (true) {
+        if (restart) {
+            parent = 1u;
+            cur = 0u;
+            pos = vec3(1.0f);
+            idx = 0u;
+            if (1.5f * t_coef.x - t_bias.x > t_min)
+                idx ^= 1u, pos.x = 1.5f;
+            if (1.5f * t_coef.y - t_bias.y > t_min)
+                idx ^= 2u, pos.y = 1.5f;
+            if (1.5f * t_coef.z - t_bias.z > t_min)
+                idx ^= 4u, pos.z = 1.5f;
+            scale = STACK_SIZE - 1;
+            scale_exp2 = 0.5f;
+            t_max = t_root_max;
+            h = t_max;
+            restart = false;
+        }
+
+        uint child_index = idx ^ oct_mask;
+        if (cur == 0u)
+            cur = uOctree[parent + child_index];
+
+        vec3 t_corner = pos * t_coef - t_bias;
+        float tc_max = min(min(t_corner.x, t_corner.y), t_corner.z);
+
+        if ((cur & 0x80000000u) != 0 && t_min <= t_max) {
+            float tv_max = min(t_max, tc_max);
+            float half_scale_exp2 = scale_exp2 * 0.5f;
+            vec3 t_center = half_scale_exp2 * t_coef + t_corner;
+
+            if (t_min <= tv_max) {
+                if ((cur & 0x40000000u) != 0)
+                    return true;
+
+                // Coarse nodes are treated as solid or empty from their coverage
+                bool coarse = ray_size >= scale_exp2;
+                if (coarse && Octree_GetColor(parent + child_index).a >= 0.5f)
+                    return true;
+
+                if (!coarse) {
+                    if (tc_max < h && scale >= OCCLUSION_MIN_STACK_SCALE)
+                        Octree_StackPush(scale, parent, t_max);
+                    h = tc_max;
+
+                    parent += (cur & 0x3fffffffu) + child_index;
+
+                    idx = 0u;
+                    --scale;
+                    scale_exp2 = half_scale_exp2;
+                    if (t_center.x > t_min)
+                        idx ^= 1u, pos.x += scale_exp2;
+                    if (t_center.y > t_min)
+                        idx ^= 2u, pos.y += scale_exp2;
+                    if (t_center.z > t_min)
+                        idx ^= 4u, pos.z += scale_exp2;
+
+                    cur = 0;
+                    t_max = tv_max;
+                    continue;
+                }
+            }
+        }
+
+        // ADVANCE
+        uint step_mask = 0u;
+        if (t_corner.x <= tc_max)
+            step_mask ^= 1u, pos.x -= scale_exp2;
+        if (t_corner.y <= tc_max)
+            step_mask ^= 2u, pos.y -= scale_exp2;
+        if (t_corner.z <= tc_max)
+            step_mask ^= 4u, pos.z -= scale_exp2;
+
+        t_min = tc_max;
+        idx ^= step_mask;
+
+        if ((idx & step_mask) != 0) {
+            // POP
+            uint differing_bits = 0;
+            if ((step_mask & 1u) != 0)
+                differing_bits |= floatBitsToUint(pos.x) ^ floatBitsToUint(pos.x + scale_exp2);
+            if ((step_mask & 2u) != 0)
+                differing_bits |= floatBitsToUint(pos.y) ^ floatBitsToUint(pos.y + scale_exp2);
+            if ((step_mask & 4u) != 0)
+                differing_bits |= floatBitsToUint(pos.z) ^ floatBitsToUint(pos.z + scale_exp2);
+            scale = findMSB(differing_bits);
+            if (scale >= STACK_SIZE || t_min > t_root_max)
+                return false;
+
+            // The parent was never pushed, walk down again from the root
+            if (scale < OCCLUSION_MIN_STACK_SCALE || !Octree_StackPop(scale, parent, t_max)) {
+                restart = true;
+                continue;
+            }
+
+            scale_exp2 = uintBitsToFloat((scale - STACK_SIZE + 127u) << 23u);
+
+            uint shx = floatBitsToUint(pos.x) >> scale;
+            uint shy = floatBitsToUint(pos.y) >> scale;
+            uint shz = floatBitsToUint(pos.z) >> scale;
+            pos.x = uintBitsToFloat(shx << scale);
+            pos.y = uintBitsToFloat(shy << scale);
+            pos.z = uintBitsToFloat(shz << scale);
+            idx = (shx & 1u) | ((shy & 1u) << 1u) | ((shz & 1u) << 2u);
+
+            h = 0.0f;
+            cur = 0;
+        }
+    }
+    return false;
 }
 
-#endif
\ No newline at end of file
+#endif
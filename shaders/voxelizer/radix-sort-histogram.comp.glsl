@@ -0,0 +1,48 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxel-fragment.glsl"
+
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) readonly buffer SortKeyBuffer {
+    uint64_t sortKeys[];
+};
+
+// Digit major, histogram[digit * uTileCount + tile] so that a single
+// exclusive scan gives the scatter offset of every tile
+layout(binding = 1, set = 0) writeonly buffer HistogramBuffer {
+    uint histogram[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uCount;
+    uint uShift;
+    uint uTileCount;
+};
+
+shared uint sHistogram[RADIX_BINS];
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint tile = gl_WorkGroupID.x;
+
+    if (lid < RADIX_BINS)
+        sHistogram[lid] = 0;
+    barrier();
+
+    uint begin = tile * TILE_SIZE + lid * ITEMS_PER_THREAD;
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        if (index < uCount) {
+            uint digit = uint(sortKeys[index] >> uShift) & RADIX_MASK;
+            atomicAdd(sHistogram[digit], 1);
+        }
+    }
+    barrier();
+
+    if (lid < RADIX_BINS)
+        histogram[lid * uTileCount + tile] = sHistogram[lid];
+}
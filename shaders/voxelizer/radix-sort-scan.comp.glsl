@@ -0,0 +1,51 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxel-fragment.glsl"
+
+// In-place exclusive scan run by a single workgroup, the arrays scanned
+// here are per tile counts so they stay small
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) buffer ScanBuffer {
+    uint data[];
+};
+
+layout(binding = 1, set = 0) writeonly buffer ScanTotalBuffer {
+    uint total;
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uCount;
+};
+
+shared uint sData[WORKGROUP_SIZE];
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+
+    uint carry = 0;
+    for (uint chunk = 0; chunk < uCount; chunk += WORKGROUP_SIZE) {
+        uint index = chunk + lid;
+        uint value = index < uCount ? data[index] : 0;
+        sData[lid] = value;
+        barrier();
+
+        for (uint offset = 1; offset < WORKGROUP_SIZE; offset <<= 1) {
+            uint sum = lid >= offset ? sData[lid - offset] : 0;
+            barrier();
+            sData[lid] += sum;
+            barrier();
+        }
+
+        if (index < uCount)
+            data[index] = carry + sData[lid] - value;
+        carry += sData[WORKGROUP_SIZE - 1];
+        barrier();
+    }
+
+    if (lid == 0)
+        total = carry;
+}
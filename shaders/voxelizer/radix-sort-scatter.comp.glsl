@@ -0,0 +1,84 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxel-fragment.glsl"
+
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) readonly buffer SrcSortKeyBuffer {
+    uint64_t srcKeys[];
+};
+
+layout(binding = 1, set = 0) writeonly buffer DstSortKeyBuffer {
+    uint64_t dstKeys[];
+};
+
+layout(binding = 2, set = 0) readonly buffer HistogramBuffer {
+    uint histogram[];
+};
+
+// Colors are the values of the sort and follow their keys
+layout(binding = 3, set = 0) readonly buffer SrcColorBuffer {
+    uint srcColors[];
+};
+
+layout(binding = 4, set = 0) writeonly buffer DstColorBuffer {
+    uint dstColors[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uCount;
+    uint uShift;
+    uint uTileCount;
+};
+
+shared uint sCounts[RADIX_BINS * WORKGROUP_SIZE];
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint tile = gl_WorkGroupID.x;
+    uint begin = tile * TILE_SIZE + lid * ITEMS_PER_THREAD;
+
+    uint localCounts[RADIX_BINS];
+    for (uint i = 0; i < RADIX_BINS; ++i)
+        localCounts[i] = 0;
+
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        if (index < uCount)
+            localCounts[uint(srcKeys[index] >> uShift) & RADIX_MASK]++;
+    }
+
+    for (uint i = 0; i < RADIX_BINS; ++i)
+        sCounts[i * WORKGROUP_SIZE + lid] = localCounts[i];
+    barrier();
+
+    // Every thread owns a contiguous range of the tile, scanning the counts
+    // in thread order keeps the sort stable
+    if (lid < RADIX_BINS) {
+        uint sum = 0;
+        for (uint i = 0; i < WORKGROUP_SIZE; ++i) {
+            uint count = sCounts[lid * WORKGROUP_SIZE + i];
+            sCounts[lid * WORKGROUP_SIZE + i] = sum;
+            sum += count;
+        }
+    }
+    barrier();
+
+    uint offsets[RADIX_BINS];
+    for (uint i = 0; i < RADIX_BINS; ++i)
+        offsets[i] = histogram[i * uTileCount + tile] + sCounts[i * WORKGROUP_SIZE + lid];
+
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        if (index < uCount) {
+            uint64_t key = srcKeys[index];
+            uint digit = uint(key >> uShift) & RADIX_MASK;
+            uint dst = offsets[digit]++;
+            dstKeys[dst] = key;
+            dstColors[dst] = srcColors[index];
+        }
+    }
+}
@@ -4,6 +4,7 @@
 #extension GL_ARB_gpu_shader_int64 : enable
 
 #include "terrain.glsl"
+#include "voxel-fragment.glsl"
 
 layout(local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
 
@@ -11,8 +12,12 @@ layout(set = 0, binding = 0) writeonly buffer VoxelCountBuffer {
     uint voxelCount[];
 };
 
-layout(set = 0, binding = 1) writeonly buffer VoxelFragmentList {
-    uint64_t voxelFragmentList[];
+layout(set = 0, binding = 1) writeonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(set = 0, binding = 2) writeonly buffer VoxelColorBuffer {
+    uint voxelColors[];
 };
 
 layout(push_constant) uniform PushConstant {
@@ -24,10 +29,7 @@ void main() {
     float d = GetNoise(p - voxelResolution * 0.5f);
     if (d <= 0.0f) {
         uint index = atomicAdd(voxelCount[1], 1);
-        uint color = 0xffffff;
-        voxelFragmentList[index] = uint64_t(color) << 40 |
-                                   uint64_t(p.z) << 24 |
-                                   uint64_t(p.y) << 12 |
-                                   uint64_t(p.x);
+        voxelKeys[index] = EncodeMorton(uvec3(p));
+        voxelColors[index] = 0xffffff;
     }
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxel-fragment.glsl"
+
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) readonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(binding = 1, set = 0) writeonly buffer TileCountBuffer {
+    uint tileCounts[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uCount;
+};
+
+shared uint sCount;
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint tile = gl_WorkGroupID.x;
+
+    if (lid == 0)
+        sCount = 0;
+    barrier();
+
+    // Count the first fragment of every run of equal positions
+    uint count = 0;
+    uint begin = tile * TILE_SIZE + lid * ITEMS_PER_THREAD;
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        if (index < uCount && (index == 0 || voxelKeys[index] != voxelKeys[index - 1]))
+            count++;
+    }
+    atomicAdd(sCount, count);
+    barrier();
+
+    if (lid == 0)
+        tileCounts[tile] = sCount;
+}
@@ -0,0 +1,83 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxel-fragment.glsl"
+
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) readonly buffer SortKeyBuffer {
+    uint64_t sortKeys[];
+};
+
+layout(binding = 1, set = 0) readonly buffer SortColorBuffer {
+    uint sortColors[];
+};
+
+layout(binding = 2, set = 0) readonly buffer TileOffsetBuffer {
+    uint tileOffsets[];
+};
+
+layout(binding = 3, set = 0) writeonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(binding = 4, set = 0) writeonly buffer VoxelColorBuffer {
+    uint voxelColors[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint uCount;
+};
+
+shared uint sOffsets[WORKGROUP_SIZE];
+
+bool IsRunHead(uint index) {
+    return index == 0 || sortKeys[index] != sortKeys[index - 1];
+}
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint tile = gl_WorkGroupID.x;
+    uint begin = tile * TILE_SIZE + lid * ITEMS_PER_THREAD;
+
+    uint count = 0;
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        if (index < uCount && IsRunHead(index))
+            count++;
+    }
+    sOffsets[lid] = count;
+    barrier();
+
+    if (lid == 0) {
+        uint sum = tileOffsets[tile];
+        for (uint i = 0; i < WORKGROUP_SIZE; ++i) {
+            uint c = sOffsets[i];
+            sOffsets[i] = sum;
+            sum += c;
+        }
+    }
+    barrier();
+
+    uint offset = sOffsets[lid];
+    for (uint i = 0; i < ITEMS_PER_THREAD; ++i) {
+        uint index = begin + i;
+        if (index >= uCount || !IsRunHead(index))
+            continue;
+
+        // Merge the duplicates by averaging their colors
+        uint64_t key = sortKeys[index];
+        vec3 color = vec3(0.0f);
+        uint duplicates = 0;
+        for (uint j = index; j < uCount && sortKeys[j] == key; ++j) {
+            color += unpackUnorm4x8(sortColors[j] & VOXEL_COLOR_MASK).rgb;
+            duplicates++;
+        }
+
+        voxelKeys[offset] = key;
+        voxelColors[offset] = packUnorm4x8(vec4(color / float(duplicates), 0.0f)) & VOXEL_COLOR_MASK;
+        offset++;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef VOXEL_FRAGMENT_GLSL
+#define VOXEL_FRAGMENT_GLSL
+
+// Fragment layout and tiling are shared with the C++ side
+#include "../../src/voxelizer/voxel-fragment-layout.h"
+
+#define WORKGROUP_SIZE FRAGMENT_WORKGROUP_SIZE
+#define ITEMS_PER_THREAD FRAGMENT_ITEMS_PER_THREAD
+#define TILE_SIZE (WORKGROUP_SIZE * ITEMS_PER_THREAD)
+
+#define RADIX_BITS FRAGMENT_RADIX_BITS
+#define RADIX_BINS (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_BINS - 1)
+
+uint64_t SplitBy3(uint a) {
+    uint64_t x = uint64_t(a) & 0x1fffffUL;
+    x = (x | x << 32) & 0x1f00000000ffffUL;
+    x = (x | x << 16) & 0x1f0000ff0000ffUL;
+    x = (x | x << 8) & 0x100f00f00f00f00fUL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3UL;
+    x = (x | x << 2) & 0x1249249249249249UL;
+    return x;
+}
+
+uint CompactBy3(uint64_t x) {
+    x &= 0x1249249249249249UL;
+    x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3UL;
+    x = (x ^ (x >> 4)) & 0x100f00f00f00f00fUL;
+    x = (x ^ (x >> 8)) & 0x1f0000ff0000ffUL;
+    x = (x ^ (x >> 16)) & 0x1f00000000ffffUL;
+    x = (x ^ (x >> 32)) & 0x1fffffUL;
+    return uint(x);
+}
+
+// Child index at every level is x + 2y + 4z, so x takes the lowest bit
+uint64_t EncodeMorton(uvec3 p) {
+    return SplitBy3(p.x) | (SplitBy3(p.y) << 1) | (SplitBy3(p.z) << 2);
+}
+
+uvec3 DecodeMorton(uint64_t code) {
+    return uvec3(CompactBy3(code), CompactBy3(code >> 1), CompactBy3(code >> 2));
+}
+
+#endif
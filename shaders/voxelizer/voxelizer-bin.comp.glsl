@@ -0,0 +1,60 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxelizer-compute.glsl"
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// One thread per triangle, small triangles are voxelized here and the
+// others are split in the tiles of their bounds the plane passes through
+void main() {
+    // Large scenes spread the groups over y to stay within the dispatch limits
+    uint triangleIndex = (gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+    if (triangleIndex >= uTriangleCount)
+        return;
+
+    Triangle triangle = LoadTriangle(triangleIndex);
+    uvec3 boundsMin, boundsMax;
+    if (!GetTriangleBounds(triangle, boundsMin, boundsMax))
+        return;
+
+    uvec3 extent = boundsMax - boundsMin + 1;
+    if (extent.x * extent.y * extent.z <= SMALL_TRIANGLE_VOXELS) {
+        TriangleSetup setup = SetupTriangle(triangle, 1.0f);
+        // Degenerate triangles cover no voxel once rasterized either
+        if (dot(setup.normal, setup.normal) == 0.0f)
+            return;
+
+        for (uint z = boundsMin.z; z <= boundsMax.z; ++z) {
+            for (uint y = boundsMin.y; y <= boundsMax.y; ++y) {
+                for (uint x = boundsMin.x; x <= boundsMax.x; ++x) {
+                    uvec3 voxel = uvec3(x, y, z);
+                    uint color;
+                    if (Overlaps(setup, vec3(voxel)) && ShadeVoxel(triangle, setup.normal, voxel, color))
+                        WriteVoxel(voxel, color);
+                }
+            }
+        }
+        return;
+    }
+
+    TriangleSetup tileSetup = SetupTriangle(triangle, float(VOXELIZER_TILE_SIZE));
+    if (dot(tileSetup.normal, tileSetup.normal) == 0.0f)
+        return;
+
+    uvec3 tileMin = boundsMin / VOXELIZER_TILE_SIZE;
+    uvec3 tileExtent = boundsMax / VOXELIZER_TILE_SIZE - tileMin + 1;
+    uint tileCount = tileExtent.x * tileExtent.y * tileExtent.z;
+    for (uint tile = 0; tile < tileCount; ++tile) {
+        uvec3 tileOffset = uvec3(tile % tileExtent.x, (tile / tileExtent.x) % tileExtent.y, tile / (tileExtent.x * tileExtent.y));
+        if (!Overlaps(tileSetup, vec3((tileMin + tileOffset) * VOXELIZER_TILE_SIZE)))
+            continue;
+
+        uint index = atomicAdd(workItemCount, 1);
+        if (index < uWorkItemCapacity)
+            workItems[index] = uvec2(triangleIndex, tile);
+    }
+}
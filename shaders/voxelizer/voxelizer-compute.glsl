@@ -0,0 +1,196 @@
+#ifndef VOXELIZER_COMPUTE_GLSL
+#define VOXELIZER_COMPUTE_GLSL
+
+// Triangle/box overlap voxelization in compute, shared by the binning and
+// the tile pass. A voxel is written when the triangle touches its cube,
+// the same voxels conservative rasterization along the dominant axis gives.
+
+#define ENABLE_BINDLESS_SET
+#include "../meshdata.glsl"
+#include "../material.glsl"
+#include "voxel-fragment.glsl"
+
+// Triangles covering up to this many voxels of their bounds are voxelized
+// by the binning thread, larger ones are split in tiles
+#define SMALL_TRIANGLE_VOXELS 32
+#define VOXELIZER_TILE_SIZE 4
+#define MAX_DISPATCH_GROUPS 65535
+
+layout(binding = 5, set = 0) readonly buffer Indices {
+    uint indices[];
+};
+
+// Exclusive prefix sum of the triangle counts of the culled draws
+layout(binding = 6, set = 0) readonly buffer DrawTriangleOffsets {
+    uint drawTriangleOffsets[];
+};
+
+// Dispatch arguments of the tile pass followed by the counters, the counts
+// keep going past the capacities so that the host can grow the buffers
+layout(binding = 7, set = 0) buffer VoxelizerCounters {
+    uint tileGroupsX;
+    uint tileGroupsY;
+    uint tileGroupsZ;
+    uint fragmentCount;
+    uint workItemCount;
+};
+
+layout(binding = 8, set = 0) writeonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(binding = 9, set = 0) writeonly buffer VoxelColorBuffer {
+    uint voxelColors[];
+};
+
+// Triangle index and the index of the tile inside the tiles its bounds cover
+layout(binding = 10, set = 0) buffer WorkItems {
+    uvec2 workItems[];
+};
+
+// Lowest corner and size of the voxelized cube, the grid has
+// uGridResolution voxels per axis
+layout(push_constant) uniform PushConstant {
+    vec3 uVolumeMin;
+    float uVolumeSize;
+    uint uGridResolution;
+    uint uTriangleCount;
+    uint uDrawCount;
+    uint uFragmentCapacity;
+    uint uWorkItemCapacity;
+};
+
+struct Triangle {
+    // Positions in voxels
+    vec3 p[3];
+    vec2 uv[3];
+    uint drawId;
+};
+
+struct TriangleSetup {
+    vec3 normal;
+    // Plane offsets at the two corners of the box along the normal
+    float d1, d2;
+    // Edge functions of the projections on the yz, zx and xy planes
+    vec2 edgeNormals[9];
+    float edgeOffsets[9];
+};
+
+uint FindDraw(uint triangle) {
+    uint first = 0, count = uDrawCount;
+    while (count > 0) {
+        uint halfCount = count / 2;
+        if (drawTriangleOffsets[first + halfCount + 1] <= triangle) {
+            first += halfCount + 1;
+            count -= halfCount + 1;
+        } else
+            count = halfCount;
+    }
+    return first;
+}
+
+Triangle LoadTriangle(uint triangle) {
+    uint draw = FindDraw(triangle);
+    MeshDrawCommand drawCommand = drawCommands[draw];
+    mat4 worldTransform = transforms[drawCommand.drawId];
+    uint firstIndex = drawCommand.firstIndex + (triangle - drawTriangleOffsets[draw]) * 3;
+
+    Triangle result;
+    for (int i = 0; i < 3; ++i) {
+        VertexData vertex = vertices[indices[firstIndex + i] + drawCommand.baseVertex];
+        vec3 worldPos = (worldTransform * vec4(vertex.px, vertex.py, vertex.pz, 1.0f)).xyz;
+        result.p[i] = (worldPos - uVolumeMin) / uVolumeSize * float(uGridResolution);
+        result.uv[i] = vec2(vertex.tu, vertex.tv);
+    }
+    result.drawId = drawCommand.drawId;
+    return result;
+}
+
+// Schwarz and Seidel, Fast Parallel Surface and Solid Voxelization on GPUs.
+// boxSize is the size of the tested cubes, a voxel or a tile
+TriangleSetup SetupTriangle(Triangle triangle, float boxSize) {
+    TriangleSetup setup;
+    vec3 e[3] = vec3[3](triangle.p[1] - triangle.p[0], triangle.p[2] - triangle.p[1], triangle.p[0] - triangle.p[2]);
+    setup.normal = cross(e[0], e[1]);
+
+    vec3 c = mix(vec3(0.0f), vec3(boxSize), greaterThan(setup.normal, vec3(0.0f)));
+    setup.d1 = dot(setup.normal, c - triangle.p[0]);
+    setup.d2 = dot(setup.normal, vec3(boxSize) - c - triangle.p[0]);
+
+    for (int axis = 0; axis < 3; ++axis) {
+        // Projection on the plane orthogonal to axis, as (u, v)
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        float orientation = setup.normal[axis] < 0.0f ? -1.0f : 1.0f;
+        for (int i = 0; i < 3; ++i) {
+            vec2 edgeNormal = vec2(-e[i][v], e[i][u]) * orientation;
+            vec2 p = vec2(triangle.p[i][u], triangle.p[i][v]);
+            setup.edgeNormals[axis * 3 + i] = edgeNormal;
+            setup.edgeOffsets[axis * 3 + i] = -dot(edgeNormal, p) + max(0.0f, edgeNormal.x * boxSize) + max(0.0f, edgeNormal.y * boxSize);
+        }
+    }
+    return setup;
+}
+
+// Exact for boxes overlapping the bounds of the triangle, the callers only
+// visit voxels and tiles inside GetTriangleBounds
+bool Overlaps(TriangleSetup setup, vec3 boxMin) {
+    float planeDistance = dot(setup.normal, boxMin);
+    if ((planeDistance + setup.d1) * (planeDistance + setup.d2) > 0.0f)
+        return false;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        vec2 p = vec2(boxMin[(axis + 1) % 3], boxMin[(axis + 2) % 3]);
+        for (int i = 0; i < 3; ++i) {
+            if (dot(setup.edgeNormals[axis * 3 + i], p) + setup.edgeOffsets[axis * 3 + i] < 0.0f)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Voxel bounds of the triangle clamped to the grid, empty when it is outside
+bool GetTriangleBounds(Triangle triangle, out uvec3 boundsMin, out uvec3 boundsMax) {
+    vec3 pMin = min(min(triangle.p[0], triangle.p[1]), triangle.p[2]);
+    vec3 pMax = max(max(triangle.p[0], triangle.p[1]), triangle.p[2]);
+    if (any(lessThan(pMax, vec3(0.0f))) || any(greaterThanEqual(pMin, vec3(uGridResolution))))
+        return false;
+
+    boundsMin = uvec3(clamp(floor(pMin), vec3(0.0f), vec3(uGridResolution - 1)));
+    boundsMax = uvec3(clamp(floor(pMax), vec3(0.0f), vec3(uGridResolution - 1)));
+    return true;
+}
+
+// Color of the triangle at the point closest to the voxel center, the
+// alpha tested texels are skipped like the rasterized voxelizer does
+bool ShadeVoxel(Triangle triangle, vec3 normal, uvec3 voxel, out uint color) {
+    vec3 center = vec3(voxel) + 0.5f;
+    vec3 p = center - normal * (dot(normal, center - triangle.p[0]) / dot(normal, normal));
+
+    vec3 barycentric;
+    barycentric.x = dot(cross(triangle.p[2] - triangle.p[1], p - triangle.p[1]), normal);
+    barycentric.y = dot(cross(triangle.p[0] - triangle.p[2], p - triangle.p[2]), normal);
+    barycentric.z = dot(cross(triangle.p[1] - triangle.p[0], p - triangle.p[0]), normal);
+    barycentric = max(barycentric, vec3(0.0f));
+    barycentric /= max(barycentric.x + barycentric.y + barycentric.z, 1e-20f);
+    vec2 uv = triangle.uv[0] * barycentric.x + triangle.uv[1] * barycentric.y + triangle.uv[2] * barycentric.z;
+
+    Material material = materials[triangle.drawId];
+    vec4 diffuseColor;
+    if (material.albedoMap != INVALID_TEXTURE)
+        diffuseColor = sampleTextureLOD(material.albedoMap, uv, 0.0f);
+    else
+        diffuseColor = material.albedo;
+
+    color = packUnorm4x8(diffuseColor) & VOXEL_COLOR_MASK;
+    return diffuseColor.a >= 0.5f;
+}
+
+void WriteVoxel(uvec3 voxel, uint color) {
+    uint index = atomicAdd(fragmentCount, 1);
+    if (index < uFragmentCapacity) {
+        voxelKeys[index] = EncodeMorton(voxel);
+        voxelColors[index] = color;
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+#version 460
+
+#extension GL_ARB_gpu_shader_int64 : enable
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0, set = 0) readonly buffer DrawOverflowBuffer {
+    uint drawOverflow[];
+};
+
+layout(binding = 1, set = 0) readonly buffer KeptKeyBuffer {
+    uint64_t keptKeys[];
+};
+
+layout(binding = 2, set = 0) readonly buffer KeptColorBuffer {
+    uint keptColors[];
+};
+
+layout(binding = 3, set = 0) readonly buffer KeptDrawBuffer {
+    uint keptDraws[];
+};
+
+layout(binding = 4, set = 0) buffer VoxelFragmentCountBuffer {
+    uint voxelCount[];
+};
+
+layout(binding = 5, set = 0) writeonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(binding = 6, set = 0) writeonly buffer VoxelColorBuffer {
+    uint voxelColors[];
+};
+
+layout(binding = 7, set = 0) writeonly buffer VoxelDrawBuffer {
+    uint voxelDraws[];
+};
+
+layout(push_constant) uniform PushConstant {
+    uint uKeptCount;
+};
+
+// Moves the fragments written before the output overflowed to the grown
+// buffers, except those of the draws that are drawn again and would
+// otherwise be counted twice in the voxel colors
+void main() {
+    // Large outputs spread the groups over y to stay within the dispatch limits
+    uint fragmentIndex = (gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+    if (fragmentIndex >= uKeptCount)
+        return;
+
+    uint drawID = keptDraws[fragmentIndex];
+    if (drawOverflow[drawID] != 0)
+        return;
+
+    uint index = atomicAdd(voxelCount[1], 1);
+    voxelKeys[index] = keptKeys[fragmentIndex];
+    voxelColors[index] = keptColors[fragmentIndex];
+    voxelDraws[index] = drawID;
+}
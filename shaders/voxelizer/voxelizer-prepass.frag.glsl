@@ -7,7 +7,7 @@
 layout(location = 0) in vec3 gPos01;
 
 layout(push_constant) uniform PushConstant {
-    layout(offset = 8) uint uVoxelResolution;
+    layout(offset = 16) uint uVoxelResolution;
 };
 
 layout(binding = 4, set = 0) writeonly buffer VoxelFragmentCountBuffer {
@@ -15,5 +15,7 @@ layout(binding = 4, set = 0) writeonly buffer VoxelFragmentCountBuffer {
 };
 
 void main() {
+    if (IsOutsideVolume(gPos01))
+        return;
     atomicAdd(voxelCount[0], 1);
 }
\ No newline at end of file
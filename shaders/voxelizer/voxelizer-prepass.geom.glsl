@@ -8,8 +8,11 @@ layout(triangle_strip, max_vertices = 3) out;
 
 layout(location = 0) out vec3 gPos01;
 
+// Lowest corner and size of the cube being voxelized, either the whole
+// scene or a single brick of it
 layout(push_constant) uniform PushConstant {
-    float minExtent, maxExtent;
+    vec3 uVolumeMin;
+    float uVolumeSize;
 };
 
 void main() {
@@ -23,7 +26,7 @@ void main() {
 
     for (int i = 0; i < 3; ++i) {
         // Convert to clipspace position, project it along dominant axis
-        vec3 pos01 = ((gl_in[i].gl_Position.xyz - minExtent) / (maxExtent - minExtent));
+        vec3 pos01 = (gl_in[i].gl_Position.xyz - uVolumeMin) / uVolumeSize;
         gPos01 = pos01;
 
         vec3 projectedPosition = ProjectAlongDominantAxis(pos01 * 2.0f - 1.0f, dominantAxis);
@@ -0,0 +1,18 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxelizer-compute.glsl"
+
+layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+
+// Work items beyond the capacity were dropped, the tile pass runs over
+// the written ones and the host re-runs both passes with more room
+void main() {
+    uint itemCount = min(workItemCount, uWorkItemCapacity);
+    tileGroupsX = min(itemCount, MAX_DISPATCH_GROUPS);
+    tileGroupsY = (itemCount + MAX_DISPATCH_GROUPS - 1) / MAX_DISPATCH_GROUPS;
+    tileGroupsZ = 1;
+}
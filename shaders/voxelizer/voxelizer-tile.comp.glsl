@@ -0,0 +1,35 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_ARB_gpu_shader_int64 : enable
+
+#include "voxelizer-compute.glsl"
+
+layout(local_size_x = VOXELIZER_TILE_SIZE, local_size_y = VOXELIZER_TILE_SIZE, local_size_z = VOXELIZER_TILE_SIZE) in;
+
+// One workgroup per work item of the binning pass, every thread tests
+// one voxel of the tile against the triangle
+void main() {
+    uint itemIndex = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    if (itemIndex >= min(workItemCount, uWorkItemCapacity))
+        return;
+
+    uvec2 workItem = workItems[itemIndex];
+    Triangle triangle = LoadTriangle(workItem.x);
+    uvec3 boundsMin, boundsMax;
+    GetTriangleBounds(triangle, boundsMin, boundsMax);
+
+    uvec3 tileMin = boundsMin / VOXELIZER_TILE_SIZE;
+    uvec3 tileExtent = boundsMax / VOXELIZER_TILE_SIZE - tileMin + 1;
+    uint tile = workItem.y;
+    uvec3 tileOffset = uvec3(tile % tileExtent.x, (tile / tileExtent.x) % tileExtent.y, tile / (tileExtent.x * tileExtent.y));
+    uvec3 voxel = (tileMin + tileOffset) * VOXELIZER_TILE_SIZE + gl_LocalInvocationID;
+    if (any(lessThan(voxel, boundsMin)) || any(greaterThan(voxel, boundsMax)))
+        return;
+
+    TriangleSetup setup = SetupTriangle(triangle, 1.0f);
+    uint color;
+    if (Overlaps(setup, vec3(voxel)) && ShadeVoxel(triangle, setup.normal, voxel, color))
+        WriteVoxel(voxel, color);
+}
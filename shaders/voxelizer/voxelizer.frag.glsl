@@ -6,6 +6,7 @@
 #define ENABLE_BINDLESS_SET
 #include "../material.glsl"
 #include "voxelizer.glsl"
+#include "voxel-fragment.glsl"
 
 layout(location = 0) in vec3 gPos01;
 layout(location = 1) in vec2 gUV;
@@ -15,18 +16,35 @@ layout(binding = 5, set = 0) writeonly buffer VoxelFragmentCountBuffer {
     uint voxelCount[];
 };
 
-layout(binding = 6, set = 0) writeonly buffer VoxelFragmentBuffer {
-    uint64_t voxelFragment[];
+layout(binding = 6, set = 0) writeonly buffer VoxelKeyBuffer {
+    uint64_t voxelKeys[];
+};
+
+layout(binding = 7, set = 0) writeonly buffer VoxelColorBuffer {
+    uint voxelColors[];
+};
+
+// Set for the draws that lost fragments to a full buffer, indexed by draw id
+layout(binding = 8, set = 0) writeonly buffer DrawOverflowBuffer {
+    uint drawOverflow[];
+};
+
+// Draw of every fragment, the fragments of the draws drawn again after an
+// overflow are dropped with it
+layout(binding = 9, set = 0) writeonly buffer VoxelDrawBuffer {
+    uint voxelDraws[];
 };
 
 layout(push_constant) uniform PushConstant {
-    layout(offset = 8) uint uVoxelResolution;
+    layout(offset = 16) uint uVoxelResolution;
+    uint uFragmentCapacity;
 };
 
-// layout(rgba8, binding = 7, set = 0) uniform writeonly image3D voxelTexture;
+// layout(rgba8, binding = 8, set = 0) uniform writeonly image3D voxelTexture;
 
 void main() {
-    uint index = atomicAdd(voxelCount[1], 1);
+    if (IsOutsideVolume(gPos01))
+        return;
 
     Material material = materials[gDrawID];
     vec4 diffuseColor;
@@ -38,14 +56,19 @@ void main() {
     if (diffuseColor.a < 0.5)
         discard;
 
-    uint color = packUnorm4x8(diffuseColor);
+    // Only counted once written so that alpha tested fragments leave no
+    // empty entries behind, the prepass count is an upper bound. The count
+    // keeps going past the capacity so that the host can grow the buffers
+    uint index = atomicAdd(voxelCount[1], 1);
+    if (index >= uFragmentCapacity) {
+        drawOverflow[gDrawID] = 1;
+        return;
+    }
 
     ivec3 vp = ivec3(gPos01 * uVoxelResolution);
-    // voxelFragment[index] = (vp.x << 20) | (vp.y << 10) | vp.z;
-    voxelFragment[index] = uint64_t(color) << 40 |
-                           uint64_t(vp.z) << 24 |
-                           uint64_t(vp.y) << 12 |
-                           uint64_t(vp.x);
+    voxelKeys[index] = EncodeMorton(uvec3(vp));
+    voxelColors[index] = packUnorm4x8(diffuseColor) & VOXEL_COLOR_MASK;
+    voxelDraws[index] = gDrawID;
 
     // imageStore(voxelTexture, vp, vec4(diffuseColor.rgb, 1.0f));
 }
\ No newline at end of file
@@ -14,8 +14,11 @@ layout(location = 0) out vec3 gPos01;
 layout(location = 1) out vec2 gUV;
 layout(location = 2) out flat uint gDrawID;
 
+// Lowest corner and size of the cube being voxelized, either the whole
+// scene or a single brick of it
 layout(push_constant) uniform PushConstant {
-    float minExtent, maxExtent;
+    vec3 uVolumeMin;
+    float uVolumeSize;
 };
 
 void main() {
@@ -29,7 +32,7 @@ void main() {
 
     for (int i = 0; i < 3; ++i) {
         // Convert to clipspace position
-        vec3 pos01 = ((vWorldPos[i] - minExtent) / (maxExtent - minExtent));
+        vec3 pos01 = (vWorldPos[i] - uVolumeMin) / uVolumeSize;
         gPos01 = pos01;
         gUV = vUV[i];
         gDrawID = vDrawID[i];
@@ -28,6 +28,11 @@ vec3 WorldToTextureSpace(vec3 p, float voxelResolution) {
     return p + voxelResolution * 0.5;
 }
 
+// Triangles crossing the volume are not clipped along the projection axis
+bool IsOutsideVolume(vec3 pos01) {
+    return any(lessThan(pos01, vec3(0.0f))) || any(greaterThanEqual(pos01, vec3(1.0f)));
+}
+
 bool IsInsideCube(ivec3 textureCoord, int voxelResolution) {
     if (textureCoord.x >= 0 && textureCoord.y >= 0 && textureCoord.z >= 0 &&
         textureCoord.x < voxelResolution && textureCoord.y < voxelResolution && textureCoord.z < voxelResolution)
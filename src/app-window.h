@@ -1,14 +1,17 @@
 #pragma once
 
 #include "gfx/opengl.h"
+#ifdef VULKAN_ENABLED
 #include <GLFW/glfw3.h>
 #ifdef PLATFORM_WINDOWS
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h>
 #endif
+#endif
 
 #include "math-utils.h"
 #include "rendering/rendering-device.h"
+#include "rendering/null-rendering-device.h"
 #ifdef VULKAN_ENABLED
 #include "rendering/vulkan-rendering-device.h"
 #endif
@@ -19,7 +22,18 @@
 template <typename App>
 struct AppWindow {
 
-    AppWindow(const char *title, const glm::vec2 &windowSize) : windowSize(windowSize) {
+    AppWindow(const char *title, const glm::vec2 &windowSize, bool headless = false) : windowSize(windowSize), headless(headless) {
+#ifndef VULKAN_ENABLED
+        // Nothing to present with, only the null device is available
+        this->headless = true;
+#endif
+        if (this->headless) {
+            RD::GetInstance() = new NullRenderingDevice();
+            RD::GetInstance()->Initialize(nullptr);
+            return;
+        }
+
+#ifdef VULKAN_ENABLED
         if (!glfwInit()) {
             LOGE("Failed to initialize GLFW");
             return;
@@ -59,10 +73,10 @@ struct AppWindow {
                 app.OnResize(static_cast<float>(sx), static_cast<float>(sy));
             });
 
+#ifdef PLATFORM_WINDOWS
         platformData.windowPtr = glfwGetWin32Window(glfwWindowPtr);
-#if VULKAN_ENABLED
-        RD::GetInstance() = new VulkanRenderingDevice();
 #endif
+        RD::GetInstance() = new VulkanRenderingDevice();
         RenderingDevice *device = RenderingDevice::GetInstance();
 #ifdef _DEBUG
         device->SetValidationMode(true);
@@ -78,16 +92,24 @@ struct AppWindow {
         this->windowSize.x = static_cast<float>(width);
         this->windowSize.y = static_cast<float>(height);
         std::cout << width << " " << height << std::endl;
+#endif
     }
 
     virtual ~AppWindow() {
         RenderingDevice::GetInstance()->Shutdown();
+        if (headless)
+            return;
+#ifdef VULKAN_ENABLED
         glfwDestroyWindow(glfwWindowPtr);
         glfwTerminate();
+#endif
     }
 
-    RD::WindowPlatformData platformData;
-    GLFWwindow *glfwWindowPtr;
+    RD::WindowPlatformData platformData = {};
+#ifdef VULKAN_ENABLED
+    GLFWwindow *glfwWindowPtr = nullptr;
+#endif
     glm::vec2 windowSize;
     bool minimized = false;
+    bool headless = false;
 };
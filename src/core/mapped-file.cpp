@@ -0,0 +1,91 @@
+#include "pch.h"
+#include "mapped-file.h"
+
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace core {
+
+#ifdef PLATFORM_WINDOWS
+    bool MappedFile::Open(const std::string &filename) {
+        Close();
+
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            fileHandle = nullptr;
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            Close();
+            return false;
+        }
+        size = static_cast<uint64_t>(fileSize.QuadPart);
+
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            Close();
+            return false;
+        }
+
+        data = static_cast<const uint8_t *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if (data == nullptr) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data)
+            UnmapViewOfFile(data);
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        if (fileHandle)
+            CloseHandle(fileHandle);
+        data = nullptr;
+        mappingHandle = nullptr;
+        fileHandle = nullptr;
+        size = 0;
+    }
+#else
+    bool MappedFile::Open(const std::string &filename) {
+        Close();
+
+        fileDescriptor = open(filename.c_str(), O_RDONLY);
+        if (fileDescriptor < 0)
+            return false;
+
+        struct stat fileStat;
+        if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0) {
+            Close();
+            return false;
+        }
+        size = static_cast<uint64_t>(fileStat.st_size);
+
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (mapping == MAP_FAILED) {
+            Close();
+            return false;
+        }
+        data = static_cast<const uint8_t *>(mapping);
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data)
+            munmap(const_cast<uint8_t *>(data), size);
+        if (fileDescriptor >= 0)
+            close(fileDescriptor);
+        data = nullptr;
+        fileDescriptor = -1;
+        size = 0;
+    }
+#endif
+
+} // namespace core
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace core {
+
+    // Read-only memory mapping of a whole file, the mapping is released on
+    // Close or when the object goes out of scope
+    class MappedFile {
+      public:
+        MappedFile() = default;
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile() {
+            Close();
+        }
+
+        // Returns false if the file doesn't exist or is empty
+        bool Open(const std::string &filename);
+        void Close();
+
+        const uint8_t *GetData() const {
+            return data;
+        }
+
+        uint64_t GetSize() const {
+            return size;
+        }
+
+      private:
+        const uint8_t *data = nullptr;
+        uint64_t size = 0;
+
+#ifdef PLATFORM_WINDOWS
+        void *fileHandle = nullptr;
+        void *mappingHandle = nullptr;
+#else
+        int fileDescriptor = -1;
+#endif
+    };
+} // namespace core
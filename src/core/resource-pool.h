@@ -1,49 +1,146 @@
+#pragma once
+
 #include <stdint.h>
-#include <vector>
-#include <numeric>
+#include <atomic>
+#include <mutex>
 #include <assert.h>
 #include <iostream>
 
+// Handles are the slot index in the low 32 bits and the slot generation in
+// the high 32 bits. Release bumps the generation so that Access catches a
+// stale handle instead of silently aliasing the resource reusing the slot.
+// Slots live in chunks that never move, a chunk is added when the free list
+// runs out. Obtain, Access and Release don't lock, only growing does.
 template <typename T>
 struct ResourcePool {
 
+    // Bindless descriptors are indexed with the slot index
+    static uint32_t Index(uint64_t handle) {
+        return static_cast<uint32_t>(handle);
+    }
+
+    static uint32_t Generation(uint64_t handle) {
+        return static_cast<uint32_t>(handle >> 32);
+    }
+
+    // size is the slot count of a chunk, rounded up to a power of two
     void Initialize(uint32_t size, std::string name = "") {
-        _size = size;
+        _chunkShift = 0;
+        while ((1u << _chunkShift) < size)
+            _chunkShift++;
         _name = name;
-
-        _freeLists.resize(size);
-        _resources.resize(size);
-        std::iota(_freeLists.rbegin(), _freeLists.rend(), 0);
+        Grow();
     }
 
     uint64_t Obtain() {
-        assert(_freeLists.size() > 0);
-        uint64_t index = _freeLists.back();
-        _freeLists.pop_back();
-        return index;
+        uint64_t head = _freeHead.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t index = Index(head);
+            if (index == EMPTY) {
+                Grow();
+                head = _freeHead.load(std::memory_order_acquire);
+                continue;
+            }
+
+            // The tag in the high bits changes on every update, a slot obtained
+            // and released again in between fails the exchange
+            Slot *slot = GetSlot(index);
+            uint64_t next = ((head & TAG_MASK) + TAG_INCREMENT) | slot->nextFree.load(std::memory_order_relaxed);
+            if (_freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                _liveCount.fetch_add(1, std::memory_order_relaxed);
+                return (uint64_t(slot->generation.load(std::memory_order_relaxed)) << 32) | index;
+            }
+        }
     }
 
-    T *Access(uint64_t index) {
-        assert(index < _size);
-        return &_resources[index];
+    T *Access(uint64_t handle) {
+        Slot *slot = GetSlot(Index(handle));
+        assert(slot->generation.load(std::memory_order_acquire) == Generation(handle) && "Stale resource handle");
+        return &slot->resource;
     }
 
-    void Release(uint64_t index) {
-        assert(index < _size);
-        _freeLists.push_back(index);
+    void Release(uint64_t handle) {
+        uint32_t index = Index(handle);
+        Slot *slot = GetSlot(index);
+
+        // Zero is skipped so that a live handle is never zero
+        uint32_t generation = Generation(handle);
+        uint32_t nextGeneration = generation + 1 == 0 ? 1 : generation + 1;
+        if (!slot->generation.compare_exchange_strong(generation, nextGeneration, std::memory_order_acq_rel)) {
+            assert(0 && "Resource released twice or with a stale handle");
+            return;
+        }
+
+        Push(index, index);
+        _liveCount.fetch_sub(1, std::memory_order_relaxed);
     }
 
     void Shutdown() {
-        if (_freeLists.size() < _size) {
+        if (_liveCount.load() > 0) {
             std::string message = _name + "[ResourcePool] has unfreed resources";
             LOG(message)
         }
-        _resources.clear();
-        _freeLists.clear();
+
+        uint32_t chunkCount = _chunkCount.load();
+        for (uint32_t i = 0; i < chunkCount; ++i)
+            delete[] _chunks[i].exchange(nullptr);
+        _chunkCount = 0;
+        _freeHead = EMPTY;
+        _liveCount = 0;
+    }
+
+    static const uint32_t EMPTY = UINT32_MAX;
+    static const uint32_t MAX_CHUNK_COUNT = 1024;
+    static const uint64_t TAG_MASK = ~uint64_t(UINT32_MAX);
+    static const uint64_t TAG_INCREMENT = uint64_t(1) << 32;
+
+    struct Slot {
+        T resource = {};
+        std::atomic<uint32_t> generation = 1;
+        std::atomic<uint32_t> nextFree = EMPTY;
+    };
+
+    Slot *GetSlot(uint32_t index) {
+        uint32_t chunk = index >> _chunkShift;
+        assert(chunk < _chunkCount.load(std::memory_order_acquire) && "Resource handle out of range");
+        return &_chunks[chunk].load(std::memory_order_acquire)[index & ((1u << _chunkShift) - 1)];
+    }
+
+    // Links first..last, already chained through nextFree, in front of the free list
+    void Push(uint32_t first, uint32_t last) {
+        Slot *lastSlot = GetSlot(last);
+        uint64_t head = _freeHead.load(std::memory_order_relaxed);
+        do {
+            lastSlot->nextFree.store(Index(head), std::memory_order_relaxed);
+        } while (!_freeHead.compare_exchange_weak(head, ((head & TAG_MASK) + TAG_INCREMENT) | first, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void Grow() {
+        std::lock_guard lock{_growMutex};
+        // Another thread grew the pool or released a slot while this one waited
+        uint32_t chunkIndex = _chunkCount.load(std::memory_order_relaxed);
+        if (chunkIndex > 0 && Index(_freeHead.load(std::memory_order_acquire)) != EMPTY)
+            return;
+        assert(chunkIndex < MAX_CHUNK_COUNT && "Resource pool is full");
+
+        uint32_t chunkSize = 1u << _chunkShift;
+        uint32_t first = chunkIndex << _chunkShift;
+        Slot *chunk = new Slot[chunkSize];
+        for (uint32_t i = 0; i + 1 < chunkSize; ++i)
+            chunk[i].nextFree.store(first + i + 1, std::memory_order_relaxed);
+
+        // Published before any of its slots can be obtained
+        _chunks[chunkIndex].store(chunk, std::memory_order_release);
+        _chunkCount.store(chunkIndex + 1, std::memory_order_release);
+        Push(first, first + chunkSize - 1);
     }
 
     std::string _name;
-    uint32_t _size;
-    std::vector<uint64_t> _freeLists;
-    std::vector<T> _resources;
-};
\ No newline at end of file
+    uint32_t _chunkShift = 0;
+    std::atomic<Slot *> _chunks[MAX_CHUNK_COUNT];
+    std::atomic<uint32_t> _chunkCount = 0;
+    // Tag in the high 32 bits, index of the first free slot in the low ones
+    std::atomic<uint64_t> _freeHead = EMPTY;
+    std::atomic<uint32_t> _liveCount = 0;
+    std::mutex _growMutex;
+};
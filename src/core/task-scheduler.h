@@ -0,0 +1,28 @@
+#pragma once
+
+#include "enkiTS/src/TaskScheduler.h"
+
+#include <mutex>
+
+namespace core {
+
+    // Process wide enkiTS scheduler, started on first use with one thread per core
+    inline enki::TaskScheduler *GetTaskScheduler() {
+        static enki::TaskScheduler scheduler;
+        static std::once_flag initialized;
+        std::call_once(initialized, [] { scheduler.Initialize(); });
+        return &scheduler;
+    }
+
+    // Runs fn(i) for every i in [0, count) on the scheduler and waits for it
+    template <typename Fn>
+    void ParallelFor(uint32_t count, Fn &&fn) {
+        enki::TaskScheduler *scheduler = GetTaskScheduler();
+        enki::TaskSet task(count, [&](enki::TaskSetPartition range, uint32_t threadNum) {
+            for (uint32_t i = range.start; i < range.end; ++i)
+                fn(i);
+        });
+        scheduler->AddTaskSetToPipe(&task);
+        scheduler->WaitforTask(&task);
+    }
+} // namespace core
@@ -11,6 +11,7 @@ struct TextureLoadRequest {
 };
 
 struct RenderScene;
+class UploadManager;
 
 struct BufferUploadRequest {
     void *data;
@@ -20,7 +21,7 @@ struct BufferUploadRequest {
 
 class AsyncLoader {
   public:
-    void Initialize(std::shared_ptr<RenderScene> scene);
+    void Initialize(std::shared_ptr<RenderScene> scene, std::shared_ptr<UploadManager> uploadManager);
 
     void Start();
 
@@ -28,7 +29,10 @@ class AsyncLoader {
         textureLoadQueue.push(TextureLoadRequest{filename, textureId});
     }
 
-    void LoadTextureSync(std::string filename, TextureID textureId, RD::ImmediateSubmitInfo *submitInfo);
+    // Decodes the file and queues the upload, the texture is ready on the
+    // graphics queue once the upload manager was flushed and the ownership
+    // acquired
+    void LoadTextureSync(std::string filename, TextureID textureId);
 
     void Shutdown();
 
@@ -36,14 +40,11 @@ class AsyncLoader {
     bool execute;
     std::thread _thread;
 
-    QueueID mainQueue;
     ThreadSafeQueue<TextureLoadRequest> textureLoadQueue;
 
-    BufferID stagingBuffer;
-    uint8_t *stagingBufferPtr;
-    RD::ImmediateSubmitInfo transferSubmitInfo;
     RD *device;
     void ProcessQueue(RD *device);
 
     std::shared_ptr<RenderScene> scene;
+    std::shared_ptr<UploadManager> uploadManager;
 };
\ No newline at end of file
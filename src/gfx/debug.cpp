@@ -8,12 +8,15 @@ namespace Debug {
     BufferID gLineBuffer;
     PipelineID gLinePipeline;
     static uint32_t gLineBufferOffset = 0;
+    // First line of the region of the frame being recorded, every frame in
+    // flight has its own
+    static uint32_t gLineBufferBase = 0;
     static Line *gLineBufferPtr = nullptr;
     static const int MAX_LINE_COUNT = 1'000'000;
     UniformSetID gUniformSet;
 
     void Initialize() {
-        uint32_t bufferSize = MAX_LINE_COUNT * sizeof(Line);
+        uint32_t bufferSize = RD::MAX_FRAMES_IN_FLIGHT * MAX_LINE_COUNT * sizeof(Line);
         RenderingDevice *device = RD::GetInstance();
         gLineBuffer = device->CreateBuffer(bufferSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "Debug Draw SSBO");
 
@@ -59,7 +62,7 @@ namespace Debug {
     void AddLine(const glm::vec3 &p0, const glm::vec3 &p1, uint32_t color) {
         InitializeBufferPtr();
 
-        Line *line = (gLineBufferPtr + gLineBufferOffset);
+        Line *line = (gLineBufferPtr + gLineBufferBase + gLineBufferOffset);
         line->p0 = p0;
         line->p1 = p1;
         line->c0 = line->c1 = color;
@@ -69,7 +72,7 @@ namespace Debug {
     void AddRect(const glm::vec3 &min, const glm::vec3 &max, uint32_t color) {
         InitializeBufferPtr();
 
-        Line *line = (gLineBufferPtr + gLineBufferOffset);
+        Line *line = (gLineBufferPtr + gLineBufferBase + gLineBufferOffset);
 
         glm::vec3 size = max - min;
         // Bottom
@@ -138,6 +141,7 @@ namespace Debug {
     }
 
     void NewFrame() {
+        gLineBufferBase = RD::GetInstance()->GetFrameIndex() * MAX_LINE_COUNT;
         gLineBufferOffset = 0;
     }
 
@@ -151,7 +155,7 @@ namespace Debug {
         device->BindPipeline(commandBuffer, gLinePipeline);
         device->BindUniformSet(commandBuffer, gLinePipeline, &gUniformSet, 1);
         device->BindPushConstants(commandBuffer, gLinePipeline, RD::SHADER_STAGE_VERTEX, &VP[0][0], 0, static_cast<uint32_t>(sizeof(glm::mat4)));
-        device->Draw(commandBuffer, numLines * 2, 1, 0, 0);
+        device->Draw(commandBuffer, numLines * 2, 1, gLineBufferBase * 2, 0);
     }
 
     void Shutdown() {
@@ -7,6 +7,7 @@
 #include "tinygltf/stb_image.h"
 #include "async-loader.h"
 #include "rendering/rendering-utils.h"
+#include "rendering/upload-manager.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtx/euler_angles.hpp>
@@ -47,6 +48,8 @@ void GLTFScene::ParseMaterial(tinygltf::Model *model, MaterialInfo *component, u
             uint32_t hash = DJB2Hash(texturePath);
             LOG("Path: " + texturePath + " Hash: " + std::to_string(hash));
             auto found = textureMap.find(hash);
+            // The bindless slot is the low 32 bits of the texture ID, the
+            // generation is in the high ones
             if (found != textureMap.end()) {
                 return (uint32_t)found->second.id;
             } else {
@@ -69,8 +72,15 @@ void GLTFScene::ParseMaterial(tinygltf::Model *model, MaterialInfo *component, u
                 desc.samplerDescription = &samplerDesc;
 
                 TextureID textureId = device->CreateTexture(&desc, image.uri);
+                // Materials index the bindless array with the slot
+                if ((uint32_t)textureId.id >= device->GetBindlessTextureCount()) {
+                    LOGW("Too many textures to bind " + texturePath);
+                    device->Destroy(textureId);
+                    return INVALID_TEXTURE_ID;
+                }
                 textureMap[hash] = textureId;
-                asyncLoader->LoadTextureSync(texturePath, textureId, &stagingSubmitInfo);
+                asyncLoader->LoadTextureSync(texturePath, textureId);
+                AddTexturesToUpdate(textureId);
                 device->UpdateBindlessDescriptor(&textureId, 1);
                 return (uint32_t)textureId.id;
             }
@@ -158,11 +168,20 @@ bool GLTFScene::ParseMesh(tinygltf::Model *model, tinygltf::Mesh &mesh, MeshGrou
             assert(0);
         }
 
-        glm::vec3 minExtent = transform * glm::vec4(positionAccessor.minValues[0], positionAccessor.minValues[1], positionAccessor.minValues[2], 1.0f);
-        glm::vec3 maxExtent = transform * glm::vec4(positionAccessor.maxValues[0], positionAccessor.maxValues[1], positionAccessor.maxValues[2], 1.0f);
-
-        //glm::vec3 minBound = glm::min(minExtent, maxExtent);
-        //glm::vec3 maxBound = glm::max(minExtent, maxExtent);
+        // Every corner is transformed, the voxelizer culls draws against the
+        // bounds so they have to hold under rotation too
+        glm::vec3 localMin = glm::vec3(positionAccessor.minValues[0], positionAccessor.minValues[1], positionAccessor.minValues[2]);
+        glm::vec3 localMax = glm::vec3(positionAccessor.maxValues[0], positionAccessor.maxValues[1], positionAccessor.maxValues[2]);
+        glm::vec3 minExtent = glm::vec3(FLT_MAX);
+        glm::vec3 maxExtent = glm::vec3(-FLT_MAX);
+        for (int corner = 0; corner < 8; ++corner) {
+            glm::vec3 p = glm::vec3(corner & 1 ? localMax.x : localMin.x,
+                                    corner & 2 ? localMax.y : localMin.y,
+                                    corner & 4 ? localMax.z : localMin.z);
+            p = transform * glm::vec4(p, 1.0f);
+            minExtent = glm::min(minExtent, p);
+            maxExtent = glm::max(maxExtent, p);
+        }
 
         meshGroup->aabb.push_back({minExtent, maxExtent});
         meshGroup->transforms.push_back(transform);
@@ -240,18 +259,30 @@ bool GLTFScene::LoadFile(const std::string &filename, MeshGroup *meshGroup) {
         }
     }
 
+    // Embedded data uris are already part of the glTF file
+    sourceFiles.push_back(filename);
+    for (auto &buffer : model.buffers) {
+        if (!buffer.uri.empty() && buffer.uri.rfind("data:", 0) != 0)
+            sourceFiles.push_back(_meshBasePath + buffer.uri);
+    }
+    for (auto &image : model.images) {
+        if (!image.uri.empty() && image.uri.rfind("data:", 0) != 0)
+            sourceFiles.push_back(_meshBasePath + image.uri);
+    }
+
     for (auto &scene : model.scenes)
         ParseScene(&model, &scene, meshGroup);
 
     return true;
 }
 
-bool GLTFScene::Initialize(const std::vector<std::string> &filenames, std::shared_ptr<AsyncLoader> loader) {
+bool GLTFScene::Initialize(const std::vector<std::string> &filenames, std::shared_ptr<AsyncLoader> loader, std::shared_ptr<UploadManager> uploadManager) {
     device = RD::GetInstance();
     asyncLoader = loader;
+    this->uploadManager = uploadManager;
 
     RD::UniformBinding vsBindings[] = {
-        {RD::BINDING_TYPE_UNIFORM_BUFFER, 0, 0},
+        {RD::BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, 0},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 3},
@@ -310,12 +341,13 @@ bool GLTFScene::Initialize(const std::vector<std::string> &filenames, std::share
     return true;
 }
 
-void GLTFScene::PrepareDraws(BufferID globalUB) {
+void GLTFScene::PrepareDraws(BufferID frameDataBuffer, uint32_t frameDataSize) {
     uint32_t vertexSize = static_cast<uint32_t>(meshGroup.vertices.size() * sizeof(Vertex));
     vertexBuffer = device->CreateBuffer(vertexSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "VertexBuffer");
 
     uint32_t indexSize = static_cast<uint32_t>(meshGroup.indices.size() * sizeof(uint32_t));
-    indexBuffer = device->CreateBuffer(indexSize, RD::BUFFER_USAGE_INDEX_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "IndexBuffer");
+    // Also read as a storage buffer by the compute voxelizer
+    indexBuffer = device->CreateBuffer(indexSize, RD::BUFFER_USAGE_INDEX_BUFFER_BIT | RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "IndexBuffer");
 
     uint32_t drawCommandSize = static_cast<uint32_t>(meshGroup.drawCommands.size() * sizeof(RD::DrawElementsIndirectCommand));
     drawCommandBuffer = device->CreateBuffer(drawCommandSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT | RD::BUFFER_USAGE_INDIRECT_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "DrawCommandBuffer");
@@ -326,11 +358,6 @@ void GLTFScene::PrepareDraws(BufferID globalUB) {
     uint32_t materialSize = static_cast<uint32_t>(meshGroup.materials.size() * sizeof(MaterialInfo));
     materialBuffer = device->CreateBuffer(materialSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Material Buffer");
 
-    uint32_t maxSize = std::max({vertexSize, indexSize, transformSize, materialSize, drawCommandSize});
-
-    BufferID stagingBuffer = device->CreateBuffer(maxSize, RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "Temp Staging Buffer");
-    uint8_t *stagingBufferPtr = device->MapBuffer(stagingBuffer);
-
     BufferUploadRequest uploadRequests[] = {
         {meshGroup.vertices.data(), vertexBuffer, vertexSize},
         {meshGroup.indices.data(), indexBuffer, indexSize},
@@ -339,24 +366,23 @@ void GLTFScene::PrepareDraws(BufferID globalUB) {
         {meshGroup.materials.data(), materialBuffer, materialSize},
     };
 
-    //@TODO Move to transfer queue
-
-    for (auto &request : uploadRequests) {
-        std::memcpy(stagingBufferPtr, request.data, request.size);
-
-        device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
-            RD::BufferCopyRegion copyRegion{
-                0, 0, request.size};
-            device->CopyBuffer(commandBuffer, stagingBuffer, request.bufferId, &copyRegion);
-        },
-                                &stagingSubmitInfo);
-        device->WaitForFence(&stagingSubmitInfo.fence, 1, UINT64_MAX);
-        device->ResetFences(&stagingSubmitInfo.fence, 1);
-        device->ResetCommandPool(stagingSubmitInfo.commandPool);
-    }
+    for (auto &request : uploadRequests)
+        uploadManager->UploadBuffer(request.bufferId, request.data, request.size);
+
+    // The textures of the materials were queued while loading the files, a
+    // single wait covers every batch. ImmediateSubmit doesn't wait for the
+    // upload timeline so it has to be done on the CPU
+    uploadManager->WaitForUpload(uploadManager->Flush());
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        UpdateTextures(commandBuffer);
+    },
+                            &stagingSubmitInfo);
+    device->WaitForFence(&stagingSubmitInfo.fence, 1, UINT64_MAX);
+    device->ResetFences(&stagingSubmitInfo.fence, 1);
+    device->ResetCommandPool(stagingSubmitInfo.commandPool);
 
     RD::BoundUniform boundedUniform[] = {
-        {RD::BINDING_TYPE_UNIFORM_BUFFER, 0, globalUB},
+        {RD::BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, frameDataBuffer, 0, frameDataSize},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 1, vertexBuffer},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 2, drawCommandBuffer},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 3, transformBuffer},
@@ -367,13 +393,12 @@ void GLTFScene::PrepareDraws(BufferID globalUB) {
 
     device->Destroy(stagingSubmitInfo.fence);
     device->Destroy(stagingSubmitInfo.commandPool);
-    device->Destroy(stagingBuffer);
 }
 
-void GLTFScene::Render(CommandBufferID commandBuffer) {
+void GLTFScene::Render(CommandBufferID commandBuffer, uint32_t frameDataOffset) {
     if (drawCommandBuffer && meshGroup.drawCommands.size() > 0) {
         device->BindPipeline(commandBuffer, renderPipeline);
-        device->BindUniformSet(commandBuffer, renderPipeline, &bindingSet, 1);
+        device->BindUniformSet(commandBuffer, renderPipeline, &bindingSet, 1, &frameDataOffset, 1);
 
         device->BindIndexBuffer(commandBuffer, indexBuffer);
         device->DrawIndexedIndirect(commandBuffer, drawCommandBuffer, 0, (uint32_t)meshGroup.drawCommands.size(), sizeof(RD::DrawElementsIndirectCommand));
@@ -381,33 +406,19 @@ void GLTFScene::Render(CommandBufferID commandBuffer) {
 }
 
 void GLTFScene::UpdateTextures(CommandBufferID commandBuffer) {
-    // Transfer Queue Ownership
-    QueueID transferQueue = device->GetDeviceQueue(RD::QUEUE_TYPE_TRANSFER);
-    QueueID mainQueue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
-
-    std::lock_guard lock{textureUpdateMutex};
-    uint32_t textureUpdateCount = static_cast<uint32_t>(texturesToUpdate.size());
-    std::vector<RD::TextureBarrier> barriers(textureUpdateCount);
-    for (uint32_t i = 0; i < textureUpdateCount; ++i) {
-        barriers[i].texture = texturesToUpdate[i];
-        barriers[i].srcAccess = 0,
-        barriers[i].dstAccess = RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT;
-        barriers[i].newLayout = RD::TEXTURE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barriers[i].srcQueueFamily = transferQueue;
-        barriers[i].dstQueueFamily = mainQueue;
-        barriers[i].baseMipLevel = 0;
-        barriers[i].baseArrayLayer = 0;
-        barriers[i].layerCount = 1;
-        barriers[i].levelCount = 1;
+    std::vector<TextureID> textures;
+    {
+        std::lock_guard lock{textureUpdateMutex};
+        textures.swap(texturesToUpdate);
     }
 
-    device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_ALL_COMMANDS_BIT, RD::PIPELINE_STAGE_TRANSFER_BIT, barriers.data(), textureUpdateCount, nullptr, 0);
-    for (auto &texture : texturesToUpdate) {
+    // Textures are added once their upload was flushed, acquiring after
+    // taking the list covers all of them
+    uploadManager->AcquireOwnership(commandBuffer);
+    for (auto &texture : textures) {
         device->GenerateMipmap(commandBuffer, texture);
         device->UpdateBindlessTexture(texture);
     }
-
-    texturesToUpdate.clear();
 }
 
 void GLTFScene::Shutdown() {
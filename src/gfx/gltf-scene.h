@@ -15,9 +15,9 @@ class AsyncLoader;
 
 class GLTFScene : public RenderScene {
   public:
-    bool Initialize(const std::vector<std::string> &filenames, std::shared_ptr<AsyncLoader> loader) override;
-    void PrepareDraws(BufferID globalUB) override;
-    void Render(CommandBufferID commandBuffer) override;
+    bool Initialize(const std::vector<std::string> &filenames, std::shared_ptr<AsyncLoader> loader, std::shared_ptr<UploadManager> uploadManager) override;
+    void PrepareDraws(BufferID frameDataBuffer, uint32_t frameDataSize) override;
+    void Render(CommandBufferID commandBuffer, uint32_t frameDataOffset) override;
 
     void AddTexturesToUpdate(TextureID texture) override {
         std::lock_guard lock{textureUpdateMutex};
@@ -45,6 +45,7 @@ class GLTFScene : public RenderScene {
 
     RD *device;
     std::shared_ptr<AsyncLoader> asyncLoader;
+    std::shared_ptr<UploadManager> uploadManager;
     std::string _meshBasePath;
 
     // @TODO shared among different scene
@@ -54,8 +55,8 @@ class GLTFScene : public RenderScene {
     std::mutex textureUpdateMutex;
     std::vector<TextureID> texturesToUpdate;
 
-    // @NOTE this submitInfo is used for synchronous transfer of texture and upload
-    // buffer resources to the gpu. This is destroyed at the end of PrepareDraws
+    // @NOTE this submitInfo is used to acquire the uploads and generate the mipmaps
+    // on the graphics queue. This is destroyed at the end of PrepareDraws
     RD::ImmediateSubmitInfo stagingSubmitInfo;
 
     AABB boundingBox;
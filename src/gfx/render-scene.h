@@ -8,17 +8,21 @@
 #include "mesh.h"
 
 class AsyncLoader;
+class UploadManager;
 
 struct RenderScene {
 
-    virtual bool Initialize(const std::vector<std::string> &filenames, std::shared_ptr<AsyncLoader> asyncLoader) = 0;
+    virtual bool Initialize(const std::vector<std::string> &filenames, std::shared_ptr<AsyncLoader> asyncLoader, std::shared_ptr<UploadManager> uploadManager) = 0;
 
-    virtual void PrepareDraws(BufferID globalUB) = 0;
+    // The FrameData is bound as a dynamic uniform buffer of frameDataSize
+    // bytes in frameDataBuffer, Render takes its offset for the frame
+    virtual void PrepareDraws(BufferID frameDataBuffer, uint32_t frameDataSize) = 0;
 
-    virtual void Render(CommandBufferID commandBuffer) = 0;
+    virtual void Render(CommandBufferID commandBuffer, uint32_t frameDataOffset) = 0;
 
     // ThreadSafe function that serializes the textures that must be updated
-    // Update can be ownership transfer or adding to list of bindless texture
+    // Update is the mipmap generation and adding to list of bindless texture,
+    // the ownership of every flushed upload is acquired with them
     virtual void AddTexturesToUpdate(TextureID texture) = 0;
 
     virtual void UpdateTextures(CommandBufferID commandBuffer) = 0;
@@ -33,4 +37,8 @@ struct RenderScene {
     BufferID materialBuffer;
     BufferID drawCommandBuffer;
     MeshGroup meshGroup;
+
+    // Every file the scene was loaded from including buffers and textures,
+    // caches derived from the scene are keyed on their content
+    std::vector<std::string> sourceFiles;
 };
\ No newline at end of file
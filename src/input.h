@@ -1,6 +1,5 @@
 #include "core/resource.h"
 
-#include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
 struct Key {
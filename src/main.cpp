@@ -1,7 +1,74 @@
 #include "voxel-app.h"
 
-int main() {
-    VoxelApp app;
+int main(int argc, char **argv) {
+    // --headless builds the octree on the null device without opening a window
+    // --build-strategy <top-down|bottom-up|bottom-up-cpu|bricked> picks the octree builder,
+    // headless runs default to the multithreaded CPU build
+    // --validate compares the octree against a reference build with a different strategy,
+    // the CPU build for the compute ones and the top-down build for the CPU ones (headless only),
+    // skipped for an octree loaded with --octree
+    // --voxelizer <raster|raster-single-pass|compute> voxelizes the scene with the geometry shader,
+    // without its counting pass, or in compute
+    // --no-octree-cache always rebuilds the octree instead of loading it from cache/
+    // --resolution <n> voxels per axis, a power of two up to 16384
+    // --octree <file.svo> loads a cached octree instead of building the terrain (headless only)
+    // --benchmark <file.json> measures the octree traversal and writes the results as JSON,
+    // headless runs only benchmark the CPU traversal
+    // --thumbnail <file.png> renders the octree on the CPU and writes it as a png (headless only)
+    VoxelAppOptions options;
+    bool hasBuildStrategy = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--headless") == 0)
+            options.headless = true;
+        else if (std::strcmp(argv[i], "--validate") == 0)
+            options.validateOctree = true;
+        else if (std::strcmp(argv[i], "--no-octree-cache") == 0)
+            options.useOctreeCache = false;
+        else if (std::strcmp(argv[i], "--voxelizer") == 0 && i + 1 < argc) {
+            const char *method = argv[++i];
+            if (std::strcmp(method, "compute") == 0)
+                options.voxelizationMethod = SceneVoxelizer::VOXELIZATION_METHOD_COMPUTE;
+            else if (std::strcmp(method, "raster-single-pass") == 0)
+                options.voxelizationMethod = SceneVoxelizer::VOXELIZATION_METHOD_RASTER_SINGLE_PASS;
+            else if (std::strcmp(method, "raster") == 0)
+                options.voxelizationMethod = SceneVoxelizer::VOXELIZATION_METHOD_RASTER;
+            else
+                std::cout << "Ignoring --voxelizer " << method << ", expected raster, raster-single-pass or compute" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--octree") == 0 && i + 1 < argc)
+            options.octreeFile = argv[++i];
+        else if (std::strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+            options.benchmarkOutput = argv[++i];
+        else if (std::strcmp(argv[i], "--thumbnail") == 0 && i + 1 < argc)
+            options.thumbnailOutput = argv[++i];
+        else if (std::strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+            uint32_t resolution = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            if (resolution > 1 && (resolution & (resolution - 1)) == 0 && resolution <= (1u << MAX_VOXEL_RESOLUTION_LOG2))
+                options.resolution = resolution;
+            else
+                std::cout << "Ignoring --resolution " << argv[i] << ", expected a power of two up to " << (1u << MAX_VOXEL_RESOLUTION_LOG2) << std::endl;
+        } else if (std::strcmp(argv[i], "--build-strategy") == 0 && i + 1 < argc) {
+            const char *strategy = argv[++i];
+            if (std::strcmp(strategy, "bottom-up") == 0)
+                options.buildStrategy = OctreeBuilder::BUILD_STRATEGY_BOTTOM_UP;
+            else if (std::strcmp(strategy, "bottom-up-cpu") == 0)
+                options.buildStrategy = OctreeBuilder::BUILD_STRATEGY_BOTTOM_UP_CPU;
+            else if (std::strcmp(strategy, "bricked") == 0)
+                options.buildStrategy = OctreeBuilder::BUILD_STRATEGY_BRICKED_CPU;
+            else if (std::strcmp(strategy, "top-down") == 0)
+                options.buildStrategy = OctreeBuilder::BUILD_STRATEGY_TOP_DOWN;
+            else {
+                std::cout << "Ignoring --build-strategy " << strategy << ", expected top-down, bottom-up, bottom-up-cpu or bricked" << std::endl;
+                continue;
+            }
+            hasBuildStrategy = true;
+        }
+    }
+
+    if (options.headless && !hasBuildStrategy)
+        options.buildStrategy = OctreeBuilder::BUILD_STRATEGY_BOTTOM_UP_CPU;
+
+    VoxelApp app(options);
     app.Run();
     return 0;
 }
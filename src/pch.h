@@ -24,12 +24,16 @@
 #include <mutex>
 #include <thread>
 #include <filesystem>
+#include <cstring>
+#include <functional>
 
 #ifdef _WIN32
 #define PLATFORM_WINDOWS
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#elif defined(__linux__)
+#define PLATFORM_LINUX
 #else
 #error "Unsupported platform"
 #endif
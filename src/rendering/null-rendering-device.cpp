@@ -0,0 +1,310 @@
+#include "pch.h"
+#include "null-rendering-device.h"
+
+void NullRenderingDevice::Initialize(void *platformData) {
+    cpuDevice.name = "Null Device";
+    cpuDevice.vendor = 0;
+    cpuDevice.deviceType = DeviceType::DEVICE_TYPE_CPU;
+
+    _shaders.Initialize(64, "Shaders");
+    _pipeline.Initialize(64, "Pipeline");
+    _textures.Initialize(128, "Textures");
+    _buffers.Initialize(64, "Buffers");
+    _uniformSets.Initialize(256, "UniformSets");
+    _commandPools.Initialize(16, "CommandPools");
+    _fences.Initialize(16, "Fences");
+    _queryPools.Initialize(4, "QueryPools");
+
+    transientAllocator.Initialize(this, 1024 * 1024, 16);
+
+    frameCommandPool = CreateCommandPool(GetDeviceQueue(QUEUE_TYPE_GRAPHICS), "FrameCommandPool");
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        frames[i].commandBuffer = CreateCommandBuffer(frameCommandPool, "FrameCommandBuffer" + std::to_string(i));
+
+    LOG("Initialized headless null rendering device");
+}
+
+QueueID NullRenderingDevice::GetDeviceQueue(QueueType queueType) {
+    // Every queue is the calling thread
+    return QueueID{uint64_t(0)};
+}
+
+ShaderID NullRenderingDevice::CreateShader(const uint32_t *byteCode, uint32_t codeSizeInBytes, ShaderDescription *desc, const std::string &name) {
+    uint64_t shaderID = _shaders.Obtain();
+    NullShader *shader = _shaders.Access(shaderID);
+    // assets/SPIRV/octree-tag-node.comp.spv -> octree-tag-node.comp
+    shader->name = std::filesystem::path(name).stem().string();
+    shader->stage = desc->stage;
+    return ShaderID{shaderID};
+}
+
+PipelineID NullRenderingDevice::CreateGraphicsPipeline(const ShaderID *shaders,
+                                                       uint32_t shaderCount,
+                                                       Topology topology,
+                                                       const RasterizationState *rs,
+                                                       const DepthState *ds,
+                                                       const Format *colorAttachmentsFormat,
+                                                       const BlendState *attachmentBlendStates,
+                                                       uint32_t colorAttachmentCount,
+                                                       Format depthAttachmentFormat,
+                                                       bool enableBindless,
+                                                       const std::string &name) {
+    uint64_t pipelineID = _pipeline.Obtain();
+    NullPipeline *pipeline = _pipeline.Access(pipelineID);
+    pipeline->name = name;
+    pipeline->shaderName.clear();
+    return PipelineID{pipelineID};
+}
+
+PipelineID NullRenderingDevice::CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name,
+                                                     const SpecializationConstant *specializationConstants, uint32_t specializationConstantCount) {
+    NullShader *nullShader = _shaders.Access(shader.id);
+
+    uint64_t pipelineID = _pipeline.Obtain();
+    NullPipeline *pipeline = _pipeline.Access(pipelineID);
+    pipeline->name = name;
+    pipeline->shaderName = nullShader->name;
+
+    if (kernels.find(pipeline->shaderName) == kernels.end())
+        LOGW("No compute kernel registered for " + pipeline->shaderName + ", dispatches of " + name + " will be skipped");
+
+    return PipelineID{pipelineID};
+}
+
+void NullRenderingDevice::CreateComputePipelines(const ComputePipelineDescription *descriptions, uint32_t count, PipelineID *pipelines) {
+    // Nothing is compiled, the kernel lookup is cheap enough to stay serial
+    for (uint32_t i = 0; i < count; ++i) {
+        const ComputePipelineDescription &description = descriptions[i];
+        pipelines[i] = CreateComputePipeline(description.shader, description.enableBindless, description.name,
+                                             description.specializationConstants, description.specializationConstantCount);
+    }
+}
+
+TextureID NullRenderingDevice::CreateTexture(TextureDescription *description, const std::string &name) {
+    uint64_t textureID = _textures.Obtain();
+    TextureDescription *texture = _textures.Access(textureID);
+    *texture = *description;
+    texture->samplerDescription = nullptr;
+    return TextureID{textureID};
+}
+
+CommandPoolID NullRenderingDevice::CreateCommandPool(QueueID queue, const std::string &name) {
+    return CommandPoolID{_commandPools.Obtain()};
+}
+
+CommandBufferID NullRenderingDevice::CreateCommandBuffer(CommandPoolID commandPool, const std::string &name) {
+    _commandBuffers.emplace_back(NullCommandBuffer{});
+    return CommandBufferID(_commandBuffers.size() - 1);
+}
+
+UniformSetID NullRenderingDevice::CreateUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set, const std::string &name) {
+    assert(set < MAX_SET_COUNT);
+    uint64_t uniformSetID = _uniformSets.Obtain();
+    NullUniformSet *uniformSet = _uniformSets.Access(uniformSetID);
+    uniformSet->set = set;
+    uniformSet->uniforms.assign(uniforms, uniforms + uniformCount);
+    uniformSet->transient = false;
+    return UniformSetID{uniformSetID};
+}
+
+UniformSetID NullRenderingDevice::CreateTransientUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set) {
+    UniformSetID uniformSet = CreateUniformSet(pipeline, uniforms, uniformCount, set, "");
+    _uniformSets.Access(uniformSet.id)->transient = true;
+    frames[frameIndex].transientUniformSets.push_back(uniformSet.id);
+    return uniformSet;
+}
+
+void NullRenderingDevice::BeginFrame() {
+    NullFrame &frame = frames[frameIndex];
+    transientAllocator.Reset(frameIndex);
+    for (uint64_t uniformSetID : frame.transientUniformSets) {
+        _uniformSets.Access(uniformSetID)->uniforms.clear();
+        _uniformSets.Release(uniformSetID);
+    }
+    frame.transientUniformSets.clear();
+
+    // The sets bound last time this slot was recorded may have just been released
+    NullCommandBuffer &cb = _commandBuffers[frame.commandBuffer.id];
+    cb.setBound.fill(false);
+    for (auto &offsets : cb.dynamicOffsets)
+        offsets.clear();
+}
+
+void NullRenderingDevice::Present() {
+    frameIndex = (frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+FenceID NullRenderingDevice::CreateFence(const std::string &name, bool signalled) {
+    return FenceID{_fences.Obtain()};
+}
+
+QueryPoolID NullRenderingDevice::CreateTimestampQueryPool(uint32_t queryCount, const std::string &name) {
+    uint64_t queryPoolID = _queryPools.Obtain();
+    _queryPools.Access(queryPoolID)->assign(queryCount, 0);
+    return QueryPoolID{queryPoolID};
+}
+
+void NullRenderingDevice::ResetQueryPool(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount) {
+    std::vector<uint64_t> *queries = _queryPools.Access(queryPool.id);
+    std::fill(queries->begin() + firstQuery, queries->begin() + firstQuery + queryCount, 0);
+}
+
+void NullRenderingDevice::WriteTimestamp(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t query) {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    (*_queryPools.Access(queryPool.id))[query] = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+void NullRenderingDevice::GetQueryResults(QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount, uint64_t *results) {
+    std::vector<uint64_t> *queries = _queryPools.Access(queryPool.id);
+    std::copy(queries->begin() + firstQuery, queries->begin() + firstQuery + queryCount, results);
+}
+
+BufferID NullRenderingDevice::CreateBuffer(uint64_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) {
+    assert(size > 0);
+    uint64_t bufferID = _buffers.Obtain();
+    NullBuffer *buffer = _buffers.Access(bufferID);
+    buffer->data.assign(static_cast<size_t>(size), 0);
+
+    memoryUsage += size;
+    return BufferID(bufferID);
+}
+
+uint8_t *NullRenderingDevice::MapBuffer(BufferID buffer) {
+    return _buffers.Access(buffer.id)->data.data();
+}
+
+void NullRenderingDevice::CopyBuffer(CommandBufferID commandBuffer, BufferID src, BufferID dst, BufferCopyRegion *region) {
+    NullBuffer *srcBuffer = _buffers.Access(src.id);
+    NullBuffer *dstBuffer = _buffers.Access(dst.id);
+    assert(region->srcOffset + region->size <= srcBuffer->data.size());
+    assert(region->dstOffset + region->size <= dstBuffer->data.size());
+    std::memcpy(dstBuffer->data.data() + region->dstOffset, srcBuffer->data.data() + region->srcOffset, region->size);
+}
+
+void NullRenderingDevice::BindPipeline(CommandBufferID commandBuffer, PipelineID pipeline) {
+    _commandBuffers[commandBuffer.id].pipeline = pipeline;
+}
+
+void NullRenderingDevice::BindPushConstants(CommandBufferID commandBuffer, PipelineID pipeline, ShaderStage shaderStage, void *data, uint32_t offset, uint32_t size) {
+    assert(offset + size <= MAX_PUSH_CONSTANT_SIZE);
+    std::memcpy(_commandBuffers[commandBuffer.id].pushConstants.data() + offset, data, size);
+}
+
+void NullRenderingDevice::BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount, const uint32_t *dynamicOffsets, uint32_t dynamicOffsetCount) {
+    assert(dynamicOffsetCount == 0 || uniformSetCount == 1);
+    NullCommandBuffer &cb = _commandBuffers[commandBuffer.id];
+    for (uint32_t i = 0; i < uniformSetCount; ++i) {
+        uint32_t set = _uniformSets.Access(uniformSet[i].id)->set;
+        cb.sets[set] = uniformSet[i];
+        cb.setBound[set] = true;
+        cb.dynamicOffsets[set].assign(dynamicOffsets, dynamicOffsets + dynamicOffsetCount);
+    }
+}
+
+void NullRenderingDevice::DispatchCompute(CommandBufferID commandBuffer, uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ) {
+    NullCommandBuffer &cb = _commandBuffers[commandBuffer.id];
+    NullPipeline *pipeline = _pipeline.Access(cb.pipeline.id);
+
+    auto found = kernels.find(pipeline->shaderName);
+    if (found == kernels.end())
+        return;
+
+    ComputeContext context = {};
+    context.workGroupCount[0] = workGroupX;
+    context.workGroupCount[1] = workGroupY;
+    context.workGroupCount[2] = workGroupZ;
+    context.pushConstants = cb.pushConstants.data();
+
+    for (uint32_t set = 0; set < MAX_SET_COUNT; ++set) {
+        if (!cb.setBound[set])
+            continue;
+
+        NullUniformSet *uniformSet = _uniformSets.Access(cb.sets[set].id);
+        for (auto &uniform : uniformSet->uniforms) {
+            if (uniform.bindingType != BINDING_TYPE_STORAGE_BUFFER && uniform.bindingType != BINDING_TYPE_UNIFORM_BUFFER && uniform.bindingType != BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC)
+                continue;
+            assert(uniform.binding < MAX_BINDING_COUNT);
+            NullBuffer *buffer = _buffers.Access(uniform.resourceID.id);
+            uint64_t offset = uniform.offset;
+            if (uniform.bindingType == BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC) {
+                // Dynamic offsets are in binding order
+                uint32_t dynamicIndex = 0;
+                for (auto &other : uniformSet->uniforms) {
+                    if (other.bindingType == BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC && other.binding < uniform.binding)
+                        dynamicIndex++;
+                }
+                assert(dynamicIndex < cb.dynamicOffsets[set].size());
+                offset += cb.dynamicOffsets[set][dynamicIndex];
+            }
+            context.buffers[set][uniform.binding] = buffer->data.data() + offset;
+        }
+    }
+
+    found->second(context);
+}
+
+void NullRenderingDevice::DispatchComputeIndirect(CommandBufferID commandBuffer, BufferID indirectBuffer, uint32_t offset) {
+    // Previous commands have already executed, so the arguments can be read back directly
+    const uint32_t *args = reinterpret_cast<const uint32_t *>(_buffers.Access(indirectBuffer.id)->data.data() + offset);
+    DispatchCompute(commandBuffer, args[0], args[1], args[2]);
+}
+
+void NullRenderingDevice::ImmediateSubmit(std::function<void(CommandBufferID commandBuffer)> &&function, ImmediateSubmitInfo *queueInfo) {
+    function(queueInfo->commandBuffer);
+}
+
+void NullRenderingDevice::Destroy(PipelineID pipeline) {
+    _pipeline.Release(pipeline.id);
+}
+
+void NullRenderingDevice::Destroy(ShaderID shaderModule) {
+    _shaders.Release(shaderModule.id);
+}
+
+void NullRenderingDevice::Destroy(CommandPoolID commandPool) {
+    _commandPools.Release(commandPool.id);
+}
+
+void NullRenderingDevice::Destroy(TextureID texture) {
+    _textures.Release(texture.id);
+}
+
+void NullRenderingDevice::Destroy(UniformSetID uniformSet) {
+    if (_uniformSets.Access(uniformSet.id)->transient)
+        return;
+    _uniformSets.Access(uniformSet.id)->uniforms.clear();
+    _uniformSets.Release(uniformSet.id);
+}
+
+void NullRenderingDevice::Destroy(BufferID buffer) {
+    NullBuffer *nullBuffer = _buffers.Access(buffer.id);
+    memoryUsage -= nullBuffer->data.size();
+    nullBuffer->data = std::vector<uint8_t>();
+    _buffers.Release(buffer.id);
+}
+
+void NullRenderingDevice::Destroy(FenceID fence) {
+    _fences.Release(fence.id);
+}
+
+void NullRenderingDevice::Destroy(QueryPoolID queryPool) {
+    *_queryPools.Access(queryPool.id) = std::vector<uint64_t>();
+    _queryPools.Release(queryPool.id);
+}
+
+void NullRenderingDevice::Shutdown() {
+    transientAllocator.Shutdown(this);
+    _shaders.Shutdown();
+    _pipeline.Shutdown();
+    _textures.Shutdown();
+    _buffers.Shutdown();
+    for (auto &frame : frames)
+        frame.transientUniformSets.clear();
+    _uniformSets.Shutdown();
+    Destroy(frameCommandPool);
+    _commandPools.Shutdown();
+    _fences.Shutdown();
+    _queryPools.Shutdown();
+    _commandBuffers.clear();
+    kernels.clear();
+}
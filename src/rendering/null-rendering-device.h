@@ -0,0 +1,237 @@
+#pragma once
+
+#include "rendering-device.h"
+
+#include "core/resource-pool.h"
+#include "transient-allocator.h"
+
+#include <vector>
+#include <array>
+#include <unordered_map>
+
+// Headless backend that keeps every resource in host memory. Commands are
+// executed as soon as they are recorded, compute dispatches are forwarded to
+// C++ kernels registered against the shader they replace and everything that
+// needs a real GPU (rasterization, swapchain, present) is a no-op.
+class NullRenderingDevice : public RenderingDevice {
+
+  public:
+    static const uint32_t MAX_SET_COUNT = 4;
+    static const uint32_t MAX_BINDING_COUNT = 16;
+    static const uint32_t MAX_PUSH_CONSTANT_SIZE = 128;
+
+    struct ComputeContext {
+        uint32_t workGroupCount[3];
+        uint8_t *pushConstants;
+
+        // Returns the host memory of the buffer bound at (set, binding)
+        template <typename T>
+        T *GetBuffer(uint32_t set, uint32_t binding) const {
+            return reinterpret_cast<T *>(buffers[set][binding]);
+        }
+
+        template <typename T>
+        const T &GetPushConstants() const {
+            return *reinterpret_cast<const T *>(pushConstants);
+        }
+
+        std::array<std::array<uint8_t *, MAX_BINDING_COUNT>, MAX_SET_COUNT> buffers;
+    };
+
+    // A kernel runs the whole dispatch, it is expected to loop over
+    // workGroupCount * local_size of the shader it replaces
+    using ComputeKernel = std::function<void(const ComputeContext &context)>;
+
+    // Kernels are looked up by shader name, ie. "octree-tag-node.comp"
+    // for assets/SPIRV/octree-tag-node.comp.spv
+    void RegisterComputeKernel(const std::string &shaderName, ComputeKernel &&kernel) {
+        kernels[shaderName] = std::move(kernel);
+    }
+
+    void Initialize(void *platformData) override;
+
+    void Shutdown() override;
+
+    inline void SetValidationMode(bool state) override {}
+
+    uint64_t GetMemoryUsage() override {
+        return memoryUsage;
+    }
+
+    QueueID GetDeviceQueue(QueueType queueType) override;
+
+    void CreateSurface() override {}
+    void CreateSwapchain(bool vsync = true) override {}
+
+    PipelineID CreateGraphicsPipeline(const ShaderID *shaders,
+                                      uint32_t shaderCount,
+                                      Topology topology,
+                                      const RasterizationState *rs,
+                                      const DepthState *ds,
+                                      const Format *colorAttachmentsFormat,
+                                      const BlendState *attachmentBlendStates,
+                                      uint32_t colorAttachmentCount,
+                                      Format depthAttachmentFormat,
+                                      bool enableBindless,
+                                      const std::string &name) override;
+    PipelineID CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name,
+                                     const SpecializationConstant *specializationConstants, uint32_t specializationConstantCount) override;
+    void CreateComputePipelines(const ComputePipelineDescription *descriptions, uint32_t count, PipelineID *pipelines) override;
+    TextureID CreateTexture(TextureDescription *description, const std::string &name) override;
+    ShaderID CreateShader(const uint32_t *byteCode, uint32_t codeSizeInBytes, ShaderDescription *desc, const std::string &name) override;
+    CommandBufferID CreateCommandBuffer(CommandPoolID commandPool, const std::string &name) override;
+    CommandPoolID CreateCommandPool(QueueID queue, const std::string &name = "CommandPool") override;
+    void ResetCommandPool(CommandPoolID commandPool) override {}
+    UniformSetID CreateUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set, const std::string &name) override;
+    UniformSetID CreateTransientUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set) override;
+
+    FenceID CreateFence(const std::string &name = "fence", bool signalled = false) override;
+    void WaitForFence(FenceID *fence, uint32_t fenceCount, uint64_t timeout) override {}
+    void ResetFences(FenceID *fences, uint32_t fenceCount) override {}
+    bool IsFenceSignalled(FenceID fence) override { return true; }
+
+    // Commands run when they are recorded, the timestamps are host nanoseconds
+    QueryPoolID CreateTimestampQueryPool(uint32_t queryCount, const std::string &name = "queryPool") override;
+    void ResetQueryPool(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount) override;
+    void WriteTimestamp(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t query) override;
+    void GetQueryResults(QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount, uint64_t *results) override;
+    float GetTimestampPeriod() override { return 1.0f; }
+
+    BufferID CreateBuffer(uint64_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) override;
+    uint8_t *MapBuffer(BufferID buffer) override;
+
+    TransientAllocation AllocateTransient(uint32_t size) override {
+        return transientAllocator.Allocate(size);
+    }
+
+    BufferID GetTransientBuffer() override {
+        return transientAllocator.buffer;
+    }
+
+    void CopyBuffer(CommandBufferID commandBuffer, BufferID src, BufferID dst, BufferCopyRegion *region) override;
+    void CopyBufferToTexture(CommandBufferID commandBuffer, BufferID src, TextureID dst, BufferImageCopyRegion *region) override {}
+
+    void SetViewport(CommandBufferID commandBuffer, float offsetX, float offsetY, float width, float height) override {}
+    void SetScissor(CommandBufferID commandBuffer, int offsetX, int offsetY, uint32_t width, uint32_t height) override {}
+
+    void BindIndexBuffer(CommandBufferID commandBuffer, BufferID buffer) override {}
+    void BindPipeline(CommandBufferID commandBuffer, PipelineID pipeline) override;
+    void BindPushConstants(CommandBufferID commandBuffer, PipelineID pipeline, ShaderStage shaderStage, void *data, uint32_t offset, uint32_t size) override;
+    void BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount, const uint32_t *dynamicOffsets = nullptr, uint32_t dynamicOffsetCount = 0) override;
+
+    void DispatchCompute(CommandBufferID commandBuffer, uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ = 1) override;
+    void DispatchComputeIndirect(CommandBufferID commandBuffer, BufferID indirectBuffer, uint32_t offset) override;
+
+    void Submit(CommandBufferID commandBuffer, FenceID fence) override {}
+    // Commands run as they are recorded, the upload is already done
+    uint64_t SubmitUpload(CommandBufferID commandBuffer, QueueID queue) override { return ++uploadValue; }
+    uint64_t GetCompletedUploadValue() override { return uploadValue; }
+    void WaitForUpload(uint64_t value) override {}
+    void ImmediateSubmit(std::function<void(CommandBufferID commandBuffer)> &&function, ImmediateSubmitInfo *queueInfo) override;
+
+    void PipelineBarrier(CommandBufferID commandBuffer,
+                         BitField<PipelineStageBits> srcStage,
+                         BitField<PipelineStageBits> dstStage,
+                         TextureBarrier *textureBarriers,
+                         uint32_t textureBarrierCount,
+                         BufferBarrier *bufferBarriers,
+                         uint32_t bufferBarrierCount) override {}
+
+    void PrepareSwapchain(CommandBufferID commandBuffer, TextureLayout layout) override {}
+    void CopyToSwapchain(CommandBufferID commandBuffer, TextureID texture) override {}
+
+    // Everything recorded so far has executed
+    void BeginFrame() override;
+    uint32_t GetFrameIndex() override { return frameIndex; }
+    CommandBufferID GetFrameCommandBuffer() override { return frames[frameIndex].commandBuffer; }
+    void WaitIdle() override {}
+    void BeginCommandBuffer(CommandBufferID commandBuffer) override {}
+    void EndCommandBuffer(CommandBufferID commandBuffer) override {}
+
+    void BeginRenderPass(CommandBufferID commandBuffer, RenderingInfo *renderingInfo) override {}
+    void EndRenderPass(CommandBufferID commandBuffer) override {}
+
+    void DrawElementInstanced(CommandBufferID commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex = 0, uint32_t vertexOffset = 0, uint32_t firstInstance = 0) override {}
+    void Draw(CommandBufferID commandBuffer, uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) override {}
+    void DrawIndexedIndirect(CommandBufferID commandBuffer, BufferID indirectBuffer, uint32_t offset, uint32_t drawCount, uint32_t stride) override {}
+
+    void Present() override;
+
+    void UpdateBindlessDescriptor(TextureID *bindlessTexture, uint32_t count) override {}
+    void UpdateBindlessTexture(TextureID texture) override {}
+    uint32_t GetBindlessTextureCount() override { return UINT32_MAX; }
+    void GenerateMipmap(CommandBufferID commandBuffer, TextureID texture) override {}
+
+    void Destroy(PipelineID pipeline) override;
+    void Destroy(ShaderID shaderModule) override;
+    void Destroy(CommandPoolID commandPool) override;
+    void Destroy(TextureID texture) override;
+    void Destroy(UniformSetID uniformSet) override;
+    void Destroy(BufferID buffer) override;
+    void Destroy(FenceID fence) override;
+    void Destroy(QueryPoolID queryPool) override;
+
+    uint32_t GetDeviceCount() override {
+        return 1;
+    }
+
+    Device *GetDevice(int index) override {
+        return &cpuDevice;
+    }
+
+  private:
+    struct NullShader {
+        std::string name;
+        ShaderStage stage;
+    };
+
+    struct NullPipeline {
+        std::string name;
+        std::string shaderName;
+    };
+
+    struct NullBuffer {
+        std::vector<uint8_t> data;
+    };
+
+    struct NullUniformSet {
+        uint32_t set;
+        std::vector<BoundUniform> uniforms;
+        bool transient = false;
+    };
+
+    struct NullCommandBuffer {
+        PipelineID pipeline;
+        std::array<UniformSetID, MAX_SET_COUNT> sets;
+        std::array<bool, MAX_SET_COUNT> setBound;
+        std::array<uint8_t, MAX_PUSH_CONSTANT_SIZE> pushConstants;
+        std::array<std::vector<uint32_t>, MAX_SET_COUNT> dynamicOffsets;
+    };
+
+    struct NullFrame {
+        CommandBufferID commandBuffer;
+        // Released when the slot is recorded again
+        std::vector<uint64_t> transientUniformSets;
+    };
+
+    ResourcePool<NullShader> _shaders;
+    ResourcePool<NullPipeline> _pipeline;
+    ResourcePool<TextureDescription> _textures;
+    ResourcePool<NullUniformSet> _uniformSets;
+    ResourcePool<NullBuffer> _buffers;
+    ResourcePool<uint32_t> _commandPools;
+    ResourcePool<uint32_t> _fences;
+    ResourcePool<std::vector<uint64_t>> _queryPools;
+    std::vector<NullCommandBuffer> _commandBuffers;
+
+    std::unordered_map<std::string, ComputeKernel> kernels;
+
+    TransientAllocator transientAllocator;
+    CommandPoolID frameCommandPool;
+    std::array<NullFrame, MAX_FRAMES_IN_FLIGHT> frames;
+    uint32_t frameIndex = 0;
+
+    Device cpuDevice;
+    uint64_t memoryUsage = 0;
+    uint64_t uploadValue = 0;
+};
@@ -37,6 +37,7 @@ DEFINE_ID(UniformSet)
 DEFINE_ID(Buffer)
 DEFINE_ID(Queue)
 DEFINE_ID(Fence)
+DEFINE_ID(QueryPool)
 
 constexpr const uint64_t INVALID_ID = UINT64_MAX;
 constexpr const uint32_t INVALID_TEXTURE_ID = UINT32_MAX;
@@ -72,6 +73,9 @@ class RenderingDevice {
         BINDING_TYPE_IMAGE,
         BINDING_TYPE_STORAGE_BUFFER,
         BINDING_TYPE_UNIFORM_BUFFER,
+        // Bound with an offset given to BindUniformSet, for the transient
+        // allocations that move every frame
+        BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC,
         BINDING_TYPE_MAX
     };
 
@@ -81,6 +85,8 @@ class RenderingDevice {
         uint32_t binding;
     };
 
+    // For BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC the dynamic offset is added to
+    // offset and range must be given
     struct BoundUniform {
         BindingType bindingType;
         uint32_t binding;
@@ -89,11 +95,31 @@ class RenderingDevice {
         uint64_t range = UINT64_MAX;
     };
 
+    struct TransientAllocation {
+        BufferID buffer;
+        uint32_t offset;
+        uint8_t *data;
+    };
+
     struct PushConstant {
         uint32_t offset;
         uint32_t size;
     };
 
+    // 32 bit specialization constant, matches layout(constant_id = id)
+    struct SpecializationConstant {
+        uint32_t id;
+        uint32_t value;
+    };
+
+    struct ComputePipelineDescription {
+        ShaderID shader;
+        bool enableBindless = false;
+        std::string name;
+        const SpecializationConstant *specializationConstants = nullptr;
+        uint32_t specializationConstantCount = 0;
+    };
+
     struct ImmediateSubmitInfo {
         QueueID queue;
         CommandPoolID commandPool;
@@ -336,6 +362,9 @@ class RenderingDevice {
 
     struct BufferImageCopyRegion {
         uint64_t bufferOffset;
+        // Rows of the first mip level of a 2D texture, a zero count copies the whole level
+        uint32_t rowOffset;
+        uint32_t rowCount;
     };
 
 #define QUEUE_FAMILY_IGNORED QueueID(UINT32_MAX)
@@ -460,6 +489,11 @@ class RenderingDevice {
         void *windowPtr;
     };
 
+    // Frames the CPU records ahead of the GPU. BeginFrame waits until the GPU
+    // is done with the last frame that used the same slot, so everything
+    // written by the CPU every frame needs a copy per slot
+    static const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+
     virtual void Initialize(void *platformData) = 0;
 
     virtual void SetValidationMode(bool state) = 0;
@@ -481,20 +515,44 @@ class RenderingDevice {
                                               Format depthAttachmentFormat,
                                               bool enableBindless,
                                               const std::string &name) = 0;
-    virtual PipelineID CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name) = 0;
+    virtual PipelineID CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name,
+                                             const SpecializationConstant *specializationConstants = nullptr, uint32_t specializationConstantCount = 0) = 0;
+    // Compiles the pipelines in parallel, pipelines[i] is created from descriptions[i]
+    virtual void CreateComputePipelines(const ComputePipelineDescription *descriptions, uint32_t count, PipelineID *pipelines) = 0;
     virtual TextureID CreateTexture(TextureDescription *description, const std::string &name) = 0;
     virtual ShaderID CreateShader(const uint32_t *byteCode, uint32_t codeSizeInBytes, ShaderDescription *desc, const std::string &name = "shader") = 0;
     virtual CommandBufferID CreateCommandBuffer(CommandPoolID commandPool, const std::string &name = "commandBuffer") = 0;
     virtual CommandPoolID CreateCommandPool(QueueID queue, const std::string &name = "commandPool") = 0;
     virtual void ResetCommandPool(CommandPoolID commandPool) = 0;
+    // Sets created with the same bindings are shared, every CreateUniformSet
+    // still needs its own Destroy
     virtual UniformSetID CreateUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set, const std::string &name) = 0;
+    // Lives until the frame slot is recorded again and is never destroyed,
+    // for work that is waited for before the frame ends
+    virtual UniformSetID CreateTransientUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set) = 0;
 
     virtual FenceID CreateFence(const std::string &name = "fence", bool signalled = false) = 0;
     virtual void WaitForFence(FenceID *fence, uint32_t fenceCount, uint64_t timeout) = 0;
     virtual void ResetFences(FenceID *fences, uint32_t fenceCount) = 0;
-
-    virtual BufferID CreateBuffer(uint32_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) = 0;
+    virtual bool IsFenceSignalled(FenceID fence) = 0;
+
+    // Timestamps are in ticks, GetTimestampPeriod is the nanoseconds per tick
+    // and zero when the device can't write timestamps on its queues
+    virtual QueryPoolID CreateTimestampQueryPool(uint32_t queryCount, const std::string &name = "queryPool") = 0;
+    virtual void ResetQueryPool(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount) = 0;
+    // Written once every command recorded before it has completed
+    virtual void WriteTimestamp(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t query) = 0;
+    // Waits for the queries to be available
+    virtual void GetQueryResults(QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount, uint64_t *results) = 0;
+    virtual float GetTimestampPeriod() = 0;
+
+    virtual BufferID CreateBuffer(uint64_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) = 0;
     virtual uint8_t *MapBuffer(BufferID buffer) = 0;
+    // Mapped memory that lives until the frame slot is recorded again, for
+    // the per frame uniforms and uploads. Every allocation is in the buffer
+    // returned by GetTransientBuffer, data is null when the frame ran out
+    virtual TransientAllocation AllocateTransient(uint32_t size) = 0;
+    virtual BufferID GetTransientBuffer() = 0;
     virtual void CopyBuffer(CommandBufferID commandBuffer, BufferID src, BufferID dst, BufferCopyRegion *region) = 0;
     virtual void CopyBufferToTexture(CommandBufferID commandBuffer, BufferID src, TextureID dst, BufferImageCopyRegion *region) = 0;
 
@@ -506,12 +564,20 @@ class RenderingDevice {
     virtual void BindPipeline(CommandBufferID commandBuffer, PipelineID pipeline) = 0;
     virtual void BindPushConstants(CommandBufferID commandBuffer, PipelineID pipeline, ShaderStage shaderStage, void *data, uint32_t offset, uint32_t size) = 0;
 
-    virtual void BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount) = 0;
+    // Dynamic offsets are in binding order and only for a single set
+    virtual void BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount, const uint32_t *dynamicOffsets = nullptr, uint32_t dynamicOffsetCount = 0) = 0;
     virtual void DispatchCompute(CommandBufferID commandBuffer, uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ) = 0;
     virtual void DispatchComputeIndirect(CommandBufferID commandBuffer, BufferID indirectBuffer, uint32_t offset) = 0;
 
     virtual void Submit(CommandBufferID commandBuffer, FenceID Fence) = 0;
 
+    // Submits a recorded command buffer on queue and returns the value it
+    // signals on the upload timeline. Every Submit made afterwards waits for
+    // it on the GPU, the CPU can poll or wait for it
+    virtual uint64_t SubmitUpload(CommandBufferID commandBuffer, QueueID queue) = 0;
+    virtual uint64_t GetCompletedUploadValue() = 0;
+    virtual void WaitForUpload(uint64_t value) = 0;
+
     virtual void ImmediateSubmit(std::function<void(CommandBufferID commandBuffer)> &&function, ImmediateSubmitInfo *queueInfo) = 0;
     virtual void PipelineBarrier(CommandBufferID commandBuffer,
                                  BitField<PipelineStageBits> srcStage,
@@ -526,6 +592,11 @@ class RenderingDevice {
     virtual void CopyToSwapchain(CommandBufferID commandBuffer, TextureID texture) = 0;
 
     virtual void BeginFrame() = 0;
+    // Slot of the frame being recorded, in [0, MAX_FRAMES_IN_FLIGHT)
+    virtual uint32_t GetFrameIndex() = 0;
+    // Reset by BeginFrame, submitted once per frame
+    virtual CommandBufferID GetFrameCommandBuffer() = 0;
+    virtual void WaitIdle() = 0;
     virtual void BeginCommandBuffer(CommandBufferID commandBuffer) = 0;
     virtual void EndCommandBuffer(CommandBufferID commandBuffer) = 0;
 
@@ -538,7 +609,10 @@ class RenderingDevice {
 
     virtual void Present() = 0;
 
+    // Textures are bound at their pool index, the ones at or past
+    // GetBindlessTextureCount can't be bound and are skipped
     virtual void UpdateBindlessDescriptor(TextureID *bindlessTexture, uint32_t count) = 0;
+    virtual uint32_t GetBindlessTextureCount() = 0;
     virtual void UpdateBindlessTexture(TextureID texture) = 0;
     virtual void GenerateMipmap(CommandBufferID commandBuffer, TextureID texture) = 0;
 
@@ -549,6 +623,7 @@ class RenderingDevice {
     virtual void Destroy(UniformSetID uniformSet) = 0;
     virtual void Destroy(BufferID buffer) = 0;
     virtual void Destroy(FenceID fence) = 0;
+    virtual void Destroy(QueryPoolID queryPool) = 0;
 
     virtual void Shutdown() = 0;
 
@@ -557,13 +632,11 @@ class RenderingDevice {
 
     virtual ~RenderingDevice() = default;
 
+    // Set once at startup by AppWindow, either the vulkan device or the
+    // headless null device
     static RenderingDevice *&GetInstance() {
-#ifdef VULKAN_ENABLED
         static RenderingDevice *device = nullptr;
         return device;
-#else
-#error No Supported Device Selected
-#endif
     }
 }; // namespace gfx
 
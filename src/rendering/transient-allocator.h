@@ -0,0 +1,46 @@
+#pragma once
+
+#include "rendering-device.h"
+
+// Bump allocator over a persistently mapped buffer split in one region per
+// frame in flight. A region is reset once the GPU is done with the frame
+// that last used it, so allocations live until the same slot comes back.
+struct TransientAllocator {
+
+    void Initialize(RenderingDevice *device, uint32_t frameSize, uint32_t alignment) {
+        this->frameSize = frameSize;
+        this->alignment = alignment;
+        buffer = device->CreateBuffer(frameSize * RD::MAX_FRAMES_IN_FLIGHT,
+                                      RD::BUFFER_USAGE_UNIFORM_BUFFER_BIT | RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                      RD::MEMORY_ALLOCATION_TYPE_CPU,
+                                      "Transient Buffer");
+        data = device->MapBuffer(buffer);
+        Reset(0);
+    }
+
+    void Reset(uint32_t frameIndex) {
+        head = frameIndex * frameSize;
+        end = head + frameSize;
+    }
+
+    // The allocation has no buffer and no data once the frame region is full
+    RD::TransientAllocation Allocate(uint32_t size) {
+        uint32_t offset = (head + alignment - 1) & ~(alignment - 1);
+        if (uint64_t(offset) + size > end)
+            return RD::TransientAllocation{BufferID{INVALID_ID}, 0, nullptr};
+        head = offset + size;
+        return RD::TransientAllocation{buffer, offset, data + offset};
+    }
+
+    void Shutdown(RenderingDevice *device) {
+        device->Destroy(buffer);
+    }
+
+    BufferID buffer;
+    uint8_t *data = nullptr;
+    uint32_t frameSize = 0;
+    // Power of two covering the uniform and storage buffer offset alignment
+    uint32_t alignment = 1;
+    uint32_t head = 0;
+    uint32_t end = 0;
+};
@@ -0,0 +1,214 @@
+#include "pch.h"
+#include "upload-manager.h"
+
+void UploadManager::Initialize(RD *device, uint32_t stagingSize) {
+    ASSERT(stagingSize % STAGING_ALIGNMENT == 0, "Staging size must be a multiple of the alignment");
+    this->device = device;
+    this->stagingSize = stagingSize;
+
+    transferQueue = device->GetDeviceQueue(RD::QUEUE_TYPE_TRANSFER);
+    mainQueue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+
+    stagingBuffer = device->CreateBuffer(stagingSize, RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "Upload Staging Buffer");
+    stagingBufferPtr = device->MapBuffer(stagingBuffer);
+
+    for (uint32_t i = 0; i < BATCH_COUNT; ++i) {
+        std::string suffix = " " + std::to_string(i);
+        batches[i].commandPool = device->CreateCommandPool(transferQueue, "Upload Command Pool" + suffix);
+        batches[i].commandBuffer = device->CreateCommandBuffer(batches[i].commandPool, "Upload Command Buffer" + suffix);
+    }
+}
+
+void UploadManager::UploadBuffer(BufferID buffer, const void *data, uint64_t size, uint64_t dstOffset) {
+    if (size == 0)
+        return;
+
+    std::lock_guard lock{uploadMutex};
+
+    const uint8_t *src = static_cast<const uint8_t *>(data);
+    for (uint64_t offset = 0; offset < size;) {
+        uint32_t chunkSize = static_cast<uint32_t>(std::min(size - offset, uint64_t(MaxChunkSize())));
+        uint32_t stagingOffset = AllocateStaging(chunkSize);
+        BeginBatch();
+        std::memcpy(stagingBufferPtr + stagingOffset, src + offset, chunkSize);
+
+        RD::BufferCopyRegion copyRegion{stagingOffset, dstOffset + offset, chunkSize};
+        device->CopyBuffer(batches[batchIndex].commandBuffer, stagingBuffer, buffer, &copyRegion);
+        offset += chunkSize;
+    }
+
+    // The copies of the earlier batches are on the same queue, the release
+    // in the last one covers them
+    RD::BufferBarrier release{buffer, RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT, 0, transferQueue, mainQueue, dstOffset, size};
+    device->PipelineBarrier(batches[batchIndex].commandBuffer, RD::PIPELINE_STAGE_TRANSFER_BIT, RD::PIPELINE_STAGE_ALL_COMMANDS_BIT, nullptr, 0, &release, 1);
+    recordingBufferAcquires.push_back({buffer, 0, RD::BARRIER_ACCESS_MEMORY_READ_BIT, transferQueue, mainQueue, dstOffset, size});
+}
+
+void UploadManager::UploadTexture(TextureID texture, const void *data, uint64_t size, uint32_t height) {
+    if (size == 0 || height == 0)
+        return;
+    ASSERT(size % height == 0, "Texture size must be a whole number of rows");
+
+    std::lock_guard lock{uploadMutex};
+
+    uint64_t rowSize = size / height;
+    if (rowSize > MaxChunkSize()) {
+        LOGE("Texture row is larger than an upload chunk");
+        return;
+    }
+    uint32_t rowsPerChunk = static_cast<uint32_t>(MaxChunkSize() / rowSize);
+
+    RD::TextureBarrier transferBarrier[] = {
+        RD::TextureBarrier{
+            .texture = texture,
+            .srcAccess = 0,
+            .dstAccess = RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT,
+            .newLayout = RD::TEXTURE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamily = QUEUE_FAMILY_IGNORED,
+            .dstQueueFamily = QUEUE_FAMILY_IGNORED,
+            .baseMipLevel = 0,
+            .baseArrayLayer = 0,
+            .levelCount = 1,
+            .layerCount = 1,
+        },
+        RD::TextureBarrier{
+            .texture = texture,
+            .srcAccess = RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccess = 0,
+            .newLayout = RD::TEXTURE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamily = transferQueue,
+            .dstQueueFamily = mainQueue,
+            .baseMipLevel = 0,
+            .baseArrayLayer = 0,
+            .levelCount = 1,
+            .layerCount = 1,
+        },
+    };
+
+    const uint8_t *src = static_cast<const uint8_t *>(data);
+    for (uint32_t row = 0; row < height;) {
+        uint32_t rowCount = std::min(height - row, rowsPerChunk);
+        uint32_t chunkSize = static_cast<uint32_t>(rowCount * rowSize);
+        uint32_t stagingOffset = AllocateStaging(chunkSize);
+        BeginBatch();
+        std::memcpy(stagingBufferPtr + stagingOffset, src + row * rowSize, chunkSize);
+
+        // The layout transition goes before the first copy, the later batches
+        // are submitted after it on the same queue
+        if (row == 0)
+            device->PipelineBarrier(batches[batchIndex].commandBuffer, RD::PIPELINE_STAGE_TOP_OF_PIPE_BIT, RD::PIPELINE_STAGE_TRANSFER_BIT, &transferBarrier[0], 1, nullptr, 0);
+
+        RD::BufferImageCopyRegion copyRegion = {};
+        copyRegion.bufferOffset = stagingOffset;
+        copyRegion.rowOffset = row;
+        copyRegion.rowCount = rowCount;
+        device->CopyBufferToTexture(batches[batchIndex].commandBuffer, stagingBuffer, texture, &copyRegion);
+        row += rowCount;
+    }
+
+    device->PipelineBarrier(batches[batchIndex].commandBuffer, RD::PIPELINE_STAGE_TRANSFER_BIT, RD::PIPELINE_STAGE_ALL_COMMANDS_BIT, &transferBarrier[1], 1, nullptr, 0);
+
+    // The mipmaps are generated with transfers on the graphics queue
+    RD::TextureBarrier acquire = transferBarrier[1];
+    acquire.srcAccess = 0;
+    acquire.dstAccess = RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT;
+    recordingTextureAcquires.push_back(acquire);
+}
+
+uint64_t UploadManager::Flush() {
+    std::lock_guard lock{uploadMutex};
+    return FlushBatch();
+}
+
+void UploadManager::AcquireOwnership(CommandBufferID commandBuffer) {
+    std::lock_guard lock{uploadMutex};
+    if (bufferAcquires.empty() && textureAcquires.empty())
+        return;
+
+    device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_ALL_COMMANDS_BIT, RD::PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                            textureAcquires.data(), static_cast<uint32_t>(textureAcquires.size()),
+                            bufferAcquires.data(), static_cast<uint32_t>(bufferAcquires.size()));
+    bufferAcquires.clear();
+    textureAcquires.clear();
+}
+
+void UploadManager::Shutdown() {
+    std::lock_guard lock{uploadMutex};
+    device->WaitForUpload(FlushBatch());
+
+    for (Batch &batch : batches)
+        device->Destroy(batch.commandPool);
+    device->Destroy(stagingBuffer);
+}
+
+uint32_t UploadManager::AllocateStaging(uint32_t size) {
+    ASSERT(size <= stagingSize, "Upload is larger than the staging buffer");
+    for (;;) {
+        // Everything retired, start over at the beginning of the ring
+        if (!recording && inFlight.empty())
+            stagingHead = stagingTail = 0;
+
+        uint64_t start = (stagingHead + STAGING_ALIGNMENT - 1) & ~uint64_t(STAGING_ALIGNMENT - 1);
+        // Allocations don't wrap around the end of the ring
+        if (start % stagingSize + size > stagingSize)
+            start += stagingSize - start % stagingSize;
+
+        if (start + size - stagingTail <= stagingSize) {
+            stagingHead = start + size;
+            return static_cast<uint32_t>(start % stagingSize);
+        }
+
+        // The ring is full, submit the pending copies and wait for the oldest batch
+        FlushBatch();
+        WaitOldestBatch();
+    }
+}
+
+void UploadManager::BeginBatch() {
+    if (recording)
+        return;
+
+    // Batches are submitted and retired in order, the next one is only in
+    // flight when all of them are
+    while (inFlight.size() == BATCH_COUNT)
+        WaitOldestBatch();
+
+    Batch &batch = batches[batchIndex];
+    device->ResetCommandPool(batch.commandPool);
+    device->BeginCommandBuffer(batch.commandBuffer);
+    recording = true;
+}
+
+uint64_t UploadManager::FlushBatch() {
+    if (!recording)
+        return lastValue;
+
+    Batch &batch = batches[batchIndex];
+    device->EndCommandBuffer(batch.commandBuffer);
+    batch.value = device->SubmitUpload(batch.commandBuffer, transferQueue);
+    batch.stagingEnd = stagingHead;
+    inFlight.push_back(batchIndex);
+
+    bufferAcquires.insert(bufferAcquires.end(), recordingBufferAcquires.begin(), recordingBufferAcquires.end());
+    textureAcquires.insert(textureAcquires.end(), recordingTextureAcquires.begin(), recordingTextureAcquires.end());
+    recordingBufferAcquires.clear();
+    recordingTextureAcquires.clear();
+
+    batchIndex = (batchIndex + 1) % BATCH_COUNT;
+    recording = false;
+    lastValue = batch.value;
+    return lastValue;
+}
+
+void UploadManager::WaitOldestBatch() {
+    if (inFlight.empty())
+        return;
+
+    device->WaitForUpload(batches[inFlight.front()].value);
+
+    uint64_t completedValue = device->GetCompletedUploadValue();
+    while (!inFlight.empty() && batches[inFlight.front()].value <= completedValue) {
+        stagingTail = batches[inFlight.front()].stagingEnd;
+        inFlight.pop_front();
+    }
+}
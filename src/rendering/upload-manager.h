@@ -0,0 +1,92 @@
+#pragma once
+
+#include "rendering-device.h"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Packs the uploads in a ring staging buffer and records them in batches on
+// the transfer queue. Each batch signals a value on the upload timeline and
+// releases its destinations to the graphics queue, AcquireOwnership records
+// the matching acquire barriers. Safe to use from the loader thread.
+class UploadManager {
+  public:
+    void Initialize(RD *device, uint32_t stagingSize);
+
+    // The destination must not be in use by the graphics queue, buffers
+    // larger than the ring are split in several copies
+    void UploadBuffer(BufferID buffer, const void *data, uint64_t size, uint64_t dstOffset = 0);
+
+    // Copies the first mip level of a 2D texture of the given height, split
+    // in row ranges when it is larger than the ring. The texture is left in
+    // TEXTURE_LAYOUT_TRANSFER_DST_OPTIMAL for the mipmap generation
+    void UploadTexture(TextureID texture, const void *data, uint64_t size, uint32_t height);
+
+    // Submits the uploads recorded so far, returns the timeline value of
+    // the last batch
+    uint64_t Flush();
+
+    void WaitForUpload(uint64_t value) {
+        device->WaitForUpload(value);
+    }
+
+    // Acquire barriers for everything flushed so far, recorded on the
+    // graphics queue before the first use
+    void AcquireOwnership(CommandBufferID commandBuffer);
+
+    void Shutdown();
+
+  private:
+    struct Batch {
+        CommandPoolID commandPool;
+        CommandBufferID commandBuffer;
+        // Upload timeline value, zero until it is submitted
+        uint64_t value = 0;
+        // Ring head once the batch was recorded, the staging memory up to
+        // there is free when the batch completes
+        uint64_t stagingEnd = 0;
+    };
+
+    static const uint32_t BATCH_COUNT = 4;
+    static const uint32_t STAGING_ALIGNMENT = 16;
+
+    // A quarter of the ring so that the first chunks can retire while the
+    // next ones are copied
+    uint32_t MaxChunkSize() const {
+        return stagingSize / 4;
+    }
+
+    // Returns the offset in the staging buffer, waits for the oldest
+    // batches when the ring is full
+    uint32_t AllocateStaging(uint32_t size);
+    void BeginBatch();
+    uint64_t FlushBatch();
+    void WaitOldestBatch();
+
+    RD *device = nullptr;
+    QueueID transferQueue;
+    QueueID mainQueue;
+
+    BufferID stagingBuffer;
+    uint8_t *stagingBufferPtr = nullptr;
+    uint32_t stagingSize = 0;
+    // Monotonic positions in the ring, the staging offset is modulo stagingSize
+    uint64_t stagingHead = 0;
+    uint64_t stagingTail = 0;
+
+    Batch batches[BATCH_COUNT];
+    uint32_t batchIndex = 0;
+    bool recording = false;
+    // Indices of the submitted batches, oldest first
+    std::deque<uint32_t> inFlight;
+    uint64_t lastValue = 0;
+
+    // Acquire barriers of the batch being recorded and of the flushed ones
+    std::vector<RD::BufferBarrier> recordingBufferAcquires;
+    std::vector<RD::TextureBarrier> recordingTextureAcquires;
+    std::vector<RD::BufferBarrier> bufferAcquires;
+    std::vector<RD::TextureBarrier> textureAcquires;
+
+    std::mutex uploadMutex;
+};
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "vulkan-rendering-device.h"
 #include "ui/win32-ui.h"
+#include "core/task-scheduler.h"
 
 #define VMA_IMPLEMENTATION
 #define VMA_DYNAMIC_VULKAN_FUNCTIONS 1
@@ -12,6 +13,26 @@ constexpr const uint64_t MAIN_QUEUE = 0;
 constexpr const uint64_t TRANSFER_QUEUE = 1;
 constexpr const uint64_t COMPUTE_QUEUE = 2;
 
+static constexpr const char *kPipelineCachePath = "cache/pipeline-cache.bin";
+static constexpr uint32_t kPipelineCacheMagic = 0x43505856; // "VXPC"
+static constexpr uint32_t kPipelineCacheVersion = 1;
+
+// Written in front of the driver data, a cache from another device or
+// driver is dropped before it reaches vkCreatePipelineCache
+struct PipelineCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint32_t padding;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint8_t deviceUUID[VK_UUID_SIZE];
+    uint8_t driverUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t dataHash;
+};
+
 #define VK_LOAD_FUNCTION(instance, pFuncName) (vkGetInstanceProcAddr(instance, pFuncName))
 #define VK_CHECK(x)                                             \
     do {                                                        \
@@ -82,8 +103,66 @@ static VkDescriptorType RD_BINDING_TYPE_TO_VK_DESCRIPTOR_TYPE[RD::BINDING_TYPE_M
     VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
     VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+    VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+};
+
+// Transient pools are shared by every layout, sized for the sets of the
+// voxelizers and the sorter
+static const uint32_t TRANSIENT_POOL_SET_COUNT = 64;
+static VkDescriptorPoolSize TRANSIENT_POOL_SIZES[] = {
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, TRANSIENT_POOL_SET_COUNT * 8},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, TRANSIENT_POOL_SET_COUNT},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, TRANSIENT_POOL_SET_COUNT},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, TRANSIENT_POOL_SET_COUNT},
 };
 
+static constexpr uint64_t kFNVOffsetBasis = 14695981039346656037ull;
+static constexpr uint64_t kFNVPrime = 1099511628211ull;
+
+static uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= kFNVPrime;
+    }
+    return hash;
+}
+
+static uint64_t HashBoundUniforms(VkDescriptorSetLayout layout, const RD::BoundUniform *uniforms, uint32_t uniformCount) {
+    uint64_t hash = HashBytes(kFNVOffsetBasis, &layout, sizeof(layout));
+    for (uint32_t i = 0; i < uniformCount; ++i) {
+        const RD::BoundUniform &uniform = uniforms[i];
+        hash = HashBytes(hash, &uniform.bindingType, sizeof(uniform.bindingType));
+        hash = HashBytes(hash, &uniform.binding, sizeof(uniform.binding));
+        hash = HashBytes(hash, &uniform.resourceID.id, sizeof(uniform.resourceID.id));
+        hash = HashBytes(hash, &uniform.offset, sizeof(uniform.offset));
+        hash = HashBytes(hash, &uniform.range, sizeof(uniform.range));
+    }
+    return hash;
+}
+
+static bool SameBoundUniforms(const std::vector<RD::BoundUniform> &lhs, const RD::BoundUniform *rhs, uint32_t rhsCount) {
+    if (lhs.size() != rhsCount)
+        return false;
+    for (uint32_t i = 0; i < rhsCount; ++i) {
+        if (lhs[i].bindingType != rhs[i].bindingType || lhs[i].binding != rhs[i].binding ||
+            lhs[i].resourceID.id != rhs[i].resourceID.id || lhs[i].offset != rhs[i].offset || lhs[i].range != rhs[i].range)
+            return false;
+    }
+    return true;
+}
+
+static bool SameSetLayoutBindings(const std::vector<VkDescriptorSetLayoutBinding> &lhs, const VkDescriptorSetLayoutBinding *rhs, uint32_t rhsCount) {
+    if (lhs.size() != rhsCount)
+        return false;
+    for (uint32_t i = 0; i < rhsCount; ++i) {
+        if (lhs[i].binding != rhs[i].binding || lhs[i].descriptorType != rhs[i].descriptorType ||
+            lhs[i].descriptorCount != rhs[i].descriptorCount || lhs[i].stageFlags != rhs[i].stageFlags)
+            return false;
+    }
+    return true;
+}
+
 void VulkanRenderingDevice::FindValidationLayers(std::vector<const char *> &enabledLayers) {
     uint32_t instanceLayerCount;
     VK_CHECK(vkEnumerateInstanceLayerProperties(&instanceLayerCount, nullptr));
@@ -385,6 +464,40 @@ void VulkanRenderingDevice::ResetFences(FenceID *fences, uint32_t fenceCount) {
     vkResetFences(device, fenceCount, vkFences.data());
 }
 
+bool VulkanRenderingDevice::IsFenceSignalled(FenceID fence) {
+    return vkGetFenceStatus(device, *_fences.Access(fence.id)) == VK_SUCCESS;
+}
+
+QueryPoolID VulkanRenderingDevice::CreateTimestampQueryPool(uint32_t queryCount, const std::string &name) {
+    uint64_t queryPoolId = _queryPools.Obtain();
+    VkQueryPool *queryPool = _queryPools.Access(queryPoolId);
+    VkQueryPoolCreateInfo createInfo{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = queryCount,
+    };
+    VK_CHECK(vkCreateQueryPool(device, &createInfo, nullptr, queryPool));
+
+    SetDebugMarkerObjectName(VK_OBJECT_TYPE_QUERY_POOL, (uint64_t)*queryPool, name.c_str());
+    return QueryPoolID{queryPoolId};
+}
+
+void VulkanRenderingDevice::ResetQueryPool(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount) {
+    vkCmdResetQueryPool(_commandBuffers[commandBuffer.id], *_queryPools.Access(queryPool.id), firstQuery, queryCount);
+}
+
+void VulkanRenderingDevice::WriteTimestamp(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t query) {
+    vkCmdWriteTimestamp2(_commandBuffers[commandBuffer.id], VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, *_queryPools.Access(queryPool.id), query);
+}
+
+void VulkanRenderingDevice::GetQueryResults(QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount, uint64_t *results) {
+    VK_CHECK(vkGetQueryPoolResults(device, *_queryPools.Access(queryPool.id), firstQuery, queryCount, sizeof(uint64_t) * queryCount, results, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+}
+
+float VulkanRenderingDevice::GetTimestampPeriod() {
+    return deviceLimits.timestampComputeAndGraphics ? deviceLimits.timestampPeriod : 0.0f;
+}
+
 VkSemaphore VulkanRenderingDevice::CreateVulkanSemaphore(const std::string &name) {
     VkSemaphoreCreateInfo createInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
     VkSemaphore semaphore = VK_NULL_HANDLE;
@@ -441,6 +554,8 @@ VkSwapchainKHR VulkanRenderingDevice::CreateSwapchainInternal(std::unique_ptr<Vu
 }
 
 void VulkanRenderingDevice::ResizeSwapchain() {
+    // The frames in flight still present to the old images
+    WaitIdle();
     VkSwapchainKHR oldSwapchain = swapchain->swapchain;
     for (auto &imageView : swapchain->imageViews)
         vkDestroyImageView(device, imageView, nullptr);
@@ -550,15 +665,10 @@ void VulkanRenderingDevice::CreateSwapchain(bool vsync) {
     }
 }
 
-VkDescriptorPool VulkanRenderingDevice::CreateDescriptorPool(VkDescriptorPoolSize *poolSizes, uint32_t poolCount, VkDescriptorPoolCreateFlags flags) {
-    uint32_t maxSets = 0;
-    for (uint32_t i = 0; i < poolCount; ++i) {
-        maxSets += poolSizes[i].descriptorCount;
-    }
-    maxSets *= poolCount;
+VkDescriptorPool VulkanRenderingDevice::CreateDescriptorPool(VkDescriptorPoolSize *poolSizes, uint32_t poolCount, uint32_t maxSets, VkDescriptorPoolCreateFlags flags) {
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .flags = flags, // VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+        .flags = flags,
         .maxSets = maxSets,
         .poolSizeCount = poolCount,
         .pPoolSizes = poolSizes,
@@ -572,10 +682,14 @@ void VulkanRenderingDevice::InitializeDevice(uint32_t deviceIndex) {
 
     physicalDevice = physicalDevices[deviceIndex];
 
+    deviceIDProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
     conservativeRasterProps.sType = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_CONSERVATIVE_RASTERIZATION_PROPERTIES_EXT};
+    conservativeRasterProps.pNext = &deviceIDProperties;
     VkPhysicalDeviceProperties2 properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &conservativeRasterProps};
     vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
     LOG("Selected Device: " + std::string(properties.properties.deviceName));
+    deviceLimits = properties.properties.limits;
+    deviceProperties = properties.properties;
 
     device = CreateDevice(physicalDevice, enabledDeviceExtensions);
 }
@@ -662,6 +776,8 @@ void VulkanRenderingDevice::Initialize(void *platformData) {
     InitializeAllocator();
     LOG("VMA Allocator Initialized ...");
 
+    LoadPipelineCache();
+
     // Create Semaphore
     VkSemaphoreCreateInfo semaphoreCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
     VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = {
@@ -674,32 +790,46 @@ void VulkanRenderingDevice::Initialize(void *platformData) {
 
     SetDebugMarkerObjectName(VK_OBJECT_TYPE_SEMAPHORE, (uint64_t)timelineSemaphore, "Timeline Semaphore");
 
-    imageAcquireSemaphore = CreateVulkanSemaphore("Image Acquire Semaphore");
-    renderEndSemaphore = CreateVulkanSemaphore("Render End Semaphore");
+    VK_CHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &uploadSemaphore));
+    SetDebugMarkerObjectName(VK_OBJECT_TYPE_SEMAPHORE, (uint64_t)uploadSemaphore, "Upload Timeline Semaphore");
 
     // Initialize Resource Pools
     _shaders.Initialize(64, "ShaderPool");
     _pipeline.Initialize(64, "PipelinePool");
     _textures.Initialize(128, "TexturePool");
     _buffers.Initialize(64, "BufferPool");
-    _uniformSets.Initialize(64, "UniformSetPool");
+    _uniformSets.Initialize(256, "UniformSetPool");
     _commandPools.Initialize(16, "CommandPool");
     _fences.Initialize(16, "Fences");
+    _queryPools.Initialize(4, "QueryPools");
     _commandBuffers.reserve(32);
 
-    // Global Descriptor Pool
-    VkDescriptorPoolSize poolSizes[] = {
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 32},
-        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 32},
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 32},
+    // Per frame uniforms and uploads, the offsets are aligned for both
+    // uniform and storage buffers
+    uint32_t transientAlignment = static_cast<uint32_t>(std::max(deviceLimits.minUniformBufferOffsetAlignment, deviceLimits.minStorageBufferOffsetAlignment));
+    transientAllocator.Initialize(this, TRANSIENT_BUFFER_FRAME_SIZE, transientAlignment);
+
+    // Per frame command buffers and swapchain semaphores
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        std::string suffix = " " + std::to_string(i);
+        FrameContext &frame = frames[i];
+        frame.commandPool = CreateCommandPool(QueueID{MAIN_QUEUE}, "Frame Command Pool" + suffix);
+        frame.commandBuffer = CreateCommandBuffer(frame.commandPool, "Frame Command Buffer" + suffix);
+        frame.imageAcquireSemaphore = CreateVulkanSemaphore("Image Acquire Semaphore" + suffix);
+        frame.renderEndSemaphore = CreateVulkanSemaphore("Render End Semaphore" + suffix);
+    }
+
+    // ImGui Descriptor Pool
+    VkDescriptorPoolSize imguiPoolSize[] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 16},
     };
-    _descriptorPool = CreateDescriptorPool(poolSizes, (uint32_t)std::size(poolSizes));
+    _imguiDescriptorPool = CreateDescriptorPool(imguiPoolSize, (uint32_t)std::size(imguiPoolSize), 16, VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
 
     // Bindless Descriptor Pool
     VkDescriptorPoolSize bindlessPoolSize[] = {
         {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_RESOURCES},
     };
-    _bindlessDescriptorPool = CreateDescriptorPool(bindlessPoolSize, (uint32_t)std::size(bindlessPoolSize), VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT);
+    _bindlessDescriptorPool = CreateDescriptorPool(bindlessPoolSize, (uint32_t)std::size(bindlessPoolSize), 1, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT);
 
     // Bindless Descriptor Layout
     VkDescriptorSetLayoutBinding _bindlessSetLayouts[] = {
@@ -720,7 +850,7 @@ void VulkanRenderingDevice::Initialize(void *platformData) {
 
     VK_CHECK(vkCreateDescriptorSetLayout(device, &bindlessLayoutInfo, nullptr, &_bindlessDescriptorSetLayout));
 
-    uint32_t maxBinding = MAX_BINDLESS_RESOURCES - 1;
+    uint32_t maxBinding = MAX_BINDLESS_RESOURCES;
     VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
         .pNext = nullptr,
@@ -816,6 +946,102 @@ VkDescriptorSetLayout VulkanRenderingDevice::CreateDescriptorSetLayout(VkDescrip
     return setLayout;
 }
 
+VkDescriptorSetLayout VulkanRenderingDevice::GetDescriptorSetLayout(VkDescriptorSetLayoutBinding *bindings, uint32_t bindingCount) {
+    uint64_t hash = kFNVOffsetBasis;
+    for (uint32_t i = 0; i < bindingCount; ++i) {
+        hash = HashBytes(hash, &bindings[i].binding, sizeof(bindings[i].binding));
+        hash = HashBytes(hash, &bindings[i].descriptorType, sizeof(bindings[i].descriptorType));
+        hash = HashBytes(hash, &bindings[i].descriptorCount, sizeof(bindings[i].descriptorCount));
+        hash = HashBytes(hash, &bindings[i].stageFlags, sizeof(bindings[i].stageFlags));
+    }
+
+    std::lock_guard lock{descriptorMutex};
+    auto range = setLayoutCache.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (SameSetLayoutBindings(it->second.bindings, bindings, bindingCount))
+            return it->second.layout;
+    }
+
+    VkDescriptorSetLayout setLayout = CreateDescriptorSetLayout(bindings, bindingCount);
+    setLayoutCache.emplace(hash, CachedSetLayout{std::vector<VkDescriptorSetLayoutBinding>(bindings, bindings + bindingCount), setLayout});
+
+    // Descriptors of one set, the pools of this layout are sized from it
+    DescriptorLayoutPool &layoutPool = descriptorLayoutPools[setLayout];
+    for (uint32_t i = 0; i < bindingCount; ++i) {
+        auto it = std::find_if(layoutPool.setSizes.begin(), layoutPool.setSizes.end(), [&](const VkDescriptorPoolSize &size) { return size.type == bindings[i].descriptorType; });
+        if (it != layoutPool.setSizes.end())
+            it->descriptorCount += bindings[i].descriptorCount;
+        else
+            layoutPool.setSizes.push_back({bindings[i].descriptorType, bindings[i].descriptorCount});
+    }
+    return setLayout;
+}
+
+VkDescriptorSet VulkanRenderingDevice::AllocateDescriptorSet(VkDescriptorSetLayout layout) {
+    std::lock_guard lock{descriptorMutex};
+    DescriptorLayoutPool &layoutPool = descriptorLayoutPools[layout];
+    if (!layoutPool.freeSets.empty()) {
+        VkDescriptorSet descriptorSet = layoutPool.freeSets.back();
+        layoutPool.freeSets.pop_back();
+        return descriptorSet;
+    }
+
+    VkDescriptorSetAllocateInfo allocateInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = layoutPool.pools.empty() ? VK_NULL_HANDLE : layoutPool.pools.back(),
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout,
+    };
+
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    if (allocateInfo.descriptorPool != VK_NULL_HANDLE && vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet) == VK_SUCCESS)
+        return descriptorSet;
+
+    // The last pool is full, the next one is twice as large
+    uint32_t setCount = layoutPool.nextPoolSetCount;
+    layoutPool.nextPoolSetCount *= 2;
+    std::vector<VkDescriptorPoolSize> poolSizes = layoutPool.setSizes;
+    for (auto &poolSize : poolSizes)
+        poolSize.descriptorCount *= setCount;
+
+    allocateInfo.descriptorPool = CreateDescriptorPool(poolSizes.data(), static_cast<uint32_t>(poolSizes.size()), setCount);
+    layoutPool.pools.push_back(allocateInfo.descriptorPool);
+    VK_CHECK(vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet));
+    return descriptorSet;
+}
+
+VkDescriptorSet VulkanRenderingDevice::AllocateTransientDescriptorSet(FrameContext &frame, VkDescriptorSetLayout layout) {
+    VkDescriptorSetAllocateInfo allocateInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout,
+    };
+
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    for (; frame.transientPoolIndex < frame.transientPools.size(); ++frame.transientPoolIndex) {
+        allocateInfo.descriptorPool = frame.transientPools[frame.transientPoolIndex];
+        if (vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet) == VK_SUCCESS)
+            return descriptorSet;
+    }
+
+    allocateInfo.descriptorPool = CreateDescriptorPool(TRANSIENT_POOL_SIZES, (uint32_t)std::size(TRANSIENT_POOL_SIZES), TRANSIENT_POOL_SET_COUNT);
+    frame.transientPools.push_back(allocateInfo.descriptorPool);
+    VK_CHECK(vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet));
+    return descriptorSet;
+}
+
+void VulkanRenderingDevice::ResetTransientUniformSets(FrameContext &frame) {
+    for (VkDescriptorPool pool : frame.transientPools)
+        VK_CHECK(vkResetDescriptorPool(device, pool, 0));
+    frame.transientPoolIndex = 0;
+
+    for (uint64_t uniformSetID : frame.transientUniformSets) {
+        _uniformSets.Access(uniformSetID)->uniforms.clear();
+        _uniformSets.Release(uniformSetID);
+    }
+    frame.transientUniformSets.clear();
+}
+
 PipelineID VulkanRenderingDevice::CreateGraphicsPipeline(const ShaderID *shaders,
                                                          uint32_t shaderCount,
                                                          Topology topology,
@@ -940,7 +1166,7 @@ PipelineID VulkanRenderingDevice::CreateGraphicsPipeline(const ShaderID *shaders
     std::vector<VkDescriptorSetLayout> &setLayouts = pipeline->setLayout;
     for (auto &setBinding : setBindings) {
         if (setBinding.size() > 0)
-            setLayouts.push_back(CreateDescriptorSetLayout(setBinding.data(), static_cast<uint32_t>(setBinding.size())));
+            setLayouts.push_back(GetDescriptorSetLayout(setBinding.data(), static_cast<uint32_t>(setBinding.size())));
     }
 
     if (enableBindless) {
@@ -954,7 +1180,7 @@ PipelineID VulkanRenderingDevice::CreateGraphicsPipeline(const ShaderID *shaders
     if (enableBindless)
         setLayouts.pop_back();
 
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &createInfo, nullptr, &pipeline->pipeline));
+    VK_CHECK(vkCreateGraphicsPipelines(device, pipelineCache, 1, &createInfo, nullptr, &pipeline->pipeline));
 
     pipeline->bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     pipeline->layout = layout;
@@ -964,15 +1190,30 @@ PipelineID VulkanRenderingDevice::CreateGraphicsPipeline(const ShaderID *shaders
     return PipelineID{pipelineID};
 }
 
-PipelineID VulkanRenderingDevice::CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name) {
+PipelineID VulkanRenderingDevice::CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name,
+                                                       const SpecializationConstant *specializationConstants, uint32_t specializationConstantCount) {
     VulkanShader *vkShader = _shaders.Access(shader.id);
     assert(vkShader->stage == VK_SHADER_STAGE_COMPUTE_BIT);
 
+    std::vector<VkSpecializationMapEntry> specializationEntries(specializationConstantCount);
+    std::vector<uint32_t> specializationData(specializationConstantCount);
+    for (uint32_t i = 0; i < specializationConstantCount; ++i) {
+        specializationEntries[i] = {specializationConstants[i].id, i * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t)};
+        specializationData[i] = specializationConstants[i].value;
+    }
+    VkSpecializationInfo specializationInfo = {
+        .mapEntryCount = specializationConstantCount,
+        .pMapEntries = specializationEntries.data(),
+        .dataSize = specializationData.size() * sizeof(uint32_t),
+        .pData = specializationData.data(),
+    };
+
     VkPipelineShaderStageCreateInfo shaderStage = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = vkShader->stage,
         .module = vkShader->shaderModule,
         .pName = "main",
+        .pSpecializationInfo = specializationConstantCount > 0 ? &specializationInfo : nullptr,
     };
 
     uint32_t uniformBindingCount = static_cast<uint32_t>(vkShader->layoutBindings.size());
@@ -997,7 +1238,7 @@ PipelineID VulkanRenderingDevice::CreateComputePipeline(const ShaderID shader, b
     setLayouts.reserve(setCount);
     for (auto &setBinding : setBindings) {
         if (setBinding.size() > 0)
-            setLayouts.push_back(CreateDescriptorSetLayout(setBinding.data(), static_cast<uint32_t>(setBinding.size())));
+            setLayouts.push_back(GetDescriptorSetLayout(setBinding.data(), static_cast<uint32_t>(setBinding.size())));
     }
 
     VkPipelineLayout layout = CreatePipelineLayout(setLayouts, vkShader->pushConstants);
@@ -1007,7 +1248,7 @@ PipelineID VulkanRenderingDevice::CreateComputePipeline(const ShaderID shader, b
         .layout = layout,
     };
 
-    VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &createInfo, nullptr, &pipeline->pipeline));
+    VK_CHECK(vkCreateComputePipelines(device, pipelineCache, 1, &createInfo, nullptr, &pipeline->pipeline));
     pipeline->layout = layout;
     pipeline->bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
     pipeline->bindlessEnabled = enableBindless;
@@ -1017,6 +1258,104 @@ PipelineID VulkanRenderingDevice::CreateComputePipeline(const ShaderID shader, b
     return PipelineID{pipelineID};
 }
 
+void VulkanRenderingDevice::CreateComputePipelines(const ComputePipelineDescription *descriptions, uint32_t count, PipelineID *pipelines) {
+    // The pipeline cache is internally synchronized and the pools don't lock,
+    // only the set layout lookup is shared
+    core::ParallelFor(count, [&](uint32_t index) {
+        const ComputePipelineDescription &description = descriptions[index];
+        pipelines[index] = CreateComputePipeline(description.shader, description.enableBindless, description.name,
+                                                 description.specializationConstants, description.specializationConstantCount);
+    });
+}
+
+void VulkanRenderingDevice::LoadPipelineCache() {
+    PipelineCacheHeader expected = {};
+    expected.magic = kPipelineCacheMagic;
+    expected.version = kPipelineCacheVersion;
+    expected.vendorID = deviceProperties.vendorID;
+    expected.deviceID = deviceProperties.deviceID;
+    expected.driverVersion = deviceProperties.driverVersion;
+    std::memcpy(expected.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+    std::memcpy(expected.deviceUUID, deviceIDProperties.deviceUUID, VK_UUID_SIZE);
+    std::memcpy(expected.driverUUID, deviceIDProperties.driverUUID, VK_UUID_SIZE);
+
+    std::vector<char> data;
+    std::ifstream inFile(kPipelineCachePath, std::ios::binary | std::ios::ate);
+    if (inFile) {
+        std::streamsize fileSize = inFile.tellg();
+        PipelineCacheHeader header = {};
+        inFile.seekg(0);
+        if (fileSize >= std::streamsize(sizeof(header)) && inFile.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+            // Everything up to the data description has to match
+            bool valid = std::memcmp(&header, &expected, offsetof(PipelineCacheHeader, dataSize)) == 0 &&
+                         header.dataSize == uint64_t(fileSize) - sizeof(header);
+            if (valid) {
+                data.resize(header.dataSize);
+                valid = inFile.read(data.data(), data.size()) && HashBytes(kFNVOffsetBasis, data.data(), data.size()) == header.dataHash;
+            }
+            if (!valid) {
+                LOG("Pipeline cache " + std::string(kPipelineCachePath) + " is stale");
+                data.clear();
+            }
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data.size(),
+        .pInitialData = data.empty() ? nullptr : data.data(),
+    };
+    VK_CHECK(vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache));
+    loadedPipelineCacheSize = data.size();
+}
+
+void VulkanRenderingDevice::SavePipelineCache() {
+    size_t dataSize = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr));
+    // Nothing was compiled that the cache didn't already have
+    if (dataSize == 0 || dataSize == loadedPipelineCacheSize)
+        return;
+
+    std::vector<char> data(dataSize);
+    VK_CHECK(vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()));
+
+    PipelineCacheHeader header = {};
+    header.magic = kPipelineCacheMagic;
+    header.version = kPipelineCacheVersion;
+    header.vendorID = deviceProperties.vendorID;
+    header.deviceID = deviceProperties.deviceID;
+    header.driverVersion = deviceProperties.driverVersion;
+    std::memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+    std::memcpy(header.deviceUUID, deviceIDProperties.deviceUUID, VK_UUID_SIZE);
+    std::memcpy(header.driverUUID, deviceIDProperties.driverUUID, VK_UUID_SIZE);
+    header.dataSize = dataSize;
+    header.dataHash = HashBytes(kFNVOffsetBasis, data.data(), dataSize);
+
+    std::filesystem::path path(kPipelineCachePath);
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // Several bake processes may exit at the same time, each one writes its
+    // own temporary file and the last rename wins
+    std::filesystem::path tempPath = path;
+    tempPath += "." + std::to_string(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream outFile(tempPath, std::ios::binary | std::ios::trunc);
+        outFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        outFile.write(data.data(), dataSize);
+        if (!outFile) {
+            LOGW("Failed to write pipeline cache " + tempPath.string());
+            outFile.close();
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+        std::filesystem::remove(tempPath, error);
+}
+
 CommandPoolID VulkanRenderingDevice::CreateCommandPool(QueueID queue, const std::string &name) {
     VkCommandPoolCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -1139,7 +1478,7 @@ TextureID VulkanRenderingDevice::CreateTexture(TextureDescription *description,
     return TextureID{textureID};
 }
 
-BufferID VulkanRenderingDevice::CreateBuffer(uint32_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) {
+BufferID VulkanRenderingDevice::CreateBuffer(uint64_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) {
     assert(size > 0);
     VkBufferCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -1215,6 +1554,11 @@ void VulkanRenderingDevice::CopyBufferToTexture(CommandBufferID commandBuffer, B
 
     copyRegion.imageOffset = {0, 0, 0};
     copyRegion.imageExtent = {texture->width, texture->height, texture->depth};
+    if (region->rowCount > 0) {
+        ASSERT(texture->depth == 1 && texture->arrayLevels == 1, "Row copies are only supported for 2D textures");
+        copyRegion.imageOffset.y = static_cast<int32_t>(region->rowOffset);
+        copyRegion.imageExtent.height = region->rowCount;
+    }
 
     VkCommandBuffer cb = _commandBuffers[commandBuffer.id];
 
@@ -1222,49 +1566,39 @@ void VulkanRenderingDevice::CopyBufferToTexture(CommandBufferID commandBuffer, B
     vkCmdCopyBufferToImage(cb, buffer->buffer, texture->image, texture->currentLayout, 1, &copyRegion);
 }
 
-UniformSetID VulkanRenderingDevice::CreateUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set, const std::string &name) {
-    std::vector<VkWriteDescriptorSet> writeSets(uniformCount);
-
-    // @TODO replace with custom allocator
-    std::vector<VkDescriptorImageInfo> imageInfos;
-    std::vector<VkDescriptorBufferInfo> bufferInfos;
-    imageInfos.reserve(16), bufferInfos.reserve(16);
+void VulkanRenderingDevice::WriteDescriptorSet(VkDescriptorSet descriptorSet, BoundUniform *uniforms, uint32_t uniformCount) {
+    ASSERT(uniformCount <= MAX_BINDING_COUNT, "Too many uniforms in a set");
+    VkWriteDescriptorSet writeSets[MAX_BINDING_COUNT];
+    VkDescriptorImageInfo imageInfos[MAX_BINDING_COUNT];
+    VkDescriptorBufferInfo bufferInfos[MAX_BINDING_COUNT];
 
     for (uint32_t i = 0; i < uniformCount; ++i) {
         BoundUniform *uniform = uniforms + i;
         writeSets[i] = {};
         writeSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[i].dstSet = descriptorSet;
         writeSets[i].dstBinding = uniform->binding;
-        writeSets[i].descriptorType = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+        writeSets[i].descriptorType = RD_BINDING_TYPE_TO_VK_DESCRIPTOR_TYPE[uniform->bindingType];
         writeSets[i].descriptorCount = 1;
 
         switch (uniform->bindingType) {
         case BINDING_TYPE_IMAGE: {
             VulkanTexture *texture = _textures.Access(uniform->resourceID.id);
-            VkDescriptorImageInfo &imageInfo = imageInfos.emplace_back(VkDescriptorImageInfo{});
-            imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageInfo.imageView = texture->imageView;
+            imageInfos[i] = {};
+            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageInfos[i].imageView = texture->imageView;
 
             writeSets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-            writeSets[i].pImageInfo = &imageInfo;
-        } break;
-        case BINDING_TYPE_UNIFORM_BUFFER: {
-            VulkanBuffer *buffer = _buffers.Access(uniform->resourceID.id);
-            VkDescriptorBufferInfo &bufferInfo = bufferInfos.emplace_back(VkDescriptorBufferInfo{});
-            bufferInfo.buffer = buffer->buffer;
-            bufferInfo.offset = uniform->offset;
-            bufferInfo.range = uniform->range;
-            writeSets[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            writeSets[i].pBufferInfo = &bufferInfo;
+            writeSets[i].pImageInfo = &imageInfos[i];
         } break;
+        case BINDING_TYPE_UNIFORM_BUFFER:
+        case BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC:
         case BINDING_TYPE_STORAGE_BUFFER: {
             VulkanBuffer *buffer = _buffers.Access(uniform->resourceID.id);
-            VkDescriptorBufferInfo &bufferInfo = bufferInfos.emplace_back(VkDescriptorBufferInfo{});
-            bufferInfo.buffer = buffer->buffer;
-            bufferInfo.offset = uniform->offset;
-            bufferInfo.range = uniform->range;
-            writeSets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            writeSets[i].pBufferInfo = &bufferInfo;
+            bufferInfos[i].buffer = buffer->buffer;
+            bufferInfos[i].offset = uniform->offset;
+            bufferInfos[i].range = uniform->range;
+            writeSets[i].pBufferInfo = &bufferInfos[i];
         } break;
         default:
             assert(0 && "Undefined Binding Type");
@@ -1272,33 +1606,76 @@ UniformSetID VulkanRenderingDevice::CreateUniformSet(PipelineID pipeline, BoundU
         }
     }
 
-    VulkanPipeline *vkPipeline = _pipeline.Access(pipeline.id);
-    VkDescriptorSetAllocateInfo allocateInfo{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = _descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &vkPipeline->setLayout[set],
-    };
+    vkUpdateDescriptorSets(device, uniformCount, writeSets, 0, nullptr);
+}
 
-    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
-    vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet);
+UniformSetID VulkanRenderingDevice::CreateUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set, const std::string &name) {
+    VkDescriptorSetLayout layout = _pipeline.Access(pipeline.id)->setLayout[set];
+
+    // Same layout and bindings, share the set
+    uint64_t hash = HashBoundUniforms(layout, uniforms, uniformCount);
+    auto range = uniformSetCache.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        VulkanUniformSet *cachedSet = _uniformSets.Access(it->second);
+        if (cachedSet->layout == layout && cachedSet->set == set && SameBoundUniforms(cachedSet->uniforms, uniforms, uniformCount)) {
+            cachedSet->refCount++;
+            return UniformSetID{it->second};
+        }
+    }
+
+    VkDescriptorSet descriptorSet = AllocateDescriptorSet(layout);
     SetDebugMarkerObjectName(VK_OBJECT_TYPE_DESCRIPTOR_SET, (uint64_t)descriptorSet, name.c_str());
+    WriteDescriptorSet(descriptorSet, uniforms, uniformCount);
 
-    for (auto &writeSet : writeSets)
-        writeSet.dstSet = descriptorSet;
+    uint64_t uniformSetID = _uniformSets.Obtain();
+    VulkanUniformSet *uniformSet = _uniformSets.Access(uniformSetID);
+    uniformSet->descriptorSet = descriptorSet;
+    uniformSet->layout = layout;
+    uniformSet->set = set;
+    uniformSet->refCount = 1;
+    uniformSet->hash = hash;
+    uniformSet->cached = true;
+    uniformSet->transient = false;
+    uniformSet->uniforms.assign(uniforms, uniforms + uniformCount);
+    uniformSetCache.emplace(hash, uniformSetID);
+
+    return UniformSetID{uniformSetID};
+}
 
-    vkUpdateDescriptorSets(device, uniformCount, writeSets.data(), 0, nullptr);
+UniformSetID VulkanRenderingDevice::CreateTransientUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set) {
+    FrameContext &frame = frames[frameIndex];
+    VkDescriptorSetLayout layout = _pipeline.Access(pipeline.id)->setLayout[set];
+    VkDescriptorSet descriptorSet = AllocateTransientDescriptorSet(frame, layout);
+    WriteDescriptorSet(descriptorSet, uniforms, uniformCount);
 
     uint64_t uniformSetID = _uniformSets.Obtain();
     VulkanUniformSet *uniformSet = _uniformSets.Access(uniformSetID);
-    uniformSet->descriptorPool = _descriptorPool;
     uniformSet->descriptorSet = descriptorSet;
+    uniformSet->layout = layout;
     uniformSet->set = set;
+    uniformSet->refCount = 1;
+    uniformSet->cached = false;
+    uniformSet->transient = true;
+    frame.transientUniformSets.push_back(uniformSetID);
 
     return UniformSetID{uniformSetID};
 }
 
 void VulkanRenderingDevice::BeginFrame() {
+    // Wait for the GPU to be done with the last frame recorded in this slot
+    FrameContext &frame = frames[frameIndex];
+    VkSemaphoreWaitInfo waitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &timelineSemaphore,
+        .pValues = &frame.semaphoreValue,
+    };
+    VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+    FlushPendingDestroys(GetCompletedSemaphoreValue());
+    ResetCommandPool(frame.commandPool);
+    transientAllocator.Reset(frameIndex);
+    ResetTransientUniformSets(frame);
+
     // Check swapchain resize
     VkSurfaceCapabilitiesKHR surfaceCaps = {};
     VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCaps));
@@ -1309,7 +1686,7 @@ void VulkanRenderingDevice::BeginFrame() {
     if (resized)
         ResizeSwapchain();
 
-    VK_CHECK(vkAcquireNextImageKHR(device, swapchain->swapchain, UINT64_MAX, imageAcquireSemaphore, VK_NULL_HANDLE, &swapchain->currentImageIndex));
+    VK_CHECK(vkAcquireNextImageKHR(device, swapchain->swapchain, UINT64_MAX, frame.imageAcquireSemaphore, VK_NULL_HANDLE, &swapchain->currentImageIndex));
 }
 
 void VulkanRenderingDevice::BeginCommandBuffer(CommandBufferID commandBuffer) {
@@ -1453,17 +1830,21 @@ void VulkanRenderingDevice::PrepareSwapchain(CommandBufferID commandBuffer, Text
 void VulkanRenderingDevice::Submit(CommandBufferID commandBuffer, FenceID fence) {
 
     VkQueue queue = _queues[0];
+    FrameContext &frame = frames[frameIndex];
 
+    std::lock_guard lock{queueSubmitMutex};
     VkSemaphoreSubmitInfoKHR waitSemaphores[] = {
         {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, timelineSemaphore, lastSemaphoreValue_, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, 0},
-        {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, imageAcquireSemaphore, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0},
+        {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, frame.imageAcquireSemaphore, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0},
+        {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, uploadSemaphore, lastUploadValue_, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR, 0},
     };
 
     lastSemaphoreValue_++;
+    frame.semaphoreValue = lastSemaphoreValue_;
 
     VkSemaphoreSubmitInfoKHR signalSemaphores[]{
         {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, timelineSemaphore, lastSemaphoreValue_, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, 0},
-        {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, renderEndSemaphore, 0, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, 0},
+        {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, frame.renderEndSemaphore, 0, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, 0},
     };
 
     VkCommandBuffer vkCommandBuffer = _commandBuffers[commandBuffer.id];
@@ -1483,13 +1864,52 @@ void VulkanRenderingDevice::Submit(CommandBufferID commandBuffer, FenceID fence)
         .pSignalSemaphoreInfos = signalSemaphores,
     };
 
-    VkFence *vkFence;
-    if (fence.id != INVALID_ID) {
-        vkFence = _fences.Access(fence.id);
-    } else
-        vkFence = VK_NULL_HANDLE;
+    // Frames are paced with the timeline semaphore, the fence is optional
+    VkFence vkFence = VK_NULL_HANDLE;
+    if (fence.id != INVALID_ID)
+        vkFence = *_fences.Access(fence.id);
+
+    VK_CHECK(vkQueueSubmit2(queue, 1, &submitInfo, vkFence));
+}
+
+uint64_t VulkanRenderingDevice::SubmitUpload(CommandBufferID commandBuffer, QueueID queue) {
+    std::lock_guard lock{queueSubmitMutex};
+    uint64_t value = ++lastUploadValue_;
+
+    VkSemaphoreSubmitInfoKHR signalSemaphore = {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR, nullptr, uploadSemaphore, value, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR, 0};
+    VkCommandBufferSubmitInfo commandBufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = _commandBuffers[commandBuffer.id],
+    };
+
+    VkSubmitInfo2 submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .pNext = nullptr,
+        .waitSemaphoreInfoCount = 0,
+        .pWaitSemaphoreInfos = nullptr,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &commandBufferInfo,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signalSemaphore,
+    };
+    VK_CHECK(vkQueueSubmit2(_queues[queue.id], 1, &submitInfo, VK_NULL_HANDLE));
+    return value;
+}
 
-    VK_CHECK(vkQueueSubmit2(queue, 1, &submitInfo, *vkFence));
+uint64_t VulkanRenderingDevice::GetCompletedUploadValue() {
+    uint64_t value = 0;
+    VK_CHECK(vkGetSemaphoreCounterValue(device, uploadSemaphore, &value));
+    return value;
+}
+
+void VulkanRenderingDevice::WaitForUpload(uint64_t value) {
+    VkSemaphoreWaitInfo waitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &uploadSemaphore,
+        .pValues = &value,
+    };
+    VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
 }
 
 void VulkanRenderingDevice::SetViewport(CommandBufferID commandBuffer, float offsetX, float offsetY, float width, float height) {
@@ -1526,12 +1946,13 @@ void VulkanRenderingDevice::BindPushConstants(CommandBufferID commandBuffer, Pip
     vkCmdPushConstants(cb, vkPipeline->layout, RD_STAGE_TO_VK_SHADER_STAGE_BITS[shaderStage], offset, size, data);
 }
 
-void VulkanRenderingDevice::BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSets, uint32_t uniformSetCount) {
+void VulkanRenderingDevice::BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSets, uint32_t uniformSetCount, const uint32_t *dynamicOffsets, uint32_t dynamicOffsetCount) {
+    assert(dynamicOffsetCount == 0 || uniformSetCount == 1);
     VulkanPipeline *vkPipeline = _pipeline.Access(pipeline.id);
     VkCommandBuffer cb = _commandBuffers[commandBuffer.id];
     for (uint32_t i = 0; i < uniformSetCount; ++i) {
         VulkanUniformSet *vkUniformSet = _uniformSets.Access(uniformSets[i].id);
-        vkCmdBindDescriptorSets(cb, vkPipeline->bindPoint, vkPipeline->layout, vkUniformSet->set, 1, &vkUniformSet->descriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(cb, vkPipeline->bindPoint, vkPipeline->layout, vkUniformSet->set, 1, &vkUniformSet->descriptorSet, dynamicOffsetCount, dynamicOffsets);
     }
 }
 
@@ -1743,11 +2164,12 @@ void VulkanRenderingDevice::ImmediateSubmit(std::function<void(CommandBufferID)>
     };
 
     VkFence *vkFence = _fences.Access(queueInfo->fence.id);
+    std::lock_guard lock{queueSubmitMutex};
     VK_CHECK(vkQueueSubmit(_queues[queueInfo->queue.id], 1, &submitInfo, *vkFence));
 }
 
 void VulkanRenderingDevice::Present() {
-    VkSemaphore waitSemaphores[] = {renderEndSemaphore};
+    VkSemaphore waitSemaphores[] = {frames[frameIndex].renderEndSemaphore};
     VkPresentInfoKHR presentInfo = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = static_cast<uint32_t>(std::size(waitSemaphores)),
@@ -1757,25 +2179,75 @@ void VulkanRenderingDevice::Present() {
         .pImageIndices = &swapchain->currentImageIndex,
     };
 
-    VK_CHECK(vkQueuePresentKHR(_queues[0], &presentInfo));
+    {
+        std::lock_guard lock{queueSubmitMutex};
+        VK_CHECK(vkQueuePresentKHR(_queues[0], &presentInfo));
+    }
 
     UpdateBindlessDescriptor(bindlessTextureToUpdate.data(), static_cast<uint32_t>(bindlessTextureToUpdate.size()));
+    frameIndex = (frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
-void VulkanRenderingDevice::Destroy(BufferID buffer) {
-    VulkanBuffer *vkBuffer = _buffers.Access(buffer.id);
-    if (vkBuffer->mapped) {
-        vmaUnmapMemory(vmaAllocator, vkBuffer->allocation);
+void VulkanRenderingDevice::WaitIdle() {
+    VK_CHECK(vkDeviceWaitIdle(device));
+    FlushPendingDestroys(GetCompletedSemaphoreValue());
+}
+
+uint64_t VulkanRenderingDevice::GetCompletedSemaphoreValue() {
+    uint64_t value = 0;
+    VK_CHECK(vkGetSemaphoreCounterValue(device, timelineSemaphore, &value));
+    return value;
+}
+
+void VulkanRenderingDevice::DeferDestroy(std::function<void()> &&destroy) {
+    // Anything submitted so far may use the resource
+    if (GetCompletedSemaphoreValue() >= lastSemaphoreValue_)
+        destroy();
+    else
+        pendingDestroys.push_back({lastSemaphoreValue_, std::move(destroy)});
+}
+
+void VulkanRenderingDevice::FlushPendingDestroys(uint64_t completedValue) {
+    while (!pendingDestroys.empty() && pendingDestroys.front().semaphoreValue <= completedValue) {
+        pendingDestroys.front().destroy();
+        pendingDestroys.pop_front();
+    }
+}
+
+void VulkanRenderingDevice::EvictCachedUniformSets(uint64_t resourceID, bool texture) {
+    for (auto it = uniformSetCache.begin(); it != uniformSetCache.end();) {
+        VulkanUniformSet *uniformSet = _uniformSets.Access(it->second);
+        bool bound = std::any_of(uniformSet->uniforms.begin(), uniformSet->uniforms.end(), [&](const BoundUniform &uniform) {
+            return uniform.resourceID.id == resourceID && (uniform.bindingType == BINDING_TYPE_IMAGE) == texture;
+        });
+        // Still destroyed by its owners, only the lookup goes away
+        if (bound) {
+            uniformSet->cached = false;
+            it = uniformSetCache.erase(it);
+        } else
+            ++it;
     }
-    memoryUsage -= vkBuffer->allocation->GetSize();
-    vmaDestroyBuffer(vmaAllocator, vkBuffer->buffer, vkBuffer->allocation);
+}
+
+void VulkanRenderingDevice::Destroy(BufferID buffer) {
+    EvictCachedUniformSets(buffer.id, false);
+    VulkanBuffer vkBuffer = *_buffers.Access(buffer.id);
     _buffers.Release(buffer.id);
+    DeferDestroy([this, vkBuffer]() {
+        if (vkBuffer.mapped) {
+            vmaUnmapMemory(vmaAllocator, vkBuffer.allocation);
+        }
+        memoryUsage -= vkBuffer.allocation->GetSize();
+        vmaDestroyBuffer(vmaAllocator, vkBuffer.buffer, vkBuffer.allocation);
+    });
 }
 
 void VulkanRenderingDevice::Destroy(CommandPoolID commandPool) {
-    VkCommandPool *vkcmdPool = _commandPools.Access(commandPool.id);
-    vkDestroyCommandPool(device, *vkcmdPool, nullptr);
+    VkCommandPool vkcmdPool = *_commandPools.Access(commandPool.id);
     _commandPools.Release(commandPool.id);
+    DeferDestroy([this, vkcmdPool]() {
+        vkDestroyCommandPool(device, vkcmdPool, nullptr);
+    });
 }
 
 void VulkanRenderingDevice::UpdateBindlessDescriptor(TextureID *bindlessTexture, uint32_t textureCount) {
@@ -1783,25 +2255,32 @@ void VulkanRenderingDevice::UpdateBindlessDescriptor(TextureID *bindlessTexture,
         std::vector<VkWriteDescriptorSet> writeSets(textureCount);
         std::vector<VkDescriptorImageInfo> imageInfos(textureCount);
 
+        uint32_t writeCount = 0;
         for (uint32_t i = 0; i < textureCount; ++i) {
+            uint32_t index = ResourcePool<VulkanTexture>::Index(bindlessTexture[i].id);
+            if (index >= MAX_BINDLESS_RESOURCES) {
+                LOGE("Texture " + std::to_string(index) + " is past the bindless descriptor array");
+                continue;
+            }
+
             VulkanTexture *texture = _textures.Access(bindlessTexture[i].id);
-            VkWriteDescriptorSet &writeSet = writeSets[i];
+            VkWriteDescriptorSet &writeSet = writeSets[writeCount];
             writeSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             writeSet.pNext = nullptr;
             writeSet.dstSet = _bindlessDescriptorSet;
             writeSet.dstBinding = BINDLESS_TEXTURE_BINDING,
-            writeSet.dstArrayElement = (uint32_t)bindlessTexture[i].id;
+            writeSet.dstArrayElement = index;
             writeSet.descriptorCount = 1;
             writeSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 
-            VkDescriptorImageInfo &imageInfo = imageInfos[i];
+            VkDescriptorImageInfo &imageInfo = imageInfos[writeCount++];
             imageInfo.sampler = texture->sampler;
             imageInfo.imageLayout = texture->currentLayout;
             imageInfo.imageView = texture->imageView;
             writeSet.pImageInfo = &imageInfo;
         }
 
-        vkUpdateDescriptorSets(device, textureCount, writeSets.data(), 0, nullptr);
+        vkUpdateDescriptorSets(device, writeCount, writeSets.data(), 0, nullptr);
     }
 }
 
@@ -1881,10 +2360,11 @@ void VulkanRenderingDevice::GenerateMipmap(CommandBufferID commandBuffer, Textur
 
 void VulkanRenderingDevice::Destroy(PipelineID pipeline) {
     VulkanPipeline *vkPipeline = _pipeline.Access(pipeline.id);
-    vkDestroyPipeline(device, vkPipeline->pipeline, nullptr);
-    vkDestroyPipelineLayout(device, vkPipeline->layout, nullptr);
-    for (auto &setLayout : vkPipeline->setLayout)
-        vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    // Set layouts are shared through the cache and destroyed at shutdown
+    DeferDestroy([this, vkPipelineHandle = vkPipeline->pipeline, layout = vkPipeline->layout]() {
+        vkDestroyPipeline(device, vkPipelineHandle, nullptr);
+        vkDestroyPipelineLayout(device, layout, nullptr);
+    });
 
     vkPipeline->pipeline = nullptr;
     vkPipeline->bindlessEnabled = false;
@@ -1903,18 +2383,41 @@ void VulkanRenderingDevice::Destroy(ShaderID shaderModule) {
 }
 
 void VulkanRenderingDevice::Destroy(TextureID texture) {
+    EvictCachedUniformSets(texture.id, true);
     VulkanTexture *vkTexture = _textures.Access(texture.id);
-    memoryUsage -= vkTexture->allocation->GetSize();
+    DeferDestroy([this, sampler = vkTexture->sampler, imageView = vkTexture->imageView, image = vkTexture->image, allocation = vkTexture->allocation]() {
+        memoryUsage -= allocation->GetSize();
 
-    vkDestroySampler(device, vkTexture->sampler, nullptr);
-    vkDestroyImageView(device, vkTexture->imageView, nullptr);
-    vmaDestroyImage(vmaAllocator, vkTexture->image, vkTexture->allocation);
+        vkDestroySampler(device, sampler, nullptr);
+        vkDestroyImageView(device, imageView, nullptr);
+        vmaDestroyImage(vmaAllocator, image, allocation);
+    });
     _textures.Release(texture.id);
 }
 
 void VulkanRenderingDevice::Destroy(UniformSetID uniformSet) {
     VulkanUniformSet *vkUniformSet = _uniformSets.Access(uniformSet.id);
-    vkFreeDescriptorSets(device, _descriptorPool, 1, &vkUniformSet->descriptorSet);
+    // Transient sets go away with their frame
+    if (vkUniformSet->transient || --vkUniformSet->refCount > 0)
+        return;
+
+    if (vkUniformSet->cached) {
+        auto range = uniformSetCache.equal_range(vkUniformSet->hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == uniformSet.id) {
+                uniformSetCache.erase(it);
+                break;
+            }
+        }
+    }
+
+    // Recycled in the pool of its layout once the GPU is done with it
+    DeferDestroy([this, descriptorSet = vkUniformSet->descriptorSet, layout = vkUniformSet->layout]() {
+        std::lock_guard lock{descriptorMutex};
+        descriptorLayoutPools[layout].freeSets.push_back(descriptorSet);
+    });
+    vkUniformSet->uniforms.clear();
+    vkUniformSet->cached = false;
     _uniformSets.Release(uniformSet.id);
 }
 
@@ -1923,7 +2426,23 @@ void VulkanRenderingDevice::Destroy(FenceID fence) {
     vkDestroyFence(device, vkFence, nullptr);
 }
 
+void VulkanRenderingDevice::Destroy(QueryPoolID queryPool) {
+    VkQueryPool vkQueryPool = *_queryPools.Access(queryPool.id);
+    DeferDestroy([this, vkQueryPool]() {
+        vkDestroyQueryPool(device, vkQueryPool, nullptr);
+    });
+    _queryPools.Release(queryPool.id);
+}
+
 void VulkanRenderingDevice::Shutdown() {
+    WaitIdle();
+    transientAllocator.Shutdown(this);
+    for (FrameContext &frame : frames) {
+        Destroy(frame.commandPool);
+        vkDestroySemaphore(device, frame.imageAcquireSemaphore, nullptr);
+        vkDestroySemaphore(device, frame.renderEndSemaphore, nullptr);
+    }
+
     // Release resource pool
     _shaders.Shutdown();
     _commandPools.Shutdown();
@@ -1931,15 +2450,32 @@ void VulkanRenderingDevice::Shutdown() {
     _textures.Shutdown();
     _uniformSets.Shutdown();
     _buffers.Shutdown();
+    _queryPools.Shutdown();
 
     vkDestroyDescriptorSetLayout(device, _bindlessDescriptorSetLayout, nullptr);
     // vkFreeDescriptorSets(device, _bindlessDescriptorPool, 1, &_bindlessDescriptorSet);
     vkDestroyDescriptorPool(device, _bindlessDescriptorPool, nullptr);
 
-    vkDestroyDescriptorPool(device, _descriptorPool, nullptr);
+    for (FrameContext &frame : frames) {
+        for (VkDescriptorPool pool : frame.transientPools)
+            vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    for (auto &layoutPool : descriptorLayoutPools) {
+        for (VkDescriptorPool pool : layoutPool.second.pools)
+            vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    for (auto &setLayout : setLayoutCache)
+        vkDestroyDescriptorSetLayout(device, setLayout.second.layout, nullptr);
+    descriptorLayoutPools.clear();
+    setLayoutCache.clear();
+    uniformSetCache.clear();
+    vkDestroyDescriptorPool(device, _imguiDescriptorPool, nullptr);
+
+    SavePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
     vkDestroySemaphore(device, timelineSemaphore, nullptr);
-    vkDestroySemaphore(device, imageAcquireSemaphore, nullptr);
-    vkDestroySemaphore(device, renderEndSemaphore, nullptr);
+    vkDestroySemaphore(device, uploadSemaphore, nullptr);
     for (auto &view : swapchain->imageViews)
         vkDestroyImageView(device, view, nullptr);
     vmaDestroyAllocator(vmaAllocator);
@@ -6,12 +6,15 @@
 #include <volk.h>
 
 #include "core/resource-pool.h"
+#include "transient-allocator.h"
 
 #include <vma/vk_mem_alloc.h>
 
 #include <vector>
 #include <memory>
 #include <array>
+#include <deque>
+#include <mutex>
 
 class VulkanRenderingDevice : public RenderingDevice {
 
@@ -39,7 +42,9 @@ class VulkanRenderingDevice : public RenderingDevice {
                                       bool enableBindless,
                                       const std::string &name) override;
 
-    PipelineID CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name) override;
+    PipelineID CreateComputePipeline(const ShaderID shader, bool enableBindless, const std::string &name,
+                                     const SpecializationConstant *specializationConstants, uint32_t specializationConstantCount) override;
+    void CreateComputePipelines(const ComputePipelineDescription *descriptions, uint32_t count, PipelineID *pipelines) override;
     CommandBufferID CreateCommandBuffer(CommandPoolID commandPool, const std::string &name) override;
 
     CommandPoolID CreateCommandPool(QueueID queue, const std::string &name = "CommandPool") override;
@@ -47,14 +52,30 @@ class VulkanRenderingDevice : public RenderingDevice {
 
     TextureID CreateTexture(TextureDescription *description, const std::string &name) override;
     UniformSetID CreateUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set, const std::string &name) override;
+    UniformSetID CreateTransientUniformSet(PipelineID pipeline, BoundUniform *uniforms, uint32_t uniformCount, uint32_t set) override;
 
     FenceID CreateFence(const std::string &name = "fence", bool signalled = false) override;
     void WaitForFence(FenceID *fence, uint32_t fenceCount, uint64_t timeout) override;
     void ResetFences(FenceID *fences, uint32_t fenceCount) override;
+    bool IsFenceSignalled(FenceID fence) override;
 
-    BufferID CreateBuffer(uint32_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) override;
+    QueryPoolID CreateTimestampQueryPool(uint32_t queryCount, const std::string &name = "queryPool") override;
+    void ResetQueryPool(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount) override;
+    void WriteTimestamp(CommandBufferID commandBuffer, QueryPoolID queryPool, uint32_t query) override;
+    void GetQueryResults(QueryPoolID queryPool, uint32_t firstQuery, uint32_t queryCount, uint64_t *results) override;
+    float GetTimestampPeriod() override;
+
+    BufferID CreateBuffer(uint64_t size, uint32_t usageFlags, MemoryAllocationType allocationType, const std::string &name) override;
     uint8_t *MapBuffer(BufferID buffer) override;
 
+    TransientAllocation AllocateTransient(uint32_t size) override {
+        return transientAllocator.Allocate(size);
+    }
+
+    BufferID GetTransientBuffer() override {
+        return transientAllocator.buffer;
+    }
+
     void CopyBuffer(CommandBufferID commandBuffer, BufferID src, BufferID dst, BufferCopyRegion *region) override;
     void CopyBufferToTexture(CommandBufferID commandBuffer, BufferID src, TextureID dst, BufferImageCopyRegion *region) override;
 
@@ -63,6 +84,13 @@ class VulkanRenderingDevice : public RenderingDevice {
     }
 
     void BeginFrame() override;
+    uint32_t GetFrameIndex() override {
+        return frameIndex;
+    }
+    CommandBufferID GetFrameCommandBuffer() override {
+        return frames[frameIndex].commandBuffer;
+    }
+    void WaitIdle() override;
     void BeginCommandBuffer(CommandBufferID commandBuffer) override;
     void EndCommandBuffer(CommandBufferID commandBuffer) override;
 
@@ -79,6 +107,9 @@ class VulkanRenderingDevice : public RenderingDevice {
     void DrawIndexedIndirect(CommandBufferID commandBuffer, BufferID indirectBuffer, uint32_t offset, uint32_t drawCount, uint32_t stride) override;
 
     void Submit(CommandBufferID commandBuffer, FenceID fence) override;
+    uint64_t SubmitUpload(CommandBufferID commandBuffer, QueueID queue) override;
+    uint64_t GetCompletedUploadValue() override;
+    void WaitForUpload(uint64_t value) override;
     void ImmediateSubmit(std::function<void(CommandBufferID commandBufferfence)> &&function, ImmediateSubmitInfo *queueInfo) override;
 
     void Present() override;
@@ -93,7 +124,7 @@ class VulkanRenderingDevice : public RenderingDevice {
 
     void BindIndexBuffer(CommandBufferID commandBuffer, BufferID buffer) override;
     void BindPipeline(CommandBufferID commandBuffer, PipelineID pipeline) override;
-    void BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount) override;
+    void BindUniformSet(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount, const uint32_t *dynamicOffsets = nullptr, uint32_t dynamicOffsetCount = 0) override;
     void BindPushConstants(CommandBufferID commandBuffer, PipelineID pipeline, ShaderStage shaderStage, void *data, uint32_t offset, uint32_t size) override;
     void DispatchCompute(CommandBufferID commandBuffer, uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ = 1) override;
     void DispatchComputeIndirect(CommandBufferID commandBuffer, BufferID indirectBuffer, uint32_t offset);
@@ -108,6 +139,9 @@ class VulkanRenderingDevice : public RenderingDevice {
     }
 
     void UpdateBindlessDescriptor(TextureID *texture, uint32_t textureCount) override;
+    uint32_t GetBindlessTextureCount() override {
+        return MAX_BINDLESS_RESOURCES;
+    }
 
     void GenerateMipmap(CommandBufferID commandBuffer, TextureID texture) override;
 
@@ -118,6 +152,7 @@ class VulkanRenderingDevice : public RenderingDevice {
     void Destroy(UniformSetID uniformSet) override;
     void Destroy(BufferID buffer) override;
     void Destroy(FenceID fence) override;
+    void Destroy(QueryPoolID queryPool) override;
 
     Device *GetDevice(int index) override {
         return &gpus[index];
@@ -135,6 +170,9 @@ class VulkanRenderingDevice : public RenderingDevice {
     std::vector<VkPhysicalDevice> physicalDevices;
 
     VkPhysicalDeviceConservativeRasterizationPropertiesEXT conservativeRasterProps{};
+    VkPhysicalDeviceLimits deviceLimits{};
+    VkPhysicalDeviceProperties deviceProperties{};
+    VkPhysicalDeviceIDProperties deviceIDProperties{};
     VkPhysicalDeviceFeatures2 deviceFeatures2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
     VkPhysicalDeviceVulkan11Features deviceFeatures11 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES};
     VkPhysicalDeviceVulkan12Features deviceFeatures12 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
@@ -152,10 +190,41 @@ class VulkanRenderingDevice : public RenderingDevice {
     VmaAllocator vmaAllocator = VK_NULL_HANDLE;
     VkSurfaceKHR surface = VK_NULL_HANDLE;
     VkSemaphore timelineSemaphore = VK_NULL_HANDLE;
-    VkSemaphore renderEndSemaphore = VK_NULL_HANDLE;
-    VkSemaphore imageAcquireSemaphore = VK_NULL_HANDLE;
     uint64_t lastSemaphoreValue_ = 0;
 
+    // Signalled by SubmitUpload, the frame submits wait for lastUploadValue_
+    VkSemaphore uploadSemaphore = VK_NULL_HANDLE;
+    uint64_t lastUploadValue_ = 0;
+    // The uploads are submitted from the loader thread, a queue may be
+    // shared by several queue types
+    std::mutex queueSubmitMutex;
+
+    struct FrameContext {
+        CommandPoolID commandPool;
+        CommandBufferID commandBuffer;
+        VkSemaphore imageAcquireSemaphore = VK_NULL_HANDLE;
+        VkSemaphore renderEndSemaphore = VK_NULL_HANDLE;
+        // Timeline value signalled by the last submit of this slot
+        uint64_t semaphoreValue = 0;
+        // Transient uniform sets, the pools are reset in bulk when the slot
+        // comes back
+        std::vector<VkDescriptorPool> transientPools;
+        uint32_t transientPoolIndex = 0;
+        std::vector<uint64_t> transientUniformSets;
+    };
+    FrameContext frames[MAX_FRAMES_IN_FLIGHT];
+    uint32_t frameIndex = 0;
+
+    // Destruction of resources the frames in flight may still use, run once
+    // the timeline semaphore reaches semaphoreValue
+    struct PendingDestroy {
+        uint64_t semaphoreValue;
+        std::function<void()> destroy;
+    };
+    std::deque<PendingDestroy> pendingDestroys;
+
+    TransientAllocator transientAllocator;
+
     struct VulkanShader {
         VkShaderModule shaderModule;
         std::vector<RD::UniformBinding> layoutBindings;
@@ -206,15 +275,38 @@ class VulkanRenderingDevice : public RenderingDevice {
     struct VulkanBuffer {
         VkBuffer buffer;
         VmaAllocation allocation;
-        uint32_t size;
+        VkDeviceSize size;
         uint32_t samplerId;
         bool mapped;
     };
 
     struct VulkanUniformSet {
         VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
-        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
         uint32_t set = 0;
+        // CreateUniformSet calls sharing the set through the cache
+        uint32_t refCount = 0;
+        uint64_t hash = 0;
+        bool cached = false;
+        bool transient = false;
+        // Compared on a cache hit and checked when a resource is destroyed
+        std::vector<BoundUniform> uniforms;
+    };
+
+    // Set layout shared by the pipelines declaring the same bindings
+    struct CachedSetLayout {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        VkDescriptorSetLayout layout;
+    };
+
+    // Descriptor sets of one set layout. A new pool twice as large is added
+    // when the last one is full and destroyed sets are recycled, not freed
+    struct DescriptorLayoutPool {
+        // Descriptors of a single set
+        std::vector<VkDescriptorPoolSize> setSizes;
+        std::vector<VkDescriptorPool> pools;
+        uint32_t nextPoolSetCount = 8;
+        std::vector<VkDescriptorSet> freeSets;
     };
 
     std::unique_ptr<VulkanSwapchain> swapchain;
@@ -231,17 +323,35 @@ class VulkanRenderingDevice : public RenderingDevice {
     ResourcePool<VulkanUniformSet> _uniformSets;
     ResourcePool<VulkanBuffer> _buffers;
     ResourcePool<VkFence> _fences;
+    ResourcePool<VkQueryPool> _queryPools;
     std::vector<VkCommandBuffer> _commandBuffers;
 
-    VkDescriptorPool _descriptorPool;
+    // Hash of the bindings to the set layouts, shared by the pipelines with
+    // the same bindings and live until shutdown, the pools are per layout
+    std::unordered_multimap<uint64_t, CachedSetLayout> setLayoutCache;
+    std::unordered_map<VkDescriptorSetLayout, DescriptorLayoutPool> descriptorLayoutPools;
+    // Hash of the layout and the bound uniforms to the uniform set
+    std::unordered_multimap<uint64_t, uint64_t> uniformSetCache;
+    // Guards the layout cache and pools, pipelines are created in parallel
+    std::mutex descriptorMutex;
+
+    // Loaded from disk at startup and written back at shutdown when new
+    // pipelines were compiled
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    size_t loadedPipelineCacheSize = 0;
+
+    // The ImGui backend allocates and frees its own sets
+    VkDescriptorPool _imguiDescriptorPool;
     VkDescriptorPool _bindlessDescriptorPool;
     VkDescriptorSetLayout _bindlessDescriptorSetLayout;
     VkDescriptorSet _bindlessDescriptorSet;
 
     static const uint32_t MAX_SET_COUNT = 4;
+    static const uint32_t MAX_BINDING_COUNT = 16;
     static const uint32_t MAX_BINDLESS_RESOURCES = 16536;
     static const uint32_t BINDLESS_TEXTURE_BINDING = 10;
     static const uint32_t BINDLESS_TEXTURE_SET = 1;
+    static const uint32_t TRANSIENT_BUFFER_FRAME_SIZE = 4 * 1024 * 1024;
 
     uint64_t memoryUsage = 0;
     void *_platformData;
@@ -254,11 +364,25 @@ class VulkanRenderingDevice : public RenderingDevice {
     void InitializeDevice(uint32_t deviceIndex);
     void InitializeDevices();
     void InitializeAllocator();
+    void LoadPipelineCache();
+    void SavePipelineCache();
+
+    uint64_t GetCompletedSemaphoreValue();
+    void DeferDestroy(std::function<void()> &&destroy);
+    void FlushPendingDestroys(uint64_t completedValue);
 
     VkDevice CreateDevice(VkPhysicalDevice physicalDevice, std::vector<const char *> &enabledExtensions);
     VkSwapchainKHR CreateSwapchainInternal(std::unique_ptr<VulkanSwapchain> &swapchain);
-    VkDescriptorPool CreateDescriptorPool(VkDescriptorPoolSize *poolSizes, uint32_t poolCount, VkDescriptorPoolCreateFlags flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+    VkDescriptorPool CreateDescriptorPool(VkDescriptorPoolSize *poolSizes, uint32_t poolCount, uint32_t maxSets, VkDescriptorPoolCreateFlags flags = 0);
     VkDescriptorSetLayout CreateDescriptorSetLayout(VkDescriptorSetLayoutBinding *binding, uint32_t bindingCount, VkDescriptorSetLayoutCreateFlags flags = 0);
+    VkDescriptorSetLayout GetDescriptorSetLayout(VkDescriptorSetLayoutBinding *bindings, uint32_t bindingCount);
+    VkDescriptorSet AllocateDescriptorSet(VkDescriptorSetLayout layout);
+    VkDescriptorSet AllocateTransientDescriptorSet(FrameContext &frame, VkDescriptorSetLayout layout);
+    void WriteDescriptorSet(VkDescriptorSet descriptorSet, BoundUniform *uniforms, uint32_t uniformCount);
+    void ResetTransientUniformSets(FrameContext &frame);
+    // Destroyed resource IDs are reused, the sets bound to them must not be
+    // returned by the cache anymore
+    void EvictCachedUniformSets(uint64_t resourceID, bool texture);
     VkPipelineLayout CreatePipelineLayout(std::vector<VkDescriptorSetLayout> &setLayouts, std::vector<VkPushConstantRange> &pushConstantRanges);
     VkImageMemoryBarrier CreateImageBarrier(VkImage image,
                                             VkImageAspectFlags aspect,
@@ -0,0 +1,224 @@
+#include "pch.h"
+
+#include "cpu-octree-kernels.h"
+#include "cpu-octree-utils.h"
+#include "rendering/null-rendering-device.h"
+#include "voxelizer/voxel-fragment-sorter.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+namespace octree::kernels {
+    // Must match the layout of OctreeBuildInfo in the shaders
+    struct BuildInfo {
+        uint32_t allocationBegin;
+        uint32_t allocationCount;
+        uint32_t allocatedThisFrame;
+    };
+
+    struct TagNodePushConstants {
+        uint32_t voxelCount;
+        uint32_t level;
+        uint32_t voxelDims;
+    };
+
+    struct MortonPushConstants {
+        uint32_t voxelCount;
+        uint32_t tileCount;
+        uint32_t maxLevel;
+    };
+
+    struct FilterPushConstants {
+        uint32_t nodeBegin;
+        uint32_t nodeEnd;
+    };
+
+    static constexpr uint32_t kLocalSize = 32;
+    static constexpr uint32_t kTileSize = VoxelFragmentSorter::kTileSize;
+
+    // octree-init-node.comp
+    static void InitNode(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *octree = context.GetBuffer<uint32_t>(0, 0);
+        BuildInfo *buildInfo = context.GetBuffer<BuildInfo>(0, 1);
+
+        uint32_t threadCount = std::min(context.workGroupCount[0] * kLocalSize, buildInfo->allocationCount);
+        std::memset(octree + buildInfo->allocationBegin, 0, threadCount * sizeof(uint32_t));
+    }
+
+    // octree-tag-node.comp
+    static void TagNode(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *octree = context.GetBuffer<uint32_t>(0, 0);
+        const uint64_t *voxelKeys = context.GetBuffer<uint64_t>(0, 1);
+        const uint32_t *voxelColors = context.GetBuffer<uint32_t>(0, 2);
+        const TagNodePushConstants &params = context.GetPushConstants<TagNodePushConstants>();
+
+        const uint32_t leafNodeLevel = static_cast<uint32_t>(std::log2(params.voxelDims));
+        uint64_t threadCount = std::min<uint64_t>(uint64_t(context.workGroupCount[0]) * kLocalSize, params.voxelCount);
+        for (uint64_t threadId = 0; threadId < threadCount; ++threadId) {
+            glm::vec3 position = glm::vec3(utils::DecodeMorton(voxelKeys[threadId])) - float(params.voxelDims) * 0.5f;
+
+            uint32_t childIndex = 0;
+            uint32_t node = octree[0];
+            glm::vec3 center = glm::vec3(0.0f);
+            bool bFlag = true;
+
+            float halfDims = params.voxelDims * 0.5f;
+            for (uint32_t i = 0; i < params.level; ++i) {
+                halfDims *= 0.5f;
+                if ((node & 0x80000000) == 0) {
+                    bFlag = false;
+                    break;
+                }
+
+                childIndex += node & 0x3FFFFFFF;
+                glm::ivec3 region = glm::ivec3(glm::greaterThanEqual(position, center));
+                childIndex += region.x + region.y * 2 + region.z * 4;
+                center += (glm::vec3(region) * 2.0f - 1.0f) * halfDims;
+                node = octree[childIndex];
+            }
+
+            if (bFlag) {
+                if (params.level == leafNodeLevel)
+                    octree[childIndex] = (voxelColors[threadId] & utils::COLOR_MASK) | 0x40000000;
+                octree[childIndex] |= 0x80000000;
+            }
+        }
+    }
+
+    // octree-allocate-node.comp
+    static void AllocateNode(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *octree = context.GetBuffer<uint32_t>(0, 0);
+        BuildInfo *buildInfo = context.GetBuffer<BuildInfo>(0, 1);
+
+        uint32_t threadCount = std::min(context.workGroupCount[0] * kLocalSize, buildInfo->allocationCount);
+        for (uint32_t id = 0; id < threadCount; ++id) {
+            uint32_t currentNode = buildInfo->allocationBegin + id;
+            if ((octree[currentNode] & 0x80000000) != 0) {
+                uint32_t offset = buildInfo->allocatedThisFrame;
+                buildInfo->allocatedThisFrame += 8;
+                octree[currentNode] |= buildInfo->allocationCount + offset - id;
+            }
+        }
+    }
+
+    // octree-update-params.comp
+    static void UpdateParams(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *dispatchParams = context.GetBuffer<uint32_t>(0, 0);
+        BuildInfo *buildInfo = context.GetBuffer<BuildInfo>(0, 1);
+
+        buildInfo->allocationBegin = buildInfo->allocationBegin + buildInfo->allocationCount;
+        buildInfo->allocationCount = buildInfo->allocatedThisFrame;
+        buildInfo->allocatedThisFrame = 0;
+        dispatchParams[0] = (buildInfo->allocationCount + kLocalSize - 1) / kLocalSize;
+    }
+
+    static uint32_t GetNodeLevel(const uint64_t *voxelKeys, uint32_t index, uint32_t maxLevel) {
+        return index == 0 ? 0 : utils::GetSplitLevel(voxelKeys[index - 1], voxelKeys[index], maxLevel);
+    }
+
+    // octree-morton-count.comp
+    static void MortonCount(const NullRenderingDevice::ComputeContext &context) {
+        const uint64_t *voxelKeys = context.GetBuffer<uint64_t>(0, 0);
+        uint32_t *nodeCounts = context.GetBuffer<uint32_t>(0, 1);
+        const MortonPushConstants &params = context.GetPushConstants<MortonPushConstants>();
+
+        for (uint32_t tile = 0; tile < context.workGroupCount[0]; ++tile) {
+            uint32_t counts[utils::kMaxOctreeLevels] = {};
+            uint32_t end = std::min((tile + 1) * kTileSize, params.voxelCount);
+            for (uint32_t i = tile * kTileSize; i < end; ++i) {
+                for (uint32_t level = GetNodeLevel(voxelKeys, i, params.maxLevel); level <= params.maxLevel; ++level)
+                    counts[level]++;
+            }
+
+            for (uint32_t level = 0; level <= params.maxLevel; ++level)
+                nodeCounts[level * params.tileCount + tile] = counts[level];
+        }
+    }
+
+    // octree-morton-write.comp
+    static void MortonWrite(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *octree = context.GetBuffer<uint32_t>(0, 0);
+        const uint64_t *voxelKeys = context.GetBuffer<uint64_t>(0, 1);
+        const uint32_t *nodeOffsets = context.GetBuffer<uint32_t>(0, 2);
+        const uint32_t *voxelColors = context.GetBuffer<uint32_t>(0, 3);
+        const MortonPushConstants &params = context.GetPushConstants<MortonPushConstants>();
+
+        auto getLevelBase = [&](uint32_t level) {
+            return level == 0 ? 0 : 1 + 8 * nodeOffsets[(level - 1) * params.tileCount];
+        };
+
+        for (uint32_t tile = 0; tile < context.workGroupCount[0]; ++tile) {
+            uint32_t ranks[utils::kMaxOctreeLevels];
+            for (uint32_t level = 0; level <= params.maxLevel; ++level)
+                ranks[level] = nodeOffsets[level * params.tileCount + tile] - nodeOffsets[level * params.tileCount] - 1;
+
+            uint32_t end = std::min((tile + 1) * kTileSize, params.voxelCount);
+            for (uint32_t i = tile * kTileSize; i < end; ++i) {
+                uint64_t key = voxelKeys[i];
+                for (uint32_t level = GetNodeLevel(voxelKeys, i, params.maxLevel); level <= params.maxLevel; ++level) {
+                    uint32_t rank = ++ranks[level];
+                    uint32_t slot = level == 0 ? 0 : getLevelBase(level) + ranks[level - 1] * 8 + utils::GetChildIndex(key, level, params.maxLevel);
+
+                    if (level == params.maxLevel)
+                        octree[slot] = (voxelColors[i] & utils::COLOR_MASK) | 0x40000000 | 0x80000000;
+                    else
+                        octree[slot] = (getLevelBase(level + 1) + rank * 8 - slot) | 0x80000000;
+                }
+            }
+        }
+    }
+
+    // octree-filter-attributes.comp
+    static void FilterAttributes(const NullRenderingDevice::ComputeContext &context) {
+        const uint32_t *octree = context.GetBuffer<uint32_t>(0, 0);
+        glm::uvec2 *attributes = context.GetBuffer<glm::uvec2>(0, 1);
+        const FilterPushConstants &range = context.GetPushConstants<FilterPushConstants>();
+
+        uint32_t end = std::min(range.nodeBegin + context.workGroupCount[0] * kLocalSize, range.nodeEnd);
+        for (uint32_t id = range.nodeBegin; id < end; ++id) {
+            uint32_t node = octree[id];
+            if ((node & 0x80000000) == 0)
+                continue;
+
+            if ((node & 0x40000000) != 0) {
+                attributes[id] = glm::uvec2((node & utils::COLOR_MASK) | 0xFF000000, 0u);
+                continue;
+            }
+
+            uint32_t first = id + (node & 0x3FFFFFFF);
+            glm::vec3 color = glm::vec3(0.0f), normal = glm::vec3(0.0f);
+            float coverage = 0.0f, weightSum = 0.0f;
+            for (uint32_t i = 0; i < 8; ++i) {
+                glm::vec3 offset = glm::vec3(float(i & 1), float((i >> 1) & 1), float((i >> 2) & 1)) * 2.0f - 1.0f;
+                uint32_t child = octree[first + i];
+                if ((child & 0x80000000) == 0) {
+                    normal += offset;
+                    continue;
+                }
+
+                glm::uvec2 childAttributes = (child & 0x40000000) != 0 ? glm::uvec2(child | 0xFF000000, 0u) : attributes[first + i];
+                glm::vec4 childColor = glm::unpackUnorm4x8(childAttributes.x);
+                float weight = std::max(childColor.a, 1.0f / 255.0f);
+                color += glm::vec3(childColor) * weight;
+                normal += glm::vec3(glm::unpackSnorm4x8(childAttributes.y)) * weight;
+                coverage += childColor.a;
+                weightSum += weight;
+            }
+
+            color /= weightSum;
+            float normalLength = glm::length(normal);
+            normal = normalLength > 1e-4f ? normal / normalLength : glm::vec3(0.0f);
+            attributes[id] = glm::uvec2(glm::packUnorm4x8(glm::vec4(color, coverage / 8.0f)), glm::packSnorm4x8(glm::vec4(normal, 0.0f)));
+        }
+    }
+
+    void Register(NullRenderingDevice *device) {
+        device->RegisterComputeKernel("octree-init-node.comp", InitNode);
+        device->RegisterComputeKernel("octree-tag-node.comp", TagNode);
+        device->RegisterComputeKernel("octree-allocate-node.comp", AllocateNode);
+        device->RegisterComputeKernel("octree-update-params.comp", UpdateParams);
+        device->RegisterComputeKernel("octree-morton-count.comp", MortonCount);
+        device->RegisterComputeKernel("octree-morton-write.comp", MortonWrite);
+        device->RegisterComputeKernel("octree-filter-attributes.comp", FilterAttributes);
+    }
+} // namespace octree::kernels
@@ -0,0 +1,10 @@
+#pragma once
+
+class NullRenderingDevice;
+
+namespace octree::kernels {
+
+    // Registers the CPU ports of the octree build compute shaders so that
+    // OctreeBuilder can run on the headless null device
+    void Register(NullRenderingDevice *device);
+};
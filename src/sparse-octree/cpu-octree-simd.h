@@ -0,0 +1,141 @@
+#pragma once
+
+// Thin wrapper over the SIMD registers used by the packet traversal of
+// cpu-octree-tracer, the widest instruction set enabled at compile time
+// is used. Masks are Int lanes with every bit set.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OCTREE_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCTREE_SIMD_WIDTH 4
+#else
+#define OCTREE_SIMD_WIDTH 1
+#endif
+
+namespace octree::simd {
+
+    static constexpr uint32_t kWidth = OCTREE_SIMD_WIDTH;
+
+#if OCTREE_SIMD_WIDTH == 8
+    struct Float {
+        __m256 v;
+    };
+    struct Int {
+        __m256i v;
+    };
+
+    inline Float SetFloat(float value) { return {_mm256_set1_ps(value)}; }
+    inline Int SetInt(uint32_t value) { return {_mm256_set1_epi32(static_cast<int>(value))}; }
+    inline Float LoadFloat(const float *data) { return {_mm256_load_ps(data)}; }
+    inline Int LoadInt(const uint32_t *data) { return {_mm256_load_si256(reinterpret_cast<const __m256i *>(data))}; }
+    inline void Store(float *data, Float a) { _mm256_store_ps(data, a.v); }
+    inline void Store(uint32_t *data, Int a) { _mm256_store_si256(reinterpret_cast<__m256i *>(data), a.v); }
+
+    inline Float operator+(Float a, Float b) { return {_mm256_add_ps(a.v, b.v)}; }
+    inline Float operator-(Float a, Float b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    inline Float operator*(Float a, Float b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    inline Float Min(Float a, Float b) { return {_mm256_min_ps(a.v, b.v)}; }
+
+    inline Int operator+(Int a, Int b) { return {_mm256_add_epi32(a.v, b.v)}; }
+    inline Int operator&(Int a, Int b) { return {_mm256_and_si256(a.v, b.v)}; }
+    inline Int operator|(Int a, Int b) { return {_mm256_or_si256(a.v, b.v)}; }
+    inline Int operator^(Int a, Int b) { return {_mm256_xor_si256(a.v, b.v)}; }
+    // ~a & b
+    inline Int AndNot(Int a, Int b) { return {_mm256_andnot_si256(a.v, b.v)}; }
+    template <int Count>
+    inline Int ShiftLeft(Int a) { return {_mm256_slli_epi32(a.v, Count)}; }
+    // Lanes shifted by 32 or more are zero
+    inline Int ShiftLeft(Int a, Int count) { return {_mm256_sllv_epi32(a.v, count.v)}; }
+    inline Int ShiftRight(Int a, Int count) { return {_mm256_srlv_epi32(a.v, count.v)}; }
+
+    inline Int AsInt(Float a) { return {_mm256_castps_si256(a.v)}; }
+    inline Float AsFloat(Int a) { return {_mm256_castsi256_ps(a.v)}; }
+
+    inline Int Equal(Int a, Int b) { return {_mm256_cmpeq_epi32(a.v, b.v)}; }
+    inline Int LessEqual(Float a, Float b) { return AsInt({_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}); }
+    inline Int Less(Float a, Float b) { return AsInt({_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}); }
+    inline Int Greater(Float a, Float b) { return AsInt({_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}); }
+
+    inline Float Select(Int mask, Float a, Float b) { return {_mm256_blendv_ps(b.v, a.v, AsFloat(mask).v)}; }
+    inline Int Select(Int mask, Int a, Int b) { return {_mm256_blendv_epi8(b.v, a.v, mask.v)}; }
+    inline uint32_t MoveMask(Int mask) { return static_cast<uint32_t>(_mm256_movemask_ps(AsFloat(mask).v)); }
+
+    // base[index] for the lanes in mask, the other lanes keep a
+    inline Int Gather(const uint32_t *base, Int index, Int mask, Int a) {
+        return {_mm256_mask_i32gather_epi32(a.v, reinterpret_cast<const int *>(base), index.v, mask.v, 4)};
+    }
+#elif OCTREE_SIMD_WIDTH == 4
+    struct Float {
+        __m128 v;
+    };
+    struct Int {
+        __m128i v;
+    };
+
+    inline Float SetFloat(float value) { return {_mm_set1_ps(value)}; }
+    inline Int SetInt(uint32_t value) { return {_mm_set1_epi32(static_cast<int>(value))}; }
+    inline Float LoadFloat(const float *data) { return {_mm_load_ps(data)}; }
+    inline Int LoadInt(const uint32_t *data) { return {_mm_load_si128(reinterpret_cast<const __m128i *>(data))}; }
+    inline void Store(float *data, Float a) { _mm_store_ps(data, a.v); }
+    inline void Store(uint32_t *data, Int a) { _mm_store_si128(reinterpret_cast<__m128i *>(data), a.v); }
+
+    inline Float operator+(Float a, Float b) { return {_mm_add_ps(a.v, b.v)}; }
+    inline Float operator-(Float a, Float b) { return {_mm_sub_ps(a.v, b.v)}; }
+    inline Float operator*(Float a, Float b) { return {_mm_mul_ps(a.v, b.v)}; }
+    inline Float Min(Float a, Float b) { return {_mm_min_ps(a.v, b.v)}; }
+
+    inline Int operator+(Int a, Int b) { return {_mm_add_epi32(a.v, b.v)}; }
+    inline Int operator&(Int a, Int b) { return {_mm_and_si128(a.v, b.v)}; }
+    inline Int operator|(Int a, Int b) { return {_mm_or_si128(a.v, b.v)}; }
+    inline Int operator^(Int a, Int b) { return {_mm_xor_si128(a.v, b.v)}; }
+    // ~a & b
+    inline Int AndNot(Int a, Int b) { return {_mm_andnot_si128(a.v, b.v)}; }
+    template <int Count>
+    inline Int ShiftLeft(Int a) { return {_mm_slli_epi32(a.v, Count)}; }
+
+    // SSE2 has no per lane shifts
+    inline Int ShiftLeft(Int a, Int count) {
+        alignas(16) uint32_t values[4], counts[4];
+        Store(values, a);
+        Store(counts, count);
+        for (uint32_t i = 0; i < 4; ++i)
+            values[i] = counts[i] < 32 ? values[i] << counts[i] : 0;
+        return LoadInt(values);
+    }
+
+    inline Int ShiftRight(Int a, Int count) {
+        alignas(16) uint32_t values[4], counts[4];
+        Store(values, a);
+        Store(counts, count);
+        for (uint32_t i = 0; i < 4; ++i)
+            values[i] = counts[i] < 32 ? values[i] >> counts[i] : 0;
+        return LoadInt(values);
+    }
+
+    inline Int AsInt(Float a) { return {_mm_castps_si128(a.v)}; }
+    inline Float AsFloat(Int a) { return {_mm_castsi128_ps(a.v)}; }
+
+    inline Int Equal(Int a, Int b) { return {_mm_cmpeq_epi32(a.v, b.v)}; }
+    inline Int LessEqual(Float a, Float b) { return AsInt({_mm_cmple_ps(a.v, b.v)}); }
+    inline Int Less(Float a, Float b) { return AsInt({_mm_cmplt_ps(a.v, b.v)}); }
+    inline Int Greater(Float a, Float b) { return AsInt({_mm_cmpgt_ps(a.v, b.v)}); }
+
+    inline Int Select(Int mask, Int a, Int b) { return (mask & a) | AndNot(mask, b); }
+    inline Float Select(Int mask, Float a, Float b) { return AsFloat(Select(mask, AsInt(a), AsInt(b))); }
+    inline uint32_t MoveMask(Int mask) { return static_cast<uint32_t>(_mm_movemask_ps(AsFloat(mask).v)); }
+
+    // base[index] for the lanes in mask, the other lanes keep a
+    inline Int Gather(const uint32_t *base, Int index, Int mask, Int a) {
+        alignas(16) uint32_t values[4], indices[4];
+        Store(values, a);
+        Store(indices, index);
+        uint32_t bits = MoveMask(mask);
+        for (uint32_t i = 0; i < 4; ++i) {
+            if (bits & (1u << i))
+                values[i] = base[indices[i]];
+        }
+        return LoadInt(values);
+    }
+#endif
+} // namespace octree::simd
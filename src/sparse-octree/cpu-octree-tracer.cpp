@@ -0,0 +1,468 @@
+#include "pch.h"
+#include "cpu-octree-tracer.h"
+#include "cpu-octree-utils.h"
+
+#include "tinygltf/stb_image_write.h"
+
+#include <bit>
+#include <glm/gtc/packing.hpp>
+
+namespace octree::tracer {
+
+    static constexpr float kEpsilon = 3.552713678800501e-15f;
+
+    // Pixels of a RenderImage tile, a multiple of every packet size
+    static constexpr uint32_t kTileSize = 16;
+
+    static float MinComponent(const glm::vec3 &v) {
+        return std::min(std::min(v.x, v.y), v.z);
+    }
+
+    static float MaxComponent(const glm::vec3 &v) {
+        return std::max(std::max(v.x, v.y), v.z);
+    }
+
+    // State of a ray entering the root, shared by the scalar and the packet
+    // traversal
+    struct RaySetup {
+        // Direction with the zero components replaced by kEpsilon
+        glm::vec3 direction;
+        glm::vec3 tCoef;
+        glm::vec3 tBias;
+        uint32_t octMask;
+        float tMin;
+        float tMax;
+        glm::vec3 pos;
+        uint32_t idx;
+    };
+
+    static RaySetup SetupRay(const Ray &ray) {
+        RaySetup setup;
+        glm::vec3 &d = setup.direction;
+        d = ray.direction;
+        for (int i = 0; i < 3; ++i)
+            d[i] = std::abs(d[i]) > kEpsilon ? d[i] : (d[i] >= 0.0f ? kEpsilon : -kEpsilon);
+
+        // The octree is mirrored so that the ray direction is negative on
+        // every axis, octMask undoes it for the child indices
+        setup.tCoef = 1.0f / -glm::abs(d);
+        setup.tBias = setup.tCoef * ray.origin;
+
+        setup.octMask = 0;
+        for (uint32_t i = 0; i < 3; ++i) {
+            if (d[i] > 0.0f) {
+                setup.octMask ^= 1u << i;
+                setup.tBias[i] = 3.0f * setup.tCoef[i] - setup.tBias[i];
+            }
+        }
+
+        setup.tMin = std::max(MaxComponent(2.0f * setup.tCoef - setup.tBias), 0.0f);
+        setup.tMax = MinComponent(setup.tCoef - setup.tBias);
+
+        setup.pos = glm::vec3(1.0f);
+        setup.idx = 0;
+        for (uint32_t i = 0; i < 3; ++i) {
+            if (1.5f * setup.tCoef[i] - setup.tBias[i] > setup.tMin) {
+                setup.idx ^= 1u << i;
+                setup.pos[i] = 1.5f;
+            }
+        }
+        return setup;
+    }
+
+    // Position and normal of the cube the traversal stopped at
+    static void FinishRay(const Ray &ray, const RaySetup &setup, glm::vec3 pos, float scaleExp2, float tMin, RayHit &outHit) {
+        glm::vec3 tCorner = setup.tCoef * (pos + scaleExp2) - setup.tBias;
+        glm::vec3 normal = (tCorner.x > tCorner.y && tCorner.x > tCorner.z)
+                               ? glm::vec3(-1.0f, 0.0f, 0.0f)
+                               : (tCorner.y > tCorner.z ? glm::vec3(0.0f, -1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, -1.0f));
+
+        // Undo the mirroring of the coordinate system
+        for (uint32_t i = 0; i < 3; ++i) {
+            if ((setup.octMask & (1u << i)) == 0)
+                normal[i] = -normal[i];
+            else
+                pos[i] = 3.0f - scaleExp2 - pos[i];
+        }
+
+        glm::vec3 position = glm::clamp(ray.origin + tMin * setup.direction, pos, pos + scaleExp2);
+        for (uint32_t i = 0; i < 3; ++i) {
+            if (normal[i] != 0.0f)
+                position[i] = normal[i] > 0.0f ? pos[i] + scaleExp2 + kEpsilon * 2.0f : pos[i] - kEpsilon;
+        }
+
+        outHit.position = position;
+        outHit.normal = normal;
+        outHit.t = tMin;
+    }
+
+    bool RayMarchLeaf(const uint32_t *octree, const Ray &ray, RayHit &outHit) {
+        struct StackItem {
+            uint32_t node;
+            float tMax;
+        } stack[kStackSize + 1];
+
+        const RaySetup setup = SetupRay(ray);
+        const glm::vec3 tCoef = setup.tCoef;
+        const glm::vec3 tBias = setup.tBias;
+        const uint32_t octMask = setup.octMask;
+
+        float tMin = setup.tMin;
+        float tMax = setup.tMax;
+        float h = tMax;
+
+        uint32_t parent = 1;
+        uint32_t cur = 0;
+        glm::vec3 pos = setup.pos;
+        uint32_t idx = setup.idx;
+
+        uint32_t scale = kStackSize - 1;
+        float scaleExp2 = 0.5f;
+        uint32_t iterations = 0;
+        uint32_t stackDepth = 0;
+
+        while (scale < kStackSize) {
+            ++iterations;
+            uint32_t childIndex = idx ^ octMask;
+            if (cur == 0)
+                cur = octree[parent + childIndex];
+
+            glm::vec3 tCorner = pos * tCoef - tBias;
+            float tcMax = MinComponent(tCorner);
+
+            if ((cur & utils::INTERNAL_NODE_MASK) && tMin <= tMax) {
+                // INTERSECT
+                float tvMax = std::min(tMax, tcMax);
+                float halfScaleExp2 = scaleExp2 * 0.5f;
+                glm::vec3 tCenter = halfScaleExp2 * tCoef + tCorner;
+
+                if (tMin <= tvMax) {
+                    if (cur & utils::LEAF_NODE_MASK)
+                        break;
+
+                    // PUSH
+                    if (tcMax < h) {
+                        stack[scale] = {parent, tMax};
+                        stackDepth = std::max(stackDepth, kStackSize - scale);
+                    }
+                    h = tcMax;
+
+                    parent += (cur & utils::CHILD_PTR_MASK) + childIndex;
+
+                    idx = 0;
+                    --scale;
+                    scaleExp2 = halfScaleExp2;
+                    for (uint32_t i = 0; i < 3; ++i) {
+                        if (tCenter[i] > tMin) {
+                            idx ^= 1u << i;
+                            pos[i] += scaleExp2;
+                        }
+                    }
+
+                    cur = 0;
+                    tMax = tvMax;
+                    continue;
+                }
+            }
+
+            // ADVANCE
+            uint32_t stepMask = 0;
+            for (uint32_t i = 0; i < 3; ++i) {
+                if (tCorner[i] <= tcMax) {
+                    stepMask ^= 1u << i;
+                    pos[i] -= scaleExp2;
+                }
+            }
+
+            tMin = tcMax;
+            idx ^= stepMask;
+
+            if (idx & stepMask) {
+                // POP
+                // Highest differing bit between the two positions
+                uint32_t differingBits = 0;
+                for (uint32_t i = 0; i < 3; ++i) {
+                    if (stepMask & (1u << i))
+                        differingBits |= std::bit_cast<uint32_t>(pos[i]) ^ std::bit_cast<uint32_t>(pos[i] + scaleExp2);
+                }
+                scale = static_cast<uint32_t>(std::bit_width(differingBits)) - 1;
+                if (scale >= kStackSize)
+                    break;
+                scaleExp2 = std::bit_cast<float>((scale - kStackSize + 127u) << 23u);
+
+                parent = stack[scale].node;
+                tMax = stack[scale].tMax;
+
+                // Round the position to the parent and extract the child slot
+                idx = 0;
+                for (uint32_t i = 0; i < 3; ++i) {
+                    uint32_t shifted = std::bit_cast<uint32_t>(pos[i]) >> scale;
+                    pos[i] = std::bit_cast<float>(shifted << scale);
+                    idx |= (shifted & 1u) << i;
+                }
+
+                h = 0.0f;
+                cur = 0;
+            }
+        }
+
+        bool hit = scale < kStackSize && tMin <= tMax;
+        FinishRay(ray, setup, pos, scaleExp2, tMin, outHit);
+        outHit.color = hit ? octree[parent + (idx ^ octMask)] & utils::COLOR_MASK : 0;
+        outHit.iterations = iterations;
+        outHit.stackDepth = stackDepth;
+        return hit;
+    }
+
+#if OCTREE_SIMD_WIDTH > 1
+    // Every lane runs the loop of RayMarchLeaf and drops out when it stops,
+    // the updates of each step are masked with the lanes taking it. The
+    // stack and the pop scale are per lane and stay scalar.
+    uint32_t RayMarchPacket(const uint32_t *octree, const Ray *rays, uint32_t rayCount, RayHit *outHits) {
+        using namespace simd;
+        constexpr uint32_t N = kPacketSize;
+        assert(rayCount <= N);
+
+        RaySetup setups[N];
+        alignas(32) float coef[3][N], bias[3][N], pos[3][N], tMins[N], tMaxs[N];
+        alignas(32) uint32_t octMasks[N], indices[N], lanes[N];
+        for (uint32_t lane = 0; lane < N; ++lane) {
+            // Unused lanes trace the first ray but never take part
+            setups[lane] = SetupRay(rays[lane < rayCount ? lane : 0]);
+            for (uint32_t i = 0; i < 3; ++i) {
+                coef[i][lane] = setups[lane].tCoef[i];
+                bias[i][lane] = setups[lane].tBias[i];
+                pos[i][lane] = setups[lane].pos[i];
+            }
+            tMins[lane] = setups[lane].tMin;
+            tMaxs[lane] = setups[lane].tMax;
+            octMasks[lane] = setups[lane].octMask;
+            indices[lane] = setups[lane].idx;
+            lanes[lane] = lane < rayCount ? ~0u : 0u;
+        }
+
+        const Float tCoefX = LoadFloat(coef[0]), tCoefY = LoadFloat(coef[1]), tCoefZ = LoadFloat(coef[2]);
+        const Float tBiasX = LoadFloat(bias[0]), tBiasY = LoadFloat(bias[1]), tBiasZ = LoadFloat(bias[2]);
+        const Int octMask = LoadInt(octMasks);
+        const Int zero = SetInt(0), one = SetInt(1), two = SetInt(2), four = SetInt(4);
+        const Float zeroFloat = SetFloat(0.0f), half = SetFloat(0.5f);
+
+        Float posX = LoadFloat(pos[0]), posY = LoadFloat(pos[1]), posZ = LoadFloat(pos[2]);
+        Float tMin = LoadFloat(tMins);
+        Float tMax = LoadFloat(tMaxs);
+        Float h = tMax;
+        Float scaleExp2 = half;
+        Int parent = one;
+        Int cur = zero;
+        Int idx = LoadInt(indices);
+        Int scale = SetInt(kStackSize - 1);
+        Int active = LoadInt(lanes);
+        Int leafMask = zero;
+        Int iterations = zero;
+
+        uint32_t stackNode[kStackSize + 1][N];
+        float stackTMax[kStackSize + 1][N];
+        uint32_t stackDepth[N] = {};
+        alignas(32) uint32_t scales[N], parents[N], bits[N];
+        alignas(32) float values[N];
+
+        while (MoveMask(active)) {
+            iterations = iterations + (active & one);
+            Int childIndex = idx ^ octMask;
+            Int fetch = active & Equal(cur, zero);
+            if (MoveMask(fetch))
+                cur = Gather(octree, parent + childIndex, fetch, cur);
+
+            Float tCornerX = posX * tCoefX - tBiasX;
+            Float tCornerY = posY * tCoefY - tBiasY;
+            Float tCornerZ = posZ * tCoefZ - tBiasZ;
+            Float tcMax = Min(Min(tCornerX, tCornerY), tCornerZ);
+
+            // INTERSECT
+            Int valid = AndNot(Equal(cur & SetInt(utils::INTERNAL_NODE_MASK), zero), active) & LessEqual(tMin, tMax);
+            Float tvMax = Min(tMax, tcMax);
+            Float halfScaleExp2 = scaleExp2 * half;
+            Int intersect = valid & LessEqual(tMin, tvMax);
+
+            Int leaf = AndNot(Equal(cur & SetInt(utils::LEAF_NODE_MASK), zero), intersect);
+            leafMask = leafMask | leaf;
+            active = AndNot(leaf, active);
+
+            Int push = AndNot(leaf, intersect);
+            if (MoveMask(push)) {
+                uint32_t storeBits = MoveMask(push & Less(tcMax, h));
+                if (storeBits) {
+                    Store(scales, scale);
+                    Store(parents, parent);
+                    Store(values, tMax);
+                    for (uint32_t lane = 0; lane < N; ++lane) {
+                        if (storeBits & (1u << lane)) {
+                            stackNode[scales[lane]][lane] = parents[lane];
+                            stackTMax[scales[lane]][lane] = values[lane];
+                            stackDepth[lane] = std::max(stackDepth[lane], kStackSize - scales[lane]);
+                        }
+                    }
+                }
+                h = Select(push, tcMax, h);
+                parent = Select(push, parent + (cur & SetInt(utils::CHILD_PTR_MASK)) + childIndex, parent);
+                scale = Select(push, scale + SetInt(~0u), scale);
+                scaleExp2 = Select(push, halfScaleExp2, scaleExp2);
+
+                Int centerX = Greater(halfScaleExp2 * tCoefX + tCornerX, tMin);
+                Int centerY = Greater(halfScaleExp2 * tCoefY + tCornerY, tMin);
+                Int centerZ = Greater(halfScaleExp2 * tCoefZ + tCornerZ, tMin);
+                idx = Select(push, (centerX & one) | (centerY & two) | (centerZ & four), idx);
+                posX = Select(push, posX + Select(centerX, halfScaleExp2, zeroFloat), posX);
+                posY = Select(push, posY + Select(centerY, halfScaleExp2, zeroFloat), posY);
+                posZ = Select(push, posZ + Select(centerZ, halfScaleExp2, zeroFloat), posZ);
+
+                cur = Select(push, zero, cur);
+                tMax = Select(push, tvMax, tMax);
+            }
+
+            // ADVANCE
+            Int advance = AndNot(push, active);
+            Int stepX = advance & LessEqual(tCornerX, tcMax);
+            Int stepY = advance & LessEqual(tCornerY, tcMax);
+            Int stepZ = advance & LessEqual(tCornerZ, tcMax);
+            posX = posX - Select(stepX, scaleExp2, zeroFloat);
+            posY = posY - Select(stepY, scaleExp2, zeroFloat);
+            posZ = posZ - Select(stepZ, scaleExp2, zeroFloat);
+            tMin = Select(advance, tcMax, tMin);
+            Int stepMask = (stepX & one) | (stepY & two) | (stepZ & four);
+            idx = idx ^ stepMask;
+
+            Int pop = AndNot(Equal(idx & stepMask, zero), advance);
+            uint32_t popBits = MoveMask(pop);
+            if (popBits) {
+                // POP
+                Int differingBits = (stepX & (AsInt(posX) ^ AsInt(posX + scaleExp2))) |
+                                    (stepY & (AsInt(posY) ^ AsInt(posY + scaleExp2))) |
+                                    (stepZ & (AsInt(posZ) ^ AsInt(posZ + scaleExp2)));
+                Store(bits, differingBits);
+                Store(scales, scale);
+                Store(parents, parent);
+                Store(values, tMax);
+                uint32_t exitBits = 0;
+                for (uint32_t lane = 0; lane < N; ++lane) {
+                    if ((popBits & (1u << lane)) == 0)
+                        continue;
+                    scales[lane] = static_cast<uint32_t>(std::bit_width(bits[lane])) - 1;
+                    if (scales[lane] >= kStackSize) {
+                        exitBits |= 1u << lane;
+                        continue;
+                    }
+                    parents[lane] = stackNode[scales[lane]][lane];
+                    values[lane] = stackTMax[scales[lane]][lane];
+                }
+                for (uint32_t lane = 0; lane < N; ++lane)
+                    bits[lane] = (exitBits & (1u << lane)) ? ~0u : 0u;
+                active = AndNot(LoadInt(bits), active);
+                pop = pop & active;
+
+                scale = LoadInt(scales);
+                parent = LoadInt(parents);
+                tMax = LoadFloat(values);
+                scaleExp2 = Select(pop, AsFloat(ShiftLeft<23>(scale + SetInt(127u - kStackSize))), scaleExp2);
+
+                // Round the position to the parent and extract the child slot
+                Int shiftedX = ShiftRight(AsInt(posX), scale);
+                Int shiftedY = ShiftRight(AsInt(posY), scale);
+                Int shiftedZ = ShiftRight(AsInt(posZ), scale);
+                posX = Select(pop, AsFloat(ShiftLeft(shiftedX, scale)), posX);
+                posY = Select(pop, AsFloat(ShiftLeft(shiftedY, scale)), posY);
+                posZ = Select(pop, AsFloat(ShiftLeft(shiftedZ, scale)), posZ);
+                idx = Select(pop, (shiftedX & one) | (ShiftLeft<1>(shiftedY & one)) | (ShiftLeft<2>(shiftedZ & one)), idx);
+
+                h = Select(pop, zeroFloat, h);
+                cur = Select(pop, zero, cur);
+            }
+        }
+
+        alignas(32) uint32_t iterationCounts[N];
+        Store(pos[0], posX);
+        Store(pos[1], posY);
+        Store(pos[2], posZ);
+        Store(tMins, tMin);
+        Store(values, scaleExp2);
+        Store(parents, parent);
+        Store(indices, idx);
+        Store(iterationCounts, iterations);
+
+        uint32_t hitBits = MoveMask(leafMask);
+        for (uint32_t lane = 0; lane < rayCount; ++lane) {
+            RayHit &hit = outHits[lane];
+            FinishRay(rays[lane], setups[lane], glm::vec3(pos[0][lane], pos[1][lane], pos[2][lane]), values[lane], tMins[lane], hit);
+            hit.color = (hitBits & (1u << lane)) ? octree[parents[lane] + (indices[lane] ^ octMasks[lane])] & utils::COLOR_MASK : 0;
+            hit.iterations = iterationCounts[lane];
+            hit.stackDepth = stackDepth[lane];
+        }
+        return hitBits & ((1u << rayCount) - 1);
+    }
+#else
+    uint32_t RayMarchPacket(const uint32_t *octree, const Ray *rays, uint32_t rayCount, RayHit *outHits) {
+        assert(rayCount <= kPacketSize);
+        uint32_t hitBits = 0;
+        for (uint32_t i = 0; i < rayCount; ++i)
+            hitBits |= RayMarchLeaf(octree, rays[i], outHits[i]) ? 1u << i : 0u;
+        return hitBits;
+    }
+#endif
+
+    Camera LookAt(const glm::vec3 &eye, const glm::vec3 &target, float fovY, float aspect) {
+        glm::vec3 forward = glm::normalize(target - eye);
+        glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+        glm::vec3 up = glm::cross(right, forward);
+        float tanHalfFov = std::tan(fovY * 0.5f);
+        return Camera{eye, glm::mat3(right * tanHalfFov * aspect, up * tanHalfFov, forward)};
+    }
+
+    void RenderImage(const uint32_t *octree, const Camera &camera, Image &outImage) {
+        const uint32_t width = outImage.width;
+        const uint32_t height = outImage.height;
+        outImage.pixels.resize(uint64_t(width) * height);
+
+        const glm::vec3 lightDirection = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f));
+        const glm::vec3 skyColor = glm::vec3(0.55f, 0.7f, 0.9f);
+
+        uint32_t tileCountX = (width + kTileSize - 1) / kTileSize;
+        uint32_t tileCountY = (height + kTileSize - 1) / kTileSize;
+        core::ParallelFor(tileCountX * tileCountY, [&](uint32_t tile) {
+            uint32_t tileX = (tile % tileCountX) * kTileSize;
+            uint32_t tileY = (tile / tileCountX) * kTileSize;
+            uint32_t endX = std::min(tileX + kTileSize, width);
+            uint32_t endY = std::min(tileY + kTileSize, height);
+
+            Ray rays[kPacketSize];
+            RayHit hits[kPacketSize];
+            for (uint32_t y = tileY; y < endY; ++y) {
+                for (uint32_t x = tileX; x < endX; x += kPacketSize) {
+                    uint32_t rayCount = std::min(kPacketSize, endX - x);
+                    for (uint32_t i = 0; i < rayCount; ++i) {
+                        glm::vec2 uv = glm::vec2((float(x + i) + 0.5f) / float(width) * 2.0f - 1.0f,
+                                                 1.0f - (float(y) + 0.5f) / float(height) * 2.0f);
+                        rays[i] = {camera.origin, glm::normalize(camera.rayMatrix * glm::vec3(uv, 1.0f))};
+                    }
+
+                    uint32_t hitBits = RayMarchPacket(octree, rays, rayCount, hits);
+                    for (uint32_t i = 0; i < rayCount; ++i) {
+                        glm::vec3 color = skyColor;
+                        if (hitBits & (1u << i)) {
+                            glm::vec3 albedo = glm::vec3(glm::unpackUnorm4x8(hits[i].color));
+                            color = albedo * (0.3f + 0.7f * std::max(glm::dot(hits[i].normal, lightDirection), 0.0f));
+                        }
+                        outImage.pixels[uint64_t(y) * width + x + i] = glm::packUnorm4x8(glm::vec4(color, 1.0f));
+                    }
+                }
+            }
+        });
+    }
+
+    bool WriteImage(const std::string &filename, const Image &image) {
+        std::filesystem::path path(filename);
+        std::error_code error;
+        if (path.has_parent_path())
+            std::filesystem::create_directories(path.parent_path(), error);
+        return stbi_write_png(filename.c_str(), int(image.width), int(image.height), 4, image.pixels.data(), int(image.width * sizeof(uint32_t))) != 0;
+    }
+} // namespace octree::tracer
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "cpu-octree-simd.h"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace octree::tracer {
+
+    // Same as STACK_SIZE in octree.glsl, scales go from kStackSize - 1 at
+    // the root down to the leaves
+    static constexpr uint32_t kStackSize = 23;
+
+    // Rays traced together by RayMarchPacket, 8 with AVX2, 4 with SSE2 and
+    // a single one without SIMD
+    static constexpr uint32_t kPacketSize = simd::kWidth;
+
+    // Everything is in the octree space of octree.glsl, where the octree
+    // spans [1, 2] on every axis
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 direction;
+    };
+
+    struct RayHit {
+        glm::vec3 position;
+        glm::vec3 normal;
+        float t;
+        // rgb of the leaf
+        uint32_t color;
+        // Loop iterations of the traversal, o_iter of the GLSL version
+        uint32_t iterations;
+        // Deepest stack entry that was written, zero when nothing was pushed
+        uint32_t stackDepth;
+    };
+
+    // Port of Octree_RayMarchLeaf in octree.glsl over the node layout of
+    // cpu-octree-utils, the traversal is the same step for step so the
+    // iterations and the hits match the GPU
+    bool RayMarchLeaf(const uint32_t *octree, const Ray &ray, RayHit &outHit);
+
+    // Traces up to kPacketSize rays in lockstep, every lane gives the same
+    // result as RayMarchLeaf. Returns a bit mask of the rays that hit
+    uint32_t RayMarchPacket(const uint32_t *octree, const Ray *rays, uint32_t rayCount, RayHit *outHits);
+
+    // Pinhole camera, the ray through uv in [-1, 1] has the direction
+    // normalize(rayMatrix * vec3(uv, 1)) like GenerateOctreeRay
+    struct Camera {
+        glm::vec3 origin;
+        glm::mat3 rayMatrix;
+    };
+
+    // fovY in radians
+    Camera LookAt(const glm::vec3 &eye, const glm::vec3 &target, float fovY, float aspect);
+
+    struct Image {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // rgba8, top row first
+        std::vector<uint32_t> pixels;
+    };
+
+    // Traces every pixel of outImage in packets with a directional light,
+    // the tiles are spread over the task scheduler
+    void RenderImage(const uint32_t *octree, const Camera &camera, Image &outImage);
+
+    bool WriteImage(const std::string &filename, const Image &image);
+} // namespace octree::tracer
@@ -2,34 +2,302 @@
 
 #include "cpu-octree-utils.h"
 
-static constexpr uint32_t LEAF_NODE_MASK = 0x40000000;
-static constexpr uint32_t INTERNAL_NODE_MASK = 0x80000000;
-static constexpr uint32_t CHILD_PTR_MASK = 0x3fffffff;
-static constexpr uint32_t COLOR_MASK = 0xffffff;
+#include <bit>
+#include <glm/gtc/packing.hpp>
 
 namespace octree::utils {
-    static void _ListVoxels(const std::vector<uint32_t> &octree, uint32_t nodeIndex, const glm::vec3 &center, float halfSize, std::vector<glm::vec4> &voxels) {
-        uint32_t node = octree[nodeIndex];
-        if ((node & LEAF_NODE_MASK) == LEAF_NODE_MASK) {
-            uint32_t color = node & COLOR_MASK;
-            voxels.push_back({center, color});
-            return;
+    // Subtrees rooted at this level are processed by separate tasks
+    static constexpr uint32_t kSubtreeLevel = 3;
+
+    void ListVoxelsFromOctree(const uint32_t *octree, uint32_t resolution, VoxelList &outVoxels, const TraversalOptions &options) {
+        std::vector<OctreeNode> subtrees;
+        CollectSubtrees(octree, resolution, kSubtreeLevel, options, subtrees);
+
+        // Count first so that every subtree writes its own exact range
+        std::vector<uint32_t> subtreeOffsets(subtrees.size() + 1, 0);
+        ParallelTraverseOctree(octree, resolution, subtrees, options, [&](uint32_t subtree, const OctreeNode &node, uint32_t value) {
+            if (value & LEAF_NODE_MASK)
+                subtreeOffsets[subtree + 1]++;
+            return true;
+        });
+        std::partial_sum(subtreeOffsets.begin(), subtreeOffsets.end(), subtreeOffsets.begin());
+
+        outVoxels.positions.resize(subtreeOffsets.back());
+        outVoxels.colors.resize(subtreeOffsets.back());
+
+        const glm::vec3 offset = glm::vec3(0.5f - resolution * 0.5f);
+        ParallelTraverseOctree(octree, resolution, subtrees, options, [&](uint32_t subtree, const OctreeNode &node, uint32_t value) {
+            if (value & LEAF_NODE_MASK) {
+                uint32_t index = subtreeOffsets[subtree]++;
+                outVoxels.positions[index] = glm::vec3(node.position) + offset;
+                outVoxels.colors[index] = value & COLOR_MASK;
+            }
+            return true;
+        });
+    }
+
+    void ListVoxelsFromOctree(const std::vector<uint32_t> &octree, std::vector<glm::vec4> &outVoxels, float octreeDims) {
+        VoxelList voxels;
+        ListVoxelsFromOctree(octree.data(), static_cast<uint32_t>(octreeDims), voxels);
+
+        outVoxels.resize(voxels.positions.size());
+        for (size_t i = 0; i < outVoxels.size(); ++i)
+            outVoxels[i] = glm::vec4(voxels.positions[i], static_cast<float>(voxels.colors[i]));
+    }
+
+    static uint64_t SplitBy3(uint32_t a) {
+        uint64_t x = a & 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffff;
+        x = (x | x << 16) & 0x1f0000ff0000ff;
+        x = (x | x << 8) & 0x100f00f00f00f00f;
+        x = (x | x << 4) & 0x10c30c30c30c30c3;
+        x = (x | x << 2) & 0x1249249249249249;
+        return x;
+    }
+
+    static uint32_t CompactBy3(uint64_t x) {
+        x &= 0x1249249249249249;
+        x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3;
+        x = (x ^ (x >> 4)) & 0x100f00f00f00f00f;
+        x = (x ^ (x >> 8)) & 0x1f0000ff0000ff;
+        x = (x ^ (x >> 16)) & 0x1f00000000ffff;
+        x = (x ^ (x >> 32)) & 0x1fffff;
+        return static_cast<uint32_t>(x);
+    }
+
+    uint64_t EncodeMorton(const glm::uvec3 &position) {
+        return SplitBy3(position.x) | (SplitBy3(position.y) << 1) | (SplitBy3(position.z) << 2);
+    }
+
+    glm::uvec3 DecodeMorton(uint64_t key) {
+        return glm::uvec3(CompactBy3(key), CompactBy3(key >> 1), CompactBy3(key >> 2));
+    }
+
+    // Levels are three key bits each, the root owns the highest ones
+    uint32_t GetSplitLevel(uint64_t keyA, uint64_t keyB, uint32_t maxLevel) {
+        uint64_t diff = keyA ^ keyB;
+        if (diff == 0)
+            return maxLevel + 1;
+        return maxLevel - static_cast<uint32_t>(std::bit_width(diff) - 1) / 3;
+    }
+
+    uint32_t GetChildIndex(uint64_t key, uint32_t level, uint32_t maxLevel) {
+        return static_cast<uint32_t>(key >> (3 * (maxLevel - level))) & 7;
+    }
+
+    // Keys no longer leave room for the color above 4K, so they are sorted
+    // as pairs
+    struct SortItem {
+        uint64_t key;
+        uint32_t color;
+
+        bool operator<(const SortItem &other) const {
+            return key < other.key;
+        }
+    };
+
+    // Averages the colors of duplicate fragments like voxel-fragment-unique-write
+    static uint32_t AverageColor(const SortItem *items, uint32_t count) {
+        glm::vec3 color = glm::vec3(0.0f);
+        for (uint32_t i = 0; i < count; ++i)
+            color += glm::vec3(glm::unpackUnorm4x8(items[i].color & COLOR_MASK));
+        return glm::packUnorm4x8(glm::vec4(color / float(count), 0.0f)) & COLOR_MASK;
+    }
+
+    uint32_t BuildOctreeFromVoxels(const uint64_t *voxelKeys, const uint32_t *voxelColors, uint32_t fragmentCount, uint32_t maxLevel, std::vector<uint32_t> &outOctree) {
+        assert(maxLevel < kMaxOctreeLevels && fragmentCount > 0);
+
+        const uint32_t splitLevel = std::min(kSubtreeLevel, maxLevel);
+        const uint32_t subtreeCount = 1u << (3 * splitLevel);
+        const uint32_t subtreeShift = 3 * (maxLevel - splitLevel);
+
+        enki::TaskScheduler *scheduler = core::GetTaskScheduler();
+        const uint32_t chunkCount = std::max(1u, std::min(scheduler->GetNumTaskThreads() * 4, fragmentCount / 4096));
+        const uint32_t chunkSize = (fragmentCount + chunkCount - 1) / chunkCount;
+
+        // Bucket the fragments by subtree, each chunk counts and later
+        // scatters its own range so the buckets stay stable
+        std::vector<SortItem> items(fragmentCount);
+        std::vector<uint32_t> chunkOffsets(size_t(chunkCount) * subtreeCount, 0);
+        core::ParallelFor(chunkCount, [&](uint32_t chunk) {
+            uint32_t *offsets = chunkOffsets.data() + size_t(chunk) * subtreeCount;
+            uint32_t end = std::min((chunk + 1) * chunkSize, fragmentCount);
+            for (uint32_t i = chunk * chunkSize; i < end; ++i) {
+                items[i] = SortItem{voxelKeys[i], voxelColors[i]};
+                offsets[items[i].key >> subtreeShift]++;
+            }
+        });
+
+        std::vector<uint32_t> subtreeBegin(subtreeCount + 1, 0);
+        uint32_t offset = 0;
+        for (uint32_t subtree = 0; subtree < subtreeCount; ++subtree) {
+            subtreeBegin[subtree] = offset;
+            for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+                uint32_t count = chunkOffsets[size_t(chunk) * subtreeCount + subtree];
+                chunkOffsets[size_t(chunk) * subtreeCount + subtree] = offset;
+                offset += count;
+            }
+        }
+        subtreeBegin[subtreeCount] = offset;
+
+        std::vector<SortItem> subtreeItems(fragmentCount);
+        core::ParallelFor(chunkCount, [&](uint32_t chunk) {
+            uint32_t *offsets = chunkOffsets.data() + size_t(chunk) * subtreeCount;
+            uint32_t end = std::min((chunk + 1) * chunkSize, fragmentCount);
+            for (uint32_t i = chunk * chunkSize; i < end; ++i)
+                subtreeItems[offsets[items[i].key >> subtreeShift]++] = items[i];
+        });
+        items = std::vector<SortItem>();
+
+        // Sort and merge every subtree, then count its nodes on the levels
+        // at and below the split level
+        std::vector<uint32_t> uniqueCounts(subtreeCount, 0);
+        std::vector<uint32_t> subtreeNodeCounts(size_t(subtreeCount) * kMaxOctreeLevels, 0);
+        core::ParallelFor(subtreeCount, [&](uint32_t subtree) {
+            SortItem *begin = subtreeItems.data() + subtreeBegin[subtree];
+            SortItem *end = subtreeItems.data() + subtreeBegin[subtree + 1];
+            if (begin == end)
+                return;
+            std::sort(begin, end);
+
+            uint32_t *nodeCounts = subtreeNodeCounts.data() + size_t(subtree) * kMaxOctreeLevels;
+            uint32_t uniqueCount = 0;
+            for (SortItem *run = begin; run != end;) {
+                uint64_t key = run->key;
+                SortItem *runEnd = run + 1;
+                while (runEnd != end && runEnd->key == key)
+                    runEnd++;
+
+                uint32_t nodeLevel = uniqueCount == 0 ? splitLevel : GetSplitLevel(begin[uniqueCount - 1].key, key, maxLevel);
+                for (uint32_t level = nodeLevel; level <= maxLevel; ++level)
+                    nodeCounts[level]++;
+
+                begin[uniqueCount++] = SortItem{key, AverageColor(run, static_cast<uint32_t>(runEnd - run))};
+                run = runEnd;
+            }
+            uniqueCounts[subtree] = uniqueCount;
+        });
+
+        // Levels above the split are shared between subtrees, the non empty
+        // subtrees act as their fragments
+        uint32_t levelCounts[kMaxOctreeLevels] = {};
+        std::vector<uint8_t> subtreeNodeLevels(subtreeCount, 0);
+        uint32_t previousSubtree = UINT32_MAX;
+        for (uint32_t subtree = 0; subtree < subtreeCount; ++subtree) {
+            if (uniqueCounts[subtree] == 0)
+                continue;
+
+            uint32_t nodeLevel = 0;
+            if (previousSubtree != UINT32_MAX)
+                nodeLevel = splitLevel - static_cast<uint32_t>(std::bit_width(previousSubtree ^ subtree) - 1) / 3;
+            subtreeNodeLevels[subtree] = static_cast<uint8_t>(nodeLevel);
+            for (uint32_t level = nodeLevel; level < splitLevel; ++level)
+                levelCounts[level]++;
+            previousSubtree = subtree;
+        }
+
+        // Rank of the first node of every subtree on each level below the split
+        std::vector<uint32_t> subtreeRanks(size_t(subtreeCount) * kMaxOctreeLevels, 0);
+        for (uint32_t subtree = 0; subtree < subtreeCount; ++subtree) {
+            for (uint32_t level = splitLevel; level <= maxLevel; ++level) {
+                subtreeRanks[size_t(subtree) * kMaxOctreeLevels + level] = levelCounts[level];
+                levelCounts[level] += subtreeNodeCounts[size_t(subtree) * kMaxOctreeLevels + level];
+            }
+        }
+
+        uint32_t levelBase[kMaxOctreeLevels + 1] = {};
+        uint32_t levelStart = 0;
+        for (uint32_t level = 1; level <= maxLevel + 1; ++level) {
+            levelBase[level] = 1 + 8 * levelStart;
+            levelStart += levelCounts[level - 1];
         }
-        if ((node & 0x80000000)) {
-            uint32_t childIndex = nodeIndex + (node & CHILD_PTR_MASK);
-            float childHSize = halfSize * 0.5f;
-            for (uint32_t i = 0; i < 8; ++i) {
-                glm::vec3 region = {static_cast<float>(i & 1),
-                                    static_cast<float>((i >> 1) & 1),
-                                    static_cast<float>((i >> 2) & 1)};
-                region = region * 2.0f - 1.0f;
-                glm::vec3 childPos = center + region * childHSize;
-                _ListVoxels(octree, childIndex + i, childPos, childHSize, voxels);
+        outOctree.assign(levelBase[maxLevel + 1], 0);
+
+        // Write the shared levels, remembering the parent of every subtree
+        std::vector<uint32_t> subtreeParentRanks(subtreeCount, 0);
+        uint32_t sharedRanks[kMaxOctreeLevels];
+        std::fill(std::begin(sharedRanks), std::end(sharedRanks), UINT32_MAX);
+        for (uint32_t subtree = 0; subtree < subtreeCount; ++subtree) {
+            if (uniqueCounts[subtree] == 0)
+                continue;
+
+            for (uint32_t level = subtreeNodeLevels[subtree]; level < splitLevel; ++level) {
+                uint32_t rank = ++sharedRanks[level];
+                uint32_t childIndex = (subtree >> (3 * (splitLevel - level))) & 7;
+                uint32_t slot = level == 0 ? 0 : levelBase[level] + sharedRanks[level - 1] * 8 + childIndex;
+                outOctree[slot] = (levelBase[level + 1] + rank * 8 - slot) | INTERNAL_NODE_MASK;
             }
+            if (splitLevel > 0)
+                subtreeParentRanks[subtree] = sharedRanks[splitLevel - 1];
         }
+
+        core::ParallelFor(subtreeCount, [&](uint32_t subtree) {
+            const SortItem *subtreeFragments = subtreeItems.data() + subtreeBegin[subtree];
+            uint32_t ranks[kMaxOctreeLevels];
+            for (uint32_t level = splitLevel; level <= maxLevel; ++level)
+                ranks[level] = subtreeRanks[size_t(subtree) * kMaxOctreeLevels + level] - 1;
+            if (splitLevel > 0)
+                ranks[splitLevel - 1] = subtreeParentRanks[subtree];
+
+            for (uint32_t i = 0; i < uniqueCounts[subtree]; ++i) {
+                uint64_t key = subtreeFragments[i].key;
+                uint32_t nodeLevel = i == 0 ? splitLevel : GetSplitLevel(subtreeFragments[i - 1].key, key, maxLevel);
+                for (uint32_t level = nodeLevel; level <= maxLevel; ++level) {
+                    uint32_t rank = ++ranks[level];
+                    uint32_t slot = level == 0 ? 0 : levelBase[level] + ranks[level - 1] * 8 + GetChildIndex(key, level, maxLevel);
+
+                    if (level == maxLevel)
+                        outOctree[slot] = (subtreeFragments[i].color & COLOR_MASK) | LEAF_NODE_MASK | INTERNAL_NODE_MASK;
+                    else
+                        outOctree[slot] = (levelBase[level + 1] + rank * 8 - slot) | INTERNAL_NODE_MASK;
+                }
+            }
+        });
+
+        return std::accumulate(uniqueCounts.begin(), uniqueCounts.end(), 0u);
+    }
+    void AppendBrickOctree(const std::vector<uint32_t> &octree, const glm::uvec3 &brick, std::vector<BrickOctree> &outBricks, std::vector<uint32_t> &outNodes) {
+        assert(octree.size() > 1 && (octree[0] & INTERNAL_NODE_MASK));
+        outBricks.push_back(BrickOctree{brick, static_cast<uint32_t>(outNodes.size()), octree[0]});
+        outNodes.insert(outNodes.end(), octree.begin() + 1, octree.end());
     }
 
-    void ListVoxelsFromOctree(const std::vector<uint32_t> &octree, std::vector<glm::vec4> &outVoxels, float octreeDims) {
-        _ListVoxels(octree, 0, glm::vec3(0.0f), octreeDims * 0.5f, outVoxels);
+    void StitchBrickOctrees(const std::vector<BrickOctree> &bricks, uint32_t brickLevels, std::vector<uint32_t> &inOutNodes) {
+        assert(brickLevels > 0 && !bricks.empty());
+
+        // Every brick is a voxel of the top tree, its leaves are the brick roots
+        std::vector<uint64_t> brickKeys(bricks.size());
+        for (size_t i = 0; i < bricks.size(); ++i)
+            brickKeys[i] = EncodeMorton(bricks[i].brick);
+        std::vector<uint32_t> brickColors(bricks.size(), 0);
+
+        std::vector<uint32_t> topOctree;
+        BuildOctreeFromVoxels(brickKeys.data(), brickColors.data(), static_cast<uint32_t>(brickKeys.size()), brickLevels, topOctree);
+
+        const uint32_t brickCount = 1u << brickLevels;
+        std::vector<uint32_t> brickLookup(size_t(brickCount) * brickCount * brickCount, UINT32_MAX);
+        for (uint32_t i = 0; i < static_cast<uint32_t>(bricks.size()); ++i) {
+            const glm::uvec3 &brick = bricks[i].brick;
+            brickLookup[brick.x + brickCount * (brick.y + brickCount * brick.z)] = i;
+        }
+
+        // Shift the brick nodes in place rather than concatenating into a
+        // new list, the node list is the largest allocation of the build
+        const uint32_t topSize = static_cast<uint32_t>(topOctree.size());
+        const size_t brickNodeCount = inOutNodes.size();
+        inOutNodes.resize(brickNodeCount + topSize);
+        std::move_backward(inOutNodes.begin(), inOutNodes.begin() + brickNodeCount, inOutNodes.end());
+        std::copy(topOctree.begin(), topOctree.end(), inOutNodes.begin());
+
+        TraverseOctree(topOctree.data(), brickCount, OctreeNode{0, 0, glm::uvec3(0)}, {}, [&](const OctreeNode &node, uint32_t value) {
+            if ((value & LEAF_NODE_MASK) == 0)
+                return true;
+
+            const BrickOctree &brick = bricks[brickLookup[node.position.x + brickCount * (node.position.y + brickCount * node.position.z)]];
+            // Children of the dropped root now start one slot earlier
+            uint32_t childIndex = topSize + brick.offset + (brick.rootValue & CHILD_PTR_MASK) - 1;
+            inOutNodes[node.index] = (childIndex - node.index) | INTERNAL_NODE_MASK;
+            return false;
+        });
     }
 } // namespace octree::utils
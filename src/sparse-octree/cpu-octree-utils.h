@@ -1,9 +1,134 @@
 #pragma once
 
+#include "core/task-scheduler.h"
+#include "voxelizer/voxel-fragment-layout.h"
+
 #include <glm/glm.hpp>
 #include <vector>
 
 namespace octree::utils {
 
+    static constexpr uint32_t kMaxOctreeLevels = MAX_OCTREE_LEVELS;
+
+    static constexpr uint32_t LEAF_NODE_MASK = 0x40000000;
+    static constexpr uint32_t INTERNAL_NODE_MASK = 0x80000000;
+    static constexpr uint32_t CHILD_PTR_MASK = 0x3fffffff;
+    static constexpr uint32_t COLOR_MASK = VOXEL_COLOR_MASK;
+
+    struct OctreeNode {
+        uint32_t index;
+        uint32_t level;
+        // Lowest corner of the node in voxels
+        glm::uvec3 position;
+    };
+
+    struct TraversalOptions {
+        // Children of nodes at this level are not visited
+        uint32_t maxLevel = UINT32_MAX;
+        // Only nodes overlapping [regionMin, regionMax) in voxels are visited
+        glm::uvec3 regionMin = glm::uvec3(0);
+        glm::uvec3 regionMax = glm::uvec3(UINT32_MAX);
+    };
+
+    // Structure of arrays so that positions can be uploaded as is
+    struct VoxelList {
+        // Voxel centers relative to the center of the octree
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> colors;
+    };
+
+    // Depth first traversal with an explicit stack, children are visited in
+    // morton order. visitor(const OctreeNode &node, uint32_t value) is called
+    // for every non empty node and returns false to skip its children.
+    template <typename Visitor>
+    void TraverseOctree(const uint32_t *octree, uint32_t resolution, const OctreeNode &root, const TraversalOptions &options, Visitor &&visitor) {
+        // Every level pops one node and pushes eight
+        OctreeNode stack[kMaxOctreeLevels * 8];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = root;
+
+        while (stackSize > 0) {
+            OctreeNode node = stack[--stackSize];
+            uint32_t value = octree[node.index];
+            if ((value & INTERNAL_NODE_MASK) == 0)
+                continue;
+
+            uint32_t size = resolution >> node.level;
+            if (glm::any(glm::greaterThanEqual(node.position, options.regionMax)) ||
+                glm::any(glm::lessThanEqual(node.position + size, options.regionMin)))
+                continue;
+
+            if (!visitor(node, value) || (value & LEAF_NODE_MASK) || node.level >= options.maxLevel)
+                continue;
+
+            uint32_t childIndex = node.index + (value & CHILD_PTR_MASK);
+            uint32_t childSize = size >> 1;
+            for (int i = 7; i >= 0; --i) {
+                glm::uvec3 region = glm::uvec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+                stack[stackSize++] = OctreeNode{childIndex + i, node.level + 1, node.position + region * childSize};
+            }
+        }
+    }
+
+    // Roots of the non empty subtrees at splitLevel in morton order, leaves
+    // and nodes at options.maxLevel above it are returned as their own subtree
+    inline void CollectSubtrees(const uint32_t *octree, uint32_t resolution, uint32_t splitLevel, const TraversalOptions &options, std::vector<OctreeNode> &outSubtrees) {
+        TraverseOctree(octree, resolution, OctreeNode{0, 0, glm::uvec3(0)}, options, [&](const OctreeNode &node, uint32_t value) {
+            if (node.level < splitLevel && node.level < options.maxLevel && (value & LEAF_NODE_MASK) == 0)
+                return true;
+            outSubtrees.push_back(node);
+            return false;
+        });
+    }
+
+    // Traverses every subtree as a separate task. visitor(uint32_t subtree,
+    // const OctreeNode &node, uint32_t value) is only called from the task
+    // owning the subtree, nodes above the subtrees are not visited.
+    template <typename Visitor>
+    void ParallelTraverseOctree(const uint32_t *octree, uint32_t resolution, const std::vector<OctreeNode> &subtrees, const TraversalOptions &options, Visitor &&visitor) {
+        core::ParallelFor(static_cast<uint32_t>(subtrees.size()), [&](uint32_t subtree) {
+            TraverseOctree(octree, resolution, subtrees[subtree], options, [&](const OctreeNode &node, uint32_t value) {
+                return visitor(subtree, node, value);
+            });
+        });
+    }
+
+    // Lists the leaves in morton order, which doesn't depend on how the
+    // builder laid out the nodes
+    void ListVoxelsFromOctree(const uint32_t *octree, uint32_t resolution, VoxelList &outVoxels, const TraversalOptions &options = {});
+
     void ListVoxelsFromOctree(const std::vector<uint32_t> &octree, std::vector<glm::vec4> &outVoxels, float octreeDims);
+
+    // Same morton encoding as voxel-fragment.glsl, x takes the lowest bit
+    uint64_t EncodeMorton(const glm::uvec3 &position);
+    glm::uvec3 DecodeMorton(uint64_t key);
+
+    // Shallowest level at which the two keys fall in different nodes,
+    // maxLevel + 1 when they share the same voxel
+    uint32_t GetSplitLevel(uint64_t keyA, uint64_t keyB, uint32_t maxLevel);
+
+    // Child index of the key's node at level inside its parent
+    uint32_t GetChildIndex(uint64_t key, uint32_t level, uint32_t maxLevel);
+
+    // Sorts and merges the raw voxelizer fragments and builds the octree
+    // bottom-up, the layout matches the bottom-up build of OctreeBuilder on
+    // the GPU. Every subtree below the first few levels is a separate task.
+    // Returns the number of unique voxels.
+    uint32_t BuildOctreeFromVoxels(const uint64_t *voxelKeys, const uint32_t *voxelColors, uint32_t fragmentCount, uint32_t maxLevel, std::vector<uint32_t> &outOctree);
+
+    // Octree of a single brick whose nodes below the root were appended to
+    // the shared node list
+    struct BrickOctree {
+        glm::uvec3 brick;
+        uint32_t offset;
+        uint32_t rootValue;
+    };
+
+    // The root of a brick is dropped, it becomes a leaf slot of the top tree
+    void AppendBrickOctree(const std::vector<uint32_t> &octree, const glm::uvec3 &brick, std::vector<BrickOctree> &outBricks, std::vector<uint32_t> &outNodes);
+
+    // Builds the tree above the bricks, brickLevels deep, and moves it in
+    // front of the appended brick nodes. The brick roots are replaced by
+    // the leaf slots of the top tree so the result is a single octree.
+    void StitchBrickOctrees(const std::vector<BrickOctree> &bricks, uint32_t brickLevels, std::vector<uint32_t> &inOutNodes);
 };
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include "pch.h"
+#include "octree-benchmark.h"
+#include "octree-builder.h"
+#include "core/task-scheduler.h"
+#include "rendering/rendering-utils.h"
+
+#include "tinygltf/json.hpp"
+
+#include <bit>
+#include <limits>
+#include <glm/gtc/constants.hpp>
+
+namespace {
+    using Clock = std::chrono::high_resolution_clock;
+
+    // Rays of a set are split in chunks of this size between the CPU threads
+    constexpr uint32_t kChunkSize = 1024;
+    constexpr uint32_t kGroupSize = 64;
+
+    // PCG hash, the ray sets have to be the same on every run and platform
+    // so std::uniform_real_distribution is out
+    uint32_t PCGHash(uint32_t value) {
+        uint32_t state = value * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    float RandomFloat(uint32_t &state) {
+        state = PCGHash(state);
+        return float(state >> 8) * (1.0f / 16777216.0f);
+    }
+} // namespace
+
+bool OctreeBenchmark::Run(std::shared_ptr<OctreeBuilder> builder, const Options &options, const std::string &outputFile) {
+    this->builder = builder;
+    this->options = options;
+    builder->ReadbackOctree(nodes);
+    GenerateRaySets();
+
+    std::vector<Result> results;
+    for (const RaySet &raySet : raySets) {
+        std::vector<octree::tracer::RayHit> hits;
+        results.push_back(RunCPU(raySet, hits));
+        results.push_back(RunCPUPacket(raySet, hits));
+        if (options.runGPU)
+            results.push_back(RunGPU(raySet, hits));
+    }
+
+    nlohmann::json output;
+    output["octree"] = {
+        {"resolution", builder->resolution},
+        {"nodes", builder->octreeElmCount},
+        {"voxels", builder->voxelCount},
+    };
+    output["options"] = {
+        {"width", options.width},
+        {"height", options.height},
+        {"cameraCount", options.cameraCount},
+        {"incoherentRayCount", options.incoherentRayCount},
+        {"repeatCount", options.repeatCount},
+        {"seed", options.seed},
+    };
+
+    nlohmann::json resultArray = nlohmann::json::array();
+    for (const Result &result : results) {
+        float seconds = std::max(result.milliseconds, 1e-6f) * 0.001f;
+        float rayCount = float(std::max(result.rayCount, 1u));
+        float mraysPerSecond = float(result.rayCount) / seconds * 1e-6f;
+        float averageIterations = float(result.iterationCount) / rayCount;
+
+        nlohmann::json entry = {
+            {"backend", result.backend},
+            {"rays", result.raySet},
+            {"rayCount", result.rayCount},
+            {"hitRate", float(result.hitCount) / rayCount},
+            {"milliseconds", result.milliseconds},
+            {"mraysPerSecond", mraysPerSecond},
+            {"averageIterations", averageIterations},
+            {"stackDepthHistogram", result.stackDepthHistogram},
+        };
+        if (result.backend != "cpu")
+            entry["mismatchCount"] = result.mismatchCount;
+        resultArray.push_back(entry);
+
+        std::cout << result.backend << " " << result.raySet << ": " << mraysPerSecond << " Mrays/s, "
+                  << averageIterations << " iterations/ray" << std::endl;
+    }
+    output["results"] = resultArray;
+
+    std::filesystem::path path(outputFile);
+    std::error_code error;
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path(), error);
+
+    std::ofstream outFile(path);
+    if (!outFile) {
+        LOGE("Failed to open benchmark output " + outputFile);
+        return false;
+    }
+    outFile << output.dump(4) << std::endl;
+    return static_cast<bool>(outFile);
+}
+
+void OctreeBenchmark::GenerateRaySets() {
+    raySets.clear();
+    raySets.reserve(3);
+
+    // Cameras orbit the center of the octree slightly above it, looking at
+    // the center with a 60 degree vertical field of view
+    RaySet &primary = raySets.emplace_back(RaySet{"primary", {}});
+    primary.rays.resize(uint64_t(options.width) * options.height * options.cameraCount);
+    const glm::vec3 center = glm::vec3(1.5f);
+    const float tanHalfFov = std::tan(glm::radians(30.0f));
+    const float aspect = float(options.width) / float(options.height);
+    for (uint32_t camera = 0; camera < options.cameraCount; ++camera) {
+        float angle = glm::two_pi<float>() * float(camera) / float(options.cameraCount);
+        glm::vec3 eye = center + glm::vec3(std::cos(angle) * 0.45f, 0.2f + 0.1f * std::sin(2.0f * angle), std::sin(angle) * 0.45f);
+        glm::vec3 forward = glm::normalize(center - eye);
+        glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+        glm::vec3 up = glm::cross(right, forward);
+
+        uint64_t offset = uint64_t(camera) * options.width * options.height;
+        for (uint32_t y = 0; y < options.height; ++y) {
+            for (uint32_t x = 0; x < options.width; ++x) {
+                float u = ((float(x) + 0.5f) / float(options.width) * 2.0f - 1.0f) * tanHalfFov * aspect;
+                float v = ((float(y) + 0.5f) / float(options.height) * 2.0f - 1.0f) * tanHalfFov;
+                primary.rays[offset + y * options.width + x] = {eye, glm::normalize(forward + right * u + up * v)};
+            }
+        }
+    }
+
+    // Shadow rays start from the primary hits, half a voxel off the surface
+    std::vector<uint8_t> primaryHit(primary.rays.size());
+    std::vector<octree::tracer::RayHit> primaryHits(primary.rays.size());
+    uint32_t primaryChunkCount = static_cast<uint32_t>((primary.rays.size() + kChunkSize - 1) / kChunkSize);
+    core::ParallelFor(primaryChunkCount, [&](uint32_t chunk) {
+        uint64_t end = std::min<uint64_t>(uint64_t(chunk + 1) * kChunkSize, primary.rays.size());
+        for (uint64_t i = uint64_t(chunk) * kChunkSize; i < end; ++i)
+            primaryHit[i] = octree::tracer::RayMarchLeaf(nodes.data(), primary.rays[i], primaryHits[i]);
+    });
+
+    RaySet shadow = {"shadow", {}};
+    const glm::vec3 lightDirection = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f));
+    const float surfaceOffset = 0.5f / float(builder->resolution);
+    for (uint64_t i = 0; i < primary.rays.size(); ++i) {
+        if (primaryHit[i])
+            shadow.rays.push_back({primaryHits[i].position + primaryHits[i].normal * surfaceOffset, lightDirection});
+    }
+    raySets.push_back(std::move(shadow));
+
+    // Uniform origins inside the octree and uniform directions
+    RaySet &incoherent = raySets.emplace_back(RaySet{"incoherent", {}});
+    incoherent.rays.resize(options.incoherentRayCount);
+    uint32_t state = options.seed;
+    for (octree::tracer::Ray &ray : incoherent.rays) {
+        ray.origin = glm::vec3(1.0f + RandomFloat(state), 1.0f + RandomFloat(state), 1.0f + RandomFloat(state));
+        float z = RandomFloat(state) * 2.0f - 1.0f;
+        float phi = RandomFloat(state) * glm::two_pi<float>();
+        float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+        ray.direction = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+    }
+}
+
+OctreeBenchmark::Result OctreeBenchmark::RunCPU(const RaySet &raySet, std::vector<octree::tracer::RayHit> &outHits) {
+    Result result;
+    result.backend = "cpu";
+    result.raySet = raySet.name;
+    result.rayCount = static_cast<uint32_t>(raySet.rays.size());
+    outHits.resize(raySet.rays.size());
+    std::vector<uint8_t> hit(raySet.rays.size());
+
+    uint32_t chunkCount = (result.rayCount + kChunkSize - 1) / kChunkSize;
+    result.milliseconds = std::numeric_limits<float>::max();
+    for (uint32_t repeat = 0; repeat < options.repeatCount; ++repeat) {
+        auto start = Clock::now();
+        core::ParallelFor(chunkCount, [&](uint32_t chunk) {
+            uint32_t end = std::min((chunk + 1) * kChunkSize, result.rayCount);
+            for (uint32_t i = chunk * kChunkSize; i < end; ++i)
+                hit[i] = octree::tracer::RayMarchLeaf(nodes.data(), raySet.rays[i], outHits[i]);
+        });
+        result.milliseconds = std::min(result.milliseconds, std::chrono::duration<float, std::milli>(Clock::now() - start).count());
+    }
+
+    for (uint32_t i = 0; i < result.rayCount; ++i) {
+        // Misses are compared by their sign against the GPU
+        if (!hit[i])
+            outHits[i].t = -1.0f;
+        result.hitCount += hit[i];
+        result.iterationCount += outHits[i].iterations;
+        result.stackDepthHistogram[outHits[i].stackDepth]++;
+    }
+    return result;
+}
+
+OctreeBenchmark::Result OctreeBenchmark::RunCPUPacket(const RaySet &raySet, const std::vector<octree::tracer::RayHit> &cpuHits) {
+    using octree::tracer::kPacketSize;
+    static_assert(kChunkSize % kPacketSize == 0);
+
+    Result result;
+    result.backend = "cpu-packet";
+    result.raySet = raySet.name;
+    result.rayCount = static_cast<uint32_t>(raySet.rays.size());
+    std::vector<octree::tracer::RayHit> hits(raySet.rays.size());
+    std::vector<uint8_t> hit(raySet.rays.size());
+
+    uint32_t chunkCount = (result.rayCount + kChunkSize - 1) / kChunkSize;
+    result.milliseconds = std::numeric_limits<float>::max();
+    for (uint32_t repeat = 0; repeat < options.repeatCount; ++repeat) {
+        auto start = Clock::now();
+        core::ParallelFor(chunkCount, [&](uint32_t chunk) {
+            uint32_t end = std::min((chunk + 1) * kChunkSize, result.rayCount);
+            for (uint32_t i = chunk * kChunkSize; i < end; i += kPacketSize) {
+                uint32_t rayCount = std::min(kPacketSize, end - i);
+                uint32_t hitBits = octree::tracer::RayMarchPacket(nodes.data(), &raySet.rays[i], rayCount, &hits[i]);
+                for (uint32_t j = 0; j < rayCount; ++j)
+                    hit[i + j] = static_cast<uint8_t>((hitBits >> j) & 1);
+            }
+        });
+        result.milliseconds = std::min(result.milliseconds, std::chrono::duration<float, std::milli>(Clock::now() - start).count());
+    }
+
+    for (uint32_t i = 0; i < result.rayCount; ++i) {
+        bool cpuHit = cpuHits[i].t >= 0.0f;
+        if (bool(hit[i]) != cpuHit || hits[i].iterations != cpuHits[i].iterations || (cpuHit && hits[i].t != cpuHits[i].t))
+            result.mismatchCount++;
+        result.hitCount += hit[i];
+        result.iterationCount += hits[i].iterations;
+        result.stackDepthHistogram[hits[i].stackDepth]++;
+    }
+    return result;
+}
+
+OctreeBenchmark::Result OctreeBenchmark::RunGPU(const RaySet &raySet, const std::vector<octree::tracer::RayHit> &cpuHits) {
+    Result result;
+    result.backend = "gpu";
+    result.raySet = raySet.name;
+    result.rayCount = static_cast<uint32_t>(raySet.rays.size());
+    if (result.rayCount == 0)
+        return result;
+
+    RD *device = RD::GetInstance();
+    RD::PushConstant pushConstant = {0, sizeof(uint32_t)};
+    RD::UniformBinding bindings[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 3},
+    };
+    ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-benchmark.comp.spv", bindings, (uint32_t)std::size(bindings), &pushConstant, 1);
+    PipelineID pipeline = device->CreateComputePipeline(shader, false, "Octree Benchmark");
+    device->Destroy(shader);
+
+    // Origin and direction of every ray as two vec4
+    const uint32_t raySize = result.rayCount * static_cast<uint32_t>(sizeof(glm::vec4) * 2);
+    const uint32_t resultSize = result.rayCount * static_cast<uint32_t>(sizeof(glm::uvec4));
+    BufferID stagingBuffer = device->CreateBuffer(raySize, RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeBenchmarkStagingBuffer");
+    BufferID rayBuffer = device->CreateBuffer(raySize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeBenchmarkRayBuffer");
+    BufferID resultBuffer = device->CreateBuffer(resultSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeBenchmarkResultBuffer");
+    BufferID readbackBuffer = device->CreateBuffer(resultSize, RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeBenchmarkReadbackBuffer");
+
+    glm::vec4 *rayData = reinterpret_cast<glm::vec4 *>(device->MapBuffer(stagingBuffer));
+    for (uint32_t i = 0; i < result.rayCount; ++i) {
+        rayData[i * 2] = glm::vec4(raySet.rays[i].origin, 0.0f);
+        rayData[i * 2 + 1] = glm::vec4(raySet.rays[i].direction, 0.0f);
+    }
+
+    RD::BoundUniform boundUniforms[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, builder->octreeBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 1, builder->octreeAttributeBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 2, rayBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 3, resultBuffer},
+    };
+    UniformSetID uniformSet = device->CreateUniformSet(pipeline, boundUniforms, (uint32_t)std::size(boundUniforms), 0, "OctreeBenchmarkSet");
+
+    RD::ImmediateSubmitInfo submitInfo;
+    submitInfo.queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+    submitInfo.commandPool = device->CreateCommandPool(submitInfo.queue, "OctreeBenchmarkCommandPool");
+    submitInfo.commandBuffer = device->CreateCommandBuffer(submitInfo.commandPool, "OctreeBenchmarkCommandBuffer");
+    submitInfo.fence = device->CreateFence("OctreeBenchmarkFence");
+    auto submit = [&](std::function<void(CommandBufferID commandBuffer)> &&function) {
+        device->ImmediateSubmit(std::move(function), &submitInfo);
+        device->WaitForFence(&submitInfo.fence, 1, UINT64_MAX);
+        device->ResetFences(&submitInfo.fence, 1);
+        device->ResetCommandPool(submitInfo.commandPool);
+    };
+
+    RD::BufferBarrier uploadBarrier = {rayBuffer, RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    submit([&](CommandBufferID commandBuffer) {
+        RD::BufferCopyRegion region = {0, 0, raySize};
+        device->CopyBuffer(commandBuffer, stagingBuffer, rayBuffer, &region);
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_TRANSFER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &uploadBarrier, 1);
+    });
+
+    // Timestamps around a single dispatch, the wall clock is only used when
+    // the queue can't write timestamps
+    uint32_t groupCount = (result.rayCount + kGroupSize - 1) / kGroupSize;
+    RD::BufferBarrier resultBarrier = {resultBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    float timestampPeriod = device->GetTimestampPeriod();
+    QueryPoolID queryPool = device->CreateTimestampQueryPool(2, "OctreeBenchmarkQueryPool");
+    result.milliseconds = std::numeric_limits<float>::max();
+    // The first dispatch warms up the pipeline and is not timed
+    for (uint32_t repeat = 0; repeat <= options.repeatCount; ++repeat) {
+        auto start = Clock::now();
+        submit([&](CommandBufferID commandBuffer) {
+            device->ResetQueryPool(commandBuffer, queryPool, 0, 2);
+            device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &resultBarrier, 1);
+            device->BindPipeline(commandBuffer, pipeline);
+            device->BindUniformSet(commandBuffer, pipeline, &uniformSet, 1);
+            device->BindPushConstants(commandBuffer, pipeline, RD::SHADER_STAGE_COMPUTE, &result.rayCount, 0, sizeof(uint32_t));
+            device->WriteTimestamp(commandBuffer, queryPool, 0);
+            device->DispatchCompute(commandBuffer, groupCount, 1, 1);
+            device->WriteTimestamp(commandBuffer, queryPool, 1);
+        });
+        if (repeat == 0)
+            continue;
+
+        float milliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+        if (timestampPeriod > 0.0f) {
+            uint64_t timestamps[2];
+            device->GetQueryResults(queryPool, 0, 2, timestamps);
+            milliseconds = static_cast<float>(double(timestamps[1] - timestamps[0]) * timestampPeriod * 1e-6);
+        }
+        result.milliseconds = std::min(result.milliseconds, milliseconds);
+    }
+    device->Destroy(queryPool);
+
+    RD::BufferBarrier readbackBarrier = {resultBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_TRANSFER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    submit([&](CommandBufferID commandBuffer) {
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_TRANSFER_BIT, nullptr, 0, &readbackBarrier, 1);
+        RD::BufferCopyRegion region = {0, 0, resultSize};
+        device->CopyBuffer(commandBuffer, resultBuffer, readbackBuffer, &region);
+    });
+
+    const glm::uvec4 *gpuResults = reinterpret_cast<const glm::uvec4 *>(device->MapBuffer(readbackBuffer));
+    for (uint32_t i = 0; i < result.rayCount; ++i) {
+        const glm::uvec4 &gpuResult = gpuResults[i];
+        bool hit = std::bit_cast<float>(gpuResult.x) >= 0.0f;
+        uint32_t stackDepth = std::min(gpuResult.z, octree::tracer::kStackSize);
+        result.hitCount += hit;
+        result.iterationCount += gpuResult.y;
+        result.stackDepthHistogram[stackDepth]++;
+        if (hit != (cpuHits[i].t >= 0.0f) || gpuResult.y != cpuHits[i].iterations)
+            result.mismatchCount++;
+    }
+
+    device->Destroy(submitInfo.commandPool);
+    device->Destroy(submitInfo.fence);
+    device->Destroy(uniformSet);
+    device->Destroy(stagingBuffer);
+    device->Destroy(rayBuffer);
+    device->Destroy(resultBuffer);
+    device->Destroy(readbackBuffer);
+    device->Destroy(pipeline);
+    return result;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "cpu-octree-tracer.h"
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+class OctreeBuilder;
+
+// Measures the ESVO traversal on deterministic ray sets, on the CPU with
+// octree::tracer one ray and one packet at a time and on the GPU with
+// octree-benchmark.comp, and writes the
+// results as JSON so that traversal changes can be compared run to run
+class OctreeBenchmark {
+  public:
+    struct Options {
+        // Primary rays of every camera
+        uint32_t width = 640;
+        uint32_t height = 360;
+        // Cameras on an orbit around the center of the octree
+        uint32_t cameraCount = 8;
+        uint32_t incoherentRayCount = 1 << 20;
+        // Every ray set is timed this many times and the fastest is kept
+        uint32_t repeatCount = 5;
+        // Needs a real device, the null device has no kernel for the benchmark shader
+        bool runGPU = true;
+        uint32_t seed = 1;
+    };
+
+    // Writes the results to outputFile, returns false when it can't be written
+    bool Run(std::shared_ptr<OctreeBuilder> builder, const Options &options, const std::string &outputFile);
+
+  private:
+    struct RaySet {
+        std::string name;
+        std::vector<octree::tracer::Ray> rays;
+    };
+
+    struct Result {
+        std::string backend;
+        std::string raySet;
+        uint32_t rayCount = 0;
+        uint32_t hitCount = 0;
+        float milliseconds = 0.0f;
+        uint64_t iterationCount = 0;
+        // Rays by the deepest stack entry they wrote
+        std::array<uint32_t, octree::tracer::kStackSize + 1> stackDepthHistogram = {};
+        // Packets and GPU only, rays whose hit or iteration count differs
+        // from the scalar CPU traversal
+        uint32_t mismatchCount = 0;
+    };
+
+    void GenerateRaySets();
+    // Also keeps the hits of every ray for the GPU comparison
+    Result RunCPU(const RaySet &raySet, std::vector<octree::tracer::RayHit> &outHits);
+    Result RunCPUPacket(const RaySet &raySet, const std::vector<octree::tracer::RayHit> &cpuHits);
+    Result RunGPU(const RaySet &raySet, const std::vector<octree::tracer::RayHit> &cpuHits);
+
+    std::shared_ptr<OctreeBuilder> builder;
+    Options options;
+    std::vector<uint32_t> nodes;
+    std::vector<RaySet> raySets;
+};
@@ -11,67 +11,153 @@
 #include "voxel-renderer.h"
 #include "gfx/camera.h"
 #include "cpu-octree-utils.h"
+#include "octree-cache.h"
+#include "gfx/gltf-scene.h"
 #include <imgui.h>
 
-void OctreeBuilder::Initialize(std::shared_ptr<RenderScene> scene) {
+void OctreeBuilder::Initialize(std::shared_ptr<RenderScene> scene, BuildStrategy strategy, uint32_t voxelResolution) {
 
     // @TODO we may have to decide what to re-initialize and what to
     // destroy, so that same object can be recycled or instanced can
     // be created without duplicating the pipeline.
     this->scene = scene;
+    buildStrategy = strategy;
+
+    assert(voxelResolution > 1 && (voxelResolution & (voxelResolution - 1)) == 0 && voxelResolution <= (1u << MAX_VOXEL_RESOLUTION_LOG2));
+    resolution = voxelResolution;
+    levels = static_cast<uint32_t>(std::log2(resolution)) + 1;
 
     device = RD::GetInstance();
 
     RD::UniformBinding bindings[] = {
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+    };
+    RD::UniformBinding mortonBindings[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 3},
+    };
+    uint32_t bindingCount = 2;
+    RD::PushConstant pushConstant = {0, sizeof(uint32_t) * 3};
+    RD::PushConstant scalarPushConstant = {0, sizeof(uint32_t)};
+    RD::PushConstant rangePushConstant = {0, sizeof(uint32_t) * 2};
+
+    ShaderID shaders[] = {
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-init-node.comp.spv", bindings, bindingCount, nullptr, 0),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-tag-node.comp.spv", bindings, 3, &pushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-allocate-node.comp.spv", bindings, bindingCount, nullptr, 0),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-update-params.comp.spv", bindings, bindingCount, nullptr, 0),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-morton-count.comp.spv", mortonBindings, 2, &pushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/radix-sort-scan.comp.spv", mortonBindings, 2, &scalarPushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-morton-write.comp.spv", mortonBindings, 4, &pushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-filter-attributes.comp.spv", bindings, 2, &rangePushConstant, 1),
     };
-    uint32_t bindingCount = static_cast<uint32_t>(std::size(bindings));
 
-    {
-        ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-init-node.comp.spv", bindings, bindingCount, nullptr, 0);
-        pipelineInitNode = device->CreateComputePipeline(shader, false, "InitOctreeNodePipeline");
+    RD::ComputePipelineDescription descriptions[] = {
+        {shaders[0], false, "InitOctreeNodePipeline"},
+        {shaders[1], false, "TagOctreeNodePipeline"},
+        {shaders[2], false, "AllocateOctreeNodePipeline"},
+        {shaders[3], false, "UpdateDispatchParams"},
+        {shaders[4], false, "MortonCountOctreeNodePipeline"},
+        {shaders[5], false, "MortonScanOctreeNodePipeline"},
+        {shaders[6], false, "MortonWriteOctreeNodePipeline"},
+        {shaders[7], false, "FilterOctreeAttributesPipeline"},
+    };
+    PipelineID pipelines[std::size(descriptions)];
+    device->CreateComputePipelines(descriptions, static_cast<uint32_t>(std::size(descriptions)), pipelines);
+    pipelineInitNode = pipelines[0];
+    pipelineTagNode = pipelines[1];
+    pipelineAllocateNode = pipelines[2];
+    pipelineUpdateParams = pipelines[3];
+    pipelineMortonCount = pipelines[4];
+    pipelineMortonScan = pipelines[5];
+    pipelineMortonWrite = pipelines[6];
+    pipelineFilterAttributes = pipelines[7];
+
+    for (ShaderID shader : shaders)
         device->Destroy(shader);
-    }
 
-    {
-        RD::PushConstant pushConstant = {0, sizeof(uint32_t) * 3};
-        ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-tag-node.comp.spv", bindings, bindingCount, &pushConstant, 1);
-        pipelineTagNode = device->CreateComputePipeline(shader, false, "TagOctreeNodePipeline");
-        device->Destroy(shader);
-    }
-    {
-        ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-allocate-node.comp.spv", bindings, bindingCount, nullptr, 0);
-        pipelineAllocateNode = device->CreateComputePipeline(shader, false, "AllocateOctreeNodePipeline");
-        device->Destroy(shader);
-    }
-    {
-        ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-update-params.comp.spv", bindings, bindingCount, nullptr, 0);
-        pipelineUpdateParams = device->CreateComputePipeline(shader, false, "UpdateDispatchParams");
-        device->Destroy(shader);
-    }
+    fragmentSorter.Initialize();
 }
 
 void OctreeBuilder::Build(CommandPoolID commandPool, CommandBufferID commandBuffer) {
-    //std::shared_ptr<Voxelizer> voxelizer = std::make_shared<TerrainVoxelizer>();
-    std::shared_ptr<Voxelizer> voxelizer = std::make_shared<SceneVoxelizer>(scene);
-    voxelizer->Initialize(kResolution);
-    voxelizer->Voxelize(commandPool, commandBuffer);
-
-    uint32_t voxelCount = voxelizer->voxelCount;
-    uint32_t octreeSize = (voxelCount * kLevels * VOXEL_DATA_SIZE * 4) / 3;
+    BuildAsync(commandPool, commandBuffer, nullptr);
+    while (!Update())
+        device->WaitForFence(&buildSubmitInfo.fence, 1, UINT64_MAX);
+}
 
-    octreeBuffer = device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeBuffer");
-    LOG("Allocated Octree Memory: " + std::to_string(InMB(octreeSize)) + "MB");
+void OctreeBuilder::BuildAsync(CommandPoolID commandPool, CommandBufferID commandBuffer, BuildCallback &&onComplete) {
+    assert(!buildPending);
+    levelBegins.clear();
 
     buildInfoBuffer = device->CreateBuffer(sizeof(uint32_t) * 3, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeBuildInfoBuffer");
-    uint32_t *buildInfoPtr = (uint32_t *)device->MapBuffer(buildInfoBuffer);
+    buildInfoPtr = (uint32_t *)device->MapBuffer(buildInfoBuffer);
     buildInfoPtr[0] = 0, buildInfoPtr[1] = 1, buildInfoPtr[2] = 0;
 
     dispatchIndirectBuffer = device->CreateBuffer(sizeof(uint32_t) * 3, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_INDIRECT_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeDispatchIndirectBuffer");
     uint32_t *ptr = (uint32_t *)device->MapBuffer(dispatchIndirectBuffer);
     ptr[0] = 1, ptr[1] = 1, ptr[2] = 1;
 
+    buildSubmitInfo.queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+    buildSubmitInfo.commandPool = device->CreateCommandPool(buildSubmitInfo.queue, "TempCommandPool");
+    buildSubmitInfo.commandBuffer = device->CreateCommandBuffer(buildSubmitInfo.commandPool, "TempCommandBuffer");
+    buildSubmitInfo.fence = device->CreateFence("TempFence");
+
+    if (buildStrategy == BUILD_STRATEGY_BRICKED_CPU && scene) {
+        BuildBricked(commandPool, commandBuffer);
+        buildCallback = std::move(onComplete);
+        buildPending = true;
+        return;
+    }
+
+    // Without a scene fallback to the procedural terrain, it is also the
+    // only voxelizer that runs on the headless device
+    std::shared_ptr<Voxelizer> voxelizer;
+    if (scene)
+        voxelizer = std::make_shared<SceneVoxelizer>(scene, voxelizationMethod);
+    else
+        voxelizer = std::make_shared<TerrainVoxelizer>();
+    voxelizer->Initialize(resolution);
+    auto voxelizeStart = std::chrono::high_resolution_clock::now();
+    voxelizer->Voxelize(commandPool, commandBuffer);
+    voxelizationTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - voxelizeStart).count();
+    fragmentCount = voxelizer->voxelCount;
+
+    if (fragmentCount == 0) {
+        voxelizer->Shutdown();
+        BuildEmpty();
+    } else if (IsCPUBuild()) {
+        // Sorting and merging the fragments is part of the CPU build
+        BuildBottomUpCPU(voxelizer->voxelFragmentBuffer, voxelizer->voxelColorBuffer);
+        voxelizer->Shutdown();
+    } else {
+        // Neighbouring triangles write the same voxel many times, every
+        // duplicate would otherwise walk all the levels in TagNode
+        voxelFragmentBuffer = fragmentSorter.SortAndUnique(commandPool, commandBuffer, voxelizer->voxelFragmentBuffer, voxelizer->voxelColorBuffer, fragmentCount, resolution, voxelCount, voxelColorBuffer);
+        voxelizer->Shutdown();
+
+        if (voxelCount == 0)
+            BuildEmpty();
+        else if (buildStrategy == BUILD_STRATEGY_TOP_DOWN)
+            BuildTopDown();
+        else
+            BuildBottomUp();
+    }
+
+    buildCallback = std::move(onComplete);
+    buildPending = true;
+}
+
+void OctreeBuilder::BuildTopDown() {
+    octreeScratchSize = uint64_t(voxelCount) * levels * VOXEL_DATA_SIZE * 4 / 3;
+
+    // Worst case estimate, it is compacted to the exact size once the build finishes
+    octreeBuffer = device->CreateBuffer(octreeScratchSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeScratchBuffer");
+    LOG("Allocated Octree Memory: " + std::to_string(InMB(octreeScratchSize)) + "MB");
+
     {
         RD::BoundUniform boundUniforms[] = {
             {RD::BINDING_TYPE_STORAGE_BUFFER, 0, octreeBuffer},
@@ -83,7 +169,8 @@ void OctreeBuilder::Build(CommandPoolID commandPool, CommandBufferID commandBuff
     {
         RD::BoundUniform boundUniforms[] = {
             {RD::BINDING_TYPE_STORAGE_BUFFER, 0, octreeBuffer},
-            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, voxelizer->voxelFragmentBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, voxelFragmentBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 2, voxelColorBuffer},
         };
         tagNodeSet = device->CreateUniformSet(pipelineTagNode, boundUniforms, static_cast<uint32_t>(std::size(boundUniforms)), 0, "TagNodeSet");
     }
@@ -103,12 +190,6 @@ void OctreeBuilder::Build(CommandPoolID commandPool, CommandBufferID commandBuff
         updateParamsSet = device->CreateUniformSet(pipelineUpdateParams, boundUniforms, static_cast<uint32_t>(std::size(boundUniforms)), 0, "UpdateParamsSet");
     }
 
-    RD::ImmediateSubmitInfo submitInfo;
-    submitInfo.queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
-    submitInfo.commandPool = device->CreateCommandPool(submitInfo.queue, "TempCommandPool");
-    submitInfo.commandBuffer = device->CreateCommandBuffer(submitInfo.commandPool, "TempCommandBuffer");
-    submitInfo.fence = device->CreateFence("TempFence");
-
     RD::BufferBarrier tagNodeBarrier[] = {
         {octreeBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT | RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
     };
@@ -118,13 +199,27 @@ void OctreeBuilder::Build(CommandPoolID commandPool, CommandBufferID commandBuff
         {buildInfoBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
     };
 
+    // First slot of every level, copied from the allocation range before the level is built
+    levelBeginBuffer = transientBuffers.emplace_back(device->CreateBuffer(uint64_t(levels) * sizeof(uint32_t), RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeLevelBeginBuffer"));
+
     RD::BufferBarrier updateParamsBarrier[] = {
         {dispatchIndirectBuffer, RD::BARRIER_ACCESS_INDIRECT_COMMAND_READ_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
         {buildInfoBuffer, RD::BARRIER_ACCESS_SHADER_READ_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT | RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
     };
 
-    for (uint32_t i = 0; i < kLevels; ++i) {
-        device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+    // Next level reads the dispatch size and allocation range written by UpdateParams
+    RD::BufferBarrier nextLevelBarrier[] = {
+        {dispatchIndirectBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_INDIRECT_COMMAND_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+        {buildInfoBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT | RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_TRANSFER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+    };
+
+    // Level sizes are driven by the indirect dispatch buffer, so every level
+    // can be recorded up front and submitted once
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        for (uint32_t i = 0; i < levels; ++i) {
+            RD::BufferCopyRegion levelRegion = {0, uint64_t(i) * sizeof(uint32_t), sizeof(uint32_t)};
+            device->CopyBuffer(commandBuffer, buildInfoBuffer, levelBeginBuffer, &levelRegion);
+
             InitializeNode(commandBuffer);
 
             device->PipelineBarrier(commandBuffer,
@@ -134,35 +229,521 @@ void OctreeBuilder::Build(CommandPoolID commandPool, CommandBufferID commandBuff
 
             TagNode(commandBuffer, i, voxelCount);
 
+            // Skip this for leaf node
+            if (i == levels - 1)
+                break;
+
             device->PipelineBarrier(commandBuffer,
                                     RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                                     nullptr, 0,
                                     allocateNodeBarrier, static_cast<uint32_t>(std::size(allocateNodeBarrier)));
 
-            // Skip this for leaf node
-            if (i != kLevels - 1) {
-                AllocateNode(commandBuffer);
-
-                device->PipelineBarrier(commandBuffer,
-                                        RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT | RD::PIPELINE_STAGE_DRAW_INDIRECT_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                                        nullptr, 0,
-                                        updateParamsBarrier, static_cast<uint32_t>(std::size(updateParamsBarrier)));
-                UpdateParams(commandBuffer);
+            AllocateNode(commandBuffer);
+
+            // The transfer stage orders the level copy before the range is overwritten
+            device->PipelineBarrier(commandBuffer,
+                                    RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT | RD::PIPELINE_STAGE_DRAW_INDIRECT_BIT | RD::PIPELINE_STAGE_TRANSFER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    nullptr, 0,
+                                    updateParamsBarrier, static_cast<uint32_t>(std::size(updateParamsBarrier)));
+            UpdateParams(commandBuffer);
+
+            device->PipelineBarrier(commandBuffer,
+                                    RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT | RD::PIPELINE_STAGE_DRAW_INDIRECT_BIT | RD::PIPELINE_STAGE_TRANSFER_BIT,
+                                    nullptr, 0,
+                                    nextLevelBarrier, static_cast<uint32_t>(std::size(nextLevelBarrier)));
+        }
+    },
+                            &buildSubmitInfo);
+}
+
+void OctreeBuilder::BuildBottomUp() {
+    const uint32_t maxLevel = levels - 1;
+    const uint32_t tileCount = RenderingUtils::GetWorkGroupSize(voxelCount, VoxelFragmentSorter::kTileSize);
+    uint32_t nodeCountElements = tileCount * levels;
+
+    BufferID nodeCountBuffer = transientBuffers.emplace_back(device->CreateBuffer(uint64_t(nodeCountElements) * sizeof(uint32_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeNodeCountBuffer"));
+    BufferID nodeTotalBuffer = transientBuffers.emplace_back(device->CreateBuffer(sizeof(uint32_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeNodeTotalBuffer"));
+    // Nodes above every level, the first entry of each level in the scanned counts
+    BufferID levelStartBuffer = transientBuffers.emplace_back(device->CreateBuffer(uint64_t(levels) * sizeof(uint32_t), RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeLevelStartBuffer"));
+
+    UniformSetID countSet, scanSet;
+    {
+        RD::BoundUniform boundUniforms[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, voxelFragmentBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, nodeCountBuffer},
+        };
+        countSet = transientSets.emplace_back(device->CreateUniformSet(pipelineMortonCount, boundUniforms, static_cast<uint32_t>(std::size(boundUniforms)), 0, "MortonCountSet"));
+    }
+    {
+        RD::BoundUniform boundUniforms[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, nodeCountBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, nodeTotalBuffer},
+        };
+        scanSet = transientSets.emplace_back(device->CreateUniformSet(pipelineMortonScan, boundUniforms, static_cast<uint32_t>(std::size(boundUniforms)), 0, "MortonScanSet"));
+    }
+
+    uint32_t params[] = {voxelCount, tileCount, maxLevel};
+    RD::BufferBarrier nodeCountBarrier = {nodeCountBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+
+    // The node count of every level is needed up front to allocate the
+    // exact octree size, so counting is submitted on its own
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        device->BindPipeline(commandBuffer, pipelineMortonCount);
+        device->BindUniformSet(commandBuffer, pipelineMortonCount, &countSet, 1);
+        device->BindPushConstants(commandBuffer, pipelineMortonCount, RD::SHADER_STAGE_COMPUTE, params, 0, sizeof(params));
+        device->DispatchCompute(commandBuffer, tileCount, 1, 1);
+
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &nodeCountBarrier, 1);
+
+        device->BindPipeline(commandBuffer, pipelineMortonScan);
+        device->BindUniformSet(commandBuffer, pipelineMortonScan, &scanSet, 1);
+        device->BindPushConstants(commandBuffer, pipelineMortonScan, RD::SHADER_STAGE_COMPUTE, &nodeCountElements, 0, sizeof(uint32_t));
+        device->DispatchCompute(commandBuffer, 1, 1, 1);
+
+        RD::BufferBarrier levelStartBarrier = {nodeCountBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_TRANSFER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_TRANSFER_BIT, nullptr, 0, &levelStartBarrier, 1);
+        for (uint32_t level = 0; level < levels; ++level) {
+            RD::BufferCopyRegion levelRegion = {uint64_t(level) * tileCount * sizeof(uint32_t), uint64_t(level) * sizeof(uint32_t), sizeof(uint32_t)};
+            device->CopyBuffer(commandBuffer, nodeCountBuffer, levelStartBuffer, &levelRegion);
+        }
+    },
+                            &buildSubmitInfo);
+    device->WaitForFence(&buildSubmitInfo.fence, 1, UINT64_MAX);
+    device->ResetFences(&buildSubmitInfo.fence, 1);
+    device->ResetCommandPool(buildSubmitInfo.commandPool);
+
+    // Leaves are the unique voxels, every other node owns eight child slots
+    uint32_t nodeTotal = *(uint32_t *)device->MapBuffer(nodeTotalBuffer);
+    octreeElmCount = 1 + 8 * (nodeTotal - voxelCount);
+
+    // Every internal node above a level owns eight slots before it, the
+    // same layout as octree-morton-write
+    const uint32_t *levelStartPtr = (const uint32_t *)device->MapBuffer(levelStartBuffer);
+    levelBegins.assign(1, 0);
+    for (uint32_t level = 1; level < levels; ++level)
+        levelBegins.push_back(1 + 8 * levelStartPtr[level - 1]);
+    levelBegins.push_back(octreeElmCount);
+
+    const uint64_t octreeSize = uint64_t(octreeElmCount) * VOXEL_DATA_SIZE;
+    octreeBuffer = device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeBuffer");
+    LOG("Allocated Octree Memory: " + std::to_string(InMB(octreeSize)) + "MB");
+
+    // Empty slots are never written, clear the whole buffer with the init pass
+    buildInfoPtr[0] = 0, buildInfoPtr[1] = octreeElmCount;
+    uint32_t *ptr = (uint32_t *)device->MapBuffer(dispatchIndirectBuffer);
+    ptr[0] = RenderingUtils::GetWorkGroupSize(octreeElmCount, 32);
+
+    {
+        RD::BoundUniform boundUniforms[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, octreeBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, buildInfoBuffer},
+        };
+        initNodeSet = transientSets.emplace_back(device->CreateUniformSet(pipelineInitNode, boundUniforms, static_cast<uint32_t>(std::size(boundUniforms)), 0, "InitNodeSet"));
+    }
+
+    UniformSetID writeSet;
+    {
+        RD::BoundUniform boundUniforms[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, octreeBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, voxelFragmentBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 2, nodeCountBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 3, voxelColorBuffer},
+        };
+        writeSet = transientSets.emplace_back(device->CreateUniformSet(pipelineMortonWrite, boundUniforms, static_cast<uint32_t>(std::size(boundUniforms)), 0, "MortonWriteSet"));
+    }
+
+    RD::BufferBarrier clearBarrier = {octreeBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        InitializeNode(commandBuffer);
+
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &clearBarrier, 1);
+
+        device->BindPipeline(commandBuffer, pipelineMortonWrite);
+        device->BindUniformSet(commandBuffer, pipelineMortonWrite, &writeSet, 1);
+        device->BindPushConstants(commandBuffer, pipelineMortonWrite, RD::SHADER_STAGE_COMPUTE, params, 0, sizeof(params));
+        device->DispatchCompute(commandBuffer, tileCount, 1, 1);
+    },
+                            &buildSubmitInfo);
+}
+
+BufferID OctreeBuilder::ReadbackFragments(BufferID fragmentBuffer, BufferID colorBuffer, uint32_t count) {
+    const uint64_t keySize = uint64_t(count) * sizeof(uint64_t);
+    const uint64_t colorSize = uint64_t(count) * sizeof(uint32_t);
+    BufferID readbackBuffer = device->CreateBuffer(keySize + colorSize, RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "VoxelFragmentReadbackBuffer");
+
+    RD::BufferBarrier readbackBarriers[] = {
+        {fragmentBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_TRANSFER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+        {colorBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_TRANSFER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+    };
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT | RD::PIPELINE_STAGE_FRAGMENT_SHADER_BIT, RD::PIPELINE_STAGE_TRANSFER_BIT, nullptr, 0, readbackBarriers, static_cast<uint32_t>(std::size(readbackBarriers)));
+
+        RD::BufferCopyRegion keyRegion = {0, 0, keySize};
+        device->CopyBuffer(commandBuffer, fragmentBuffer, readbackBuffer, &keyRegion);
+        RD::BufferCopyRegion colorRegion = {0, keySize, colorSize};
+        device->CopyBuffer(commandBuffer, colorBuffer, readbackBuffer, &colorRegion);
+    },
+                            &buildSubmitInfo);
+    device->WaitForFence(&buildSubmitInfo.fence, 1, UINT64_MAX);
+    device->ResetFences(&buildSubmitInfo.fence, 1);
+    device->ResetCommandPool(buildSubmitInfo.commandPool);
+    return readbackBuffer;
+}
+
+void OctreeBuilder::UploadOctree(const std::vector<uint32_t> &octree) {
+    octreeElmCount = static_cast<uint32_t>(octree.size());
+
+    const uint64_t octreeSize = uint64_t(octreeElmCount) * VOXEL_DATA_SIZE;
+    BufferID stagingBuffer = transientBuffers.emplace_back(device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeStagingBuffer"));
+    std::memcpy(device->MapBuffer(stagingBuffer), octree.data(), octreeSize);
+
+    octreeBuffer = device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeBuffer");
+    LOG("Allocated Octree Memory: " + std::to_string(InMB(octreeSize)) + "MB");
+
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        RD::BufferCopyRegion region = {0, 0, octreeSize};
+        device->CopyBuffer(commandBuffer, stagingBuffer, octreeBuffer, &region);
+    },
+                            &buildSubmitInfo);
+}
+
+void OctreeBuilder::BuildBottomUpCPU(BufferID fragmentBuffer, BufferID colorBuffer) {
+    BufferID readbackBuffer = transientBuffers.emplace_back(ReadbackFragments(fragmentBuffer, colorBuffer, fragmentCount));
+
+    // Subtrees are built in parallel on the task scheduler
+    std::vector<uint32_t> octree;
+    const uint64_t *voxelKeys = (const uint64_t *)device->MapBuffer(readbackBuffer);
+    const uint32_t *voxelColors = (const uint32_t *)(voxelKeys + fragmentCount);
+    voxelCount = octree::utils::BuildOctreeFromVoxels(voxelKeys, voxelColors, fragmentCount, levels - 1, octree);
+    UploadOctree(octree);
+}
+
+void OctreeBuilder::BuildEmpty() {
+    // Nothing landed in the grid, the octree is a single empty root and none
+    // of the GPU build resources are created
+    LOGW("Voxelization produced no voxels");
+    emptyBuild = true;
+    voxelCount = 0;
+    UploadOctree(std::vector<uint32_t>(1, 0));
+}
+
+void OctreeBuilder::BuildBricked(CommandPoolID commandPool, CommandBufferID commandBuffer) {
+    assert(brickResolution > 1 && brickResolution < resolution && resolution % brickResolution == 0);
+    const uint32_t brickCount = resolution / brickResolution;
+    const uint32_t brickLevels = static_cast<uint32_t>(std::log2(brickCount));
+    const uint32_t brickMaxLevel = levels - 1 - brickLevels;
+
+    std::shared_ptr<SceneVoxelizer> voxelizer = std::make_shared<SceneVoxelizer>(scene, voxelizationMethod);
+    voxelizer->Initialize(resolution);
+
+    // Brick octrees are appended to a single node list as they are built,
+    // the tree above them is added once every brick is known
+    std::vector<octree::utils::BrickOctree> bricks;
+    std::vector<uint32_t> nodes, brickOctree;
+    fragmentCount = voxelCount = 0;
+    voxelizationTime = 0.0f;
+    for (uint32_t z = 0; z < brickCount; ++z) {
+        for (uint32_t y = 0; y < brickCount; ++y) {
+            for (uint32_t x = 0; x < brickCount; ++x) {
+                glm::uvec3 brick = glm::uvec3(x, y, z);
+                auto voxelizeStart = std::chrono::high_resolution_clock::now();
+                voxelizer->VoxelizeBrick(commandPool, commandBuffer, brick, brickResolution);
+                voxelizationTime += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - voxelizeStart).count();
+                if (voxelizer->voxelCount == 0)
+                    continue;
+
+                BufferID readbackBuffer = ReadbackFragments(voxelizer->voxelFragmentBuffer, voxelizer->voxelColorBuffer, voxelizer->voxelCount);
+                const uint64_t *voxelKeys = (const uint64_t *)device->MapBuffer(readbackBuffer);
+                const uint32_t *voxelColors = (const uint32_t *)(voxelKeys + voxelizer->voxelCount);
+                voxelCount += octree::utils::BuildOctreeFromVoxels(voxelKeys, voxelColors, voxelizer->voxelCount, brickMaxLevel, brickOctree);
+                fragmentCount += voxelizer->voxelCount;
+                device->Destroy(readbackBuffer);
+
+                octree::utils::AppendBrickOctree(brickOctree, brick, bricks, nodes);
             }
+        }
+    }
+    voxelizer->Shutdown();
+
+    if (bricks.empty()) {
+        BuildEmpty();
+        return;
+    }
+
+    octree::utils::StitchBrickOctrees(bricks, brickLevels, nodes);
+    UploadOctree(nodes);
+}
+
+bool OctreeBuilder::Update() {
+    if (!buildPending)
+        return true;
+
+    if (!device->IsFenceSignalled(buildSubmitInfo.fence))
+        return false;
+
+    // Bottom-up builds already write into an exact-size buffer
+    if (buildStrategy == BUILD_STRATEGY_TOP_DOWN && !emptyBuild && !compactPending && !filterPending) {
+        octreeElmCount = buildInfoPtr[0] + buildInfoPtr[1];
+        const uint32_t *levelBeginPtr = (const uint32_t *)device->MapBuffer(levelBeginBuffer);
+        levelBegins.assign(levelBeginPtr, levelBeginPtr + levels);
+        levelBegins.push_back(octreeElmCount);
+
+        float octreeMemory = InMB(uint64_t(octreeElmCount) * VOXEL_DATA_SIZE);
+        LOG("Actual Octree Memory: " + std::to_string(octreeMemory) + "MB");
+
+        CompactOctree();
+        return false;
+    }
+
+    if (compactPending) {
+        // The build sets point at the scratch buffer, they go away with it
+        device->Destroy(initNodeSet);
+        device->Destroy(tagNodeSet);
+        device->Destroy(allocateNodeSet);
+        device->Destroy(scratchOctreeBuffer);
+        compactPending = false;
+        LOG("Octree compaction freed: " + std::to_string(InMB(octreeScratchSize - uint64_t(octreeElmCount) * VOXEL_DATA_SIZE)) + "MB");
+    }
+
+    if (!filterPending) {
+        device->ResetFences(&buildSubmitInfo.fence, 1);
+        device->ResetCommandPool(buildSubmitInfo.commandPool);
+
+        UniformSetID filterSet = transientSets.emplace_back(CreateAttributeBuffer());
+        RD::BufferBarrier octreeBarrier = {octreeBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT | RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+        device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+            device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT | RD::PIPELINE_STAGE_TRANSFER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &octreeBarrier, 1);
+            FilterAttributes(commandBuffer, filterSet);
         },
-                                &submitInfo);
-        device->WaitForFence(&submitInfo.fence, 1, UINT64_MAX);
-        device->ResetFences(&submitInfo.fence, 1);
-        device->ResetCommandPool(submitInfo.commandPool);
+                                &buildSubmitInfo);
+        filterPending = true;
+        return false;
     }
+    filterPending = false;
+
+    if (!IsCPUBuild() && !emptyBuild) {
+        device->Destroy(voxelFragmentBuffer);
+        device->Destroy(voxelColorBuffer);
+    }
+    for (UniformSetID uniformSet : transientSets)
+        device->Destroy(uniformSet);
+    for (BufferID buffer : transientBuffers)
+        device->Destroy(buffer);
+    transientSets.clear();
+    transientBuffers.clear();
+
+    device->Destroy(buildSubmitInfo.commandPool);
+    device->Destroy(buildSubmitInfo.fence);
+    buildPending = false;
+
+    if (buildCallback) {
+        BuildCallback callback = std::move(buildCallback);
+        buildCallback = nullptr;
+        callback(this);
+    }
+    return true;
+}
+
+bool OctreeBuilder::GetCacheKey(uint64_t &contentHash, AABB &aabb) {
+    // The procedural terrain has no source files to key the cache on
+    if (!scene || scene->sourceFiles.empty())
+        return false;
+
+    contentHash = octree::OctreeCache::HashSceneContent(scene->sourceFiles);
+    aabb = std::static_pointer_cast<GLTFScene>(scene)->GetBoundingBox();
+    return true;
+}
+
+bool OctreeBuilder::LoadCache(const std::string &filename) {
+    assert(!buildPending);
+
+    octree::OctreeCache::Header expected = {};
+    AABB aabb;
+    if (!GetCacheKey(expected.contentHash, aabb))
+        return false;
+    expected.resolution = resolution;
+    expected.levels = levels;
+    expected.aabbMin = aabb.min;
+    expected.aabbMax = aabb.max;
+
+    octree::OctreeCache cache;
+    if (!cache.Open(filename, expected))
+        return false;
+    return UploadCache(cache);
+}
+
+bool OctreeBuilder::LoadCacheFile(const std::string &filename) {
+    assert(!buildPending);
+
+    octree::OctreeCache cache;
+    if (!cache.Open(filename))
+        return false;
+    resolution = cache.GetHeader().resolution;
+    levels = cache.GetHeader().levels;
+    return UploadCache(cache);
+}
+
+bool OctreeBuilder::UploadCache(octree::OctreeCache &cache) {
+    const octree::OctreeCache::Header &header = cache.GetHeader();
+    octreeElmCount = header.nodeCount;
+    voxelCount = header.voxelCount;
+    // The cache doesn't say which build laid out the slots
+    levelBegins.clear();
+    fragmentCount = header.fragmentCount;
+
+    // Nodes are copied straight from the mapping into the staging buffer
+    const uint64_t octreeSize = uint64_t(octreeElmCount) * VOXEL_DATA_SIZE;
+    BufferID stagingBuffer = device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeStagingBuffer");
+    std::memcpy(device->MapBuffer(stagingBuffer), cache.GetNodes(), octreeSize);
+    cache.Close();
+
+    octreeBuffer = device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeBuffer");
+    LOG("Loaded Octree from cache: " + std::to_string(InMB(octreeSize)) + "MB");
+
+    RD::ImmediateSubmitInfo submitInfo;
+    submitInfo.queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+    submitInfo.commandPool = device->CreateCommandPool(submitInfo.queue, "TempCommandPool");
+    submitInfo.commandBuffer = device->CreateCommandBuffer(submitInfo.commandPool, "TempCommandBuffer");
+    submitInfo.fence = device->CreateFence("TempFence");
+
+    UniformSetID filterSet = CreateAttributeBuffer();
+    RD::BufferBarrier uploadBarrier = {octreeBuffer, RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        RD::BufferCopyRegion region = {0, 0, octreeSize};
+        device->CopyBuffer(commandBuffer, stagingBuffer, octreeBuffer, &region);
+
+        // Node attributes are cheap to rebuild so they are not part of the cache
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_TRANSFER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &uploadBarrier, 1);
+        FilterAttributes(commandBuffer, filterSet);
+    },
+                            &submitInfo);
+    device->WaitForFence(&submitInfo.fence, 1, UINT64_MAX);
+
+    device->Destroy(filterSet);
+    device->Destroy(stagingBuffer);
     device->Destroy(submitInfo.commandPool);
     device->Destroy(submitInfo.fence);
-    voxelizer->Shutdown();
 
-    octreeElmCount = buildInfoPtr[0] + buildInfoPtr[1];
+    loadedFromCache = true;
+    return true;
+}
+
+bool OctreeBuilder::SaveCache(const std::string &filename) {
+    assert(!buildPending && octreeElmCount > 0);
+
+    octree::OctreeCache::Header header = {};
+    AABB aabb;
+    if (!GetCacheKey(header.contentHash, aabb))
+        return false;
+    header.magic = octree::OctreeCache::kMagic;
+    header.version = octree::OctreeCache::kVersion;
+    header.resolution = resolution;
+    header.levels = levels;
+    header.nodeCount = octreeElmCount;
+    header.voxelCount = voxelCount;
+    header.fragmentCount = fragmentCount;
+    header.aabbMin = aabb.min;
+    header.aabbMax = aabb.max;
+
+    std::vector<uint32_t> nodes;
+    ReadbackOctree(nodes);
+    bool written = octree::OctreeCache::Write(filename, header, nodes.data());
+    if (!written)
+        LOGE("Failed to write octree cache " + filename);
+    return written;
+}
+
+void OctreeBuilder::ReadbackOctree(std::vector<uint32_t> &outNodes) {
+    assert(!buildPending && octreeElmCount > 0);
+
+    const uint64_t octreeSize = uint64_t(octreeElmCount) * VOXEL_DATA_SIZE;
+    BufferID readbackBuffer = device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "OctreeReadbackBuffer");
+
+    RD::ImmediateSubmitInfo submitInfo;
+    submitInfo.queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+    submitInfo.commandPool = device->CreateCommandPool(submitInfo.queue, "TempCommandPool");
+    submitInfo.commandBuffer = device->CreateCommandBuffer(submitInfo.commandPool, "TempCommandBuffer");
+    submitInfo.fence = device->CreateFence("TempFence");
+
+    RD::BufferBarrier readbackBarrier = {octreeBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT | RD::BARRIER_ACCESS_TRANSFER_WRITE_BIT, RD::BARRIER_ACCESS_TRANSFER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT | RD::PIPELINE_STAGE_TRANSFER_BIT, RD::PIPELINE_STAGE_TRANSFER_BIT, nullptr, 0, &readbackBarrier, 1);
+
+        RD::BufferCopyRegion region = {0, 0, octreeSize};
+        device->CopyBuffer(commandBuffer, octreeBuffer, readbackBuffer, &region);
+    },
+                            &submitInfo);
+    device->WaitForFence(&submitInfo.fence, 1, UINT64_MAX);
+
+    const uint32_t *nodes = (const uint32_t *)device->MapBuffer(readbackBuffer);
+    outNodes.assign(nodes, nodes + octreeElmCount);
+
+    device->Destroy(readbackBuffer);
+    device->Destroy(submitInfo.commandPool);
+    device->Destroy(submitInfo.fence);
+}
+
+void OctreeBuilder::CompactOctree() {
+    // Nodes are allocated linearly from the start of the scratch buffer, so
+    // compaction is a copy of the used range into a right-sized buffer
+    uint64_t octreeSize = uint64_t(octreeElmCount) * VOXEL_DATA_SIZE;
+    scratchOctreeBuffer = octreeBuffer;
+    octreeBuffer = device->CreateBuffer(octreeSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeBuffer");
+
+    device->ResetFences(&buildSubmitInfo.fence, 1);
+    device->ResetCommandPool(buildSubmitInfo.commandPool);
+
+    RD::BufferBarrier copyBarrier = {scratchOctreeBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_TRANSFER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_TRANSFER_BIT, nullptr, 0, &copyBarrier, 1);
+
+        RD::BufferCopyRegion region = {0, 0, octreeSize};
+        device->CopyBuffer(commandBuffer, scratchOctreeBuffer, octreeBuffer, &region);
+    },
+                            &buildSubmitInfo);
+    compactPending = true;
+}
+
+UniformSetID OctreeBuilder::CreateAttributeBuffer() {
+    octreeAttributeBuffer = device->CreateBuffer(uint64_t(octreeElmCount) * NODE_ATTRIBUTE_SIZE, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "OctreeAttributeBuffer");
+
+    RD::BoundUniform boundUniforms[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, octreeBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 1, octreeAttributeBuffer},
+    };
+    return device->CreateUniformSet(pipelineFilterAttributes, boundUniforms, static_cast<uint32_t>(std::size(boundUniforms)), 0, "FilterAttributesSet");
+}
+
+void OctreeBuilder::FilterAttributes(CommandBufferID commandBuffer, UniformSetID filterSet) {
+    device->BindPipeline(commandBuffer, pipelineFilterAttributes);
+    device->BindUniformSet(commandBuffer, pipelineFilterAttributes, &filterSet, 1);
+
+    RD::BufferBarrier attributeBarrier = {octreeAttributeBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    auto dispatchRange = [&](uint32_t begin, uint32_t end) {
+        uint32_t range[] = {begin, end};
+        device->BindPushConstants(commandBuffer, pipelineFilterAttributes, RD::SHADER_STAGE_COMPUTE, range, 0, sizeof(range));
+        device->DispatchCompute(commandBuffer, RenderingUtils::GetWorkGroupSize(end - begin, 32), 1, 1);
+    };
+
+    // The GPU builds lay the levels out one after another, a level is
+    // filtered once the level below it is final
+    if (!levelBegins.empty()) {
+        for (uint32_t level = levels; level-- > 0;) {
+            if (level + 1 < levels)
+                device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &attributeBarrier, 1);
+            dispatchRange(levelBegins[level], levelBegins[level + 1]);
+        }
+        return;
+    }
 
-    float octreeMemory = InMB(octreeElmCount * sizeof(uint32_t));
-    LOG("Actual Octree Memory: " + std::to_string(octreeMemory) + "MB");
+    // The CPU builds append whole subtrees, their slots are not ordered by
+    // level. Every pass walks all the nodes and finalizes one more level
+    // from the bottom up, levels * octreeElmCount threads in total
+    for (uint32_t i = 0; i < levels; ++i) {
+        if (i > 0)
+            device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &attributeBarrier, 1);
+        dispatchRange(0, octreeElmCount);
+    }
 }
 
 void OctreeBuilder::InitializeNode(CommandBufferID commandBuffer) {
@@ -175,11 +756,11 @@ void OctreeBuilder::TagNode(CommandBufferID commandBuffer, uint32_t level, uint3
     device->BindPipeline(commandBuffer, pipelineTagNode);
     device->BindUniformSet(commandBuffer, pipelineTagNode, &tagNodeSet, 1);
 
-    uint32_t data[] = {voxelCount, level, kResolution};
+    uint32_t data[] = {voxelCount, level, resolution};
     device->BindPushConstants(commandBuffer, pipelineTagNode, RD::SHADER_STAGE_COMPUTE, &data, 0, sizeof(uint32_t) * 3);
 
     uint32_t workGroupSize = RenderingUtils::GetWorkGroupSize(data[0], 32);
-    device->DispatchCompute(commandBuffer, data[0], 1, 1);
+    device->DispatchCompute(commandBuffer, workGroupSize, 1, 1);
 }
 
 void OctreeBuilder::AllocateNode(CommandBufferID commandBuffer) {
@@ -195,17 +776,29 @@ void OctreeBuilder::UpdateParams(CommandBufferID commandBuffer) {
 }
 
 void OctreeBuilder::Shutdown() {
-    device->Destroy(dispatchIndirectBuffer);
+    while (!Update())
+        device->WaitForFence(&buildSubmitInfo.fence, 1, UINT64_MAX);
+
     device->Destroy(octreeBuffer);
-    device->Destroy(buildInfoBuffer);
+    device->Destroy(octreeAttributeBuffer);
 
     device->Destroy(pipelineInitNode);
     device->Destroy(pipelineTagNode);
     device->Destroy(pipelineAllocateNode);
     device->Destroy(pipelineUpdateParams);
+    device->Destroy(pipelineMortonCount);
+    device->Destroy(pipelineMortonScan);
+    device->Destroy(pipelineMortonWrite);
+    device->Destroy(pipelineFilterAttributes);
+    fragmentSorter.Shutdown();
+
+    // Nothing but the octree is created when it comes from the cache
+    if (loadedFromCache)
+        return;
+
+    device->Destroy(dispatchIndirectBuffer);
+    device->Destroy(buildInfoBuffer);
 
-    device->Destroy(initNodeSet);
-    device->Destroy(tagNodeSet);
-    device->Destroy(allocateNodeSet);
-    device->Destroy(updateParamsSet);
+    if (buildStrategy == BUILD_STRATEGY_TOP_DOWN && !emptyBuild)
+        device->Destroy(updateParamsSet);
 }
@@ -1,11 +1,21 @@
 #pragma once
 
 #include <memory>
+#include <functional>
+#include <vector>
+#include <string>
 
+#include "math-utils.h"
 #include "rendering/rendering-device.h"
+#include "voxelizer/voxel-fragment-sorter.h"
+#include "voxelizer/scene-voxelizer.h"
 
 struct RenderScene;
 
+namespace octree {
+    class OctreeCache;
+}
+
 namespace gfx {
     class Camera;
 }
@@ -13,28 +23,143 @@ namespace gfx {
 class OctreeBuilder {
 
   public:
-    void Initialize(std::shared_ptr<RenderScene> scene);
+    enum BuildStrategy {
+        // Every level re-walks the tree from the root for each fragment
+        BUILD_STRATEGY_TOP_DOWN,
+        // Writes all the levels at once from the morton sorted fragments
+        BUILD_STRATEGY_BOTTOM_UP,
+        // Sorts, merges and builds on the CPU using every core, the
+        // result is uploaded once
+        BUILD_STRATEGY_BOTTOM_UP_CPU,
+        // Voxelizes the scene one brick at a time and builds each brick on
+        // the CPU, only the fragments of a single brick are alive at once.
+        // Falls back to BUILD_STRATEGY_BOTTOM_UP_CPU without a scene
+        BUILD_STRATEGY_BRICKED_CPU,
+    };
+
+    static constexpr uint32_t kDefaultResolution = 1024;
 
+    // voxelResolution is the number of voxels per axis, a power of two up to
+    // 1 << MAX_VOXEL_RESOLUTION_LOG2
+    void Initialize(std::shared_ptr<RenderScene> scene, BuildStrategy strategy = BUILD_STRATEGY_TOP_DOWN, uint32_t voxelResolution = kDefaultResolution);
+
+    using BuildCallback = std::function<void(OctreeBuilder *builder)>;
+
+    // Blocks until the octree is built
     void Build(CommandPoolID commandPool, CommandBufferID commandBuffer);
 
+    // Voxelizes the scene and submits every level of the build in a single
+    // submission without waiting for it. Update() has to be polled until it
+    // returns true, onComplete is invoked from there. octreeBuffer is
+    // replaced by the compacted buffer before the callback runs.
+    void BuildAsync(CommandPoolID commandPool, CommandBufferID commandBuffer, BuildCallback &&onComplete);
+
+    // Returns true when no build is in flight
+    bool Update();
+
+    // The octree is built by utils::BuildOctreeFromVoxels instead of the
+    // compute passes
+    bool IsCPUBuild() const {
+        return buildStrategy == BUILD_STRATEGY_BOTTOM_UP_CPU || buildStrategy == BUILD_STRATEGY_BRICKED_CPU;
+    }
+
+    // Maps a cache written by SaveCache and uploads it as the octree when it
+    // matches the scene content and resolution. Returns false when the
+    // octree has to be built instead. Only scenes loaded from files are cached
+    bool LoadCache(const std::string &filename);
+
+    // Loads a cache without checking it against the scene, the resolution
+    // is taken from the cache. Used to benchmark a known octree
+    bool LoadCacheFile(const std::string &filename);
+
+    // Reads the built octree back and writes it with its cache key
+    bool SaveCache(const std::string &filename);
+
+    // Copies the built octree back to the host, blocks until it is done
+    void ReadbackOctree(std::vector<uint32_t> &outNodes);
+
     void Shutdown();
 
     std::shared_ptr<RenderScene> scene;
 
-    const uint32_t kResolution = 1024;
-    const uint32_t kLevels = static_cast<uint32_t>(std::log2(kResolution) + 1);
+    uint32_t resolution = kDefaultResolution;
+    uint32_t levels = 0;
 
     BufferID octreeBuffer, buildInfoBuffer, dispatchIndirectBuffer;
+    // Two words per node in the same slot as octreeBuffer, interior nodes
+    // hold the filtered attributes of their subtree:
+    //   x: rgb color, coverage of the node volume in the highest 8 bits
+    //   y: snorm xyz normal, zero when the node has no open side
+    BufferID octreeAttributeBuffer;
     PipelineID pipelineInitNode, pipelineTagNode, pipelineAllocateNode, pipelineUpdateParams;
+    PipelineID pipelineMortonCount, pipelineMortonScan, pipelineMortonWrite;
+    PipelineID pipelineFilterAttributes;
     UniformSetID initNodeSet, tagNodeSet, allocateNodeSet, updateParamsSet;
 
     RD *device = nullptr;
+    BuildStrategy buildStrategy = BUILD_STRATEGY_TOP_DOWN;
     const uint32_t VOXEL_DATA_SIZE = static_cast<uint32_t>(sizeof(uint32_t));
+    const uint32_t NODE_ATTRIBUTE_SIZE = static_cast<uint32_t>(sizeof(uint32_t) * 2);
     uint32_t octreeElmCount = 0;
 
+    // Bricks per axis of BUILD_STRATEGY_BRICKED_CPU are resolution / brickResolution
+    uint32_t brickResolution = 256;
+
+    // How scenes are voxelized, the terrain is always generated in compute
+    SceneVoxelizer::VoxelizationMethod voxelizationMethod = SceneVoxelizer::VOXELIZATION_METHOD_RASTER;
+    // Time spent voxelizing in the last build, summed over the bricks
+    float voxelizationTime = 0.0f;
+
+    // Fragments written by the voxelizer and the unique voxels left after
+    // merging duplicates
+    uint32_t fragmentCount = 0;
+    uint32_t voxelCount = 0;
+
+    bool loadedFromCache = false;
+
   private:
+    void BuildTopDown();
+    void BuildBottomUp();
+    void BuildBottomUpCPU(BufferID fragmentBuffer, BufferID colorBuffer);
+    void BuildBricked(CommandPoolID commandPool, CommandBufferID commandBuffer);
+    void BuildEmpty();
+
+    // Copies the keys and the colors into a single host visible buffer,
+    // the colors start right after the count keys
+    BufferID ReadbackFragments(BufferID fragmentBuffer, BufferID colorBuffer, uint32_t count);
+    void UploadOctree(const std::vector<uint32_t> &octree);
+
     void InitializeNode(CommandBufferID commandBuffer);
     void TagNode(CommandBufferID commandBuffer, uint32_t level, uint32_t voxelCount);
     void AllocateNode(CommandBufferID commandBuffer);
     void UpdateParams(CommandBufferID commandBuffer);
+    void CompactOctree();
+    // Creates octreeAttributeBuffer and returns the set FilterAttributes binds
+    UniformSetID CreateAttributeBuffer();
+    void FilterAttributes(CommandBufferID commandBuffer, UniformSetID filterSet);
+    bool GetCacheKey(uint64_t &contentHash, AABB &aabb);
+    bool UploadCache(octree::OctreeCache &cache);
+
+    VoxelFragmentSorter fragmentSorter;
+    BufferID voxelFragmentBuffer, voxelColorBuffer;
+    RD::ImmediateSubmitInfo buildSubmitInfo;
+    BuildCallback buildCallback;
+    uint32_t *buildInfoPtr = nullptr;
+    bool buildPending = false;
+    bool compactPending = false;
+    bool filterPending = false;
+    // Set when nothing was voxelized, the build resources were never created
+    bool emptyBuild = false;
+
+    BufferID scratchOctreeBuffer;
+    uint64_t octreeScratchSize = 0;
+
+    // First slot of every level plus octreeElmCount, only the GPU builds
+    // order the slots by level and fill it
+    BufferID levelBeginBuffer;
+    std::vector<uint32_t> levelBegins;
+
+    // Released once the build finishes
+    std::vector<BufferID> transientBuffers;
+    std::vector<UniformSetID> transientSets;
 };
\ No newline at end of file
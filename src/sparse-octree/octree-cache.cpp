@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "octree-cache.h"
+
+#include "core/task-scheduler.h"
+
+#include <fstream>
+
+namespace octree {
+
+    static constexpr uint64_t kFNVOffsetBasis = 0xcbf29ce484222325ull;
+    static constexpr uint64_t kFNVPrime = 0x100000001b3ull;
+
+    // FNV-1a over 64 bit words, textures can be hundreds of megabytes so
+    // hashing a byte at a time is too slow for startup
+    static uint64_t HashBytes(const uint8_t *data, uint64_t size, uint64_t hash = kFNVOffsetBasis) {
+        uint64_t wordCount = size / sizeof(uint64_t);
+        for (uint64_t i = 0; i < wordCount; ++i) {
+            uint64_t word;
+            std::memcpy(&word, data + i * sizeof(uint64_t), sizeof(uint64_t));
+            hash = (hash ^ word) * kFNVPrime;
+        }
+        for (uint64_t i = wordCount * sizeof(uint64_t); i < size; ++i)
+            hash = (hash ^ data[i]) * kFNVPrime;
+        return hash;
+    }
+
+    uint64_t OctreeCache::HashSceneContent(const std::vector<std::string> &files) {
+        std::vector<uint64_t> fileHashes(files.size(), 0);
+        if (!files.empty())
+            core::ParallelFor(static_cast<uint32_t>(files.size()), [&](uint32_t index) {
+                core::MappedFile file;
+                // Missing files still contribute so that removing one invalidates the cache
+                if (file.Open(files[index]))
+                    fileHashes[index] = HashBytes(file.GetData(), file.GetSize());
+            });
+
+        uint64_t fileCount = files.size();
+        uint64_t hash = HashBytes(reinterpret_cast<const uint8_t *>(&fileCount), sizeof(fileCount));
+        return HashBytes(reinterpret_cast<const uint8_t *>(fileHashes.data()), fileHashes.size() * sizeof(uint64_t), hash);
+    }
+
+    bool OctreeCache::Write(const std::string &filename, const Header &header, const uint32_t *nodes) {
+        std::filesystem::path path(filename);
+        std::error_code error;
+        if (path.has_parent_path())
+            std::filesystem::create_directories(path.parent_path(), error);
+
+        // Written to a temporary file first so that an interrupted write
+        // never leaves a cache with a valid header behind. Processes baking
+        // the same scene each write their own file and the last rename wins
+        std::filesystem::path tempPath = path;
+        tempPath += "." + std::to_string(std::random_device{}()) + ".tmp";
+        {
+            std::ofstream outFile(tempPath, std::ios::binary | std::ios::trunc);
+            if (!outFile) {
+                LOGE("Failed to open octree cache " + tempPath.string());
+                return false;
+            }
+            outFile.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+            outFile.write(reinterpret_cast<const char *>(nodes), uint64_t(header.nodeCount) * sizeof(uint32_t));
+            if (!outFile) {
+                outFile.close();
+                std::filesystem::remove(tempPath, error);
+                LOGE("Failed to write octree cache " + tempPath.string());
+                return false;
+            }
+        }
+
+        std::filesystem::rename(tempPath, path, error);
+        if (error) {
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+        return true;
+    }
+
+    bool OctreeCache::Open(const std::string &filename, const Header &expected) {
+        if (!Open(filename))
+            return false;
+
+        const Header &header = GetHeader();
+        bool valid = header.resolution == expected.resolution &&
+                     header.levels == expected.levels &&
+                     header.contentHash == expected.contentHash &&
+                     header.aabbMin == expected.aabbMin &&
+                     header.aabbMax == expected.aabbMax;
+        if (!valid) {
+            LOG("Octree cache " + filename + " is stale");
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    bool OctreeCache::Open(const std::string &filename) {
+        if (!file.Open(filename))
+            return false;
+
+        if (file.GetSize() < sizeof(Header)) {
+            Close();
+            return false;
+        }
+
+        const Header &header = GetHeader();
+        bool valid = header.magic == kMagic &&
+                     header.version == kVersion &&
+                     header.nodeCount > 0 &&
+                     file.GetSize() == sizeof(Header) + uint64_t(header.nodeCount) * sizeof(uint32_t);
+        if (!valid) {
+            LOG("Octree cache " + filename + " is invalid");
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void OctreeCache::Close() {
+        file.Close();
+    }
+} // namespace octree
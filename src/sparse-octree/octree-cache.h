@@ -0,0 +1,58 @@
+#pragma once
+
+#include "core/mapped-file.h"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace octree {
+
+    // Built octrees are written next to the application so that the next run
+    // with the same scene and resolution can skip voxelization entirely
+    class OctreeCache {
+      public:
+        static constexpr uint32_t kMagic = 0x4f565343; // "CSVO"
+        // Bump whenever the node layout or the header changes
+        static constexpr uint32_t kVersion = 1;
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t resolution;
+            uint32_t levels;
+            uint32_t nodeCount;
+            uint32_t voxelCount;
+            uint32_t fragmentCount;
+            uint32_t padding;
+            // Hash of every file the scene was loaded from, see HashSceneContent
+            uint64_t contentHash;
+            glm::vec3 aabbMin;
+            glm::vec3 aabbMax;
+        };
+
+        // Hashes the content of the files, the hash changes whenever the
+        // glTF, its buffers or any of its textures are modified
+        static uint64_t HashSceneContent(const std::vector<std::string> &files);
+
+        static bool Write(const std::string &filename, const Header &header, const uint32_t *nodes);
+
+        // Maps the cache and checks it against the expected header, on
+        // success the nodes stay mapped until Close is called
+        bool Open(const std::string &filename, const Header &expected);
+        // Only checks that the file is a complete cache of this version
+        bool Open(const std::string &filename);
+        void Close();
+
+        const Header &GetHeader() const {
+            return *reinterpret_cast<const Header *>(file.GetData());
+        }
+
+        const uint32_t *GetNodes() const {
+            return reinterpret_cast<const uint32_t *>(file.GetData() + sizeof(Header));
+        }
+
+      private:
+        core::MappedFile file;
+    };
+} // namespace octree
@@ -4,63 +4,276 @@
 #include "rendering/rendering-utils.h"
 #include "octree-builder.h"
 
-void OctreeTracer::Initialize(std::shared_ptr<OctreeBuilder> builder) {
+void OctreeTracer::Initialize(std::shared_ptr<OctreeBuilder> builder, uint32_t width, uint32_t height) {
     this->builder = builder;
-    RD::UniformBinding bindings[] = {
-        {RD::BINDING_TYPE_STORAGE_BUFFER, 0},
+
+    // Must match the constant_id of OCTREE_SHORT_STACK and OCTREE_SHORT_STACK_SIZE in octree.glsl
+    RD::SpecializationConstant specializations[TRAVERSAL_COUNT][2] = {
+        {{0, 0}, {1, kShortStackSize}},
+        {{0, 1}, {1, kShortStackSize}},
     };
-    RD::PushConstant pushConstants = {0, sizeof(PushConstants)};
+    const char *traversalNames[TRAVERSAL_COUNT] = {"", " Short Stack"};
+
+    RD *device = RD::GetInstance();
+    {
+        RD::UniformBinding bindings[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+            {RD::BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, 6},
+        };
+        ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-beam.comp.spv", bindings, (uint32_t)std::size(bindings), nullptr, 0);
+        for (uint32_t i = 0; i < TRAVERSAL_COUNT; ++i)
+            beamPipelines[i] = device->CreateComputePipeline(shader, false, std::string("Octree Beam") + traversalNames[i], specializations[i], 2);
+        device->Destroy(shader);
+    }
+    {
+        RD::UniformBinding bindings[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+            {RD::BINDING_TYPE_IMAGE, 0, 3},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 4},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 5},
+            {RD::BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, 6},
+        };
+        ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-trace.comp.spv", bindings, (uint32_t)std::size(bindings), nullptr, 0);
+        for (uint32_t i = 0; i < TRAVERSAL_COUNT; ++i)
+            tracePipelines[i] = device->CreateComputePipeline(shader, false, std::string("Octree Trace") + traversalNames[i], specializations[i], 2);
+        device->Destroy(shader);
+    }
+
+    CreateTargets(width, height);
+}
+
+void OctreeTracer::CreateTargets(uint32_t width, uint32_t height) {
+    this->width = width;
+    this->height = height;
+
+    RD *device = RD::GetInstance();
+    RD::TextureDescription description = RD::TextureDescription::Initialize(width, height);
+    description.format = RD::FORMAT_R8G8B8A8_UNORM;
+    description.usageFlags = RD::TEXTURE_USAGE_STORAGE_BIT | RD::TEXTURE_USAGE_TRANSFER_SRC_BIT;
+    outputTexture = device->CreateTexture(&description, "Octree Trace Output");
+
+    // One beam per tile corner
+    uint32_t beamCountX = (width + kTileSize - 1) / kTileSize + 1;
+    uint32_t beamCountY = (height + kTileSize - 1) / kTileSize + 1;
+    beamBuffer = device->CreateBuffer(beamCountX * beamCountY * sizeof(float), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Octree Beam Buffer");
 
-    ShaderID shaders[2] = {
-        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/raycast-grid.vert.spv", nullptr, 0, nullptr, 0),
-        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/octree-raycast.frag.spv", bindings, (uint32_t)std::size(bindings), &pushConstants, 1),
+    RD::BoundUniform beamBindings[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, builder->octreeBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 1, builder->octreeAttributeBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 2, beamBuffer},
+        {RD::BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC, 6, device->GetTransientBuffer(), 0, sizeof(Constants)},
     };
-    RD::RasterizationState rasterizationState = RD::RasterizationState::Create();
-    RD::DepthState depthState = RD::DepthState::Create();
-    depthState.enableDepthWrite = false;
-    depthState.enableDepthTest = false;
+    beamSet = device->CreateUniformSet(beamPipelines[0], beamBindings, (uint32_t)std::size(beamBindings), 0, "Octree Beam Set");
 
-    RD::Format colorAttachmentFormat = RD::FORMAT_B8G8R8A8_UNORM;
-    RD::BlendState blendState = RD::BlendState::Create();
+    // Shaded color and hit distance of every pixel
+    uint32_t historySize = width * height * static_cast<uint32_t>(sizeof(uint32_t) * 2);
+    historyBuffers[0] = device->CreateBuffer(historySize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Octree History Buffer 0");
+    historyBuffers[1] = device->CreateBuffer(historySize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Octree History Buffer 1");
+    historyValid = false;
 
+    for (uint32_t i = 0; i < 2; ++i) {
+        RD::BoundUniform traceBindings[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, builder->octreeBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, builder->octreeAttributeBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 2, beamBuffer},
+            {RD::BINDING_TYPE_IMAGE, 3, outputTexture, 0, 0},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 4, historyBuffers[i ^ 1]},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 5, historyBuffers[i]},
+            {RD::BINDING_TYPE_UNIFORM_BUFFER_DYNAMIC, 6, device->GetTransientBuffer(), 0, sizeof(Constants)},
+        };
+        traceSets[i] = device->CreateUniformSet(tracePipelines[0], traceBindings, (uint32_t)std::size(traceBindings), 0, "Octree Trace Set " + std::to_string(i));
+    }
+}
+
+void OctreeTracer::DestroyTargets() {
     RD *device = RD::GetInstance();
-    pipeline = device->CreateGraphicsPipeline(shaders,
-                                              static_cast<uint32_t>(std::size(shaders)),
-                                              RD::TOPOLOGY_TRIANGLE_LIST,
-                                              &rasterizationState,
-                                              &depthState,
-                                              &colorAttachmentFormat,
-                                              &blendState,
-                                              1,
-                                              RD::FORMAT_D24_UNORM_S8_UINT,
-                                              false,
-                                              "Octree Raymarch");
-    device->Destroy(shaders[0]);
-    device->Destroy(shaders[1]);
-
-    RD::BoundUniform boundUniform = {RD::BINDING_TYPE_STORAGE_BUFFER, 0, builder->octreeBuffer};
-    uniformSet = device->CreateUniformSet(pipeline, &boundUniform, 1, 0, "Octree Raymarch Set");
+    device->Destroy(beamSet);
+    device->Destroy(traceSets[0]);
+    device->Destroy(traceSets[1]);
+    device->Destroy(beamBuffer);
+    device->Destroy(historyBuffers[0]);
+    device->Destroy(historyBuffers[1]);
+    device->Destroy(outputTexture);
+}
+
+void OctreeTracer::Resize(uint32_t width, uint32_t height) {
+    DestroyTargets();
+    CreateTargets(width, height);
+}
+
+glm::mat4 OctreeTracer::GetOctreeTransform() const {
+    return glm::scale(glm::mat4(1.0f), glm::vec3(static_cast<float>(builder->resolution * 0.1))) *
+           glm::translate(glm::mat4(1.0f), glm::vec3(-1.5f, -1.5f, -1.5f));
+}
+
+glm::mat3 OctreeTracer::GetRayMatrix(std::shared_ptr<gfx::Camera> camera) const {
+    // Camera ray through uv in view space, folded with the inverse view and
+    // model matrices into a single matrix
+    glm::mat4 invP = camera->GetInvProjectionMatrix();
+    glm::mat3 viewRay = glm::mat3(glm::vec3(invP[0][0], invP[1][0], 0.0f),
+                                  glm::vec3(invP[0][1], invP[1][1], 0.0f),
+                                  glm::vec3(-invP[0][2], -invP[1][2], -1.0f));
+    glm::mat4 invM = glm::inverse(GetOctreeTransform());
+    return glm::mat3(invM) * glm::mat3(camera->GetInvViewMatrix()) * viewRay;
+}
+
+octree::tracer::Ray OctreeTracer::GetScreenRay(std::shared_ptr<gfx::Camera> camera, const glm::vec2 &pixel) const {
+    // Same ray as GenerateOctreeRay, the traced image is flipped when it is
+    // copied to the swapchain so its first row is the bottom of the window
+    glm::vec2 uv = glm::vec2(pixel.x / float(width) * 2.0f - 1.0f, 1.0f - pixel.y / float(height) * 2.0f);
+    glm::vec3 origin = glm::inverse(GetOctreeTransform()) * glm::vec4(camera->GetPosition(), 1.0f);
+    return {origin, glm::normalize(GetRayMatrix(camera) * glm::vec3(uv, 1.0f))};
 }
 
 void OctreeTracer::Trace(CommandBufferID commandBuffer, std::shared_ptr<gfx::Camera> camera) {
-    glm::mat4 M = glm::scale(glm::mat4(1.0f), glm::vec3(static_cast<float>(builder->kResolution * 0.1))) *
-                  glm::translate(glm::mat4(1.0f), glm::vec3(-1.5f, -1.5f, -1.5f));
+    RD *device = RD::GetInstance();
+    RD::TransientAllocation allocation = device->AllocateTransient(sizeof(Constants));
+    if (!allocation.data) {
+        LOGW("Transient buffer is full, octree trace skipped");
+        return;
+    }
+    Constants constants = {};
+
+    glm::mat4 M = GetOctreeTransform();
+    glm::mat4 invM = glm::inverse(M);
+    glm::mat4 invP = camera->GetInvProjectionMatrix();
+    constants.rayMatrix = glm::mat4(GetRayMatrix(camera));
+    constants.rayOrigin = invM * glm::vec4(camera->GetPosition(), 1.0f);
+    constants.imageSize = glm::uvec2(width, height);
+
+    // A beam has to cover every pixel of the four tiles around its corner,
+    // plus a pixel of slack. The traversal stops at nodes between half and
+    // all of ray_scale * t, so the scale is doubled for the node the beam
+    // stops at to be at least as large as the footprint. The model matrix
+    // is a uniform scale so the angle is the same in octree space.
+    float pixelSize = std::max(2.0f * invP[0][0] / float(width), 2.0f * invP[1][1] / float(height));
+    constants.beamScale = 2.0f * (float(kTileSize) * 1.41421356f + 1.0f) * pixelSize;
+    constants.lodScale = lodPixelSize * pixelSize;
+    constants.shadowLodScale = shadowLodPixelSize * pixelSize;
+
+    constants.flags = halfResolutionShadows ? TRACE_FLAG_HALF_RES_SHADOWS : 0;
+    if (temporalReprojection) {
+        constants.flags |= TRACE_FLAG_TEMPORAL;
+        if (historyValid)
+            constants.flags |= TRACE_FLAG_HISTORY_VALID;
+    }
+    constants.prevViewProjection = prevViewProjection;
+    constants.prevRayOrigin = glm::vec4(prevRayOrigin, 1.0f);
+    constants.frame = frameIndex;
+
+    // History is only written by temporal frames
+    historyValid = temporalReprojection;
+    prevViewProjection = camera->GetProjectionMatrix() * camera->GetViewMatrix() * M;
+    prevRayOrigin = glm::vec3(constants.rayOrigin);
+    std::memcpy(allocation.data, &constants, sizeof(Constants));
+    UniformSetID traceSet = traceSets[frameIndex & 1];
+
+    // The output was copied to the swapchain last frame
+    RD::TextureBarrier outputBarrier{
+        .texture = outputTexture,
+        .srcAccess = RD::BARRIER_ACCESS_TRANSFER_READ_BIT,
+        .dstAccess = RD::BARRIER_ACCESS_SHADER_WRITE_BIT,
+        .newLayout = RD::TEXTURE_LAYOUT_GENERAL,
+        .srcQueueFamily = QUEUE_FAMILY_IGNORED,
+        .dstQueueFamily = QUEUE_FAMILY_IGNORED,
+        .baseMipLevel = 0,
+        .baseArrayLayer = 0,
+        .levelCount = 1,
+        .layerCount = 1,
+    };
+    // and the history was written by the last trace
+    RD::BufferBarrier historyBarrier = {historyBuffers[(frameIndex - 1) & 1], RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_TRANSFER_BIT | RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, &outputBarrier, 1, &historyBarrier, 1);
+
+    uint32_t tileCountX = (width + kTileSize - 1) / kTileSize;
+    uint32_t tileCountY = (height + kTileSize - 1) / kTileSize;
 
-    pushConstants.invP = camera->GetInvProjectionMatrix();
-    pushConstants.invV = camera->GetInvViewMatrix();
-    pushConstants.invM = glm::inverse(M);
-    pushConstants.camPos = glm::vec4(camera->GetPosition(), 0.0f);
+    PipelineID beamPipeline = beamPipelines[traversal];
+    PipelineID tracePipeline = tracePipelines[traversal];
 
+    device->BindPipeline(commandBuffer, beamPipeline);
+    device->BindUniformSet(commandBuffer, beamPipeline, &beamSet, 1, &allocation.offset, 1);
+    device->DispatchCompute(commandBuffer, (tileCountX + 1 + 7) / 8, (tileCountY + 1 + 7) / 8, 1);
+
+    RD::BufferBarrier beamBarrier = {beamBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+    device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &beamBarrier, 1);
+
+    device->BindPipeline(commandBuffer, tracePipeline);
+    device->BindUniformSet(commandBuffer, tracePipeline, &traceSet, 1, &allocation.offset, 1);
+    device->DispatchCompute(commandBuffer, tileCountX, tileCountY, 1);
+    frameIndex++;
+}
+
+void OctreeTracer::Benchmark(std::shared_ptr<gfx::Camera> camera, uint32_t frameCount) {
     RD *device = RD::GetInstance();
-    device->BindPipeline(commandBuffer, pipeline);
-    device->BindUniformSet(commandBuffer, pipeline, &uniformSet, 1);
-    device->BindPushConstants(commandBuffer, pipeline, RD::SHADER_STAGE_FRAGMENT, &pushConstants, 0, sizeof(PushConstants));
+    RD::ImmediateSubmitInfo submitInfo;
+    submitInfo.queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+    submitInfo.commandPool = device->CreateCommandPool(submitInfo.queue, "Octree Benchmark Command Pool");
+    submitInfo.commandBuffer = device->CreateCommandBuffer(submitInfo.commandPool, "Octree Benchmark Command Buffer");
+    submitInfo.fence = device->CreateFence("Octree Benchmark Fence");
+
+    // Every pixel has to be traced for the numbers to compare
+    Traversal currentTraversal = traversal;
+    bool currentTemporal = temporalReprojection;
+    temporalReprojection = false;
+
+    // Timestamps around the traced frames, the wall clock is only used when
+    // the queue can't write timestamps
+    float timestampPeriod = device->GetTimestampPeriod();
+    QueryPoolID queryPool = device->CreateTimestampQueryPool(2, "Octree Benchmark Query Pool");
+
+    using Clock = std::chrono::high_resolution_clock;
+    for (uint32_t i = 0; i < TRAVERSAL_COUNT; ++i) {
+        traversal = static_cast<Traversal>(i);
+        // The first submission warms up the pipeline and the caches
+        for (uint32_t pass = 0; pass < 2; ++pass) {
+            uint32_t passFrames = pass == 0 ? 1 : frameCount;
+            auto start = Clock::now();
+            device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+                device->ResetQueryPool(commandBuffer, queryPool, 0, 2);
+                device->WriteTimestamp(commandBuffer, queryPool, 0);
+                for (uint32_t frame = 0; frame < passFrames; ++frame)
+                    Trace(commandBuffer, camera);
+                device->WriteTimestamp(commandBuffer, queryPool, 1);
+            },
+                                    &submitInfo);
+            device->WaitForFence(&submitInfo.fence, 1, UINT64_MAX);
+            float milliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+            if (timestampPeriod > 0.0f) {
+                uint64_t timestamps[2];
+                device->GetQueryResults(queryPool, 0, 2, timestamps);
+                milliseconds = static_cast<float>(double(timestamps[1] - timestamps[0]) * timestampPeriod * 1e-6);
+            }
+            device->ResetFences(&submitInfo.fence, 1);
+            device->ResetCommandPool(submitInfo.commandPool);
+
+            if (pass == 1) {
+                BenchmarkResult &result = benchmarkResults[i];
+                result.milliseconds = milliseconds / float(frameCount);
+                result.raysPerSecond = float(width) * float(height) / (result.milliseconds * 0.001f);
+                LOG("Octree traversal " + std::to_string(i) + ": " + std::to_string(result.milliseconds) + "ms, " + std::to_string(result.raysPerSecond * 1e-6f) + " Mrays/s");
+            }
+        }
+    }
+
+    traversal = currentTraversal;
+    temporalReprojection = currentTemporal;
+    historyValid = false;
 
-    device->Draw(commandBuffer, 6, 1, 0, 0);
+    device->Destroy(queryPool);
+    device->Destroy(submitInfo.commandPool);
+    device->Destroy(submitInfo.fence);
 }
 
 void OctreeTracer::Shutdown() {
+    DestroyTargets();
     RD *device = RD::GetInstance();
-    device->Destroy(pipeline);
-    device->Destroy(uniformSet);
+    for (uint32_t i = 0; i < TRAVERSAL_COUNT; ++i) {
+        device->Destroy(beamPipelines[i]);
+        device->Destroy(tracePipelines[i]);
+    }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rendering/rendering-device.h"
+#include "cpu-octree-tracer.h"
 
 #include <memory>
 #include <glm/glm.hpp>
@@ -11,24 +12,110 @@ namespace gfx {
     class Camera;
 }
 
+// Traces the octree in two compute passes, coarse beams at the corners of
+// every kTileSize^2 tile find a conservative start distance and the per
+// pixel rays start from there. The result is written to outputTexture.
 class OctreeTracer {
   public:
-    void Initialize(std::shared_ptr<OctreeBuilder> builder);
+    static constexpr uint32_t kTileSize = 8;
+    // Entries of the short stack traversal, must be a power of two
+    static constexpr uint32_t kShortStackSize = 4;
+
+    enum Traversal {
+        // Full 24 entry stack per ray
+        TRAVERSAL_FULL_STACK = 0,
+        // kShortStackSize entries, restarts from the root when it runs out
+        TRAVERSAL_SHORT_STACK,
+        TRAVERSAL_COUNT
+    };
+
+    struct BenchmarkResult {
+        float milliseconds = 0.0f;
+        // Primary rays, the shadow rays of the hits are part of the time
+        float raysPerSecond = 0.0f;
+    };
+
+    void Initialize(std::shared_ptr<OctreeBuilder> builder, uint32_t width, uint32_t height);
+
+    void Resize(uint32_t width, uint32_t height);
 
     void Trace(CommandBufferID commandBuffer, std::shared_ptr<gfx::Camera> camera);
 
+    // Traces frameCount frames from the camera with every traversal and
+    // waits for each of them, the results are stored in benchmarkResults
+    void Benchmark(std::shared_ptr<gfx::Camera> camera, uint32_t frameCount);
+
     void Shutdown();
 
+    // Maps the octree space of the traversal, [1, 2] on every axis, to world space
+    glm::mat4 GetOctreeTransform() const;
+
+    // Ray in octree space through a window pixel, y pointing down like the
+    // mouse position
+    octree::tracer::Ray GetScreenRay(std::shared_ptr<gfx::Camera> camera, const glm::vec2 &pixel) const;
+
+    TextureID outputTexture;
+
+    // Pixel rays stop at nodes that project smaller than this many pixels,
+    // zero always descends to the leaves
+    float lodPixelSize = 1.0f;
+
+    // Shadow rays are occlusion only and stop at nodes smaller than this
+    // many pixels at the primary hit, zero traces them to the leaves
+    float shadowLodPixelSize = 0.0f;
+    bool halfResolutionShadows = false;
+
+    // Traces half of the pixels every frame and reprojects the other half
+    // from the previous frame wherever the depth agrees
+    bool temporalReprojection = false;
+
+    Traversal traversal = TRAVERSAL_FULL_STACK;
+    BenchmarkResult benchmarkResults[TRAVERSAL_COUNT];
+
   private:
-    PipelineID pipeline;
-    UniformSetID uniformSet;
-    
+    // Must match TRACE_FLAG_* in octree-tracer.glsl
+    enum TraceFlags {
+        TRACE_FLAG_HALF_RES_SHADOWS = 1,
+        TRACE_FLAG_TEMPORAL = 2,
+        TRACE_FLAG_HISTORY_VALID = 4,
+    };
+
+    // Direction of the ray through uv is rayMatrix * vec3(uv, 1) in octree space
+    glm::mat3 GetRayMatrix(std::shared_ptr<gfx::Camera> camera) const;
+
+    void CreateTargets(uint32_t width, uint32_t height);
+    void DestroyTargets();
+
+    // One pipeline per traversal, the sets are shared as the layouts match
+    PipelineID beamPipelines[TRAVERSAL_COUNT];
+    PipelineID tracePipelines[TRAVERSAL_COUNT];
+    UniformSetID beamSet;
+    // Indexed by frame parity, the history buffers swap every frame
+    UniformSetID traceSets[2];
+
+    BufferID beamBuffer;
+    BufferID historyBuffers[2];
+    uint32_t width, height;
+
+    uint32_t frameIndex = 0;
+    bool historyValid = false;
+    glm::mat4 prevViewProjection;
+    glm::vec3 prevRayOrigin;
+
     std::shared_ptr<OctreeBuilder> builder;
 
-    struct PushConstants {
-        glm::mat4 invP;
-        glm::mat4 invV;
-        glm::mat4 invM;
-        glm::vec4 camPos;
-    } pushConstants;
-};
\ No newline at end of file
+    // Must match TraceConstants in octree-tracer.glsl, std140
+    struct Constants {
+        glm::mat4 rayMatrix;
+        glm::vec4 rayOrigin;
+        glm::mat4 prevViewProjection;
+        glm::vec4 prevRayOrigin;
+        glm::uvec2 imageSize;
+        float beamScale;
+        float lodScale;
+        uint32_t flags;
+        float shadowLodScale;
+        uint32_t frame;
+        uint32_t padding;
+    };
+};
@@ -36,7 +36,7 @@ namespace ImGuiService {
         initInfo.Queue = device->_queues[0];
         initInfo.MinImageCount = device->swapchain->minImageCount;
         initInfo.ImageCount = device->swapchain->imageCount;
-        initInfo.DescriptorPool = device->_descriptorPool;
+        initInfo.DescriptorPool = device->_imguiDescriptorPool;
         initInfo.Allocator = 0;
         initInfo.UseDynamicRendering = true;
         initInfo.ColorAttachmentFormat = device->swapchain->format.format;
@@ -10,10 +10,14 @@
 #include "gfx/gltf-scene.h"
 #include "gfx/async-loader.h"
 #include "rendering/rendering-utils.h"
+#include "rendering/upload-manager.h"
 #include "sparse-octree/octree-builder.h"
 #include "sparse-octree/octree-tracer.h"
+#include "sparse-octree/octree-benchmark.h"
 #include "sparse-octree/voxel-renderer.h"
 #include "sparse-octree/cpu-octree-utils.h"
+#include "sparse-octree/cpu-octree-kernels.h"
+#include "voxelizer/cpu-voxelizer-kernels.h"
 
 #include <glm/gtx/component_wise.hpp>
 
@@ -42,21 +46,24 @@ TextureID VoxelApp::CreateSwapchainDepthAttachment() {
     return device->CreateTexture(&desc, "Swapchain Depth Attachment");
 }
 
-VoxelApp::VoxelApp() : AppWindow("Voxel Application", glm::vec2{1360.0f, 769.0f}) {
+VoxelApp::VoxelApp(const VoxelAppOptions &options) : AppWindow("Voxel Application", glm::vec2{1360.0f, 769.0f}, options.headless), options(options) {
+    device = RD::GetInstance();
+    if (this->headless) {
+        InitializeHeadless();
+        return;
+    }
+
     Debug::Initialize();
 
     // Initialize CommandBuffer/Pool
-    device = RD::GetInstance();
     QueueID graphicsQueue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
     commandPool = device->CreateCommandPool(graphicsQueue, "RenderCommandPool");
     commandBuffer = device->CreateCommandBuffer(commandPool, "RenderCommandBuffer");
-    renderFence = device->CreateFence("Render Fence");
 
     Input::Singleton()->Initialize();
+#ifdef VULKAN_ENABLED
     ImGuiService::Initialize(glfwWindowPtr, commandBuffer);
-
-    globalUB = device->CreateBuffer(sizeof(FrameData), RD::BUFFER_USAGE_UNIFORM_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "GlobalUniformBuffer");
-    globalUBPtr = device->MapBuffer(globalUB);
+#endif
 
     depthAttachment = CreateSwapchainDepthAttachment();
 
@@ -67,31 +74,45 @@ VoxelApp::VoxelApp() : AppWindow("Voxel Application", glm::vec2{1360.0f, 769.0f}
     camera->SetFarPlane(1000.0f);
 
     dt = 0.0f;
+#ifdef VULKAN_ENABLED
     lastFrameTime = static_cast<float>(glfwGetTime());
+#endif
     frameData.uLightPosition = glm::vec3(0.0f, 32.0f, 32.0f);
     origin = glm::vec3(32.0f);
     target = glm::vec3(0.0f);
 
     scene = std::make_shared<GLTFScene>();
 
+    uploadManager = std::make_shared<UploadManager>();
+    uploadManager->Initialize(device, MB(64));
+
     std::shared_ptr<AsyncLoader> asyncLoader = std::make_shared<AsyncLoader>();
-    asyncLoader->Initialize(scene);
+    asyncLoader->Initialize(scene, uploadManager);
 
     std::vector<std::string> meshPath = {
         "C:/Users/Dell/OneDrive/Documents/3D-Assets/Models/Sponza/Sponza.gltf",
     };
 
-    if (scene->Initialize(meshPath, asyncLoader)) {
-        scene->PrepareDraws(globalUB);
+    if (scene->Initialize(meshPath, asyncLoader, uploadManager)) {
+        scene->PrepareDraws(device->GetTransientBuffer(), sizeof(FrameData));
     } else
         LOGE("Failed to initialize scene");
 
     octreeBuilder = std::make_shared<OctreeBuilder>();
-    octreeBuilder->Initialize(scene);
-    octreeBuilder->Build(commandPool, commandBuffer);
+    octreeBuilder->Initialize(scene, options.buildStrategy, options.resolution);
+    octreeBuilder->voxelizationMethod = options.voxelizationMethod;
+    auto buildStart = Clock::now();
+    std::string octreeCachePath = "cache/" + std::filesystem::path(meshPath[0]).stem().string() + ".svo";
+    if (!options.useOctreeCache || !octreeBuilder->LoadCache(octreeCachePath)) {
+        octreeBuilder->Build(commandPool, commandBuffer);
+        if (options.useOctreeCache)
+            octreeBuilder->SaveCache(octreeCachePath);
+    }
+    octreeBuildTime = std::chrono::duration<float, std::milli>(Clock::now() - buildStart).count();
+    octreeBuilder->ReadbackOctree(octreeNodes);
 
     octreeTracer = std::make_shared<OctreeTracer>();
-    octreeTracer->Initialize(octreeBuilder);
+    octreeTracer->Initialize(octreeBuilder, (uint32_t)windowSize.x, (uint32_t)windowSize.y);
     /*
     // This is done to render the octree by traversing it on the cpu
     // It is used to compare the raytraced output with the cpu generated
@@ -100,7 +121,7 @@ VoxelApp::VoxelApp() : AppWindow("Voxel Application", glm::vec2{1360.0f, 769.0f}
     void *gpuOctreeData = device->MapBuffer(octreeBuilder->octreeBuffer);
     std::memcpy(octree.data(), gpuOctreeData, octreeElmCount * sizeof(uint32_t));
     std::vector<glm::vec4> voxels;
-    octree::utils::ListVoxelsFromOctree(octree, voxels, static_cast<float>(octreeBuilder->kDims));
+    octree::utils::ListVoxelsFromOctree(octree, voxels, static_cast<float>(octreeBuilder->resolution));
 
     voxelRenderer = std::make_shared<VoxelRenderer>();
     voxelRenderer->Initialize(voxels);
@@ -108,7 +129,114 @@ VoxelApp::VoxelApp() : AppWindow("Voxel Application", glm::vec2{1360.0f, 769.0f}
     asyncLoader->Shutdown();
 }
 
+void VoxelApp::InitializeHeadless() {
+    NullRenderingDevice *nullDevice = static_cast<NullRenderingDevice *>(device);
+    octree::kernels::Register(nullDevice);
+    voxelizer::kernels::Register(nullDevice);
+
+    QueueID graphicsQueue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+    commandPool = device->CreateCommandPool(graphicsQueue, "HeadlessCommandPool");
+    commandBuffer = device->CreateCommandBuffer(commandPool, "HeadlessCommandBuffer");
+
+    // SceneVoxelizer needs the rasterizer, so headless builds use the terrain
+    octreeBuilder = std::make_shared<OctreeBuilder>();
+    octreeBuilder->Initialize(nullptr, options.buildStrategy, options.resolution);
+    auto buildStart = Clock::now();
+    if (options.octreeFile.empty() || !octreeBuilder->LoadCacheFile(options.octreeFile))
+        octreeBuilder->Build(commandPool, commandBuffer);
+    octreeBuildTime = std::chrono::duration<float, std::milli>(Clock::now() - buildStart).count();
+    octreeBuilder->ReadbackOctree(octreeNodes);
+}
+
+void VoxelApp::RunHeadless() {
+    std::cout << "Octree resolution: " << octreeBuilder->resolution << std::endl;
+    std::cout << "Octree nodes: " << octreeBuilder->octreeElmCount << std::endl;
+    std::cout << "Octree memory: " << InMB(octreeBuilder->octreeElmCount * sizeof(uint32_t)) << "MB" << std::endl;
+    std::cout << "Voxel fragments: " << octreeBuilder->fragmentCount << " -> " << octreeBuilder->voxelCount << " unique" << std::endl;
+    std::cout << "Voxelization time: " << octreeBuilder->voxelizationTime << "ms" << std::endl;
+    std::cout << "Octree build time: " << octreeBuildTime << "ms" << std::endl;
+
+    // The reference is always built from the terrain, a loaded octree has
+    // nothing to be compared against
+    if (options.validateOctree && octreeBuilder->loadedFromCache)
+        std::cout << "Octree validation: skipped, the octree was loaded from " << options.octreeFile << std::endl;
+    else if (options.validateOctree)
+        std::cout << "Octree validation: " << (ValidateOctree() ? "passed" : "failed") << std::endl;
+
+    if (!options.benchmarkOutput.empty())
+        RunBenchmark();
+
+    if (!options.thumbnailOutput.empty()) {
+        bool written = RenderThumbnail();
+        std::cout << "Thumbnail " << (written ? "written to " : "failed to write to ") << options.thumbnailOutput << std::endl;
+    }
+}
+
+bool VoxelApp::RenderThumbnail() {
+    octree::tracer::Image image;
+    image.width = 512;
+    image.height = 288;
+    // Looks down at the center of the octree from above one of its corners
+    octree::tracer::Camera thumbnailCamera = octree::tracer::LookAt(glm::vec3(2.4f, 2.2f, 2.6f), glm::vec3(1.5f), glm::radians(60.0f), float(image.width) / float(image.height));
+    auto renderStart = Clock::now();
+    octree::tracer::RenderImage(octreeNodes.data(), thumbnailCamera, image);
+    std::cout << "Thumbnail render time: " << std::chrono::duration<float, std::milli>(Clock::now() - renderStart).count() << "ms" << std::endl;
+    return octree::tracer::WriteImage(options.thumbnailOutput, image);
+}
+
+bool VoxelApp::RunBenchmark() {
+    OctreeBenchmark::Options benchmarkOptions;
+    // The null device has no kernel for the GPU traversal
+    benchmarkOptions.runGPU = !headless;
+    OctreeBenchmark benchmark;
+    bool written = benchmark.Run(octreeBuilder, benchmarkOptions, options.benchmarkOutput);
+    std::cout << "Benchmark results " << (written ? "written to " : "failed to write to ") << options.benchmarkOutput << std::endl;
+    return written;
+}
+
+bool VoxelApp::ValidateOctree() {
+    // Leaves are listed in morton order whatever order the builder
+    // allocated the sibling groups in, so the lists compare directly
+    auto listVoxels = [&](OctreeBuilder *builder) {
+        const uint32_t *octree = (const uint32_t *)device->MapBuffer(builder->octreeBuffer);
+        octree::utils::VoxelList voxels;
+        octree::utils::ListVoxelsFromOctree(octree, builder->resolution, voxels);
+        return voxels;
+    };
+
+    // CPU builds are checked against the top-down compute passes, which run
+    // on the null device kernels, and every other build against the CPU one
+    OctreeBuilder::BuildStrategy referenceStrategy = octreeBuilder->IsCPUBuild() ? OctreeBuilder::BUILD_STRATEGY_TOP_DOWN : OctreeBuilder::BUILD_STRATEGY_BOTTOM_UP_CPU;
+    std::cout << "Validating against the " << (octreeBuilder->IsCPUBuild() ? "top-down" : "bottom-up-cpu") << " build" << std::endl;
+
+    auto reference = std::make_shared<OctreeBuilder>();
+    reference->Initialize(nullptr, referenceStrategy, octreeBuilder->resolution);
+    reference->Build(commandPool, commandBuffer);
+
+    octree::utils::VoxelList voxels = listVoxels(octreeBuilder.get());
+    octree::utils::VoxelList referenceVoxels = listVoxels(reference.get());
+    bool valid = reference->octreeElmCount == octreeBuilder->octreeElmCount &&
+                 voxels.positions == referenceVoxels.positions &&
+                 voxels.colors == referenceVoxels.colors;
+    if (!valid)
+        std::cout << "Reference octree nodes: " << reference->octreeElmCount << std::endl;
+
+    reference->Shutdown();
+    return valid;
+}
+
 void VoxelApp::Run() {
+    if (headless) {
+        RunHeadless();
+        return;
+    }
+
+    if (!options.benchmarkOutput.empty()) {
+        RunBenchmark();
+        return;
+    }
+
+#ifdef VULKAN_ENABLED
     uint64_t frame = 0;
     dtAvg = 0.0f;
     char buffer[64];
@@ -116,9 +244,12 @@ void VoxelApp::Run() {
         glfwPollEvents();
 
         if (!AppWindow::minimized) {
+            // Waits for the GPU to finish the frame that last used this slot,
+            // the per frame data can be written after it
+            device->BeginFrame();
+            commandBuffer = device->GetFrameCommandBuffer();
             Debug::NewFrame();
             OnUpdate();
-            device->BeginFrame();
             device->BeginCommandBuffer(commandBuffer);
             device->PrepareSwapchain(commandBuffer, RD::TEXTURE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
             OnRender();
@@ -126,11 +257,8 @@ void VoxelApp::Run() {
 
             // Draw UI
             device->EndCommandBuffer(commandBuffer);
-            device->Submit(commandBuffer, renderFence);
+            device->Submit(commandBuffer, FenceID{INVALID_ID});
             device->Present();
-
-            device->WaitForFence(&renderFence, 1, UINT64_MAX);
-            device->ResetFences(&renderFence, 1);
         } else
             std::this_thread::sleep_for(1ms);
 
@@ -142,20 +270,36 @@ void VoxelApp::Run() {
         dtAvg = (dtAvg + dt) * 0.5f;
 
         std::memset(buffer, 0, sizeof(char) * 64);
-        sprintf_s(buffer, "frameTime: %.2fms", dt * 1000.0f);
+        snprintf(buffer, sizeof(buffer), "frameTime: %.2fms", dt * 1000.0f);
         glfwSetWindowTitle(glfwWindowPtr, buffer);
 
         frame++;
     }
+#endif
 }
 
 void VoxelApp::OnUpdate() {
+#ifdef VULKAN_ENABLED
     ImGuiService::NewFrame();
     if (!ImGuiService::IsFocused())
         UpdateControls();
+#endif
 
     camera->Update(dt);
 
+    if (hasPickedVoxel) {
+        glm::mat4 M = octreeTracer->GetOctreeTransform();
+        float voxelSize = 1.0f / float(octreeBuilder->resolution);
+        glm::vec3 voxelMin = M * glm::vec4(1.0f + glm::vec3(pickedVoxel) * voxelSize, 1.0f);
+        glm::vec3 voxelMax = M * glm::vec4(1.0f + glm::vec3(pickedVoxel + 1u) * voxelSize, 1.0f);
+        Debug::AddRect(voxelMin, voxelMax, 0xff00ffff);
+    }
+
+    if (runTraversalBenchmark) {
+        octreeTracer->Benchmark(camera, 32);
+        runTraversalBenchmark = false;
+    }
+
     frameData.uInvP = camera->GetInvProjectionMatrix();
     frameData.uInvV = camera->GetInvViewMatrix();
     frameData.P = camera->GetProjectionMatrix();
@@ -165,7 +309,12 @@ void VoxelApp::OnUpdate() {
     frameData.uScreenWidth = windowSize.x;
     frameData.uScreenHeight = windowSize.y;
     frameData.time = lastFrameTime;
-    std::memcpy(globalUBPtr, &frameData, sizeof(FrameData));
+    RD::TransientAllocation frameDataAllocation = device->AllocateTransient(sizeof(FrameData));
+    if (frameDataAllocation.data) {
+        std::memcpy(frameDataAllocation.data, &frameData, sizeof(FrameData));
+        frameDataOffset = frameDataAllocation.offset;
+    } else
+        LOGW("Transient buffer is full, frame data not updated");
 
     Input *input = Input::Singleton();
     input->Update();
@@ -177,11 +326,41 @@ void VoxelApp::OnRenderUI() {
 
     float memoryUsage = InMB(device->GetMemoryUsage());
     ImGui::Text("GPU Memory Usage: %.2fMB", memoryUsage);
+
+    uint32_t voxelCount = std::max(octreeBuilder->voxelCount, 1u);
+    ImGui::Text("Voxel Fragments: %u -> %u (%.2fx)", octreeBuilder->fragmentCount, octreeBuilder->voxelCount, float(octreeBuilder->fragmentCount) / float(voxelCount));
+    if (octreeBuilder->voxelizationTime > 0.0f) {
+        const char *methodNames[] = {"Raster", "Raster Single Pass", "Compute"};
+        ImGui::Text("Voxelization (%s): %.2fms, %.1f Mfragments/s", methodNames[octreeBuilder->voxelizationMethod], octreeBuilder->voxelizationTime, float(octreeBuilder->fragmentCount) / octreeBuilder->voxelizationTime * 1e-3f);
+    }
+    if (hasPickedVoxel)
+        ImGui::Text("Picked Voxel: %u %u %u", pickedVoxel.x, pickedVoxel.y, pickedVoxel.z);
+    ImGui::SliderFloat("LOD Pixel Size", &octreeTracer->lodPixelSize, 0.0f, 8.0f);
+    ImGui::SliderFloat("Shadow LOD Pixel Size", &octreeTracer->shadowLodPixelSize, 0.0f, 8.0f);
+    ImGui::Checkbox("Half Resolution Shadows", &octreeTracer->halfResolutionShadows);
+    ImGui::Checkbox("Temporal Reprojection", &octreeTracer->temporalReprojection);
+    int traversal = octreeTracer->traversal;
+    if (ImGui::Combo("Traversal", &traversal, "Full Stack\0Short Stack\0\0"))
+        octreeTracer->traversal = static_cast<OctreeTracer::Traversal>(traversal);
+    if (ImGui::Button("Benchmark Traversal"))
+        runTraversalBenchmark = true;
+    const char *traversalNames[] = {"Full Stack", "Short Stack"};
+    for (uint32_t i = 0; i < OctreeTracer::TRAVERSAL_COUNT; ++i) {
+        const OctreeTracer::BenchmarkResult &result = octreeTracer->benchmarkResults[i];
+        if (result.milliseconds > 0.0f)
+            ImGui::Text("%s: %.2fms, %.1f Mrays/s", traversalNames[i], result.milliseconds, result.raysPerSecond * 1e-6f);
+    }
     // ImGui::Combo("Scene Mode", &sceneMode, "Triangle Scene\0RayCast Octree\0CpuVoxelizer\0\0");
+#ifdef VULKAN_ENABLED
     ImGuiService::Render(commandBuffer);
+#endif
 }
 
 void VoxelApp::OnRender() {
+    // Traced in compute before the render pass, the debug draws and the UI
+    // are drawn on top of it
+    octreeTracer->Trace(commandBuffer, camera);
+    device->CopyToSwapchain(commandBuffer, octreeTracer->outputTexture);
 
     RD::TextureBarrier barrier{
         .texture = depthAttachment,
@@ -198,7 +377,7 @@ void VoxelApp::OnRender() {
     device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_TOP_OF_PIPE_BIT, RD::PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, &barrier, 1, nullptr, 0);
 
     RD::AttachmentInfo colorAttachmentInfos = {
-        .loadOp = RD::LOAD_OP_CLEAR,
+        .loadOp = RD::LOAD_OP_LOAD,
         .storeOp = RD::STORE_OP_STORE,
         .clearColor = {0.5f, 0.5f, 0.5f, 1.0f},
         .clearDepth = 0,
@@ -230,9 +409,8 @@ void VoxelApp::OnRender() {
 
     glm::mat4 VP = camera->GetProjectionMatrix() * camera->GetViewMatrix();
     // if (sceneMode == 0)
-    // scene->Render(commandBuffer);
-    // else if (sceneMode == 1)
-    octreeTracer->Trace(commandBuffer, camera);
+    // scene->Render(commandBuffer, frameDataOffset);
+    // else if (sceneMode == 1), the octree is traced before the render pass
 
     // else {
     //  voxelRenderer->Render(commandBuffer, VP);
@@ -251,6 +429,8 @@ void VoxelApp::OnMouseMove(float x, float y) {
 
 void VoxelApp::OnMouseScroll(float x, float y) {}
 
+// The input callbacks and controls only come from the glfw window
+#ifdef VULKAN_ENABLED
 void VoxelApp::OnMouseButton(int button, int action) {
     Input::Singleton()->SetKeyState(button, action != GLFW_RELEASE);
 }
@@ -260,6 +440,10 @@ void VoxelApp::OnKey(int key, int action) {
         glfwSetWindowShouldClose(glfwWindowPtr, true);
     Input::Singleton()->SetKeyState(key, action != GLFW_RELEASE);
 }
+#else
+void VoxelApp::OnMouseButton(int button, int action) {}
+void VoxelApp::OnKey(int key, int action) {}
+#endif
 
 void VoxelApp::OnResize(float width, float height) {
     minimized = width == 0 || height == 0;
@@ -270,9 +454,11 @@ void VoxelApp::OnResize(float width, float height) {
 
         device->Destroy(depthAttachment);
         depthAttachment = CreateSwapchainDepthAttachment();
+        octreeTracer->Resize((uint32_t)width, (uint32_t)height);
     }
 }
 
+#ifdef VULKAN_ENABLED
 void VoxelApp::UpdateControls() {
     const float rotateSpeed = 2.0f;
     Input *input = Input::Singleton();
@@ -299,18 +485,45 @@ void VoxelApp::UpdateControls() {
         camera->Lift(walkSpeed);
     else if (input->GetKey(GLFW_KEY_2)->isDown)
         camera->Lift(-walkSpeed);
+
+    if (input->WasKeyPressed(GLFW_MOUSE_BUTTON_RIGHT))
+        PickVoxel();
+}
+#else
+void VoxelApp::UpdateControls() {}
+#endif
+
+void VoxelApp::PickVoxel() {
+    octree::tracer::Ray ray = octreeTracer->GetScreenRay(camera, Input::Singleton()->GetMousePos());
+    octree::tracer::RayHit hit;
+    hasPickedVoxel = !octreeNodes.empty() && octree::tracer::RayMarchLeaf(octreeNodes.data(), ray, hit);
+    if (!hasPickedVoxel)
+        return;
+
+    // The hit position is nudged out of the voxel through the face it hit
+    float resolution = float(octreeBuilder->resolution);
+    glm::vec3 voxel = glm::floor((hit.position - hit.normal * (0.5f / resolution) - 1.0f) * resolution);
+    pickedVoxel = glm::uvec3(glm::clamp(voxel, glm::vec3(0.0f), glm::vec3(resolution - 1.0f)));
 }
 
 VoxelApp::~VoxelApp() {
+    if (headless) {
+        octreeBuilder->Shutdown();
+        device->Destroy(commandPool);
+        return;
+    }
+
+    device->WaitIdle();
     scene->Shutdown();
+    uploadManager->Shutdown();
     octreeBuilder->Shutdown();
     octreeTracer->Shutdown();
     // voxelRenderer->Shutdown();
 
     device->Destroy(depthAttachment);
     device->Destroy(commandPool);
-    device->Destroy(globalUB);
-    device->Destroy(renderFence);
     Debug::Shutdown();
+#ifdef VULKAN_ENABLED
     ImGuiService::Shutdown();
+#endif
 }
\ No newline at end of file
@@ -1,21 +1,43 @@
 #pragma once
 
 #include "app-window.h"
+#include "sparse-octree/octree-builder.h"
 
 #include <chrono>
 #include <vector>
 
 struct RenderScene;
-class OctreeBuilder;
 class OctreeTracer;
+class UploadManager;
 struct VoxelRenderer;
 
 namespace gfx {
     class Camera;
 } // namespace gfx
 
+struct VoxelAppOptions {
+    // Builds the octree on the null device without opening a window
+    bool headless = false;
+    // Rebuilds the octree with the CPU builder and compares the results
+    bool validateOctree = false;
+    OctreeBuilder::BuildStrategy buildStrategy = OctreeBuilder::BUILD_STRATEGY_TOP_DOWN;
+    SceneVoxelizer::VoxelizationMethod voxelizationMethod = SceneVoxelizer::VOXELIZATION_METHOD_RASTER;
+    // Voxels per axis, a power of two up to 16K
+    uint32_t resolution = OctreeBuilder::kDefaultResolution;
+    // Loads the octree from cache/<scene>.svo when the scene hasn't changed
+    // and writes it there after a build otherwise
+    bool useOctreeCache = true;
+    // Headless runs load this cache instead of building the terrain
+    std::string octreeFile;
+    // Runs OctreeBenchmark and writes the results to this file instead of
+    // opening the render loop
+    std::string benchmarkOutput;
+    // Headless runs render the octree with the CPU tracer into this png
+    std::string thumbnailOutput;
+};
+
 struct VoxelApp : AppWindow<VoxelApp> {
-    VoxelApp();
+    VoxelApp(const VoxelAppOptions &options = {});
     VoxelApp(const VoxelApp &) = delete;
     VoxelApp(const VoxelApp &&) = delete;
     VoxelApp &operator=(const VoxelApp &) = delete;
@@ -24,6 +46,13 @@ struct VoxelApp : AppWindow<VoxelApp> {
 
     void Run();
 
+    // Builds the octree on the null device without a window, used for offline bakes
+    void InitializeHeadless();
+    void RunHeadless();
+    bool ValidateOctree();
+    bool RunBenchmark();
+    bool RenderThumbnail();
+
     void OnUpdate();
 
     void OnRenderUI();
@@ -37,6 +66,8 @@ struct VoxelApp : AppWindow<VoxelApp> {
     void OnResize(float width, float height);
 
     void UpdateControls();
+    // Traces the octree under the mouse on the CPU and selects the voxel it hits
+    void PickVoxel();
     TextureID CreateSwapchainDepthAttachment();
 
     using Clock = std::chrono::high_resolution_clock;
@@ -45,10 +76,19 @@ struct VoxelApp : AppWindow<VoxelApp> {
 
     float dt, dtAvg;
     float lastFrameTime;
+    float octreeBuildTime = 0.0f;
 
     // Debug Variables
     bool enableRasterizer = false;
     bool show = true;
+    // Set from the UI, the benchmark runs before the next frame is recorded
+    bool runTraversalBenchmark = false;
+
+    // CPU copy of the octree for picking and the thumbnail, read back once
+    // it is built
+    std::vector<uint32_t> octreeNodes;
+    bool hasPickedVoxel = false;
+    glm::uvec3 pickedVoxel;
 
     struct FrameData {
         glm::mat4 uInvP;
@@ -71,18 +111,21 @@ struct VoxelApp : AppWindow<VoxelApp> {
     glm::vec3 lightPosition;
 
     RenderingDevice *device;
+    // Setup work records into commandBuffer, the render loop points it to
+    // the command buffer of the frame being recorded
     CommandPoolID commandPool;
     CommandBufferID commandBuffer;
     TextureID depthAttachment;
-    FenceID renderFence;
 
+    VoxelAppOptions options;
     std::shared_ptr<OctreeBuilder> octreeBuilder;
     std::shared_ptr<OctreeTracer> octreeTracer;
     std::shared_ptr<RenderScene> scene;
+    std::shared_ptr<UploadManager> uploadManager;
     // std::shared_ptr<VoxelRenderer> voxelRenderer;
 
-    BufferID globalUB;
-    uint8_t *globalUBPtr;
+    // Offset of this frame's FrameData in the transient buffer
+    uint32_t frameDataOffset = 0;
 
     int sceneMode = 1;
 };
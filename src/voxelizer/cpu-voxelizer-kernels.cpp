@@ -0,0 +1,198 @@
+#include "pch.h"
+
+#include "cpu-voxelizer-kernels.h"
+#include "voxel-fragment-sorter.h"
+#include "rendering/null-rendering-device.h"
+#include "sparse-octree/cpu-octree-utils.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/noise.hpp>
+#include <glm/gtc/packing.hpp>
+
+namespace voxelizer::kernels {
+    static constexpr uint32_t kLocalSize = 8;
+
+    // terrain.glsl, glm::simplex is the same Ashima simplex noise as noise2D.glsl
+    static float GetTerrainHeight(const glm::vec2 &p) {
+        const float maxHeight = 100.0f;
+        float amplitude = 1.0f;
+        float frequency = 0.002f;
+
+        float total = 0.0f;
+        float noise = 0.0f;
+        for (int i = 0; i < 5; ++i) {
+            noise += amplitude * glm::simplex(p * frequency);
+            total += amplitude;
+            amplitude *= 0.5f;
+            frequency *= 2.0f;
+        }
+
+        float normNoise = (noise / total) * 2.0f - 1.0f;
+        return normNoise * maxHeight;
+    }
+
+    // The noise only depends on xz, so it is evaluated once per column
+    // instead of once per invocation like the shaders do
+    template <typename Fn>
+    static void ForEachTerrainVoxel(const NullRenderingDevice::ComputeContext &context, Fn &&fn) {
+        const uint32_t voxelResolution = context.GetPushConstants<uint32_t>();
+        const float halfResolution = voxelResolution * 0.5f;
+
+        const uint32_t sizeX = context.workGroupCount[0] * kLocalSize;
+        const uint32_t sizeY = context.workGroupCount[1] * kLocalSize;
+        const uint32_t sizeZ = context.workGroupCount[2] * kLocalSize;
+        for (uint32_t z = 0; z < sizeZ; ++z) {
+            for (uint32_t x = 0; x < sizeX; ++x) {
+                float height = GetTerrainHeight(glm::vec2(x - halfResolution, z - halfResolution));
+                for (uint32_t y = 0; y < sizeY; ++y) {
+                    float d = (y - halfResolution) + height;
+                    if (d <= 0.0f)
+                        fn(x, y, z);
+                }
+            }
+        }
+    }
+
+    // terrain-voxelizer-prepass.comp
+    static void TerrainPrepass(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *voxelCount = context.GetBuffer<uint32_t>(0, 0);
+        ForEachTerrainVoxel(context, [&](uint32_t, uint32_t, uint32_t) {
+            voxelCount[0]++;
+        });
+    }
+
+    // terrain-voxelizer.comp
+    static void TerrainVoxelize(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *voxelCount = context.GetBuffer<uint32_t>(0, 0);
+        uint64_t *voxelKeys = context.GetBuffer<uint64_t>(0, 1);
+        uint32_t *voxelColors = context.GetBuffer<uint32_t>(0, 2);
+        ForEachTerrainVoxel(context, [&](uint32_t x, uint32_t y, uint32_t z) {
+            uint32_t index = voxelCount[1]++;
+            voxelKeys[index] = octree::utils::EncodeMorton(glm::uvec3(x, y, z));
+            voxelColors[index] = 0xffffff;
+        });
+    }
+
+    using Sorter = VoxelFragmentSorter;
+
+    struct RadixPushConstants {
+        uint32_t count;
+        uint32_t shift;
+        uint32_t tileCount;
+    };
+
+    static bool IsRunHead(const uint64_t *keys, uint32_t index) {
+        return index == 0 || keys[index] != keys[index - 1];
+    }
+
+    // radix-sort-histogram.comp
+    static void RadixHistogram(const NullRenderingDevice::ComputeContext &context) {
+        const uint64_t *keys = context.GetBuffer<uint64_t>(0, 0);
+        uint32_t *histogram = context.GetBuffer<uint32_t>(0, 1);
+        const RadixPushConstants &params = context.GetPushConstants<RadixPushConstants>();
+
+        for (uint32_t tile = 0; tile < context.workGroupCount[0]; ++tile) {
+            uint32_t tileHistogram[Sorter::kRadixBins] = {};
+            uint32_t end = std::min((tile + 1) * Sorter::kTileSize, params.count);
+            for (uint32_t i = tile * Sorter::kTileSize; i < end; ++i)
+                tileHistogram[(keys[i] >> params.shift) & (Sorter::kRadixBins - 1)]++;
+
+            for (uint32_t bin = 0; bin < Sorter::kRadixBins; ++bin)
+                histogram[bin * params.tileCount + tile] = tileHistogram[bin];
+        }
+    }
+
+    // radix-sort-scan.comp
+    static void RadixScan(const NullRenderingDevice::ComputeContext &context) {
+        uint32_t *data = context.GetBuffer<uint32_t>(0, 0);
+        uint32_t *total = context.GetBuffer<uint32_t>(0, 1);
+        const uint32_t count = context.GetPushConstants<uint32_t>();
+
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t value = data[i];
+            data[i] = sum;
+            sum += value;
+        }
+        *total = sum;
+    }
+
+    // radix-sort-scatter.comp, walking each tile in order is already stable
+    static void RadixScatter(const NullRenderingDevice::ComputeContext &context) {
+        const uint64_t *srcKeys = context.GetBuffer<uint64_t>(0, 0);
+        uint64_t *dstKeys = context.GetBuffer<uint64_t>(0, 1);
+        const uint32_t *histogram = context.GetBuffer<uint32_t>(0, 2);
+        const uint32_t *srcColors = context.GetBuffer<uint32_t>(0, 3);
+        uint32_t *dstColors = context.GetBuffer<uint32_t>(0, 4);
+        const RadixPushConstants &params = context.GetPushConstants<RadixPushConstants>();
+
+        for (uint32_t tile = 0; tile < context.workGroupCount[0]; ++tile) {
+            uint32_t offsets[Sorter::kRadixBins];
+            for (uint32_t bin = 0; bin < Sorter::kRadixBins; ++bin)
+                offsets[bin] = histogram[bin * params.tileCount + tile];
+
+            uint32_t end = std::min((tile + 1) * Sorter::kTileSize, params.count);
+            for (uint32_t i = tile * Sorter::kTileSize; i < end; ++i) {
+                uint32_t dst = offsets[(srcKeys[i] >> params.shift) & (Sorter::kRadixBins - 1)]++;
+                dstKeys[dst] = srcKeys[i];
+                dstColors[dst] = srcColors[i];
+            }
+        }
+    }
+
+    // voxel-fragment-unique-count.comp
+    static void FragmentUniqueCount(const NullRenderingDevice::ComputeContext &context) {
+        const uint64_t *keys = context.GetBuffer<uint64_t>(0, 0);
+        uint32_t *tileCounts = context.GetBuffer<uint32_t>(0, 1);
+        const uint32_t count = context.GetPushConstants<uint32_t>();
+
+        for (uint32_t tile = 0; tile < context.workGroupCount[0]; ++tile) {
+            uint32_t heads = 0;
+            uint32_t end = std::min((tile + 1) * Sorter::kTileSize, count);
+            for (uint32_t i = tile * Sorter::kTileSize; i < end; ++i)
+                heads += IsRunHead(keys, i) ? 1 : 0;
+            tileCounts[tile] = heads;
+        }
+    }
+
+    // voxel-fragment-unique-write.comp
+    static void FragmentUniqueWrite(const NullRenderingDevice::ComputeContext &context) {
+        const uint64_t *sortKeys = context.GetBuffer<uint64_t>(0, 0);
+        const uint32_t *sortColors = context.GetBuffer<uint32_t>(0, 1);
+        const uint32_t *tileOffsets = context.GetBuffer<uint32_t>(0, 2);
+        uint64_t *voxelKeys = context.GetBuffer<uint64_t>(0, 3);
+        uint32_t *voxelColors = context.GetBuffer<uint32_t>(0, 4);
+        const uint32_t count = context.GetPushConstants<uint32_t>();
+
+        for (uint32_t tile = 0; tile < context.workGroupCount[0]; ++tile) {
+            uint32_t offset = tileOffsets[tile];
+            uint32_t end = std::min((tile + 1) * Sorter::kTileSize, count);
+            for (uint32_t i = tile * Sorter::kTileSize; i < end; ++i) {
+                if (!IsRunHead(sortKeys, i))
+                    continue;
+
+                glm::vec3 color = glm::vec3(0.0f);
+                uint32_t duplicates = 0;
+                for (uint32_t j = i; j < count && sortKeys[j] == sortKeys[i]; ++j) {
+                    color += glm::vec3(glm::unpackUnorm4x8(sortColors[j] & VOXEL_COLOR_MASK));
+                    duplicates++;
+                }
+
+                voxelKeys[offset] = sortKeys[i];
+                voxelColors[offset] = glm::packUnorm4x8(glm::vec4(color / float(duplicates), 0.0f)) & VOXEL_COLOR_MASK;
+                offset++;
+            }
+        }
+    }
+
+    void Register(NullRenderingDevice *device) {
+        device->RegisterComputeKernel("terrain-voxelizer-prepass.comp", TerrainPrepass);
+        device->RegisterComputeKernel("terrain-voxelizer.comp", TerrainVoxelize);
+
+        device->RegisterComputeKernel("radix-sort-histogram.comp", RadixHistogram);
+        device->RegisterComputeKernel("radix-sort-scan.comp", RadixScan);
+        device->RegisterComputeKernel("radix-sort-scatter.comp", RadixScatter);
+        device->RegisterComputeKernel("voxel-fragment-unique-count.comp", FragmentUniqueCount);
+        device->RegisterComputeKernel("voxel-fragment-unique-write.comp", FragmentUniqueWrite);
+    }
+} // namespace voxelizer::kernels
@@ -0,0 +1,10 @@
+#pragma once
+
+class NullRenderingDevice;
+
+namespace voxelizer::kernels {
+
+    // Registers the CPU ports of the terrain voxelizer compute shaders so that
+    // TerrainVoxelizer can run on the headless null device
+    void Register(NullRenderingDevice *device);
+};
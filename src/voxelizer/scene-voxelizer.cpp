@@ -7,7 +7,19 @@
 #include "rendering/rendering-utils.h"
 #include "scene-voxelizer.h"
 
-SceneVoxelizer::SceneVoxelizer(std::shared_ptr<RenderScene> scene) : scene(scene) {
+// Bin pass threads and the fragments expected per triangle when nothing is
+// known about the scene yet
+static constexpr uint32_t kBinGroupSize = 64;
+static constexpr uint32_t kMaxDispatchGroups = 65535;
+static constexpr uint32_t kFragmentsPerTriangle = 8;
+
+// Fragment counters are 32 bit on the GPU, capacities are computed wider and
+// clamped so that a large scene doesn't wrap to a tiny buffer
+static uint32_t ClampFragmentCapacity(uint64_t capacity) {
+    return static_cast<uint32_t>(std::min<uint64_t>(capacity, UINT32_MAX));
+}
+
+SceneVoxelizer::SceneVoxelizer(std::shared_ptr<RenderScene> scene, VoxelizationMethod method) : scene(scene), method(method) {
 }
 
 void SceneVoxelizer::Initialize(uint32_t resolution) {
@@ -22,11 +34,72 @@ void SceneVoxelizer::Initialize(uint32_t resolution) {
     countBufferPtr = (uint32_t *)device->MapBuffer(voxelCountBuffer);
     std::memset(countBufferPtr, 0, sizeof(uint32_t) * 2);
 
-    InitializePrepassResources();
-    InitializeMainResources();
+    uint32_t drawCommandSize = static_cast<uint32_t>(std::max(scene->meshGroup.drawCommands.size(), size_t(1)) * sizeof(RD::DrawElementsIndirectCommand));
+    drawCommandBuffer = device->CreateBuffer(drawCommandSize,
+                                             RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                             RD::MEMORY_ALLOCATION_TYPE_CPU,
+                                             "Voxelizer Draw Command Buffer");
+    drawCommandPtr = (RD::DrawElementsIndirectCommand *)device->MapBuffer(drawCommandBuffer);
+
+    voxelFragmentBuffer = BufferID{INVALID_ID};
+    voxelColorBuffer = BufferID{INVALID_ID};
+    voxelDrawBuffer = BufferID{INVALID_ID};
+    mainSet = UniformSetID{INVALID_ID};
+    computeSet = UniformSetID{INVALID_ID};
+    workItemBuffer = BufferID{INVALID_ID};
+
+    if (method == VOXELIZATION_METHOD_COMPUTE)
+        InitializeComputeResources();
+    else {
+        if (method == VOXELIZATION_METHOD_RASTER)
+            InitializePrepassResources();
+        InitializeMainResources();
+    }
     // InitializeRayMarchResources();
 }
 
+void SceneVoxelizer::InitializeComputeResources() {
+    uint32_t drawCapacity = static_cast<uint32_t>(scene->meshGroup.drawCommands.size()) + 1;
+    drawTriangleOffsetBuffer = device->CreateBuffer(sizeof(uint32_t) * uint64_t(drawCapacity),
+                                                    RD::BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                    RD::MEMORY_ALLOCATION_TYPE_CPU,
+                                                    "Voxelizer Draw Triangle Offset Buffer");
+    drawTriangleOffsetPtr = (uint32_t *)device->MapBuffer(drawTriangleOffsetBuffer);
+
+    computeCounterBuffer = device->CreateBuffer(static_cast<uint32_t>(sizeof(uint32_t) * 5),
+                                                RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                                RD::MEMORY_ALLOCATION_TYPE_CPU,
+                                                "Voxelizer Counter Buffer");
+    computeCounterPtr = (uint32_t *)device->MapBuffer(computeCounterBuffer);
+
+    RD::UniformBinding bindings[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 3},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 4},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 5},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 6},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 7},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 8},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 9},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 10},
+    };
+    RD::PushConstant pushConstant = {0, static_cast<uint32_t>(sizeof(ComputePushConstants))};
+
+    // Every pipeline takes the bindless textures so that the layouts match
+    ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/voxelizer-bin.comp.spv", bindings, (uint32_t)std::size(bindings), &pushConstant, 1);
+    binPipeline = device->CreateComputePipeline(shader, true, "SceneVoxelizer Bin Pass");
+    device->Destroy(shader);
+
+    shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/voxelizer-tile-args.comp.spv", bindings, (uint32_t)std::size(bindings), &pushConstant, 1);
+    tileArgsPipeline = device->CreateComputePipeline(shader, true, "SceneVoxelizer Tile Args");
+    device->Destroy(shader);
+
+    shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/voxelizer-tile.comp.spv", bindings, (uint32_t)std::size(bindings), &pushConstant, 1);
+    tilePipeline = device->CreateComputePipeline(shader, true, "SceneVoxelizer Tile Pass");
+    device->Destroy(shader);
+}
+
 void SceneVoxelizer::InitializePrepassResources() {
     RD::UniformBinding vsBindings[] = {
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
@@ -35,8 +108,8 @@ void SceneVoxelizer::InitializePrepassResources() {
     };
 
     RD::PushConstant pushConstant[] = {
-        {0, static_cast<uint32_t>(sizeof(float)) * 2},
-        {8, static_cast<uint32_t>(sizeof(uint32_t))},
+        {0, static_cast<uint32_t>(sizeof(glm::vec4))},
+        {16, static_cast<uint32_t>(sizeof(FragmentPushConstants))},
     };
 
     std::shared_ptr<GLTFScene>
@@ -76,7 +149,7 @@ void SceneVoxelizer::InitializePrepassResources() {
 
     RD::BoundUniform boundedUniform[] = {
         {RD::BINDING_TYPE_STORAGE_BUFFER, 1, gltfScene->vertexBuffer},
-        {RD::BINDING_TYPE_STORAGE_BUFFER, 2, gltfScene->drawCommandBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 2, drawCommandBuffer},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 3, gltfScene->transformBuffer},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 4, voxelCountBuffer},
     };
@@ -84,6 +157,14 @@ void SceneVoxelizer::InitializePrepassResources() {
 }
 
 void SceneVoxelizer::InitializeMainResources() {
+    uint32_t drawOverflowSize = static_cast<uint32_t>(std::max(scene->meshGroup.drawCommands.size(), size_t(1)) * sizeof(uint32_t));
+    drawOverflowBuffer = device->CreateBuffer(drawOverflowSize,
+                                              RD::BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                              RD::MEMORY_ALLOCATION_TYPE_CPU,
+                                              "Voxelizer Draw Overflow Buffer");
+    drawOverflowPtr = (uint32_t *)device->MapBuffer(drawOverflowBuffer);
+    std::memset(drawOverflowPtr, 0, drawOverflowSize);
+
     // Create prepass pipeline
     RD::UniformBinding vsBindings[] = {
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
@@ -95,11 +176,13 @@ void SceneVoxelizer::InitializeMainResources() {
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 4},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 5},
         {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 6},
-        /*{RD::BINDING_TYPE_IMAGE, 0, 7},*/
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 7},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 8},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 9},
     };
     RD::PushConstant pushConstant[] = {
-        {0, static_cast<uint32_t>(sizeof(float)) * 2},
-        {8, static_cast<uint32_t>(sizeof(uint32_t))},
+        {0, static_cast<uint32_t>(sizeof(glm::vec4))},
+        {16, static_cast<uint32_t>(sizeof(FragmentPushConstants))},
     };
 
     ShaderID shaders[3] = {
@@ -130,6 +213,23 @@ void SceneVoxelizer::InitializeMainResources() {
     device->Destroy(shaders[0]);
     device->Destroy(shaders[1]);
     device->Destroy(shaders[2]);
+
+    if (method == VOXELIZATION_METHOD_RASTER_SINGLE_PASS) {
+        RD::UniformBinding csBindings[] = {
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 3},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 4},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 5},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 6},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 7},
+        };
+        RD::PushConstant csPushConstant = {0, static_cast<uint32_t>(sizeof(uint32_t))};
+        ShaderID cs = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/voxelizer-drop-draws.comp.spv", csBindings, (uint32_t)std::size(csBindings), &csPushConstant, 1);
+        dropDrawsPipeline = device->CreateComputePipeline(cs, false, "SceneVoxelizer Drop Draws");
+        device->Destroy(cs);
+    }
     /*
     {
         // @TODO Temp
@@ -202,8 +302,8 @@ void SceneVoxelizer::InitializeRayMarchResources() {
 
 void SceneVoxelizer::DrawVoxelScene(CommandBufferID commandBuffer, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount) {
     RD::RenderingInfo renderingInfo = {
-        .width = voxelResolution,
-        .height = voxelResolution,
+        .width = gridResolution,
+        .height = gridResolution,
         .layerCount = 1,
         .colorAttachmentCount = 0,
         .pColorAttachments = nullptr,
@@ -217,17 +317,13 @@ void SceneVoxelizer::DrawVoxelScene(CommandBufferID commandBuffer, PipelineID pi
     device->BindPipeline(commandBuffer, pipeline);
     device->BindUniformSet(commandBuffer, pipeline, uniformSet, uniformSetCount);
 
-    AABB aabb = std::static_pointer_cast<GLTFScene>(scene)->GetBoundingBox();
-    float extents[2] = {
-        std::min({aabb.min.x, aabb.min.y, aabb.min.z}),
-        std::max({aabb.max.x, aabb.max.y, aabb.max.z}),
-    };
-    device->BindPushConstants(commandBuffer, pipeline, RD::SHADER_STAGE_GEOMETRY, extents, 0, sizeof(float) * 2);
-    device->BindPushConstants(commandBuffer, pipeline, RD::SHADER_STAGE_FRAGMENT, &voxelResolution, 8, sizeof(uint32_t));
+    device->BindPushConstants(commandBuffer, pipeline, RD::SHADER_STAGE_GEOMETRY, &volume, 0, sizeof(glm::vec4));
+    // The prepass only reads the resolution
+    FragmentPushConstants fragmentConstants = {gridResolution, fragmentCapacity};
+    device->BindPushConstants(commandBuffer, pipeline, RD::SHADER_STAGE_FRAGMENT, &fragmentConstants, 16, sizeof(FragmentPushConstants));
 
     device->BindIndexBuffer(commandBuffer, scene->indexBuffer);
-    uint32_t drawCount = static_cast<uint32_t>(scene->meshGroup.drawCommands.size());
-    device->DrawIndexedIndirect(commandBuffer, scene->drawCommandBuffer, 0, drawCount, sizeof(RD::DrawElementsIndirectCommand));
+    device->DrawIndexedIndirect(commandBuffer, drawCommandBuffer, 0, drawCount, sizeof(RD::DrawElementsIndirectCommand));
 
     device->EndRenderPass(commandBuffer);
 }
@@ -297,32 +393,360 @@ void SceneVoxelizer::ExecuteMainPass(CommandPoolID cp, CommandBufferID cb, Fence
                             &submitInfo);
 
     device->WaitForFence(&waitFence, 1, UINT64_MAX);
-    LOG("Voxelization Write Pass Finished ..." + std::to_string(countBufferPtr[1]));
+
+    voxelCount = countBufferPtr[1];
+    LOG("Voxelization Write Pass Finished ..." + std::to_string(voxelCount));
+}
+
+void SceneVoxelizer::AllocateRasterOutput() {
+    ReleaseFragments();
+
+    voxelFragmentBuffer = device->CreateBuffer(sizeof(uint64_t) * uint64_t(fragmentCapacity), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "VoxelFragmentList Buffer");
+    voxelColorBuffer = device->CreateBuffer(sizeof(uint32_t) * uint64_t(fragmentCapacity), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT | RD::BUFFER_USAGE_TRANSFER_DST_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "VoxelFragmentColor Buffer");
+    voxelDrawBuffer = device->CreateBuffer(sizeof(uint32_t) * uint64_t(fragmentCapacity), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "VoxelFragmentDraw Buffer");
+    RD::BoundUniform boundedUniform[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 1, scene->vertexBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 2, drawCommandBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 3, scene->transformBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 4, scene->materialBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 5, voxelCountBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 6, voxelFragmentBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 7, voxelColorBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 8, drawOverflowBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 9, voxelDrawBuffer},
+    };
+    mainSet = device->CreateUniformSet(mainPipeline, boundedUniform, static_cast<uint32_t>(std::size(boundedUniform)), 0, "Main SceneVoxelizer Binding");
+}
+
+void SceneVoxelizer::ExecuteSinglePass(CommandPoolID cp, CommandBufferID cb, FenceID waitFence) {
+    uint32_t triangleCount = 0;
+    for (uint32_t i = 0; i < drawCount; ++i)
+        triangleCount += drawCommandPtr[i].count / 3;
+
+    // Sized from the previous volume, the first one guesses from the
+    // triangle count like the compute voxelizer
+    fragmentCapacity = std::max({fragmentCapacity, ClampFragmentCapacity(uint64_t(triangleCount) * kFragmentsPerTriangle), 1u});
+    AllocateRasterOutput();
+
+    RD::ImmediateSubmitInfo submitInfo = {
+        .queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS),
+        .commandPool = cp,
+        .commandBuffer = cb,
+        .fence = waitFence,
+    };
+
+    // Fragments kept from the previous runs, already in the front of the
+    // current buffers
+    uint32_t keptCount = 0;
+    for (;;) {
+        std::memset(drawOverflowPtr, 0, scene->meshGroup.drawCommands.size() * sizeof(uint32_t));
+        countBufferPtr[1] = keptCount;
+
+        device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+            DrawVoxelScene(commandBuffer, mainPipeline, &mainSet, 1);
+        },
+                                &submitInfo);
+
+        device->WaitForFence(&waitFence, 1, UINT64_MAX);
+        device->ResetFences(&waitFence, 1);
+        device->ResetCommandPool(cp);
+
+        uint32_t fragmentCount = countBufferPtr[1];
+        if (fragmentCount <= fragmentCapacity) {
+            voxelCount = fragmentCount;
+            break;
+        }
+
+        // Every fragment below the capacity was written, only the draws
+        // that lost some are drawn again. The fragments they did write are
+        // dropped so that they are not counted twice in the voxel colors
+        uint32_t rerunCount = 0;
+        for (uint32_t i = 0; i < drawCount; ++i) {
+            if (drawOverflowPtr[drawCommandPtr[i].drawId] != 0)
+                drawCommandPtr[rerunCount++] = drawCommandPtr[i];
+        }
+        LOG("Voxelizer output overflowed, " + std::to_string(fragmentCount) + " fragments, drawing " + std::to_string(rerunCount) + " of " + std::to_string(drawCount) + " draws again");
+        drawCount = rerunCount;
+
+        uint32_t writtenCount = fragmentCapacity;
+        BufferID keptKeys = voxelFragmentBuffer, keptColors = voxelColorBuffer, keptDraws = voxelDrawBuffer;
+        // Keeps ReleaseFragments off the buffers being compacted
+        voxelFragmentBuffer = BufferID{INVALID_ID};
+        voxelDrawBuffer = BufferID{INVALID_ID};
+        // The draws can't write more than everything counted by this run
+        fragmentCapacity = ClampFragmentCapacity(uint64_t(writtenCount) + fragmentCount);
+        AllocateRasterOutput();
+
+        DropOverflowedDraws(cp, cb, waitFence, keptKeys, keptColors, keptDraws, writtenCount);
+        device->Destroy(keptKeys);
+        device->Destroy(keptColors);
+        device->Destroy(keptDraws);
+        keptCount = countBufferPtr[1];
+    }
+
+    LOG("Single pass voxelization finished ..." + std::to_string(voxelCount));
+}
+
+void SceneVoxelizer::DropOverflowedDraws(CommandPoolID cp, CommandBufferID cb, FenceID waitFence, BufferID keptKeys, BufferID keptColors, BufferID keptDraws, uint32_t keptCount) {
+    RD::BoundUniform boundedUniform[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, drawOverflowBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 1, keptKeys},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 2, keptColors},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 3, keptDraws},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 4, voxelCountBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 5, voxelFragmentBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 6, voxelColorBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 7, voxelDrawBuffer},
+    };
+    UniformSetID dropDrawsSet = device->CreateUniformSet(dropDrawsPipeline, boundedUniform, static_cast<uint32_t>(std::size(boundedUniform)), 0, "Drop Draws SceneVoxelizer Binding");
+
+    RD::ImmediateSubmitInfo submitInfo = {
+        .queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS),
+        .commandPool = cp,
+        .commandBuffer = cb,
+        .fence = waitFence,
+    };
+
+    countBufferPtr[1] = 0;
+    uint32_t groupCount = RenderingUtils::GetWorkGroupSize(keptCount, 64);
+    device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+        RD::BufferBarrier keptBarriers[] = {
+            {keptKeys, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {keptColors, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {keptDraws, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+        };
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_FRAGMENT_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, keptBarriers, (uint32_t)std::size(keptBarriers));
+
+        device->BindPipeline(commandBuffer, dropDrawsPipeline);
+        device->BindUniformSet(commandBuffer, dropDrawsPipeline, &dropDrawsSet, 1);
+        device->BindPushConstants(commandBuffer, dropDrawsPipeline, RD::SHADER_STAGE_COMPUTE, &keptCount, 0, sizeof(uint32_t));
+        device->DispatchCompute(commandBuffer, std::min(groupCount, kMaxDispatchGroups), RenderingUtils::GetWorkGroupSize(groupCount, kMaxDispatchGroups), 1);
+
+        RD::BufferBarrier writeBarriers[] = {
+            {voxelFragmentBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {voxelColorBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {voxelDrawBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+        };
+        device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_FRAGMENT_SHADER_BIT, nullptr, 0, writeBarriers, (uint32_t)std::size(writeBarriers));
+    },
+                            &submitInfo);
+
+    device->WaitForFence(&waitFence, 1, UINT64_MAX);
+    device->ResetFences(&waitFence, 1);
+    device->ResetCommandPool(cp);
+    device->Destroy(dropDrawsSet);
+}
+
+void SceneVoxelizer::AllocateComputeOutput() {
+    ReleaseFragments();
+
+    voxelFragmentBuffer = device->CreateBuffer(sizeof(uint64_t) * uint64_t(fragmentCapacity), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "VoxelFragmentList Buffer");
+    voxelColorBuffer = device->CreateBuffer(sizeof(uint32_t) * uint64_t(fragmentCapacity), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "VoxelFragmentColor Buffer");
+    RD::BoundUniform boundedUniform[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 1, scene->vertexBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 2, drawCommandBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 3, scene->transformBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 4, scene->materialBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 5, scene->indexBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 6, drawTriangleOffsetBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 7, computeCounterBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 8, voxelFragmentBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 9, voxelColorBuffer},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 10, workItemBuffer},
+    };
+    computeSet = device->CreateUniformSet(binPipeline, boundedUniform, static_cast<uint32_t>(std::size(boundedUniform)), 0, "Compute SceneVoxelizer Binding");
+}
+
+void SceneVoxelizer::ReleaseFragments() {
+    if (mainSet.id != INVALID_ID)
+        device->Destroy(mainSet);
+    if (computeSet.id != INVALID_ID)
+        device->Destroy(computeSet);
+    if (voxelFragmentBuffer.id != INVALID_ID) {
+        device->Destroy(voxelFragmentBuffer);
+        device->Destroy(voxelColorBuffer);
+    }
+    if (voxelDrawBuffer.id != INVALID_ID)
+        device->Destroy(voxelDrawBuffer);
+    voxelFragmentBuffer = BufferID{INVALID_ID};
+    voxelColorBuffer = BufferID{INVALID_ID};
+    voxelDrawBuffer = BufferID{INVALID_ID};
+    mainSet = UniformSetID{INVALID_ID};
+    computeSet = UniformSetID{INVALID_ID};
+}
+
+void SceneVoxelizer::ExecuteComputePass(CommandPoolID cp, CommandBufferID cb, FenceID waitFence) {
+    uint32_t triangleCount = 0;
+    for (uint32_t i = 0; i < drawCount; ++i) {
+        drawTriangleOffsetPtr[i] = triangleCount;
+        triangleCount += drawCommandPtr[i].count / 3;
+    }
+    drawTriangleOffsetPtr[drawCount] = triangleCount;
+
+    auto reserveWorkItems = [&](uint32_t count) {
+        if (workItemBuffer.id != INVALID_ID && count <= workItemCapacity)
+            return;
+        if (workItemBuffer.id != INVALID_ID)
+            device->Destroy(workItemBuffer);
+        workItemCapacity = std::max(count, 1u);
+        workItemBuffer = device->CreateBuffer(sizeof(glm::uvec2) * uint64_t(workItemCapacity), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Voxelizer Work Item Buffer");
+    };
+
+    // The previous volume sizes the output, a run that overflows is
+    // repeated once with room for everything it counted. The counters only
+    // fall short of that when they wrap, the second run keeps what fit
+    fragmentCapacity = std::max({fragmentCapacity, ClampFragmentCapacity(uint64_t(triangleCount) * kFragmentsPerTriangle), 1u});
+    reserveWorkItems(triangleCount);
+
+    ComputePushConstants pushConstants = {
+        .volumeMin = glm::vec3(volume),
+        .volumeSize = volume.w,
+        .gridResolution = gridResolution,
+        .triangleCount = triangleCount,
+        .drawCount = drawCount,
+    };
+
+    RD::ImmediateSubmitInfo submitInfo = {
+        .queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS),
+        .commandPool = cp,
+        .commandBuffer = cb,
+        .fence = waitFence,
+    };
+
+    uint32_t binGroupCount = RenderingUtils::GetWorkGroupSize(triangleCount, kBinGroupSize);
+    uint32_t binGroupsX = std::min(binGroupCount, kMaxDispatchGroups);
+    uint32_t binGroupsY = RenderingUtils::GetWorkGroupSize(binGroupCount, kMaxDispatchGroups);
+    for (uint32_t run = 0;; ++run) {
+        AllocateComputeOutput();
+        pushConstants.fragmentCapacity = fragmentCapacity;
+        pushConstants.workItemCapacity = workItemCapacity;
+        std::memset(computeCounterPtr, 0, sizeof(uint32_t) * 5);
+
+        device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
+            device->BindPipeline(commandBuffer, binPipeline);
+            device->BindUniformSet(commandBuffer, binPipeline, &computeSet, 1);
+            device->BindPushConstants(commandBuffer, binPipeline, RD::SHADER_STAGE_COMPUTE, &pushConstants, 0, sizeof(ComputePushConstants));
+            device->DispatchCompute(commandBuffer, binGroupsX, binGroupsY, 1);
+
+            RD::BufferBarrier binBarriers[] = {
+                {computeCounterBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+                {workItemBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            };
+            device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, binBarriers, (uint32_t)std::size(binBarriers));
+
+            device->BindPipeline(commandBuffer, tileArgsPipeline);
+            device->BindUniformSet(commandBuffer, tileArgsPipeline, &computeSet, 1);
+            device->BindPushConstants(commandBuffer, tileArgsPipeline, RD::SHADER_STAGE_COMPUTE, &pushConstants, 0, sizeof(ComputePushConstants));
+            device->DispatchCompute(commandBuffer, 1, 1, 1);
+
+            RD::BufferBarrier argsBarrier = {computeCounterBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_INDIRECT_COMMAND_READ_BIT | RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX};
+            device->PipelineBarrier(commandBuffer, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_DRAW_INDIRECT_BIT | RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, &argsBarrier, 1);
+
+            device->BindPipeline(commandBuffer, tilePipeline);
+            device->BindUniformSet(commandBuffer, tilePipeline, &computeSet, 1);
+            device->BindPushConstants(commandBuffer, tilePipeline, RD::SHADER_STAGE_COMPUTE, &pushConstants, 0, sizeof(ComputePushConstants));
+            device->DispatchComputeIndirect(commandBuffer, computeCounterBuffer, 0);
+        },
+                                &submitInfo);
+
+        device->WaitForFence(&waitFence, 1, UINT64_MAX);
+        device->ResetFences(&waitFence, 1);
+
+        uint32_t fragmentCount = computeCounterPtr[3];
+        uint32_t workItemCount = computeCounterPtr[4];
+        bool overflowed = fragmentCount > fragmentCapacity || workItemCount > workItemCapacity;
+        if (!overflowed || run > 0) {
+            if (overflowed)
+                LOGW("Voxelizer output overflowed again, keeping the first " + std::to_string(fragmentCapacity) + " fragments");
+            voxelCount = std::min(fragmentCount, fragmentCapacity);
+            break;
+        }
+
+        LOG("Voxelizer output overflowed, " + std::to_string(fragmentCount) + " fragments and " + std::to_string(workItemCount) + " work items");
+        fragmentCapacity = std::max(fragmentCapacity, fragmentCount);
+        reserveWorkItems(workItemCount);
+    }
+
+    LOG("Compute voxelization finished ..." + std::to_string(voxelCount));
+}
+
+AABB SceneVoxelizer::GetSceneVolume() {
+    // The scene is voxelized as a cube enclosing its bounds
+    AABB aabb = std::static_pointer_cast<GLTFScene>(scene)->GetBoundingBox();
+    float minExtent = std::min({aabb.min.x, aabb.min.y, aabb.min.z});
+    float maxExtent = std::max({aabb.max.x, aabb.max.y, aabb.max.z});
+    return AABB{glm::vec3(minExtent), glm::vec3(maxExtent)};
+}
+
+uint32_t SceneVoxelizer::CullDrawCommands(const AABB &aabb) {
+    const MeshGroup &meshGroup = scene->meshGroup;
+    drawCount = 0;
+    for (size_t i = 0; i < meshGroup.drawCommands.size(); ++i) {
+        const AABB &meshAABB = meshGroup.aabb[i];
+        if (glm::any(glm::lessThan(meshAABB.max, aabb.min)) || glm::any(glm::greaterThan(meshAABB.min, aabb.max)))
+            continue;
+        drawCommandPtr[drawCount++] = meshGroup.drawCommands[i];
+    }
+    return drawCount;
 }
 
 void SceneVoxelizer::Voxelize(CommandPoolID cp, CommandBufferID cb) {
+    AABB sceneVolume = GetSceneVolume();
+    volume = glm::vec4(sceneVolume.min, sceneVolume.max.x - sceneVolume.min.x);
+    gridResolution = voxelResolution;
+    CullDrawCommands(sceneVolume);
+
+    // An empty scene is reported by the octree builder
+    VoxelizeVolume(cp, cb);
+}
+
+void SceneVoxelizer::VoxelizeBrick(CommandPoolID cp, CommandBufferID cb, const glm::uvec3 &brick, uint32_t brickResolution) {
+    assert(brickResolution > 0 && voxelResolution % brickResolution == 0);
+
+    AABB sceneVolume = GetSceneVolume();
+    float brickSize = (sceneVolume.max.x - sceneVolume.min.x) * float(brickResolution) / float(voxelResolution);
+    glm::vec3 brickMin = sceneVolume.min + glm::vec3(brick) * brickSize;
+    volume = glm::vec4(brickMin, brickSize);
+    gridResolution = brickResolution;
+
+    // Meshes touching the brick faces are kept, the fragment shader drops
+    // everything outside of the brick
+    CullDrawCommands(AABB{brickMin, brickMin + brickSize});
+    VoxelizeVolume(cp, cb);
+}
+
+void SceneVoxelizer::VoxelizeVolume(CommandPoolID cp, CommandBufferID cb) {
+    // Fragments of the previous volume are no longer needed
+    ReleaseFragments();
+
+    std::memset(countBufferPtr, 0, sizeof(uint32_t) * 2);
+    voxelCount = 0;
+    if (drawCount == 0)
+        return;
 
     FenceID waitFence = device->CreateFence("TempFence");
 
+    if (method == VOXELIZATION_METHOD_COMPUTE) {
+        ExecuteComputePass(cp, cb, waitFence);
+        device->Destroy(waitFence);
+        device->ResetCommandPool(cp);
+        return;
+    }
+
+    if (method == VOXELIZATION_METHOD_RASTER_SINGLE_PASS) {
+        ExecuteSinglePass(cp, cb, waitFence);
+        device->Destroy(waitFence);
+        return;
+    }
+
     ExecuteVoxelPrepass(cp, cb, waitFence);
 
     if (voxelCount > 0) {
-        // Allocate Buffer
-        uint32_t bufferSize = static_cast<uint32_t>(sizeof(uint64_t)) * voxelCount;
-        voxelFragmentBuffer = device->CreateBuffer(bufferSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "VoxelFragmentList Buffer");
-        RD::BoundUniform boundedUniform[] = {
-            {RD::BINDING_TYPE_STORAGE_BUFFER, 1, scene->vertexBuffer},
-            {RD::BINDING_TYPE_STORAGE_BUFFER, 2, scene->drawCommandBuffer},
-            {RD::BINDING_TYPE_STORAGE_BUFFER, 3, scene->transformBuffer},
-            {RD::BINDING_TYPE_STORAGE_BUFFER, 4, scene->materialBuffer},
-            {RD::BINDING_TYPE_STORAGE_BUFFER, 5, voxelCountBuffer},
-            {RD::BINDING_TYPE_STORAGE_BUFFER, 6, voxelFragmentBuffer},
-            /*{RD::BINDING_TYPE_IMAGE, 7, texture}*/};
-        mainSet = device->CreateUniformSet(mainPipeline, boundedUniform, static_cast<uint32_t>(std::size(boundedUniform)), 0, "Main SceneVoxelizer Binding");
-
+        // The prepass count is exact, the main pass can't overflow
+        fragmentCapacity = voxelCount;
+        AllocateRasterOutput();
         ExecuteMainPass(cp, cb, waitFence);
-    } else
-        LOGE("Voxelization Prepass return zero voxelCount");
+    }
 
     device->Destroy(waitFence);
     device->ResetCommandPool(cp);
@@ -351,10 +775,25 @@ void SceneVoxelizer::Shutdown() {
     device->Destroy(raymarchSet);
     device->Destroy(texture);
     */
-    device->Destroy(mainPipeline);
-    device->Destroy(mainSet);
-    device->Destroy(prepassSet);
-    device->Destroy(prepassPipeline);
+    if (method == VOXELIZATION_METHOD_COMPUTE) {
+        device->Destroy(binPipeline);
+        device->Destroy(tileArgsPipeline);
+        device->Destroy(tilePipeline);
+        device->Destroy(computeCounterBuffer);
+        device->Destroy(drawTriangleOffsetBuffer);
+        if (workItemBuffer.id != INVALID_ID)
+            device->Destroy(workItemBuffer);
+    } else {
+        device->Destroy(mainPipeline);
+        device->Destroy(drawOverflowBuffer);
+        if (method == VOXELIZATION_METHOD_RASTER_SINGLE_PASS)
+            device->Destroy(dropDrawsPipeline);
+        if (method == VOXELIZATION_METHOD_RASTER) {
+            device->Destroy(prepassSet);
+            device->Destroy(prepassPipeline);
+        }
+    }
     device->Destroy(voxelCountBuffer);
-    device->Destroy(voxelFragmentBuffer);
+    device->Destroy(drawCommandBuffer);
+    ReleaseFragments();
 }
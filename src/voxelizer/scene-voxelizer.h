@@ -1,6 +1,7 @@
 #pragma once
 
 #include "voxelizer.h"
+#include "math-utils.h"
 #include <glm/glm.hpp>
 
 #include <memory>
@@ -14,11 +15,32 @@ namespace gfx {
 class SceneVoxelizer : public Voxelizer {
 
   public:
-    SceneVoxelizer(std::shared_ptr<RenderScene> scene);
+    enum VoxelizationMethod {
+        // Rasterizes every triangle along its dominant axis through a
+        // geometry shader with conservative rasterization, twice to count
+        // and then write the fragments
+        VOXELIZATION_METHOD_RASTER,
+        // Same rasterization without the counting pass, the fragments are
+        // written to a buffer sized from the previous volume. Draws that
+        // overflow it are drawn again into a larger one
+        VOXELIZATION_METHOD_RASTER_SINGLE_PASS,
+        // Tests triangles against voxels in compute, large triangles are
+        // binned in tiles first. Writes the fragments in a single pass and
+        // only runs again when the output buffers were too small
+        VOXELIZATION_METHOD_COMPUTE,
+    };
+
+    SceneVoxelizer(std::shared_ptr<RenderScene> scene, VoxelizationMethod method = VOXELIZATION_METHOD_RASTER);
     void Initialize(uint32_t voxelResolution);
 
     void Voxelize(CommandPoolID commandPool, CommandBufferID commandBuffer);
 
+    // Voxelizes a single brick of the scene volume, split in
+    // voxelResolution / brickResolution bricks per axis. Fragment positions
+    // are relative to the brick and voxelCount is zero when it is empty.
+    // The fragments of the previous brick are released.
+    void VoxelizeBrick(CommandPoolID commandPool, CommandBufferID commandBuffer, const glm::uvec3 &brick, uint32_t brickResolution);
+
     // void RayMarch(CommandBufferID commandBuffer, std::shared_ptr<gfx::Camera> camera);
 
     void Shutdown();
@@ -27,8 +49,30 @@ class SceneVoxelizer : public Voxelizer {
 
   private:
     std::shared_ptr<RenderScene> scene;
+    VoxelizationMethod method;
     PipelineID prepassPipeline, mainPipeline;
     UniformSetID prepassSet, mainSet;
+    // Draw id of every fragment written by the main pass
+    BufferID voxelDrawBuffer;
+    // VOXELIZATION_METHOD_RASTER_SINGLE_PASS, drops the fragments of the
+    // draws that overflowed before they are drawn again
+    PipelineID dropDrawsPipeline;
+
+    // VOXELIZATION_METHOD_COMPUTE, the set is shared by the three pipelines
+    // and recreated with the fragment buffers
+    PipelineID binPipeline, tileArgsPipeline, tilePipeline;
+    UniformSetID computeSet;
+    // Dispatch arguments of the tile pass, then the fragment and the work
+    // item counts, see voxelizer-compute.glsl
+    BufferID computeCounterBuffer;
+    uint32_t *computeCounterPtr;
+    BufferID drawTriangleOffsetBuffer;
+    uint32_t *drawTriangleOffsetPtr;
+    BufferID workItemBuffer;
+    // Kept from one volume to the next so that bricks rarely overflow, also
+    // used by VOXELIZATION_METHOD_RASTER_SINGLE_PASS
+    uint32_t fragmentCapacity = 0;
+    uint32_t workItemCapacity = 0;
 
     // PipelineID clearTexturePipeline, raymarchPipeline;
     // UniformSetID clearTextureSet, raymarchSet;
@@ -39,18 +83,67 @@ class SceneVoxelizer : public Voxelizer {
     uint32_t *countBufferPtr;
     uint32_t voxelResolution;
 
+    // Draws overlapping the volume being voxelized. The vertex shader reads
+    // the transform through the draw id so culled draws keep theirs
+    BufferID drawCommandBuffer;
+    RD::DrawElementsIndirectCommand *drawCommandPtr;
+    uint32_t drawCount = 0;
+    // Flags of the draws the main pass could not write every fragment of,
+    // indexed by draw id
+    BufferID drawOverflowBuffer;
+    uint32_t *drawOverflowPtr;
+
+    // Lowest corner and size of the voxelized cube, rasterized at gridResolution
+    glm::vec4 volume;
+    uint32_t gridResolution;
+
     // TextureID texture;
     bool enableConservativeRasterization = true;
 
     void InitializePrepassResources();
     void InitializeMainResources();
+    void InitializeComputeResources();
     // void InitializeRayMarchResources();
 
+    AABB GetSceneVolume();
+    uint32_t CullDrawCommands(const AABB &aabb);
+    void VoxelizeVolume(CommandPoolID cp, CommandBufferID cb);
+
     void DrawVoxelScene(CommandBufferID cb, PipelineID pipeline, UniformSetID *uniformSet, uint32_t uniformSetCount);
 
     void ExecuteVoxelPrepass(CommandPoolID cp, CommandBufferID cb, FenceID waitFence);
 
     void ExecuteMainPass(CommandPoolID cp, CommandBufferID cb, FenceID waitFence);
+
+    void ExecuteSinglePass(CommandPoolID cp, CommandBufferID cb, FenceID waitFence);
+    // Creates the fragment buffers with fragmentCapacity entries and the set
+    // of the main pass
+    void AllocateRasterOutput();
+
+    void ExecuteComputePass(CommandPoolID cp, CommandBufferID cb, FenceID waitFence);
+    // Creates the fragment buffers with fragmentCapacity entries and the set
+    // of the compute passes
+    void AllocateComputeOutput();
+    void ReleaseFragments();
+
+    struct FragmentPushConstants {
+        uint32_t gridResolution;
+        uint32_t fragmentCapacity;
+    };
+
+    // Copies the fragments of the draws that did not overflow from the
+    // kept buffers to the current ones, see ExecuteSinglePass
+    void DropOverflowedDraws(CommandPoolID cp, CommandBufferID cb, FenceID waitFence, BufferID keptKeys, BufferID keptColors, BufferID keptDraws, uint32_t keptCount);
+
+    struct ComputePushConstants {
+        glm::vec3 volumeMin;
+        float volumeSize;
+        uint32_t gridResolution;
+        uint32_t triangleCount;
+        uint32_t drawCount;
+        uint32_t fragmentCapacity;
+        uint32_t workItemCapacity;
+    };
     /*
     struct RayMarchPushConstant {
         glm::mat4 uInvP;
@@ -27,6 +27,7 @@ void TerrainVoxelizer::Initialize(uint32_t voxelResolution) {
         RD::UniformBinding bindings[] = {
             {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
             {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
         };
         ShaderID shader = RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/terrain-voxelizer.comp.spv", bindings, static_cast<uint32_t>(std::size(bindings)), &pushConstant, 1);
         mainPipeline = device->CreateComputePipeline(shader, false, "Terrain Voxelizer Main Pipeline");
@@ -45,7 +46,7 @@ void TerrainVoxelizer::Voxelize(CommandPoolID cp, CommandBufferID cb) {
 
     {
         RD::BoundUniform prepassUniforms = {RD::BINDING_TYPE_STORAGE_BUFFER, 0, voxelCountBuffer};
-        UniformSetID prepassUniformSet = device->CreateUniformSet(prepassPipeline, &prepassUniforms, 1, 0, "Temp Set");
+        UniformSetID prepassUniformSet = device->CreateTransientUniformSet(prepassPipeline, &prepassUniforms, 1, 0);
         device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
             device->BindPipeline(commandBuffer, prepassPipeline);
             device->BindUniformSet(commandBuffer, prepassPipeline, &prepassUniformSet, 1);
@@ -56,7 +57,6 @@ void TerrainVoxelizer::Voxelize(CommandPoolID cp, CommandBufferID cb) {
         },
                                 &submitInfo);
         device->WaitForFence(&waitFence, 1, UINT64_MAX);
-        device->Destroy(prepassUniformSet);
 
         this->voxelCount = countBufferPtr[0];
         LOG("Voxelization Prepass Voxel Count: " + std::to_string(this->voxelCount));
@@ -64,14 +64,16 @@ void TerrainVoxelizer::Voxelize(CommandPoolID cp, CommandBufferID cb) {
     device->ResetFences(&waitFence, 1);
 
     // Allocate voxel fragment list buffer
-    voxelFragmentBuffer = device->CreateBuffer(this->voxelCount * sizeof(uint64_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Voxel Fragment List Buffer");
+    voxelFragmentBuffer = device->CreateBuffer(uint64_t(this->voxelCount) * sizeof(uint64_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Voxel Fragment List Buffer");
+    voxelColorBuffer = device->CreateBuffer(uint64_t(this->voxelCount) * sizeof(uint32_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "Voxel Fragment Color Buffer");
     {
         RD::BoundUniform mainUniforms[] = {
             {RD::BINDING_TYPE_STORAGE_BUFFER, 0, voxelCountBuffer},
             {RD::BINDING_TYPE_STORAGE_BUFFER, 1, voxelFragmentBuffer},
+            {RD::BINDING_TYPE_STORAGE_BUFFER, 2, voxelColorBuffer},
         };
 
-        UniformSetID mainUniformSet = device->CreateUniformSet(mainPipeline, mainUniforms, static_cast<uint32_t>(std::size(mainUniforms)), 0, "Temp Main Set");
+        UniformSetID mainUniformSet = device->CreateTransientUniformSet(mainPipeline, mainUniforms, static_cast<uint32_t>(std::size(mainUniforms)), 0);
 
         device->ImmediateSubmit([&](CommandBufferID commandBuffer) {
             device->BindPipeline(commandBuffer, mainPipeline);
@@ -83,7 +85,6 @@ void TerrainVoxelizer::Voxelize(CommandPoolID cp, CommandBufferID cb) {
         },
                                 &submitInfo);
         device->WaitForFence(&waitFence, 1, UINT64_MAX);
-        device->Destroy(mainUniformSet);
         device->Destroy(waitFence);
 
         LOG("Voxelization Voxel Count: " + std::to_string(countBufferPtr[1]));
@@ -92,6 +93,7 @@ void TerrainVoxelizer::Voxelize(CommandPoolID cp, CommandBufferID cb) {
 
 void TerrainVoxelizer::Shutdown() {
     device->Destroy(voxelFragmentBuffer);
+    device->Destroy(voxelColorBuffer);
     device->Destroy(voxelCountBuffer);
     device->Destroy(prepassPipeline);
     device->Destroy(mainPipeline);
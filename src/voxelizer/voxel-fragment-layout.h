@@ -0,0 +1,26 @@
+#ifndef VOXEL_FRAGMENT_LAYOUT_H
+#define VOXEL_FRAGMENT_LAYOUT_H
+
+// Included by both the C++ code and the shaders, keep it to preprocessor
+// definitions only.
+//
+// Voxel fragments are stored as two streams of the same length:
+//   key   (uint64): morton code of the voxel position, x takes the lowest bit
+//   color (uint):   rgb in the lowest 24 bits
+// A resolution of 2^n only uses the lowest 3n bits of the key, so the
+// number of radix sort passes follows the resolution in use.
+
+#define VOXEL_KEY_BITS_PER_AXIS 21
+#define VOXEL_COLOR_MASK 0xffffff
+
+// 16K voxels per axis, level 0 is the root. Octree child pointers are 30
+// bits which bounds the node count rather than the resolution.
+#define MAX_VOXEL_RESOLUTION_LOG2 14
+#define MAX_OCTREE_LEVELS (MAX_VOXEL_RESOLUTION_LOG2 + 1)
+
+// Tiling of the fragment sorter and of the bottom-up octree build
+#define FRAGMENT_WORKGROUP_SIZE 256
+#define FRAGMENT_ITEMS_PER_THREAD 16
+#define FRAGMENT_RADIX_BITS 4
+
+#endif
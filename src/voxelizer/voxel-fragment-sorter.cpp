@@ -0,0 +1,203 @@
+#include "pch.h"
+
+#include "voxel-fragment-sorter.h"
+#include "rendering/rendering-utils.h"
+
+uint32_t VoxelFragmentSorter::GetPassCount(uint32_t resolution) {
+    assert(resolution > 1 && resolution <= (1u << MAX_VOXEL_RESOLUTION_LOG2));
+    uint32_t keyBits = 3 * static_cast<uint32_t>(std::ceil(std::log2(resolution)));
+    return (keyBits + kRadixBits - 1) / kRadixBits;
+}
+
+void VoxelFragmentSorter::Initialize() {
+    device = RD::GetInstance();
+
+    RD::PushConstant pushConstant = {0, sizeof(uint32_t)};
+    RD::PushConstant radixPushConstant = {0, sizeof(uint32_t) * 3};
+
+    RD::UniformBinding bindings[] = {
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 0},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 1},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 2},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 3},
+        {RD::BINDING_TYPE_STORAGE_BUFFER, 0, 4},
+    };
+
+    ShaderID shaders[] = {
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/radix-sort-histogram.comp.spv", bindings, 2, &radixPushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/radix-sort-scan.comp.spv", bindings, 2, &pushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/radix-sort-scatter.comp.spv", bindings, 5, &radixPushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/voxel-fragment-unique-count.comp.spv", bindings, 2, &pushConstant, 1),
+        RenderingUtils::CreateShaderModuleFromFile("assets/SPIRV/voxel-fragment-unique-write.comp.spv", bindings, 5, &pushConstant, 1),
+    };
+
+    RD::ComputePipelineDescription descriptions[] = {
+        {shaders[0], false, "RadixSortHistogramPipeline"},
+        {shaders[1], false, "RadixSortScanPipeline"},
+        {shaders[2], false, "RadixSortScatterPipeline"},
+        {shaders[3], false, "VoxelFragmentUniqueCountPipeline"},
+        {shaders[4], false, "VoxelFragmentUniqueWritePipeline"},
+    };
+    PipelineID pipelines[std::size(descriptions)];
+    device->CreateComputePipelines(descriptions, static_cast<uint32_t>(std::size(descriptions)), pipelines);
+    histogramPipeline = pipelines[0];
+    scanPipeline = pipelines[1];
+    scatterPipeline = pipelines[2];
+    uniqueCountPipeline = pipelines[3];
+    uniqueWritePipeline = pipelines[4];
+
+    for (ShaderID shader : shaders)
+        device->Destroy(shader);
+}
+
+void VoxelFragmentSorter::Scan(CommandBufferID commandBuffer, UniformSetID scanSet, uint32_t count) {
+    device->BindPipeline(commandBuffer, scanPipeline);
+    device->BindUniformSet(commandBuffer, scanPipeline, &scanSet, 1);
+    device->BindPushConstants(commandBuffer, scanPipeline, RD::SHADER_STAGE_COMPUTE, &count, 0, sizeof(uint32_t));
+    device->DispatchCompute(commandBuffer, 1, 1, 1);
+}
+
+BufferID VoxelFragmentSorter::SortAndUnique(CommandPoolID commandPool, CommandBufferID commandBuffer, BufferID keyBuffer, BufferID colorBuffer, uint32_t fragmentCount, uint32_t resolution, uint32_t &uniqueCount, BufferID &uniqueColorBuffer) {
+    assert(fragmentCount > 0);
+    const uint32_t tileCount = RenderingUtils::GetWorkGroupSize(fragmentCount, kTileSize);
+    const uint32_t histogramCount = tileCount * kRadixBins;
+    const uint64_t keyBufferSize = uint64_t(fragmentCount) * sizeof(uint64_t);
+    const uint64_t colorBufferSize = uint64_t(fragmentCount) * sizeof(uint32_t);
+
+    BufferID sortKeyBuffers[2] = {
+        device->CreateBuffer(keyBufferSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "SortKeyBuffer0"),
+        device->CreateBuffer(keyBufferSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "SortKeyBuffer1"),
+    };
+    BufferID sortColorBuffers[2] = {
+        device->CreateBuffer(colorBufferSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "SortColorBuffer0"),
+        device->CreateBuffer(colorBufferSize, RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "SortColorBuffer1"),
+    };
+    BufferID histogramBuffer = device->CreateBuffer(uint64_t(histogramCount) * sizeof(uint32_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "RadixHistogramBuffer");
+    BufferID tileCountBuffer = device->CreateBuffer(tileCount * sizeof(uint32_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "UniqueTileCountBuffer");
+    BufferID scanTotalBuffer = device->CreateBuffer(sizeof(uint32_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT, RD::MEMORY_ALLOCATION_TYPE_CPU, "ScanTotalBuffer");
+    uint32_t *scanTotalPtr = (uint32_t *)device->MapBuffer(scanTotalBuffer);
+
+    // The passes are waited for before returning, the sets go away with the frame
+    auto createSet = [&](PipelineID pipeline, std::initializer_list<BufferID> buffers) {
+        RD::BoundUniform boundUniforms[5];
+        uint32_t binding = 0;
+        for (BufferID buffer : buffers) {
+            boundUniforms[binding] = {RD::BINDING_TYPE_STORAGE_BUFFER, binding, buffer};
+            binding++;
+        }
+        return device->CreateTransientUniformSet(pipeline, boundUniforms, binding, 0);
+    };
+
+    // The first pass reads the input directly, the following ones ping-pong
+    // between the sort buffers
+    UniformSetID histogramSets[3] = {
+        createSet(histogramPipeline, {keyBuffer, histogramBuffer}),
+        createSet(histogramPipeline, {sortKeyBuffers[0], histogramBuffer}),
+        createSet(histogramPipeline, {sortKeyBuffers[1], histogramBuffer}),
+    };
+    UniformSetID histogramScanSet = createSet(scanPipeline, {histogramBuffer, scanTotalBuffer});
+    UniformSetID scatterSets[3] = {
+        createSet(scatterPipeline, {keyBuffer, sortKeyBuffers[0], histogramBuffer, colorBuffer, sortColorBuffers[0]}),
+        createSet(scatterPipeline, {sortKeyBuffers[0], sortKeyBuffers[1], histogramBuffer, sortColorBuffers[0], sortColorBuffers[1]}),
+        createSet(scatterPipeline, {sortKeyBuffers[1], sortKeyBuffers[0], histogramBuffer, sortColorBuffers[1], sortColorBuffers[0]}),
+    };
+
+    const uint32_t passCount = GetPassCount(resolution);
+    const uint32_t sortedIndex = (passCount - 1) % 2;
+    UniformSetID uniqueCountSet = createSet(uniqueCountPipeline, {sortKeyBuffers[sortedIndex], tileCountBuffer});
+    UniformSetID tileScanSet = createSet(scanPipeline, {tileCountBuffer, scanTotalBuffer});
+
+    RD::ImmediateSubmitInfo submitInfo;
+    submitInfo.queue = device->GetDeviceQueue(RD::QUEUE_TYPE_GRAPHICS);
+    submitInfo.commandPool = commandPool;
+    submitInfo.commandBuffer = commandBuffer;
+    submitInfo.fence = device->CreateFence("FragmentSorterFence");
+
+    auto computeBarrier = [&](CommandBufferID cb) {
+        RD::BufferBarrier barriers[] = {
+            {sortKeyBuffers[0], RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {sortKeyBuffers[1], RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {sortColorBuffers[0], RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {sortColorBuffers[1], RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {histogramBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+            {tileCountBuffer, RD::BARRIER_ACCESS_SHADER_WRITE_BIT, RD::BARRIER_ACCESS_SHADER_READ_BIT | RD::BARRIER_ACCESS_SHADER_WRITE_BIT, QUEUE_FAMILY_IGNORED, QUEUE_FAMILY_IGNORED, 0, UINT64_MAX},
+        };
+        device->PipelineBarrier(cb, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, RD::PIPELINE_STAGE_COMPUTE_SHADER_BIT, nullptr, 0, barriers, static_cast<uint32_t>(std::size(barriers)));
+    };
+
+    // Sort by morton code and count the unique positions per tile
+    device->ImmediateSubmit([&](CommandBufferID cb) {
+        for (uint32_t pass = 0; pass < passCount; ++pass) {
+            uint32_t src = pass == 0 ? 0 : 1 + (pass - 1) % 2;
+            uint32_t params[] = {fragmentCount, pass * kRadixBits, tileCount};
+
+            device->BindPipeline(cb, histogramPipeline);
+            device->BindUniformSet(cb, histogramPipeline, &histogramSets[src], 1);
+            device->BindPushConstants(cb, histogramPipeline, RD::SHADER_STAGE_COMPUTE, params, 0, sizeof(params));
+            device->DispatchCompute(cb, tileCount, 1, 1);
+            computeBarrier(cb);
+
+            Scan(cb, histogramScanSet, histogramCount);
+            computeBarrier(cb);
+
+            device->BindPipeline(cb, scatterPipeline);
+            device->BindUniformSet(cb, scatterPipeline, &scatterSets[src], 1);
+            device->BindPushConstants(cb, scatterPipeline, RD::SHADER_STAGE_COMPUTE, params, 0, sizeof(params));
+            device->DispatchCompute(cb, tileCount, 1, 1);
+            computeBarrier(cb);
+        }
+
+        device->BindPipeline(cb, uniqueCountPipeline);
+        device->BindUniformSet(cb, uniqueCountPipeline, &uniqueCountSet, 1);
+        device->BindPushConstants(cb, uniqueCountPipeline, RD::SHADER_STAGE_COMPUTE, &fragmentCount, 0, sizeof(uint32_t));
+        device->DispatchCompute(cb, tileCount, 1, 1);
+        computeBarrier(cb);
+
+        Scan(cb, tileScanSet, tileCount);
+    },
+                            &submitInfo);
+    device->WaitForFence(&submitInfo.fence, 1, UINT64_MAX);
+    device->ResetFences(&submitInfo.fence, 1);
+    device->ResetCommandPool(commandPool);
+
+    // Now that the unique count is known allocate the exact output, every
+    // fragment can fall outside the grid and leave nothing to write
+    uniqueCount = *scanTotalPtr;
+    BufferID uniqueBuffer = BufferID{INVALID_ID};
+    uniqueColorBuffer = BufferID{INVALID_ID};
+    if (uniqueCount > 0) {
+        uniqueBuffer = device->CreateBuffer(uint64_t(uniqueCount) * sizeof(uint64_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "UniqueVoxelFragmentBuffer");
+        uniqueColorBuffer = device->CreateBuffer(uint64_t(uniqueCount) * sizeof(uint32_t), RD::BUFFER_USAGE_STORAGE_BUFFER_BIT | RD::BUFFER_USAGE_TRANSFER_SRC_BIT, RD::MEMORY_ALLOCATION_TYPE_GPU, "UniqueVoxelColorBuffer");
+        UniformSetID uniqueWriteSet = createSet(uniqueWritePipeline, {sortKeyBuffers[sortedIndex], sortColorBuffers[sortedIndex], tileCountBuffer, uniqueBuffer, uniqueColorBuffer});
+
+        device->ImmediateSubmit([&](CommandBufferID cb) {
+            device->BindPipeline(cb, uniqueWritePipeline);
+            device->BindUniformSet(cb, uniqueWritePipeline, &uniqueWriteSet, 1);
+            device->BindPushConstants(cb, uniqueWritePipeline, RD::SHADER_STAGE_COMPUTE, &fragmentCount, 0, sizeof(uint32_t));
+            device->DispatchCompute(cb, tileCount, 1, 1);
+        },
+                                &submitInfo);
+        device->WaitForFence(&submitInfo.fence, 1, UINT64_MAX);
+        device->ResetCommandPool(commandPool);
+    }
+
+    device->Destroy(submitInfo.fence);
+    for (uint32_t i = 0; i < 2; ++i) {
+        device->Destroy(sortKeyBuffers[i]);
+        device->Destroy(sortColorBuffers[i]);
+    }
+    device->Destroy(histogramBuffer);
+    device->Destroy(tileCountBuffer);
+    device->Destroy(scanTotalBuffer);
+
+    LOG("Voxel fragments: " + std::to_string(fragmentCount) + " unique: " + std::to_string(uniqueCount) + " sort passes: " + std::to_string(passCount));
+    return uniqueBuffer;
+}
+
+void VoxelFragmentSorter::Shutdown() {
+    device->Destroy(histogramPipeline);
+    device->Destroy(scanPipeline);
+    device->Destroy(scatterPipeline);
+    device->Destroy(uniqueCountPipeline);
+    device->Destroy(uniqueWritePipeline);
+}
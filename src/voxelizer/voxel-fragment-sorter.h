@@ -0,0 +1,37 @@
+#pragma once
+
+#include "rendering/rendering-device.h"
+#include "voxel-fragment-layout.h"
+
+// Sorts the voxel fragment list in Morton order and merges fragments that
+// land in the same voxel, averaging their colors. Overlapping triangles and
+// conservative rasterization produce a lot of these duplicates.
+class VoxelFragmentSorter {
+
+  public:
+    static constexpr uint32_t kWorkGroupSize = FRAGMENT_WORKGROUP_SIZE;
+    static constexpr uint32_t kItemsPerThread = FRAGMENT_ITEMS_PER_THREAD;
+    static constexpr uint32_t kTileSize = kWorkGroupSize * kItemsPerThread;
+    static constexpr uint32_t kRadixBits = FRAGMENT_RADIX_BITS;
+    static constexpr uint32_t kRadixBins = 1 << kRadixBits;
+
+    // Only the key bits used by the resolution are sorted
+    static uint32_t GetPassCount(uint32_t resolution);
+
+    void Initialize();
+
+    // Returns a new key buffer holding uniqueCount fragments and their
+    // averaged colors in uniqueColorBuffer, the caller owns both. Both are
+    // INVALID_ID when uniqueCount is zero. The input buffers are left
+    // untouched.
+    BufferID SortAndUnique(CommandPoolID commandPool, CommandBufferID commandBuffer, BufferID keyBuffer, BufferID colorBuffer, uint32_t fragmentCount, uint32_t resolution, uint32_t &uniqueCount, BufferID &uniqueColorBuffer);
+
+    void Shutdown();
+
+  private:
+    void Scan(CommandBufferID commandBuffer, UniformSetID scanSet, uint32_t count);
+
+    RD *device = nullptr;
+    PipelineID histogramPipeline, scanPipeline, scatterPipeline;
+    PipelineID uniqueCountPipeline, uniqueWritePipeline;
+};
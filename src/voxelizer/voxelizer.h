@@ -11,6 +11,9 @@ struct Voxelizer {
 
     virtual ~Voxelizer() {}
 
+    // Fragments are morton keys with their colors in a separate buffer,
+    // see voxel-fragment-layout.h
     uint32_t voxelCount;
     BufferID voxelFragmentBuffer;
+    BufferID voxelColorBuffer;
 };
\ No newline at end of file